@@ -26,13 +26,18 @@
 
 
 
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #if defined(HAVE_STRING_H)
 # include <string.h>
@@ -47,6 +52,7 @@
 
 #include "cw.h"
 #include "libcw.h"
+#include "libcw2.h"
 #include "i18n.h"
 #include "cmdline.h"
 #include "cw_copyright.h"
@@ -69,27 +75,135 @@ extern cw_debug_t cw_debug_object;
 static void write_to_echo_stream(const char *format, ...) __attribute__ ((__format__ (__printf__, 1, 2)));
 static void write_to_message_stream(const char *format, ...) __attribute__ ((__format__ (__printf__, 1, 2)));
 static int write_to_cw_sender(const char *format, ...) __attribute__ ((__format__ (__printf__, 1, 2)));
+static void submit_message(const char *format, ...) __attribute__ ((__format__ (__printf__, 1, 2)));
 #endif
 
 
+/* Parsed piece of input stream: a character to sound or to echo,
+   or an embedded command. Parser of input stream passes items to
+   sender, either directly, or through lookahead buffer (in
+   pipelined mode, see pipeline_run()). */
+enum {
+	ITEM_CHARACTER,   /* Character to sound (and to echo). */
+	ITEM_ECHO,        /* Character to echo only (comments, brackets of combinations). */
+	ITEM_PARAMETER,   /* Parameter setting command. */
+	ITEM_QUERY,       /* Query command. */
+	ITEM_CWQUERY,     /* CW query command. */
+	ITEM_MESSAGE,     /* Text for message stream, produced by parser. */
+	ITEM_QUIT,        /* Quit command. */
+	ITEM_END          /* End of input stream. */
+};
+
+typedef struct {
+	int type;         /* ITEM_* */
+	int c;            /* Character, or command value specifier. */
+	int value;        /* Value of parameter (ITEM_PARAMETER), or value of parsing parameter at the place of query (ITEM_QUERY, ITEM_CWQUERY). */
+	bool is_partial;  /* Character is sounded without end-of-character space (ITEM_CHARACTER). */
+	char message[32]; /* ITEM_MESSAGE. */
+} item_t;
+
+
 static int parse_stream_query(FILE *stream);
 static int parse_stream_cwquery(FILE *stream);
 static int parse_stream_parameter(int c, FILE *stream);
 static int parse_stream_command(FILE *stream);
-static int send_cw_character(int c, int is_partial);
 static void parse_stream(FILE *stream);
+static void submit_item(int type, int c, int value, bool is_partial);
+static void submit(const item_t *item);
+static int execute_item(const item_t *item);
+static int execute_query(int c, int parsing_value);
+static int execute_cwquery(int c, int parsing_value);
+static int execute_parameter(int c, int value);
+static int set_config_parameter(int c, int value);
+static int get_parsing_parameter(int c);
+static int send_cw_character(int c, int is_partial);
+static int wait_for_character_start(int n_queued);
+static int wait_for_character(void);
+static int get_parameter(int c);
+static int set_parameter(int c, int value);
+static int enqueue_character(int c, bool is_partial);
+static int enqueue_string(const char *string);
+static void flush_queue(void);
+static void pipeline_run(FILE *stream);
+static void *pipeline_reader(void *arg);
+static int render_open(const char *path);
+static int render_queue(void);
+static int render_close(void);
+static int render_write_header(void);
+#ifndef CW_UNIT_TESTS
+static int render_file(FILE *stream, const char *path);
+static int batch_run(void);
+static char *batch_output_path(const char *input_path);
+#endif
 static void cw_atexit(void);
 
 
 
 static cw_config_t *config = NULL; /* program-specific configuration */
 static bool generator = false;     /* have we created a generator? */
+static bool quit_requested = false; /* parser has seen "quit" command */
+#ifndef CW_UNIT_TESTS
 static const char *all_options = "s:|system,d:|device,"
 	"w:|wpm,t:|tone,v:|volume,"
 	"g:|gap,k:|weighting,"
 	"f:|infile,"
 	"e|noecho,m|nomessages,c|nocommands,o|nocombinations,p|nocomments,"
+	"P|pipeline,F:|outfile,B:|batch,j:|jobs,"
 	"h|help,V|version";
+#endif
+
+
+
+/* Lookahead buffer of pipelined mode. Parser thread puts items
+   here ahead of sender, so that reading of input stream (which
+   may block, e.g. on a pipe) doesn't delay sending of next
+   character. */
+#define LOOKAHEAD_CAPACITY 256
+
+/* In pipelined mode, sender enqueues next character when this many
+   tones of current character are left in tone queue: the last mark
+   of the character, its inter-mark space and end-of-character
+   space. Sender has at least four units of time to wake up before
+   tone queue runs empty. */
+#define PIPELINE_LOW_WATER 3
+
+static struct {
+	bool is_pipelined;
+	item_t items[LOOKAHEAD_CAPACITY];
+	size_t head;                /* Index of next item to be sent. */
+	size_t len;                 /* Number of items in buffer. */
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;   /* Signalled by parser. */
+	pthread_cond_t not_full;    /* Signalled by sender. */
+} lookahead = {
+	.is_pipelined = false,
+	.head = 0,
+	.len = 0,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.not_empty = PTHREAD_COND_INITIALIZER,
+	.not_full = PTHREAD_COND_INITIALIZER
+};
+
+
+
+/* Rendering sound to WAV file, instead of playing it (see
+   render_open()). Characters are sent to a generator that is never
+   started: samples of its tones are taken with cw_gen_fill_queued()
+   as soon as the tones are enqueued, so rendering takes as long as
+   calculation of the samples, not as long as the sound. */
+#define RENDER_SAMPLE_RATE  44100
+#define RENDER_BUFFER_SIZE  4096   /* [samples] */
+
+static struct {
+	cw_gen_t *gen;              /* NULL when sound is played. */
+	FILE *file;
+	uint32_t n_samples;         /* Number of samples written to file. */
+	int16_t buffer[RENDER_BUFFER_SIZE];
+} render = {
+	.gen = NULL,
+	.file = NULL,
+	.n_samples = 0
+};
 
 
 
@@ -169,14 +283,14 @@ int write_to_cw_sender(const char * format, ...)
 	va_end(ap);
 
 	/* Sound the buffer, and wait for the send to complete. */
-	if (CW_SUCCESS != cw_send_string(buffer)) {
+	if (CW_SUCCESS != enqueue_string(buffer)) {
 		perror("cw_send_string");
-		cw_flush_tone_queue();
+		flush_queue();
 		return CW_FAILURE;
 	}
-	if (CW_SUCCESS != cw_wait_for_tone_queue_critical(1)) {
+	if (CW_SUCCESS != wait_for_character()) {
 		perror("cw_wait_for_tone_queue_critical");
-		cw_flush_tone_queue();
+		flush_queue();
 		return CW_FAILURE;
 	}
 	return CW_SUCCESS;
@@ -201,27 +315,51 @@ int write_to_cw_sender(const char * format, ...)
    @return CW_FAILURE otherwise
 */
 int parse_stream_query(FILE * stream)
+{
+	const int c = toupper(fgetc(stream));
+	if (c == EOF) {
+		return CW_SUCCESS;
+	}
+
+	/* Parser may change parsing parameters before sender gets to
+	   the query, so their values are taken here. */
+	submit_item(ITEM_QUERY, c, get_parsing_parameter(c), false);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   Answer a query with value of parameter \p c, written to the
+   message stream.
+
+   \param c - parameter
+   \param parsing_value - value of parsing parameter (commands, combinations, comments) at the place of the query
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int execute_query(int c, int parsing_value)
 {
 	int value;
 
-	const int c = toupper(fgetc(stream));
 	switch (c) {
-	case EOF:
-		return CW_SUCCESS;
 	case CW_CMDV_FREQUENCY:
-		value = cw_get_frequency();
+		value = get_parameter(c);
 		break;
 	case CW_CMDV_VOLUME:
-		value = cw_get_volume();
+		value = get_parameter(c);
 		break;
 	case CW_CMDV_SPEED:
-		value = cw_get_send_speed();
+		value = get_parameter(c);
 		break;
 	case CW_CMDV_GAP:
-		value = cw_get_gap();
+		value = get_parameter(c);
 		break;
 	case CW_CMDV_WEIGHTING:
-		value = cw_get_weighting();
+		value = get_parameter(c);
 		break;
 	case CW_CMDV_ECHO:
 		value = config->do_echo;
@@ -230,13 +368,9 @@ int parse_stream_query(FILE * stream)
 		value = config->do_errors;
 		break;
 	case CW_CMDV_COMMANDS:
-		value = config->do_commands;
-		break;
 	case CW_CMDV_COMBINATIONS:
-		value = config->do_combinations;
-		break;
 	case CW_CMDV_COMMENTS:
-		value = config->do_comments;
+		value = parsing_value;
 		break;
 	default:
 		write_to_message_stream("%c%c%c", CW_STATUS_ERR, CW_CMD_QUERY, c);
@@ -261,32 +395,53 @@ int parse_stream_query(FILE * stream)
    @return CW_FAILURE otherwise
 */
 int parse_stream_cwquery(FILE * stream)
+{
+	const int c = toupper(fgetc(stream));
+	if (c == EOF) {
+		return CW_SUCCESS;
+	}
+
+	submit_item(ITEM_CWQUERY, c, get_parsing_parameter(c), false);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   Answer a cwquery with value of parameter \p c, sent in CW.
+
+   \param c - parameter
+   \param parsing_value - value of parsing parameter (commands, combinations, comments) at the place of the query
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int execute_cwquery(int c, int parsing_value)
 {
 	int value;
 	const char * format = NULL;
 
-	const int c = toupper(fgetc(stream));
 	switch (c) {
-	case EOF:
-		return CW_SUCCESS;
 	case CW_CMDV_FREQUENCY:
-		value = cw_get_frequency();
+		value = get_parameter(c);
 		format = _("%d HZ ");
 		break;
 	case CW_CMDV_VOLUME:
-		value = cw_get_volume();
+		value = get_parameter(c);
 		format = _("%d PERCENT ");
 		break;
 	case CW_CMDV_SPEED:
-		value = cw_get_send_speed();
+		value = get_parameter(c);
 		format = _("%d WPM ");
 		break;
 	case CW_CMDV_GAP:
-		value = cw_get_gap();
+		value = get_parameter(c);
 		format = _("%d DOTS ");
 		break;
 	case CW_CMDV_WEIGHTING:
-		value = cw_get_weighting();
+		value = get_parameter(c);
 		format = _("%d PERCENT ");
 		break;
 	case CW_CMDV_ECHO:
@@ -298,15 +453,15 @@ int parse_stream_cwquery(FILE * stream)
 		format = _("ERRORS %s ");
 		break;
 	case CW_CMDV_COMMANDS:
-		value = config->do_commands;
+		value = parsing_value;
 		format = _("COMMANDS %s ");
 		break;
 	case CW_CMDV_COMBINATIONS:
-		value = config->do_combinations;
+		value = parsing_value;
 		format = _("COMBINATIONS %s ");
 		break;
 	case CW_CMDV_COMMENTS:
-		value = config->do_comments;
+		value = parsing_value;
 		format = _("COMMENTS %s ");
 		break;
 	default:
@@ -314,25 +469,25 @@ int parse_stream_cwquery(FILE * stream)
 		return CW_FAILURE;
 	}
 
-	int cw_ret = CW_FAILURE;
+	int cwret = CW_FAILURE;
 	switch (c) {
 	case CW_CMDV_FREQUENCY:
 	case CW_CMDV_VOLUME:
 	case CW_CMDV_SPEED:
 	case CW_CMDV_GAP:
 	case CW_CMDV_WEIGHTING:
-		cw_ret = write_to_cw_sender(format, value);
+		cwret = write_to_cw_sender(format, value);
 		break;
 	case CW_CMDV_ECHO:
 	case CW_CMDV_ERRORS:
 	case CW_CMDV_COMMANDS:
 	case CW_CMDV_COMBINATIONS:
 	case CW_CMDV_COMMENTS:
-		cw_ret = write_to_cw_sender(format, value ? _("ON") : _("OFF"));
+		cwret = write_to_cw_sender(format, value ? _("ON") : _("OFF"));
 		break;
 	}
 
-	return cw_ret;
+	return cwret;
 }
 
 
@@ -351,32 +506,82 @@ int parse_stream_parameter(int c, FILE *stream)
 	/* Parse and check the new parameter value. */
 	int value;
 	if (1 != fscanf(stream, "%d;", &value)) {
-		write_to_message_stream("%c%c", CW_STATUS_ERR, c);
+		submit_message("%c%c", CW_STATUS_ERR, c);
 		return CW_FAILURE;
 	}
 
-	/* Either update config variable directly by assignment, or
-	   select handler that will do it by function call. */
-	int (*value_handler)(int) = NULL;
+	switch (c) {
+	case CW_CMDV_COMMANDS:
+	case CW_CMDV_COMBINATIONS:
+	case CW_CMDV_COMMENTS:
+		/* These parameters control parsing of the rest of
+		   the stream, so they are set right away, even if
+		   sender is behind the parser. Confirmation is
+		   written by sender, in order with output of
+		   preceding items. */
+		set_config_parameter(c, value);
+		submit_message("%c%c%d", CW_STATUS_OK, c, value);
+		return CW_SUCCESS;
+	default:
+		/* Other parameters affect characters that follow the
+		   command, so they are set by sender. */
+		submit_item(ITEM_PARAMETER, c, value, false);
+		return CW_SUCCESS;
+	}
+}
+
+
+
+
+/**
+   Set parameter \p c to \p value.
 
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int execute_parameter(int c, int value)
+{
+	/* Either set libcw parameter by function call, or update
+	   config variable directly by assignment. */
 	switch (c) {
 	case EOF:
 		return CW_SUCCESS;
 	case CW_CMDV_FREQUENCY:
-		value_handler = cw_set_frequency;
-		break;
 	case CW_CMDV_VOLUME:
-		value_handler = cw_set_volume;
-		break;
 	case CW_CMDV_SPEED:
-		value_handler = cw_set_send_speed;
-		break;
 	case CW_CMDV_GAP:
-		value_handler = cw_set_gap;
-		break;
 	case CW_CMDV_WEIGHTING:
-		value_handler = cw_set_weighting;
+		if (!set_parameter(c, value)) {
+			write_to_message_stream("%c%c", CW_STATUS_ERR, c);
+			return CW_FAILURE;
+		}
 		break;
+	default:
+		if (CW_SUCCESS != set_config_parameter(c, value)) {
+			return CW_FAILURE;
+		}
+		break;
+	}
+
+	/* Confirm the new value with a stderr message. */
+	write_to_message_stream("%c%c%d", CW_STATUS_OK, c, value);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   Set config variable of parameter \p c (echo, errors, commands,
+   combinations or comments) to \p value.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE if \p c is not such parameter
+*/
+int set_config_parameter(int c, int value)
+{
+	switch (c) {
 	case CW_CMDV_ECHO:
 		config->do_echo = value;
 		break;
@@ -396,19 +601,31 @@ int parse_stream_parameter(int c, FILE *stream)
 		return CW_FAILURE; /* TODO: to be verified. We return failure now because I think that in default we have exhausted all enum values. */
 	}
 
-	/* If a handler has been selected, use it to set libcw
-	   parameter. */
-	if (value_handler) {
-		if (!(*value_handler)(value)) {
-			write_to_message_stream("%c%c", CW_STATUS_ERR, c);
-			return CW_FAILURE;
-		}
-	}
+	return CW_SUCCESS;
+}
 
-	/* Confirm the new value with a stderr message. */
-	write_to_message_stream("%c%c%d", CW_STATUS_OK, c, value);
 
-	return CW_SUCCESS;
+
+
+/**
+   Get value of parameter \p c that controls parsing of input stream
+   (commands, combinations or comments).
+
+   @return value of the parameter
+   @return 0 if \p c is not such parameter
+*/
+int get_parsing_parameter(int c)
+{
+	switch (c) {
+	case CW_CMDV_COMMANDS:
+		return config->do_commands;
+	case CW_CMDV_COMBINATIONS:
+		return config->do_combinations;
+	case CW_CMDV_COMMENTS:
+		return config->do_comments;
+	default:
+		return 0;
+	}
 }
 
 
@@ -423,7 +640,7 @@ int parse_stream_parameter(int c, FILE *stream)
 */
 int parse_stream_command(FILE * stream)
 {
-	int cw_ret = CW_FAILURE;
+	int cwret = CW_FAILURE;
 
 	const int c = toupper(fgetc(stream));
 	switch (c) {
@@ -439,24 +656,26 @@ int parse_stream_command(FILE * stream)
 	case CW_CMDV_COMMANDS:
 	case CW_CMDV_COMBINATIONS:
 	case CW_CMDV_COMMENTS:
-		cw_ret = parse_stream_parameter(c, stream);
+		cwret = parse_stream_parameter(c, stream);
 		break;
 	case CW_CMD_QUERY:
-		cw_ret = parse_stream_query(stream);
+		cwret = parse_stream_query(stream);
 		break;
 	case CW_CMD_CWQUERY:
-		cw_ret = parse_stream_cwquery(stream);
+		cwret = parse_stream_cwquery(stream);
 		break;
 	case CW_CMDV_QUIT:
-		cw_flush_tone_queue();
-		write_to_echo_stream("%c", '\n');
-		exit(EXIT_SUCCESS);
+		/* Nothing after this command is parsed. */
+		quit_requested = true;
+		submit_item(ITEM_QUIT, c, 0, false);
+		cwret = CW_SUCCESS;
+		break;
 	default:
-		write_to_message_stream("%c%c%c", CW_STATUS_ERR, CW_CMD_ESCAPE, c);
-		cw_ret = CW_FAILURE;
+		submit_message("%c%c%c", CW_STATUS_ERR, CW_CMD_ESCAPE, c);
+		cwret = CW_FAILURE;
 	}
 
-	return cw_ret;
+	return cwret;
 }
 
 
@@ -469,6 +688,109 @@ int parse_stream_command(FILE * stream)
 
 
 
+/**
+   Pass an item parsed from input stream to sender: execute it right
+   away, or (in pipelined mode) put it in lookahead buffer, waiting
+   for free space if necessary.
+*/
+void submit_item(int type, int c, int value, bool is_partial)
+{
+	const item_t item = { .type = type, .c = c, .value = value, .is_partial = is_partial };
+	submit(&item);
+
+	return;
+}
+
+
+
+
+/**
+   fprintf-like function that passes text for message stream to
+   sender, so that the text is written in order with output of items
+   submitted before it.
+*/
+void submit_message(const char * format, ...)
+{
+	item_t item = { .type = ITEM_MESSAGE };
+
+	va_list ap;
+	va_start(ap, format);
+	vsnprintf(item.message, sizeof (item.message), format, ap);
+	va_end(ap);
+
+	submit(&item);
+
+	return;
+}
+
+
+
+
+/**
+   Execute \p item right away, or (in pipelined mode) put it in
+   lookahead buffer, waiting for free space if necessary.
+*/
+void submit(const item_t * item)
+{
+	if (!lookahead.is_pipelined) {
+		execute_item(item);
+		return;
+	}
+
+	pthread_mutex_lock(&lookahead.mutex);
+	while (lookahead.len == LOOKAHEAD_CAPACITY) {
+		pthread_cond_wait(&lookahead.not_full, &lookahead.mutex);
+	}
+	lookahead.items[(lookahead.head + lookahead.len) % LOOKAHEAD_CAPACITY] = *item;
+	lookahead.len++;
+	pthread_cond_signal(&lookahead.not_empty);
+	pthread_mutex_unlock(&lookahead.mutex);
+
+	return;
+}
+
+
+
+
+/**
+   Sound, echo or execute an item parsed from input stream.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int execute_item(const item_t * item)
+{
+	switch (item->type) {
+	case ITEM_CHARACTER:
+		return send_cw_character(item->c, item->is_partial);
+	case ITEM_ECHO:
+		write_to_echo_stream("%c", item->c);
+		return CW_SUCCESS;
+	case ITEM_PARAMETER:
+		return execute_parameter(item->c, item->value);
+	case ITEM_QUERY:
+		return execute_query(item->c, item->value);
+	case ITEM_CWQUERY:
+		return execute_cwquery(item->c, item->value);
+	case ITEM_MESSAGE:
+		write_to_message_stream("%s", item->message);
+		return CW_SUCCESS;
+	case ITEM_QUIT:
+		/* Parser stops at this command, so this is the last
+		   item before end of stream. The program exits when
+		   the stream is completed, from main thread. */
+		flush_queue();
+		write_to_echo_stream("%c", '\n');
+		return CW_SUCCESS;
+	case ITEM_END:
+	default:
+		return CW_SUCCESS;
+	}
+}
+
+
+
+
 /**
    Sends the given character to the CW sender, and waits for it to
    complete sounding the tones.  The character to send may be a
@@ -483,14 +805,13 @@ int send_cw_character(int c, int is_partial)
 	const int character = isspace(c) ? ' ' : c;
 
 	/* Send the character to the CW sender. */
-	const int status = is_partial
-		? cw_send_character_partial(character)
-		: cw_send_character(character);
+	const int n_queued = render.gen ? 0 : cw_get_tone_queue_length();
+	const int status = enqueue_character(character, is_partial);
 
 	if (CW_SUCCESS != status) {
 		if (errno != ENOENT) {
 			perror("cw_send_character[_partial]");
-			cw_flush_tone_queue();
+			flush_queue();
 			return CW_FAILURE;
 		} else {
 			write_to_message_stream("%c%c", CW_STATUS_ERR, character);
@@ -498,13 +819,18 @@ int send_cw_character(int c, int is_partial)
 		}
 	}
 
-	/* Echo the original character while sending it. */
+	/* Echo the original character when it starts sounding. */
+	if (CW_SUCCESS != wait_for_character_start(n_queued)) {
+		perror("cw_wait_for_tone_queue_critical");
+		flush_queue();
+		return CW_FAILURE;
+	}
 	write_to_echo_stream("%c", c);
 
 	/* Wait for the character to complete. */
-	if (CW_SUCCESS != cw_wait_for_tone_queue_critical(1)) {
+	if (CW_SUCCESS != wait_for_character()) {
 		perror("cw_wait_for_tone_queue_critical");
-		cw_flush_tone_queue();
+		flush_queue();
 		return CW_FAILURE;
 	}
 
@@ -515,93 +841,660 @@ int send_cw_character(int c, int is_partial)
 
 
 /**
-   Read characters from a file stream, and either sound them, or
-   interpret controls in them.  Returns on end of file.
-*/
-void parse_stream(FILE * stream)
-{
-	int c;
-	enum { NONE, COMBINATION, COMMENT, NESTED_COMMENT } state = NONE;
+   In pipelined mode, wait until the character just enqueued starts
+   sounding, i.e. until the first of its tones has been dequeued.
 
-	/* Cycle round states depending on input characters.  Comments
-	   may be nested inside combinations, but not the other way
-	   around; that is, combination starts and ends are not
-	   special within comments. */
-	for (c = fgetc(stream); !feof(stream); c = fgetc(stream)) {
-		switch (state) {
-		case NONE:
-			/*
-			 * Start a comment or combination, handle a command escape, or send
-			 * the character if none of these checks apply.
-			 */
-			if (c == CW_COMMENT_START && config->do_comments) {
-				state = COMMENT;
-				write_to_echo_stream("%c", c);
-			} else if (c == CW_COMBINATION_START && config->do_combinations) {
-				state = COMBINATION;
-				write_to_echo_stream("%c", c);
-			} else if (c == CW_CMD_ESCAPE && config->do_commands) {
-				parse_stream_command(stream);
-			} else {
-				send_cw_character(c, false);
-			}
-			break;
+   In pipelined mode a character is enqueued while the previous one
+   is still sounding (see wait_for_character()), so without the
+   wait it would be echoed ahead of its sound. Otherwise the
+   character is enqueued when the previous one is about to end,
+   and the function returns right away.
 
-		case COMBINATION:
-			/*
-			 * Start a comment nested in a combination, end a combination,
-			 * handle a command escape, or send the character if none of these
-			 * checks apply.
-			 */
-			if (c == CW_COMMENT_START && config->do_comments) {
-				state = NESTED_COMMENT;
-				write_to_echo_stream("%c", c);
-			} else if (c == CW_COMBINATION_END) {
-				state = NONE;
-				write_to_echo_stream("%c", c);
-			} else if (c == CW_CMD_ESCAPE && config->do_commands) {
-				parse_stream_command(stream);
-			} else {
-				/* If this is the final character in
-				   the combination, do not suppress
-				   the end of character delay.  To do
-				   this, look ahead the next
-				   character, and suppress unless
-				   combination end. */
-				const int lookahead = fgetc(stream);
-				ungetc(lookahead, stream);
-				send_cw_character(c, lookahead != CW_COMBINATION_END);
-			}
-			break;
+   \param n_queued - length of tone queue right before the character has been enqueued
 
-		case COMMENT:
-		case NESTED_COMMENT:
-			/* If in a comment nested in a combination and
-			   comment end seen, revert state to reflect
-			   in combination only.  If in an unnested
-			   comment and comment end seen, reset
-			   state. */
-			if (c == CW_COMMENT_END) {
-				state = (state == NESTED_COMMENT) ? COMBINATION : NONE;
-			}
-			write_to_echo_stream("%c", c);
-			break;
-		}
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int wait_for_character_start(int n_queued)
+{
+	if (render.gen || !lookahead.is_pipelined) {
+		return CW_SUCCESS;
 	}
 
-	return;
+	/* Number of tones of the character. If a tone has been
+	   dequeued between reading the length and enqueueing, the
+	   number is too small by one, and the echo is late by one
+	   tone. */
+	const int n_tones = cw_get_tone_queue_length() - n_queued;
+
+	return cw_wait_for_tone_queue_critical(n_tones > 1 ? n_tones - 1 : 0);
 }
 
 
 
 
 /**
-   \brief Parse command line args, then produce CW output until end of file
+   Wait until the character being sent is about to complete: only
+   the last tone of the character (its end-of-character space) is
+   left in tone queue. Next character enqueued right after the wait
+   will start sounding as soon as the space ends, so it can be echoed
+   at that moment.
 
-   \param argc
-   \param argv
-*/
-int main(int argc, char *const argv[])
+   In pipelined mode the sender doesn't wait for the last tone, but
+   wakes up a bit earlier, when PIPELINE_LOW_WATER tones are left,
+   so that a late wake up doesn't cause a gap. The next item is
+   already waiting for the sender in lookahead buffer.
+
+   When sound is rendered to file, the function doesn't wait, but
+   writes samples of the character to the file.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int wait_for_character(void)
+{
+	if (render.gen) {
+		return render_queue();
+	}
+
+	return cw_wait_for_tone_queue_critical(lookahead.is_pipelined ? PIPELINE_LOW_WATER : 1);
+}
+
+
+
+
+/**
+   Get value of libcw parameter \p c (frequency, volume, speed, gap or
+   weighting) of generator that plays the sound, or of generator that
+   renders it to file.
+
+   @return value of the parameter
+*/
+int get_parameter(int c)
+{
+	cw_gen_t *gen = render.gen;
+
+	switch (c) {
+	case CW_CMDV_FREQUENCY:
+		return gen ? cw_gen_get_frequency(gen) : cw_get_frequency();
+	case CW_CMDV_VOLUME:
+		return gen ? cw_gen_get_volume(gen) : cw_get_volume();
+	case CW_CMDV_SPEED:
+		return gen ? cw_gen_get_speed(gen) : cw_get_send_speed();
+	case CW_CMDV_GAP:
+		return gen ? cw_gen_get_gap(gen) : cw_get_gap();
+	case CW_CMDV_WEIGHTING:
+		return gen ? cw_gen_get_weighting(gen) : cw_get_weighting();
+	default:
+		return 0;
+	}
+}
+
+
+
+
+/**
+   Set libcw parameter \p c (frequency, volume, speed, gap or
+   weighting) to \p value.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int set_parameter(int c, int value)
+{
+	cw_gen_t *gen = render.gen;
+
+	switch (c) {
+	case CW_CMDV_FREQUENCY:
+		return gen ? cw_gen_set_frequency(gen, value) : cw_set_frequency(value);
+	case CW_CMDV_VOLUME:
+		return gen ? cw_gen_set_volume(gen, value) : cw_set_volume(value);
+	case CW_CMDV_SPEED:
+		return gen ? cw_gen_set_speed(gen, value) : cw_set_send_speed(value);
+	case CW_CMDV_GAP:
+		return gen ? cw_gen_set_gap(gen, value) : cw_set_gap(value);
+	case CW_CMDV_WEIGHTING:
+		return gen ? cw_gen_set_weighting(gen, value) : cw_set_weighting(value);
+	default:
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+}
+
+
+
+
+/**
+   Enqueue a complete or partial character in tone queue.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise (errno is set by libcw)
+*/
+int enqueue_character(int c, bool is_partial)
+{
+	if (render.gen) {
+		return is_partial
+			? cw_gen_enqueue_character_partial(render.gen, c)
+			: cw_gen_enqueue_character(render.gen, c);
+	} else {
+		return is_partial
+			? cw_send_character_partial(c)
+			: cw_send_character(c);
+	}
+}
+
+
+
+
+/**
+   Enqueue a string in tone queue.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise (errno is set by libcw)
+*/
+int enqueue_string(const char *string)
+{
+	return render.gen
+		? cw_gen_enqueue_string(render.gen, string)
+		: cw_send_string(string);
+}
+
+
+
+
+/**
+   Discard tones that haven't been sounded or rendered yet.
+*/
+void flush_queue(void)
+{
+	if (render.gen) {
+		cw_gen_flush_queue(render.gen);
+	} else {
+		cw_flush_tone_queue();
+	}
+
+	return;
+}
+
+
+
+
+/**
+   Read characters from a file stream, and either sound them, or
+   interpret controls in them.  Returns on end of file.
+*/
+void parse_stream(FILE * stream)
+{
+	int c;
+	enum { NONE, COMBINATION, COMMENT, NESTED_COMMENT } state = NONE;
+
+	/* Cycle round states depending on input characters.  Comments
+	   may be nested inside combinations, but not the other way
+	   around; that is, combination starts and ends are not
+	   special within comments. */
+	for (c = fgetc(stream); !feof(stream) && !quit_requested; c = fgetc(stream)) {
+		switch (state) {
+		case NONE:
+			/*
+			 * Start a comment or combination, handle a command escape, or send
+			 * the character if none of these checks apply.
+			 */
+			if (c == CW_COMMENT_START && config->do_comments) {
+				state = COMMENT;
+				submit_item(ITEM_ECHO, c, 0, false);
+			} else if (c == CW_COMBINATION_START && config->do_combinations) {
+				state = COMBINATION;
+				submit_item(ITEM_ECHO, c, 0, false);
+			} else if (c == CW_CMD_ESCAPE && config->do_commands) {
+				parse_stream_command(stream);
+			} else {
+				submit_item(ITEM_CHARACTER, c, 0, false);
+			}
+			break;
+
+		case COMBINATION:
+			/*
+			 * Start a comment nested in a combination, end a combination,
+			 * handle a command escape, or send the character if none of these
+			 * checks apply.
+			 */
+			if (c == CW_COMMENT_START && config->do_comments) {
+				state = NESTED_COMMENT;
+				submit_item(ITEM_ECHO, c, 0, false);
+			} else if (c == CW_COMBINATION_END) {
+				state = NONE;
+				submit_item(ITEM_ECHO, c, 0, false);
+			} else if (c == CW_CMD_ESCAPE && config->do_commands) {
+				parse_stream_command(stream);
+			} else {
+				/* If this is the final character in
+				   the combination, do not suppress
+				   the end of character delay.  To do
+				   this, look ahead the next
+				   character, and suppress unless
+				   combination end. */
+				const int lookahead_c = fgetc(stream);
+				ungetc(lookahead_c, stream);
+				submit_item(ITEM_CHARACTER, c, 0, lookahead_c != CW_COMBINATION_END);
+			}
+			break;
+
+		case COMMENT:
+		case NESTED_COMMENT:
+			/* If in a comment nested in a combination and
+			   comment end seen, revert state to reflect
+			   in combination only.  If in an unnested
+			   comment and comment end seen, reset
+			   state. */
+			if (c == CW_COMMENT_END) {
+				state = (state == NESTED_COMMENT) ? COMBINATION : NONE;
+			}
+			submit_item(ITEM_ECHO, c, 0, false);
+			break;
+		}
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Send input stream in pipelined mode
+
+   Input stream is parsed by a separate thread, ahead of sending,
+   into a bounded lookahead buffer. Current thread takes items from
+   the buffer and sends them, so a delay in input stream (e.g. a
+   slow pipe) doesn't cause an audible gap as long as there are
+   items in the buffer. Returns on end of file.
+*/
+void pipeline_run(FILE * stream)
+{
+	lookahead.is_pipelined = true;
+
+	pthread_t reader;
+	if (0 != pthread_create(&reader, NULL, pipeline_reader, stream)) {
+		perror("pthread_create");
+		/* Fall back to sending without lookahead. */
+		lookahead.is_pipelined = false;
+		parse_stream(stream);
+		return;
+	}
+
+	while (true) {
+		pthread_mutex_lock(&lookahead.mutex);
+		while (lookahead.len == 0) {
+			pthread_cond_wait(&lookahead.not_empty, &lookahead.mutex);
+		}
+		const item_t item = lookahead.items[lookahead.head];
+		lookahead.head = (lookahead.head + 1) % LOOKAHEAD_CAPACITY;
+		lookahead.len--;
+		pthread_cond_signal(&lookahead.not_full);
+		pthread_mutex_unlock(&lookahead.mutex);
+
+		if (item.type == ITEM_END) {
+			break;
+		}
+		execute_item(&item);
+	}
+
+	pthread_join(reader, NULL);
+
+	return;
+}
+
+
+
+
+/**
+   Thread function of parser of input stream in pipelined mode
+*/
+void *pipeline_reader(void * arg)
+{
+	parse_stream((FILE *) arg);
+	submit_item(ITEM_END, 0, 0, false);
+
+	return NULL;
+}
+
+
+
+
+/*---------------------------------------------------------------------*/
+/*  Rendering to WAV file                                              */
+/*---------------------------------------------------------------------*/
+
+
+
+
+/**
+   \brief Start rendering sound to WAV file
+
+   Create a generator for rendering, with parameters from command
+   line, and create WAV file at \p path. Until render_close() is
+   called, characters and parameter changes from input stream go to
+   the generator, and their samples go to the file.
+
+   \param path - path to output WAV file
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int render_open(const char * path)
+{
+	render.gen = cw_gen_new(CW_AUDIO_NULL, NULL);
+	if (!render.gen) {
+		fprintf(stderr, _("%s: failed to create generator\n"), config->program_name);
+		return CW_FAILURE;
+	}
+
+	if (CW_SUCCESS != cw_gen_set_sample_rate(render.gen, RENDER_SAMPLE_RATE)
+	    || CW_SUCCESS != set_parameter(CW_CMDV_FREQUENCY, config->frequency)
+	    || CW_SUCCESS != set_parameter(CW_CMDV_VOLUME, config->volume)
+	    || CW_SUCCESS != set_parameter(CW_CMDV_SPEED, config->send_speed)
+	    || CW_SUCCESS != set_parameter(CW_CMDV_GAP, config->gap)
+	    || CW_SUCCESS != set_parameter(CW_CMDV_WEIGHTING, config->weighting)) {
+
+		fprintf(stderr, "%s: failed to apply configuration\n", config->program_name);
+		cw_gen_delete(&render.gen);
+		return CW_FAILURE;
+	}
+
+	render.file = fopen(path, "wb");
+	if (!render.file) {
+		fprintf(stderr, _("%s: %s\n"), config->program_name, strerror(errno));
+		fprintf(stderr, _("%s: error opening output file %s\n"), config->program_name, path);
+		cw_gen_delete(&render.gen);
+		return CW_FAILURE;
+	}
+
+	/* Sizes in the header are updated in render_close(). */
+	render.n_samples = 0;
+	if (CW_SUCCESS != render_write_header()) {
+		fclose(render.file);
+		render.file = NULL;
+		cw_gen_delete(&render.gen);
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Write samples of all enqueued tones to WAV file
+
+   Samples of the last tone end exactly where samples of tones
+   enqueued later will begin, so there are no gaps between
+   characters in the file.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int render_queue(void)
+{
+	size_t n_rendered = 0;
+	do {
+		if (CW_SUCCESS != cw_gen_fill_queued(render.gen, render.buffer, RENDER_BUFFER_SIZE, &n_rendered)) {
+			perror("cw_gen_fill_queued");
+			return CW_FAILURE;
+		}
+
+		/* Sizes in WAV header are 32-bit. */
+		if ((uint64_t) render.n_samples + n_rendered > (UINT32_MAX - 36) / sizeof (render.buffer[0])) {
+			fprintf(stderr, "%s: output file is too large\n", config->program_name);
+			return CW_FAILURE;
+		}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		/* Samples in WAV file are little-endian. */
+		for (size_t i = 0; i < n_rendered; i++) {
+			render.buffer[i] = (int16_t) __builtin_bswap16((uint16_t) render.buffer[i]);
+		}
+#endif
+
+		if (n_rendered != fwrite(render.buffer, sizeof (render.buffer[0]), n_rendered, render.file)) {
+			perror("fwrite");
+			return CW_FAILURE;
+		}
+		render.n_samples += n_rendered;
+
+	} while (n_rendered == RENDER_BUFFER_SIZE);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Finish rendering sound to WAV file
+
+   Write remaining samples, complete header of the file, and close
+   it. The function is a no-op if sound is not rendered to file.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int render_close(void)
+{
+	if (!render.gen) {
+		return CW_SUCCESS;
+	}
+
+	int cwret = render_queue();
+
+	if (0 != fseek(render.file, 0, SEEK_SET)) {
+		perror("fseek");
+		cwret = CW_FAILURE;
+	} else if (CW_SUCCESS != render_write_header()) {
+		cwret = CW_FAILURE;
+	}
+
+	if (0 != fclose(render.file)) {
+		perror("fclose");
+		cwret = CW_FAILURE;
+	}
+	render.file = NULL;
+	cw_gen_delete(&render.gen);
+
+	return cwret;
+}
+
+
+
+
+/**
+   \brief Write header of WAV file: 16-bit mono PCM
+
+   Sizes in the header correspond to current number of samples.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int render_write_header(void)
+{
+	const uint32_t data_size = render.n_samples * sizeof (render.buffer[0]);
+	const uint32_t fields[] = {
+		36 + data_size,                      /* RIFF chunk size. */
+		16,                                  /* fmt chunk size. */
+		1 | (1 << 16),                       /* PCM, one channel. */
+		RENDER_SAMPLE_RATE,
+		RENDER_SAMPLE_RATE * sizeof (render.buffer[0]),  /* Byte rate. */
+		sizeof (render.buffer[0]) | (16 << 16),          /* Block align, bits per sample. */
+		data_size
+	};
+
+	uint8_t header[44];
+	memcpy(header, "RIFF", 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	memcpy(header + 36, "data", 4);
+
+	/* Offsets of fields in the header. */
+	static const int offsets[] = { 4, 16, 20, 24, 28, 32, 40 };
+	for (size_t f = 0; f < sizeof (offsets) / sizeof (offsets[0]); f++) {
+		for (int b = 0; b < 4; b++) {
+			header[offsets[f] + b] = (uint8_t) (fields[f] >> (8 * b));
+		}
+	}
+
+	if (1 != fwrite(header, sizeof (header), 1, render.file)) {
+		perror("fwrite");
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+#ifndef CW_UNIT_TESTS
+/**
+   \brief Render input stream to WAV file
+
+   \param stream - input stream
+   \param path - path to output WAV file
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int render_file(FILE * stream, const char * path)
+{
+	if (CW_SUCCESS != render_open(path)) {
+		return CW_FAILURE;
+	}
+
+	parse_stream(stream);
+
+	return render_close();
+}
+
+
+
+
+/**
+   \brief Render input files of batch mode to WAV files
+
+   Each input file is rendered by a separate child process, with
+   its own copy of configuration (input stream may change it with
+   embedded commands), and at most config->jobs files are rendered
+   at the same time.
+
+   @return CW_SUCCESS if all files have been rendered
+   @return CW_FAILURE otherwise
+*/
+int batch_run(void)
+{
+	int jobs = config->jobs;
+	if (jobs < 1) {
+		const long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = n_processors > 0 ? (int) n_processors : 1;
+	}
+
+	int n_started = 0;
+	int n_running = 0;
+	int n_failed = 0;
+	bool can_start = true;  /* No more files are started after fork() fails. */
+
+	while ((can_start && n_started < config->n_batch_files) || n_running > 0) {
+		if (can_start && n_started < config->n_batch_files && n_running < jobs) {
+			const char *input_path = config->batch_files[n_started];
+			const pid_t pid = fork();
+			if (pid == -1) {
+				/* Collect children that have been started so far. */
+				perror("fork");
+				can_start = false;
+				continue;
+			} else if (pid == 0) {
+				FILE *stream = fopen(input_path, "r");
+				if (!stream) {
+					fprintf(stderr, _("%s: %s\n"), config->program_name, strerror(errno));
+					fprintf(stderr, _("%s: error opening input file %s\n"), config->program_name, input_path);
+					exit(EXIT_FAILURE);
+				}
+				char *output_path = batch_output_path(input_path);
+				if (!output_path) {
+					perror("malloc");
+					exit(EXIT_FAILURE);
+				}
+				const int cwret = render_file(stream, output_path);
+				fclose(stream);
+				free(output_path);
+				exit(cwret == CW_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+			} else {
+				n_started++;
+				n_running++;
+				continue;
+			}
+		}
+
+		int status;
+		if (-1 == wait(&status)) {
+			perror("wait");
+			return CW_FAILURE;
+		}
+		n_running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			n_failed++;
+		}
+	}
+
+	if (n_failed || n_started < config->n_batch_files) {
+		fprintf(stderr, "%s: failed to render %d of %d input files\n",
+			config->program_name, config->n_batch_files - n_started + n_failed, config->n_batch_files);
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Get path of WAV file for input file of batch mode
+
+   The WAV file is put in config->batch_dir, and its name is the
+   name of input file with extension replaced by ".wav".
+
+   \param input_path - path to input file
+
+   @return path to WAV file, owned by caller
+   @return NULL on failure
+*/
+char *batch_output_path(const char * input_path)
+{
+	const char *name = strrchr(input_path, '/');
+	name = name ? name + 1 : input_path;
+
+	/* Dot at the beginning of name is not an extension. */
+	const char *extension = strrchr(name, '.');
+	const size_t name_len = (extension && extension != name) ? (size_t) (extension - name) : strlen(name);
+
+	const size_t len = strlen(config->batch_dir) + 1 + name_len + strlen(".wav") + 1;
+	char *path = (char *) malloc(len);
+	if (path) {
+		snprintf(path, len, "%s/%.*s.wav", config->batch_dir, (int) name_len, name);
+	}
+
+	return path;
+}
+
+
+
+
+
+/**
+   \brief Parse command line args, then produce CW output until end of file
+
+   \param argc
+   \param argv
+*/
+int main(int argc, char *const argv[])
 {
 	atexit(cw_atexit);
 
@@ -635,6 +1528,18 @@ int main(int argc, char *const argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (config->batch_dir) {
+		if (config->output_file) {
+			fprintf(stderr, _("%s: options -F and -B can't be used together\n"), config->program_name);
+			exit(EXIT_FAILURE);
+		}
+		if (!config->n_batch_files) {
+			fprintf(stderr, _("%s: no input files given for batch mode\n"), config->program_name);
+			exit(EXIT_FAILURE);
+		}
+		exit(batch_run() == CW_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	if (config->input_file) {
 		if (!freopen(config->input_file, "r", stdin)) {
 			fprintf(stderr, _("%s: %s\n"), config->program_name, strerror(errno));
@@ -643,6 +1548,12 @@ int main(int argc, char *const argv[])
 		}
 	}
 
+	if (config->output_file) {
+		/* Render sound of stdin stream to file instead of
+		   playing it. */
+		exit(render_file(stdin, config->output_file) == CW_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	if (config->audio_system == CW_AUDIO_ALSA
 	    && cw_is_pa_possible(NULL)) {
 
@@ -673,13 +1584,18 @@ int main(int argc, char *const argv[])
 	cw_generator_start();
 
 	/* Send stdin stream to CW parsing. */
-	parse_stream(stdin);
+	if (config->pipeline) {
+		pipeline_run(stdin);
+	} else {
+		parse_stream(stdin);
+	}
 
 	/* Await final tone completion before exiting. */
 	cw_wait_for_tone_queue();
 
 	exit(EXIT_SUCCESS);
 }
+#endif /* #ifndef CW_UNIT_TESTS */
 
 
 
@@ -687,6 +1603,10 @@ int main(int argc, char *const argv[])
 
 void cw_atexit(void)
 {
+	/* Complete WAV file also when input stream has ended
+	   with "quit" command. */
+	render_close();
+
 	if (generator) {
 		cw_generator_stop();
 		//cw_complete_reset();
@@ -699,3 +1619,460 @@ void cw_atexit(void)
 
 	return;
 }
+
+
+
+
+
+#ifdef CW_UNIT_TESTS
+
+
+#include <fcntl.h>
+#include <time.h>
+
+
+static unsigned int test_pipeline_output(void);
+static unsigned int test_pipeline_quit(void);
+static unsigned int test_pipeline_timing(void);
+static int test_run(const char *input, bool pipelined, char *output, size_t size, const char *wav_path);
+static bool test_files_equal(const char *path1, const char *path2);
+static void test_print_result(int p, bool failed);
+static int64_t test_now_usecs(void);
+static void *test_timing_writer(void *arg);
+static void *test_timing_echo_reader(void *arg);
+static void *test_timing_monitor(void *arg);
+
+
+typedef unsigned int (*cw_test_function_t)(void);
+
+static cw_test_function_t cw_unit_tests[] = {
+	test_pipeline_output,
+	test_pipeline_quit,
+	test_pipeline_timing,
+	NULL
+};
+
+
+
+int main(void)
+{
+	atexit(cw_atexit);
+
+	fprintf(stderr, "unit tests for \"cw\" functions\n\n");
+
+	config = cw_config_new("cw");
+	if (!config) {
+		exit(EXIT_FAILURE);
+	}
+	config->is_cw = 1;
+
+	int i = 0;
+	while (cw_unit_tests[i]) {
+		cw_unit_tests[i]();
+		i++;
+	}
+
+	/* "make check" facility requires this message to be
+	   printed on stdout; don't localize it */
+	fprintf(stdout, "\ncw: test result: success\n\n");
+
+	return 0;
+}
+
+
+
+
+/**
+   Send \p input to WAV file at \p wav_path, either directly or in
+   pipelined mode. Text written to echo stream and to message stream
+   is put in \p output, in order in which it was written.
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE otherwise
+*/
+int test_run(const char * input, bool pipelined, char * output, size_t size, const char * wav_path)
+{
+	/* Input stream may have changed these. */
+	config->do_echo = true;
+	config->do_errors = true;
+	config->do_commands = true;
+	config->do_combinations = true;
+	config->do_comments = true;
+	quit_requested = false;
+	lookahead.is_pipelined = false;
+
+	char buffer[256];
+	snprintf(buffer, sizeof (buffer), "%s", input);
+	FILE *stream = fmemopen(buffer, strlen(buffer), "r");
+	if (!stream) {
+		return CW_FAILURE;
+	}
+
+	char output_path[] = "/tmp/cw_test_output_XXXXXX";
+	const int fd = mkstemp(output_path);
+	if (fd == -1) {
+		fclose(stream);
+		return CW_FAILURE;
+	}
+	unlink(output_path);
+
+	if (CW_SUCCESS != render_open(wav_path)) {
+		close(fd);
+		fclose(stream);
+		return CW_FAILURE;
+	}
+
+	/* Both streams go to the same file. */
+	fflush(stdout);
+	fflush(stderr);
+	const int saved_stdout = dup(STDOUT_FILENO);
+	const int saved_stderr = dup(STDERR_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+
+	if (pipelined) {
+		pipeline_run(stream);
+	} else {
+		parse_stream(stream);
+	}
+	int cwret = render_close();
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_stdout, STDOUT_FILENO);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stdout);
+	close(saved_stderr);
+	fclose(stream);
+
+	const ssize_t n = pread(fd, output, size - 1, 0);
+	if (n < 0) {
+		cwret = CW_FAILURE;
+	}
+	output[n < 0 ? 0 : n] = '\0';
+	close(fd);
+
+	return cwret;
+}
+
+
+
+
+/**
+   @return true if files at \p path1 and \p path2 have the same contents
+   @return false otherwise
+*/
+bool test_files_equal(const char * path1, const char * path2)
+{
+	FILE *file1 = fopen(path1, "rb");
+	FILE *file2 = fopen(path2, "rb");
+	bool equal = file1 && file2;
+
+	while (equal) {
+		const int c1 = fgetc(file1);
+		const int c2 = fgetc(file2);
+		equal = c1 == c2;
+		if (c1 == EOF) {
+			break;
+		}
+	}
+
+	if (file1) {
+		fclose(file1);
+	}
+	if (file2) {
+		fclose(file2);
+	}
+
+	return equal;
+}
+
+
+
+
+void test_print_result(int p, bool failed)
+{
+	fprintf(stderr, "%*s\n", 75 - p, failed ? "FAIL" : "OK");
+
+	return;
+}
+
+
+
+
+/**
+   Pipelined mode sends the same sound and writes the same text, in
+   the same order, as direct mode: messages of commands that control
+   parsing are not written ahead of output of preceding characters,
+   and queries report values of parsing parameters at their place in
+   the stream.
+*/
+unsigned int test_pipeline_output(void)
+{
+	const int p = fprintf(stderr, "cw: pipeline_run(): output:");
+
+	const char *input = "AB%W30;C%?W%>W{com}[SO]%?P%P0;{x}%?P%E0;D%E1;%ZE";
+	const char *expected = "AB=W30C=W30{com}[SO]=P1=P0?{x?}=P0=E0=E1?%ZE";
+
+	char direct[256];
+	char pipelined[256];
+	char direct_wav[] = "/tmp/cw_test_direct_XXXXXX";
+	char pipelined_wav[] = "/tmp/cw_test_pipelined_XXXXXX";
+	close(mkstemp(direct_wav));
+	close(mkstemp(pipelined_wav));
+
+	/* Repeated, because order of output of parser and sender
+	   threads is not deterministic. */
+	bool failed = false;
+	for (int i = 0; i < 20 && !failed; i++) {
+		cw_assert (CW_SUCCESS == test_run(input, false, direct, sizeof (direct), direct_wav), "direct run failed");
+		cw_assert (CW_SUCCESS == test_run(input, true, pipelined, sizeof (pipelined), pipelined_wav), "pipelined run failed");
+
+		failed = strcmp(direct, expected)
+			|| strcmp(pipelined, expected)
+			|| !test_files_equal(direct_wav, pipelined_wav);
+		cw_assert (!failed, "output differs:\nexpected:  \"%s\"\ndirect:    \"%s\"\npipelined: \"%s\"",
+			   expected, direct, pipelined);
+	}
+
+	unlink(direct_wav);
+	unlink(pipelined_wav);
+
+	test_print_result(p, failed);
+
+	return 0;
+}
+
+
+
+
+/**
+   "Quit" command ends sending without exiting the program, and
+   nothing after the command is sent.
+*/
+unsigned int test_pipeline_quit(void)
+{
+	const int p = fprintf(stderr, "cw: pipeline_run(): quit:");
+
+	char output[64];
+	char quit_wav[] = "/tmp/cw_test_quit_XXXXXX";
+	char short_wav[] = "/tmp/cw_test_short_XXXXXX";
+	close(mkstemp(quit_wav));
+	close(mkstemp(short_wav));
+
+	bool failed = false;
+	for (int pipelined = 0; pipelined <= 1; pipelined++) {
+		/* The program would exit here on "quit" command if
+		   the command was executed by exit(). */
+		cw_assert (CW_SUCCESS == test_run("E%QT", pipelined, output, sizeof (output), quit_wav), "run with quit failed");
+		failed = failed || strcmp(output, "E\n");
+		cw_assert (!failed, "unexpected output: \"%s\"", output);
+
+		cw_assert (CW_SUCCESS == test_run("E", pipelined, output, sizeof (output), short_wav), "run without quit failed");
+		failed = failed || !test_files_equal(quit_wav, short_wav);
+		cw_assert (!failed, "text after quit command was sent");
+	}
+
+	unlink(quit_wav);
+	unlink(short_wav);
+
+	test_print_result(p, failed);
+
+	return 0;
+}
+
+
+
+/* Input of test_pipeline_timing(): characters, and how long to
+   wait before writing each of them. */
+#define TEST_TIMING_N_CHARACTERS 6
+
+static struct {
+	int fd;                     /* Write end of pipe with input. */
+	int64_t char_usecs;         /* Duration of one character. */
+
+	int echo_fd;                /* Read end of pipe with echo stream. */
+	int64_t echo_times[TEST_TIMING_N_CHARACTERS];
+	int n_echoes;
+
+	volatile bool is_monitoring;
+	int64_t empty_queue_times[1024]; /* Moments when tone queue was seen empty. */
+	int n_empty_queue_times;
+} test_timing;
+
+
+
+
+int64_t test_now_usecs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+
+
+/**
+   Write characters of input stream with a delay in the middle,
+   shorter than duration of characters written before it.
+*/
+void *test_timing_writer(__attribute__((unused)) void * arg)
+{
+	for (int i = 0; i < TEST_TIMING_N_CHARACTERS; i++) {
+		if (i == TEST_TIMING_N_CHARACTERS / 2) {
+			usleep(test_timing.char_usecs * 3 / 2);
+		}
+		if (1 != write(test_timing.fd, "T", 1)) {
+			break;
+		}
+	}
+	close(test_timing.fd);
+
+	return NULL;
+}
+
+
+
+
+/**
+   Note the moment at which each character is written to echo stream
+*/
+void *test_timing_echo_reader(__attribute__((unused)) void * arg)
+{
+	char c;
+	while (1 == read(test_timing.echo_fd, &c, 1)) {
+		if (test_timing.n_echoes < TEST_TIMING_N_CHARACTERS) {
+			test_timing.echo_times[test_timing.n_echoes++] = test_now_usecs();
+		}
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   Note the moments at which tone queue is empty
+*/
+void *test_timing_monitor(__attribute__((unused)) void * arg)
+{
+	const int capacity = sizeof (test_timing.empty_queue_times) / sizeof (test_timing.empty_queue_times[0]);
+	while (test_timing.is_monitoring) {
+		if (0 == cw_get_tone_queue_length() && test_timing.n_empty_queue_times < capacity) {
+			test_timing.empty_queue_times[test_timing.n_empty_queue_times++] = test_now_usecs();
+		}
+		usleep(500);
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   With sound played by a started generator (of null sound system),
+   a delay in input stream doesn't leave a gap in tone queue, and
+   each character is echoed when it starts sounding, not when it is
+   enqueued ahead of it.
+*/
+unsigned int test_pipeline_timing(void)
+{
+	const int p = fprintf(stderr, "cw: pipeline_run(): timing:");
+
+	config->do_echo = true;
+	quit_requested = false;
+	lookahead.is_pipelined = false;
+
+	cw_assert (CW_SUCCESS == cw_generator_new(CW_AUDIO_NULL, NULL), "failed to create generator");
+	generator = true;
+	cw_assert (CW_SUCCESS == cw_set_send_speed(30), "failed to set speed");
+	cw_assert (CW_SUCCESS == cw_set_gap(0), "failed to set gap");
+	cw_assert (CW_SUCCESS == cw_generator_start(), "failed to start generator");
+
+	/* 'T' is a dash, an inter-mark space and an end-of-character
+	   space. */
+	int dash_usecs, end_of_element_usecs, end_of_character_usecs;
+	cw_get_send_parameters(NULL, &dash_usecs, &end_of_element_usecs, &end_of_character_usecs, NULL, NULL, NULL);
+	test_timing.char_usecs = dash_usecs + end_of_element_usecs + end_of_character_usecs;
+	test_timing.n_echoes = 0;
+	test_timing.n_empty_queue_times = 0;
+	test_timing.is_monitoring = true;
+
+	int input_fds[2];
+	int echo_fds[2];
+	cw_assert (0 == pipe(input_fds) && 0 == pipe(echo_fds), "failed to create pipes");
+	test_timing.fd = input_fds[1];
+	test_timing.echo_fd = echo_fds[0];
+	FILE *stream = fdopen(input_fds[0], "r");
+	cw_assert (stream, "failed to open input stream");
+
+	fflush(stdout);
+	const int saved_stdout = dup(STDOUT_FILENO);
+	dup2(echo_fds[1], STDOUT_FILENO);
+	close(echo_fds[1]);
+
+	pthread_t writer, echo_reader, monitor;
+	pthread_create(&echo_reader, NULL, test_timing_echo_reader, NULL);
+	pthread_create(&monitor, NULL, test_timing_monitor, NULL);
+	pthread_create(&writer, NULL, test_timing_writer, NULL);
+
+	pipeline_run(stream);
+	cw_wait_for_tone_queue();
+	const int64_t end = test_now_usecs();
+
+	pthread_join(writer, NULL);
+	test_timing.is_monitoring = false;
+	pthread_join(monitor, NULL);
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+	pthread_join(echo_reader, NULL);
+	close(echo_fds[0]);
+	fclose(stream);
+
+	bool failed = test_timing.n_echoes != TEST_TIMING_N_CHARACTERS;
+	cw_assert (!failed, "%d characters echoed", test_timing.n_echoes);
+
+	/* Echo of each character comes one character after echo of
+	   previous one, also after the delay in input. Tone queue
+	   gets empty when the last tone of the last character (its
+	   end-of-character space) starts. Allowed error is a quarter
+	   of character (half of dash). */
+	const int64_t tolerance = test_timing.char_usecs / 4;
+	for (int i = 1; i < TEST_TIMING_N_CHARACTERS; i++) {
+		const int64_t interval = test_timing.echo_times[i] - test_timing.echo_times[i - 1];
+		failed = failed || llabs(interval - test_timing.char_usecs) > tolerance;
+		cw_assert (!failed, "interval between echoes #%d and #%d is %lld us, expected %lld us",
+			   i - 1, i, (long long) interval, (long long) test_timing.char_usecs);
+	}
+	const int64_t last = end - test_timing.echo_times[TEST_TIMING_N_CHARACTERS - 1];
+	const int64_t expected_last = test_timing.char_usecs - end_of_character_usecs;
+	failed = failed || llabs(last - expected_last) > tolerance;
+	cw_assert (!failed, "tone queue empty %lld us after echo of last character, expected %lld us",
+		   (long long) last, (long long) expected_last);
+
+	/* Tone queue doesn't run empty until the last character is
+	   sounding. */
+	for (int i = 0; i < test_timing.n_empty_queue_times; i++) {
+		const int64_t t = test_timing.empty_queue_times[i];
+		failed = failed || (t > test_timing.echo_times[0] && t < test_timing.echo_times[TEST_TIMING_N_CHARACTERS - 1]);
+		cw_assert (!failed, "tone queue empty %lld us after first echo",
+			   (long long) (t - test_timing.echo_times[0]));
+	}
+
+	test_print_result(p, failed);
+
+	cw_generator_stop();
+	cw_generator_delete();
+	generator = false;
+
+	return 0;
+}
+
+
+
+#endif /* #ifdef CW_UNIT_TESTS */
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Tests of cw's batch mode.
+#
+# Files rendered with -B must be identical to files rendered with -F
+# from the same scripts, whatever number of jobs renders them.
+
+
+cw=./cw
+dir=cw_batch_tests.tmp
+failed=0
+
+
+rm -rf $dir
+mkdir -p $dir/ref || exit 1
+
+printf '%%W25%%T600 CQ CQ DE TEST K\n' > $dir/a.cw
+printf '%%W40%%T900%%G10 VVV [AR] 73 =\n' > $dir/b.cw
+
+for script in a b; do
+	if ! $cw -F $dir/ref/$script.wav -f $dir/$script.cw > /dev/null 2>&1; then
+		echo "cw: failed to render $script.cw with -F"
+		failed=1
+	fi
+done
+
+
+# $1 - number of jobs
+check_batch()
+{
+	out=$dir/j$1
+	mkdir -p $out
+
+	if ! $cw -B $out -j$1 $dir/a.cw $dir/b.cw > /dev/null 2>&1; then
+		echo "cw: failed to render scripts with -B and -j$1"
+		failed=1
+	fi
+	for script in a b; do
+		if ! cmp -s $dir/ref/$script.wav $out/$script.wav; then
+			echo "cw: $script.wav rendered with -B and -j$1 differs from one rendered with -F"
+			failed=1
+		fi
+	done
+}
+
+
+check_batch 1
+check_batch 2
+
+# A script that can't be read must be reported as failed, and the
+# others still rendered.
+mkdir -p $dir/missing
+if $cw -B $dir/missing -j2 $dir/a.cw $dir/nonexistent.cw > /dev/null 2>&1; then
+	echo "cw: missing input file not reported as failure"
+	failed=1
+fi
+if ! cmp -s $dir/ref/a.wav $dir/missing/a.wav; then
+	echo "cw: a.wav not rendered next to missing input file"
+	failed=1
+fi
+
+rm -rf $dir
+
+
+if [ $failed -eq 0 ]; then
+	echo "cw: test result: success"
+else
+	echo "cw: test result: failure"
+fi
+exit $failed
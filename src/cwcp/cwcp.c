@@ -30,6 +30,15 @@
 #include <ctype.h>
 #include <curses.h>
 #include <errno.h>
+#include <stdint.h>
+
+/* cwcp waits for input and for events of libcw in an epoll loop.
+   Without epoll and timerfd it polls them in regular intervals. */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+# define CWCP_EVENT_LOOP 1
+# include <sys/epoll.h>
+# include <sys/timerfd.h>
+#endif
 
 #if defined(HAVE_STRING_H)
 # include <string.h>
@@ -81,7 +90,7 @@ static const char *all_options = "s:|system,d:|device,"
 	"w:|wpm,t:|tone,v:|volume,"
 	"g:|gap,k:|weighting,"
 	"f:|infile,F:|outfile,"
-	"T:|time,"
+	"T:|time,W:|weights,"
 	/* "c:|colours,c:|colors,m|mono," */
 	"h|help,V|version";
 
@@ -103,6 +112,7 @@ static bool timer_set_total_practice_time(int practice_time);
 static void timer_start(void);
 static bool timer_is_expired(void);
 static void timer_window_update(int elapsed, int total);
+static void timer_schedule_updates(bool enable);
 
 static void speed_update(void);
 static void frequency_update(void);
@@ -159,7 +169,10 @@ static void queue_delete_character(void);
 static void ui_refresh_main_window(void);
 static void ui_display_state(const char *state);
 static void ui_clear_main_window(void);
+static void ui_main_loop(void);
+static void ui_poll_main_loop(void);
 static void ui_poll_user_input(int fd, int usecs);
+static void ui_exit_on_error(const char *message);
 static void ui_update_mode_selection(int old_mode, int current_mode);
 static void ui_handle_event(int c);
 
@@ -570,6 +583,7 @@ void queue_transfer_character_to_libcw(void)
 static const int TIMER_MIN_TIME = 1, TIMER_MAX_TIME = 99; /* practice timer limits */
 static int timer_total_practice_time = 15; /* total time of practice, from beginning to end */
 static int timer_practice_start = 0;       /* time() value on practice start */
+static int timer_fd = -1;                  /* timerfd expiring on each full minute of practice, -1 if not used */
 
 
 
@@ -644,6 +658,40 @@ bool timer_is_expired(void)
 
 
 
+/**
+   \brief Start or stop periodic updates of practice timer
+
+   When enabled, timer_fd expires on each full minute since start
+   of practice, so that the main loop can update the timer display
+   and stop practice when its time is over, without polling.
+
+   \param enable - start updates if true, stop them if false
+*/
+void timer_schedule_updates(bool enable)
+{
+#if defined(CWCP_EVENT_LOOP)
+	if (timer_fd == -1) {
+		return;
+	}
+
+	struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+	if (enable) {
+		const int elapsed = time(NULL) - timer_practice_start;
+		spec.it_value.tv_sec = 60 - elapsed % 60;
+		spec.it_interval.tv_sec = 60;
+	}
+	timerfd_settime(timer_fd, 0, &spec, NULL);
+#else
+	(void) enable;
+#endif
+
+	return;
+}
+
+
+
+
+
 /**
    \brief Update value of time spent on practicing
 
@@ -869,6 +917,10 @@ void state_change_to_active(void)
 		last_mode = g_current_mode;
         }
 
+	if (mode_current_is_type(M_DICTIONARY)) {
+		timer_schedule_updates(true);
+	}
+
 	ui_refresh_main_window();
 
 	return;
@@ -888,6 +940,7 @@ void state_change_to_idle(void)
 	}
 
 	is_sending_active = false;
+	timer_schedule_updates(false);
 
 	ui_display_state(_("Start(F9)"));
 	touchwin(text_subwindow);
@@ -1042,6 +1095,7 @@ WINDOW *ui_init_window(int lines, int columns, int begin_y, int begin_x, const c
 	/* Create the window, and set up colors if possible and requested. */
 	WINDOW *window = newwin(lines, columns, begin_y, begin_x);
 	if (!window) {
+		ui_destroy();
 		fprintf(stderr, "newwin()\n");
 		exit(EXIT_FAILURE);
 	}
@@ -1079,6 +1133,7 @@ void ui_init_display(int lines, int columns, int begin_y, int begin_x,
 	/* Text subwindow: Create the window, and set up colors if possible and requested. */
 	*subwindow = newwin(lines - 2, columns - 2, begin_y + 1, begin_x + 1);
 	if (!*subwindow) {
+		ui_destroy();
 		fprintf(stderr, "newwin()\n");
 		exit(EXIT_FAILURE);
 	}
@@ -1249,10 +1304,12 @@ void ui_destroy(void)
 
 		delwin(screen);
 		screen = NULL;
-	}
 
-	/* End curses processing. */
-	endwin();
+		/* End curses processing. The function may be called
+		   again from atexit handler, but terminal is restored
+		   only once. */
+		endwin();
+	}
 
 	return;
 }
@@ -1261,6 +1318,28 @@ void ui_destroy(void)
 
 
 
+/**
+   \brief Restore terminal, print error message and exit
+
+   The message is printed like with perror(), after curses has
+   given the terminal back, so that it isn't lost with the screen.
+
+   \param message - message to print before description of errno
+*/
+void ui_exit_on_error(const char *message)
+{
+	const int saved_errno = errno;
+	ui_destroy();
+	errno = saved_errno;
+
+	perror(message);
+	exit(EXIT_FAILURE);
+}
+
+
+
+
+
 /**
    \brief Assess a user command, and action it if valid
 
@@ -1549,6 +1628,151 @@ void ui_handle_event(int c)
 
 
 
+#if defined(CWCP_EVENT_LOOP)
+
+
+
+
+
+/**
+   \brief Main loop of user interface
+
+   Wait in one epoll set for keyboard input, for expiry of practice
+   timer (timer_fd), and for events of libcw's tone queue. The
+   tone queue reports every dequeued tone, so the loop can pass the
+   next character to libcw as soon as the queue is getting low.
+   When nothing is being sent, the loop sleeps until user presses
+   a key.
+
+   epoll doesn't support regular files and some devices (e.g.
+   /dev/null); if stdin is one of them, the function falls back to
+   ui_poll_main_loop().
+
+   The function returns when user quits the program.
+*/
+void ui_main_loop(void)
+{
+	const int input_fd = fileno(stdin);
+	const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	const int tone_queue_fd = cw_get_tone_queue_event_fd();
+	if (epoll_fd == -1 || timer_fd == -1 || tone_queue_fd == -1) {
+		ui_exit_on_error("event loop");
+	}
+
+	const int fds[] = { input_fd, timer_fd, tone_queue_fd };
+	for (size_t i = 0; i < sizeof (fds) / sizeof (fds[0]); i++) {
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.fd = fds[i];
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) == -1) {
+			if (fds[i] == input_fd && errno == EPERM) {
+				close(timer_fd);
+				timer_fd = -1;
+				close(epoll_fd);
+
+				ui_poll_main_loop();
+				return;
+			}
+			ui_exit_on_error("epoll_ctl");
+		}
+	}
+
+	/* curses may read more than one key from stdin at a time,
+	   so on input read keys until there are no more of them. */
+	nodelay(screen, true);
+
+	while (is_running) {
+		struct epoll_event events[3];
+		const int n = epoll_wait(epoll_fd, events, 3, -1);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ui_exit_on_error("epoll_wait");
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd == timer_fd) {
+				uint64_t expirations;
+				if (read(timer_fd, &expirations, sizeof (expirations)) > 0
+				    && is_sending_active
+				    && mode_current_is_type(M_DICTIONARY)
+				    && timer_is_expired()) {
+
+					state_change_to_idle();
+				}
+			} else if (events[i].data.fd == tone_queue_fd) {
+				cw_read_tone_queue_events();
+			} else {
+				for (int c = getch(); c != ERR && is_running; c = getch()) {
+					ui_handle_event(c);
+				}
+			}
+		}
+
+		queue_transfer_character_to_libcw();
+	}
+
+	close(timer_fd);
+	timer_fd = -1;
+	close(epoll_fd);
+
+	return;
+}
+
+
+
+
+
+#else
+
+
+
+
+
+/**
+   \brief Main loop of user interface
+
+   Without epoll the user interface is polled.
+*/
+void ui_main_loop(void)
+{
+	ui_poll_main_loop();
+	return;
+}
+
+
+
+
+
+#endif /* #if defined(CWCP_EVENT_LOOP) */
+
+
+
+
+
+/**
+   \brief Polling main loop of user interface
+
+   Poll the libcw sender and keyboard input until user quits the
+   program. At 60WPM, a dot is 20ms, so polling for the maximum
+   library speed needs a 10ms (10,000usec) timeout.
+*/
+void ui_poll_main_loop(void)
+{
+	while (is_running) {
+		ui_poll_user_input(fileno(stdin), 10000);
+		ui_handle_event(getch());
+	}
+
+	return;
+}
+
+
+
+
+
 /**
    \brief Check for keyboard input from user
 
@@ -1581,8 +1805,7 @@ void ui_poll_user_input(int fd, int usecs)
 		   another timeout. */
 		fd_count = select(fd + 1, &read_set, NULL, NULL, &timeout);
 		if (fd_count == -1 && errno != EINTR) {
-			perror("select");
-			exit(EXIT_FAILURE);
+			ui_exit_on_error("select");
 		}
 
 		/* Make this call on timeouts and on reads; it's just easier. */
@@ -1708,6 +1931,7 @@ int main(int argc, char **argv)
 	}
 	config->has_practice_time = true;
 	config->has_outfile = true;
+	config->has_character_weights = true;
 
 	if (!cw_process_argv(combined_argc, combined_argv, all_options, config)) {
 		fprintf(stderr, _("%s: failed to parse command line args\n"), config->program_name);
@@ -1743,6 +1967,13 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (config->character_weights) {
+		if (!cw_dictionaries_set_character_weights(config->character_weights)) {
+			fprintf(stderr, _("%s: invalid weights value: '%s'\n"), config->program_name, config->character_weights);
+			return EXIT_FAILURE;
+		}
+	}
+
 	if (config->audio_system == CW_AUDIO_ALSA
 	    && cw_is_pa_possible(NULL)) {
 
@@ -1775,16 +2006,10 @@ int main(int argc, char **argv)
 	mode_initialize();
 
 	/* Initialize the curses user interface, then catch and action
-	   every keypress we see.  Before calling getch, wait until
-	   data is available on stdin, polling the libcw sender.  At
-	   60WPM, a dot is 20ms, so polling for the maximum library
-	   speed needs a 10ms (10,000usec) timeout. */
+	   every keypress we see, while feeding the libcw sender. */
 	ui_initialize();
 	cw_generator_start();
-	while (is_running) {
-		ui_poll_user_input(fileno(stdin), 10000);
-		ui_handle_event(getch());
-	}
+	ui_main_loop();
 
 	cw_wait_for_tone_queue();
 
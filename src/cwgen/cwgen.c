@@ -21,11 +21,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h> /* gettimeofday() */
+#include <stdbool.h>
 #include <errno.h>
 #include <assert.h>
 #include <stdint.h>
 #include <inttypes.h> /* SCNu64 in sscanf() */
+#include <pthread.h>
+#include <unistd.h>   /* sysconf() */
 
 #if defined(HAVE_STRING_H)
 # include <string.h>
@@ -38,6 +40,8 @@
 #include "i18n.h"
 #include "cmdline.h"
 #include "cw_copyright.h"
+#include "cw_random.h"
+#include "cw_alias.h"
 #include "memory.h"
 
 
@@ -52,6 +56,10 @@
 #define MIN_REPEAT             0   /* Lowest repeat count allowed. */
 #define MIN_LIMIT              0   /* Lowest character count limit allowed. */
 #define INITIAL_LIMIT          0   /* Default character count limit. */
+#define MIN_JOBS               1   /* Lowest number of generating threads allowed. */
+
+/* Approximate size of block of output [bytes]. */
+#define BLOCK_SIZE           (1024 * 1024)
 
 
 static const char *const DEFAULT_CHARSET = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
@@ -67,6 +75,11 @@ struct cwgen_config {
 	uint64_t n_chars_max;  /* Maximal number of characters (excluding spaces) to generate in whole set of groups; may be zero - no limit. */
 
 	char *charset;         /* Set of chars to be used to generate groups. */
+	char *weights;         /* Weights of chars, "CHARS:WEIGHT[,CHARS:WEIGHT...]"; NULL - all chars are equally likely. */
+
+	bool has_seed;         /* Seed has been given on command line. */
+	uint64_t seed;         /* Seed of random number generator. */
+	int n_jobs;            /* Number of generating threads; zero - one per processor. */
 } g_config = {
 	.program_name   = (char *) NULL,
 
@@ -76,13 +89,61 @@ struct cwgen_config {
         .n_repeats      = INITIAL_REPEAT,
         .n_chars_max    = INITIAL_LIMIT,
 
-	.charset        = (char *) NULL
+	.charset        = (char *) NULL,
+	.weights        = (char *) NULL,
+
+	.has_seed       = false,
+	.seed           = 0,
+	.n_jobs         = 0
 };
 
 
-static const char *all_options = "g:|groups,n:|groupsize,r:|repeat,x:|limit,c:|charset,h|help,v|version";
+/* Generated groups are put in blocks of output. Each block is made
+   with its own stream of random numbers, so contents of a block
+   depend only on the seed and on index of the block, and not on
+   the thread that has generated it: output is the same for any
+   number of threads. */
+typedef struct {
+	char *data;
+	size_t len;            /* Number of bytes in data. */
+	uint64_t n_chars;      /* Number of characters in data, excluding spaces. */
+	int index;             /* Index of block in output, -1 if the slot is free. */
+	bool is_ready;         /* Block has been generated and can be written. */
+} cwgen_block_t;
+
+
+/* Blocks are generated by threads into ring of slots, and written
+   in order of their indices by main thread. */
+typedef struct {
+	const struct cwgen_config *config;
+	int groups_per_block;
+	int n_blocks;
+	int n_threads;
+	cw_random_t base;      /* State of generator for block zero. */
+	cw_alias_table_t *alias;  /* Weighted selection of chars; NULL - chars are drawn uniformly. */
+
+	cwgen_block_t *slots;
+	int n_slots;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;   /* A slot has been freed or filled, or generation has been stopped. */
+	bool stop;
+} cwgen_output_t;
+
+
+typedef struct {
+	cwgen_output_t *output;
+	int first_block;
+} cwgen_thread_t;
+
+
+static const char *all_options = "g:|groups,n:|groupsize,r:|repeat,x:|limit,c:|charset,w:|weights,s:|seed,j:|jobs,h|help,v|version";
 
 static void cwgen_generate_characters(struct cwgen_config *config);
+static void *cwgen_generate_blocks(void *arg);
+static void cwgen_generate_block(const struct cwgen_config *config, const cw_alias_table_t *alias, cw_random_t *rng, int n_groups, cwgen_block_t *block);
+static cw_alias_table_t *cwgen_new_alias_table(const struct cwgen_config *config);
+static bool cwgen_write_block(const cwgen_block_t *block, uint64_t *n_chars, uint64_t n_chars_max);
 static void cwgen_print_usage(const char *program_name);
 static void cwgen_print_help(const char *program_name);
 static void cwgen_parse_command_line(int argc, char **argv, struct cwgen_config *config);
@@ -98,83 +159,356 @@ static void cwgen_free_config(struct cwgen_config *config);
    to the requested number of groups.  Characters are selected from the
    set given at random.
 
+   Groups are generated in blocks, by config->n_jobs threads, and
+   written to stdout in bulk. Random numbers depend only on
+   config->seed, so the output for given seed and options is always
+   the same, regardless of number of threads.
+
    \param config - program's configuration variable
 */
 void cwgen_generate_characters(struct cwgen_config *config)
 {
-	static bool is_initialized = false;
+	if (!config->has_seed) {
+		config->seed = cw_random_seed_from_time();
+	}
 
-	/* On first (usually only) call, seed the random number generator. */
-	if (!is_initialized) {
+	int n_threads = config->n_jobs;
+	if (n_threads < MIN_JOBS) {
+		const long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = n_processors > 0 ? (int) n_processors : 1;
+	}
 
-		/* Previously the initializator used value returned by
-		time(). Consecutive calls of the program within one
-		second resulted in the same generated string - not
-		very random. To improve randomness, I've switched to
-		gettimeofday(). */
-		struct timeval t;
-		gettimeofday(&t, NULL);
+	cwgen_output_t output;
+	output.config = config;
+	output.n_threads = n_threads;
+	output.stop = false;
+	cw_random_seed(&output.base, config->seed);
+	output.alias = config->weights ? cwgen_new_alias_table(config) : NULL;
+
+	/* Split the groups into blocks of roughly BLOCK_SIZE
+	   bytes. Size of block doesn't depend on number of threads. */
+	const size_t group_capacity = ((size_t) config->group_size_max + 1) * ((size_t) config->n_repeats + 1);
+	output.groups_per_block = BLOCK_SIZE / group_capacity > 0 ? (int) (BLOCK_SIZE / group_capacity) : 1;
+	if (output.groups_per_block > config->n_groups) {
+		output.groups_per_block = config->n_groups;
+	}
+	output.n_blocks = (config->n_groups + output.groups_per_block - 1) / output.groups_per_block;
+	if (output.n_threads > output.n_blocks) {
+		output.n_threads = output.n_blocks;
+	}
 
-		srandom(t.tv_usec);
-		is_initialized = true;
+	/* Two slots per thread: a thread can generate next block
+	   while its previous one is being written. Block with index
+	   i always goes to slot i % n_slots, and is generated by
+	   thread i % n_threads, so each slot is used by one thread
+	   only. */
+	output.n_slots = 2 * output.n_threads;
+	output.slots = (cwgen_block_t *) calloc(output.n_slots, sizeof (cwgen_block_t));
+	if (!output.slots) {
+		fprintf(stderr, "%s: failed to allocate memory\n", config->program_name);
+		exit(EXIT_FAILURE);
 	}
+	for (int s = 0; s < output.n_slots; s++) {
+		output.slots[s].data = (char *) malloc(output.groups_per_block * group_capacity);
+		if (!output.slots[s].data) {
+			fprintf(stderr, "%s: failed to allocate memory\n", config->program_name);
+			exit(EXIT_FAILURE);
+		}
+		output.slots[s].index = -1;
+	}
+
+	pthread_mutex_init(&output.mutex, NULL);
+	pthread_cond_init(&output.changed, NULL);
 
-	/* Allocate the buffer for repeating groups. */
-	char *buffer = (char *) malloc(config->group_size_max);
-	if (!buffer) {
+	cwgen_thread_t *threads = (cwgen_thread_t *) calloc(output.n_threads, sizeof (cwgen_thread_t));
+	pthread_t *thread_ids = (pthread_t *) calloc(output.n_threads, sizeof (pthread_t));
+	if (!threads || !thread_ids) {
 		fprintf(stderr, "%s: failed to allocate memory\n", config->program_name);
 		exit(EXIT_FAILURE);
 	}
+	for (int t = 0; t < output.n_threads; t++) {
+		threads[t].output = &output;
+		threads[t].first_block = t;
+		if (0 != pthread_create(&thread_ids[t], NULL, cwgen_generate_blocks, &threads[t])) {
+			fprintf(stderr, "%s: failed to create thread\n", config->program_name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Write blocks in order, until all blocks are written or
+	   the limit of characters is reached. */
+	uint64_t n_chars = 0;
+	for (int b = 0; b < output.n_blocks; b++) {
+		cwgen_block_t *block = &output.slots[b % output.n_slots];
+
+		pthread_mutex_lock(&output.mutex);
+		while (!(block->index == b && block->is_ready)) {
+			pthread_cond_wait(&output.changed, &output.mutex);
+		}
+		pthread_mutex_unlock(&output.mutex);
+
+		const bool more = cwgen_write_block(block, &n_chars, config->n_chars_max);
+
+		pthread_mutex_lock(&output.mutex);
+		block->index = -1;
+		block->is_ready = false;
+		if (!more) {
+			output.stop = true;
+		}
+		pthread_cond_broadcast(&output.changed);
+		pthread_mutex_unlock(&output.mutex);
+
+		if (!more) {
+			break;
+		}
+	}
+
+	for (int t = 0; t < output.n_threads; t++) {
+		pthread_join(thread_ids[t], NULL);
+	}
+
+	pthread_cond_destroy(&output.changed);
+	pthread_mutex_destroy(&output.mutex);
+	for (int s = 0; s < output.n_slots; s++) {
+		free(output.slots[s].data);
+	}
+	free(output.slots);
+	cw_alias_table_delete(&output.alias);
+	free(threads);
+	free(thread_ids);
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Thread function generating blocks of output
+
+   The thread generates every n-th block, starting with its first
+   block, where n is number of threads. State of random number
+   generator for block i is the state for block zero, advanced with
+   cw_random_jump() i times.
+
+   \param arg - thread's data (cwgen_thread_t)
+*/
+void *cwgen_generate_blocks(void *arg)
+{
+	const cwgen_thread_t *thread = (const cwgen_thread_t *) arg;
+	cwgen_output_t *output = thread->output;
+	const struct cwgen_config *config = output->config;
+
+	cw_random_t stream = output->base;
+	for (int i = 0; i < thread->first_block; i++) {
+		cw_random_jump(&stream);
+	}
+
+	for (int b = thread->first_block; b < output->n_blocks; b += output->n_threads) {
+		cwgen_block_t *block = &output->slots[b % output->n_slots];
+
+		pthread_mutex_lock(&output->mutex);
+		while (block->index != -1 && !output->stop) {
+			pthread_cond_wait(&output->changed, &output->mutex);
+		}
+		const bool stop = output->stop;
+		block->index = b;
+		pthread_mutex_unlock(&output->mutex);
+
+		if (stop) {
+			break;
+		}
+
+		int n_groups = output->groups_per_block;
+		if (b == output->n_blocks - 1) {
+			n_groups = config->n_groups - b * output->groups_per_block;
+		}
+		cw_random_t rng = stream;
+		cwgen_generate_block(config, output->alias, &rng, n_groups, block);
+
+		pthread_mutex_lock(&output->mutex);
+		block->is_ready = true;
+		pthread_cond_broadcast(&output->changed);
+		pthread_mutex_unlock(&output->mutex);
+
+		for (int i = 0; i < output->n_threads; i++) {
+			cw_random_jump(&stream);
+		}
+	}
+
+	return NULL;
+}
+
+
+
+
+
+/**
+   \brief Generate one block of output
+
+   Each group is followed by a space, and is repeated in the block
+   config->n_repeats times.
+
+   \param config - program's configuration variable
+   \param alias - alias table for weighted selection of chars, or NULL for uniform selection
+   \param rng - state of random number generator for the block
+   \param n_groups - number of unique groups in the block
+   \param block - block to put the groups in
+*/
+void cwgen_generate_block(const struct cwgen_config *config, const cw_alias_table_t *alias, cw_random_t *rng, int n_groups, cwgen_block_t *block)
+{
+	const uint32_t charset_length = strlen(config->charset);
+	const uint32_t group_size_range = config->group_size_max - config->group_size_min + 1;
 
-	/* Generate groups up to the number requested or to the character limit. */
-	int charset_length = strlen(config->charset);
-	uint64_t chars = 0;
+	char *out = block->data;
+	uint64_t n_chars = 0;
 
-	for (int group = 0; group < config->n_groups; group++) {
+	for (int group = 0; group < n_groups; group++) {
 
 		/* Randomize the group size between min and max inclusive. */
-		int group_size = config->group_size_min + random() % (config->group_size_max - config->group_size_min + 1);
+		int group_size = config->group_size_min;
+		if (group_size_range > 1) {
+			group_size += cw_random_uniform(rng, group_size_range);
+		}
 
 		/* Create random group. */
-		for (int i = 0; i < group_size; i++) {
-			buffer[i] = config->charset[random() % charset_length];
+		const char *group_start = out;
+		if (alias) {
+			for (int i = 0; i < group_size; i++) {
+				*out++ = config->charset[cw_alias_table_draw(alias, rng)];
+			}
+		} else {
+			for (int i = 0; i < group_size; i++) {
+				*out++ = config->charset[cw_random_uniform(rng, charset_length)];
+			}
 		}
+		*out++ = ' ';
 
-		/* Repeatedly print the group as requested.
-		   It's always printed at least once, then repeated
-		   for the desired repeat count.  Break altogether if
-		   we hit any set limit on printed characters. */
-		int repeat = 0;
-		do {
-			for (int i = 0; i < group_size; i++) {
+		/* The group is always present at least once, then
+		   repeated for the desired repeat count. */
+		for (int repeat = 0; repeat < config->n_repeats; repeat++) {
+			memcpy(out, group_start, group_size + 1);
+			out += group_size + 1;
+		}
+
+		n_chars += (uint64_t) group_size * (config->n_repeats + 1);
+	}
+
+	block->len = out - block->data;
+	block->n_chars = n_chars;
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Build alias table for weighted selection of chars
 
-				putchar(buffer[i]);
-				fflush(stdout);
+   Each char of config->charset has weight 1, unless config->weights
+   gives another weight for it. If a char appears in the charset
+   more than once, each appearance has the weight.
 
-				chars++;
+   The function exits the program if config->weights is invalid.
 
-				if (config->n_chars_max && chars >= config->n_chars_max) {
-					break;
+   \param config - program's configuration variable
+
+   \return alias table
+*/
+cw_alias_table_t *cwgen_new_alias_table(const struct cwgen_config *config)
+{
+	const size_t charset_length = strlen(config->charset);
+	double *weights = (double *) malloc(charset_length * sizeof (double));
+	char *spec = strdup(config->weights);
+	if (!weights || !spec) {
+		fprintf(stderr, "%s: failed to allocate memory\n", config->program_name);
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < charset_length; i++) {
+		weights[i] = 1.0;
+	}
+
+	char *saveptr = NULL;
+	for (char *item = strtok_r(spec, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+
+		/* Chars may include ':', so split the item at its last ':'. */
+		char *colon = strrchr(item, ':');
+		char *end = NULL;
+		const double weight = colon ? strtod(colon + 1, &end) : -1.0;
+		if (!colon || colon == item || end == colon + 1 || *end != '\0'
+		    || !(weight >= 0.0) || weight > 1e9) {
+
+			fprintf(stderr, _("%s: invalid weights value: '%s'\n"), config->program_name, item);
+			exit(EXIT_FAILURE);
+		}
+
+		for (const char *c = item; c < colon; c++) {
+			bool found = false;
+			for (size_t i = 0; i < charset_length; i++) {
+				if (config->charset[i] == *c) {
+					weights[i] = weight;
+					found = true;
 				}
 			}
+			if (!found) {
+				fprintf(stderr, _("%s: char '%c' in weights is not in charset\n"), config->program_name, *c);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	cw_alias_table_t *alias = cw_alias_table_new(weights, charset_length);
+	if (!alias) {
+		fprintf(stderr, _("%s: weights of all chars are zero\n"), config->program_name);
+		exit(EXIT_FAILURE);
+	}
 
-			putchar(' ');
-			fflush(stdout);
+	free(spec);
+	free(weights);
 
-			if (config->n_chars_max && chars >= config->n_chars_max) {
-				break;
-			}
+	return alias;
+}
 
-		} while (repeat++ < config->n_repeats);
 
-		if (config->n_chars_max && chars >= config->n_chars_max) {
-			break;
+
+
+
+/**
+   \brief Write block of output to stdout
+
+   If the limit of characters is reached in the block, only the
+   characters up to the limit are written, followed by a space.
+
+   \param block - block to write
+   \param n_chars - number of characters (excluding spaces) written so far, updated by the function
+   \param n_chars_max - limit of characters; zero for no limit
+
+   \return true if more blocks can be written
+   \return false if the limit has been reached
+*/
+bool cwgen_write_block(const cwgen_block_t *block, uint64_t *n_chars, uint64_t n_chars_max)
+{
+	if (n_chars_max && *n_chars + block->n_chars >= n_chars_max) {
+		uint64_t remaining = n_chars_max - *n_chars;
+		size_t len = 0;
+		while (remaining) {
+			if (block->data[len++] != ' ') {
+				remaining--;
+			}
 		}
+		fwrite(block->data, 1, len, stdout);
+		putchar(' ');
+		*n_chars = n_chars_max;
+		return false;
 	}
 
-	free(buffer);
+	fwrite(block->data, 1, block->len, stdout);
+	*n_chars += block->n_chars;
 
-	return;
+	return true;
 }
 
 
@@ -225,6 +559,14 @@ static void cwgen_print_help(const char *program_name)
 	printf(_("                         [default %s]\n"), DEFAULT_CHARSET);
 	printf(_("  -x, --limit=LIMIT      stop after LIMIT characters [default %d]\n"), INITIAL_LIMIT);
 	printf("%s", _("                         a LIMIT of zero indicates no set limit\n"));
+	printf("%s", _("  -w, --weights=WEIGHTS  make some chars more or less likely than others\n"));
+	printf("%s", _("                         WEIGHTS is CHARS:WEIGHT[,CHARS:WEIGHT...]\n"));
+	printf("%s", _("                         [default: weight of each char is 1]\n"));
+	printf("%s", _("  -s, --seed=SEED        seed random generator with SEED; the same SEED\n"));
+	printf("%s", _("                         and options give the same output\n"));
+	printf("%s", _("                         [default: based on current time]\n"));
+	printf("%s", _("  -j, --jobs=N           generate with N threads; output doesn't depend\n"));
+	printf("%s", _("                         on N [default: number of processors]\n"));
 	printf("%s", _("  -h, --help             print this message\n"));
 	printf("%s", _("  -v, --version          output version information and exit\n\n"));
 
@@ -307,6 +649,38 @@ void cwgen_parse_command_line(int argc, char **argv, struct cwgen_config *config
 			fprintf(stderr, _("%s: valid limit value: %s\n"), config->program_name, argument);
 			break;
 
+		case 'w':
+			if (strlen(argument) == 0) {
+				fprintf(stderr, _("%s: weights cannot be empty\n"), config->program_name);
+				exit(EXIT_FAILURE);
+			}
+			free(config->weights);
+			config->weights = strdup(argument);
+			if (!config->weights) {
+				fprintf(stderr, _("%s: failed to allocate memory\n"), config->program_name);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
+		case 's':
+			if (sscanf(argument, "%" SCNu64, &(config->seed)) != 1
+			    || strstr(argument, "-")) {
+
+				fprintf(stderr, _("%s: invalid seed value: '%s'\n"), config->program_name, argument);
+				exit(EXIT_FAILURE);
+			}
+			config->has_seed = true;
+			break;
+
+		case 'j':
+			if (sscanf(argument, "%d", &(config->n_jobs)) != 1
+			    || config->n_jobs < MIN_JOBS) {
+
+				fprintf(stderr, _("%s: invalid jobs value: '%s'\n"), config->program_name, argument);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
 		case 'c':
 			if (strlen(argument) == 0) {
 				fprintf(stderr, _("%s: charset cannot be empty\n"), config->program_name);
@@ -378,6 +752,12 @@ int main(int argc, char **argv)
 	cwgen_generate_characters(&g_config);
 	putchar('\n');
 
+	if (fflush(stdout) != 0 || ferror(stdout)) {
+		fprintf(stderr, _("%s: failed to write output\n"), g_config.program_name);
+		cwgen_free_config(&g_config);
+		return EXIT_FAILURE;
+	}
+
 	cwgen_free_config(&g_config);
 
 	return EXIT_SUCCESS;
@@ -401,6 +781,11 @@ void cwgen_free_config(struct cwgen_config *config)
 		config->charset = (char *) NULL;
 	}
 
+	if (config->weights) {
+		free(config->weights);
+		config->weights = (char *) NULL;
+	}
+
 	if (config->program_name) {
 		free(config->program_name);
 		config->program_name = (char *) NULL;
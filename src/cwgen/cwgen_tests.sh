@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Tests of cwgen's output for given seed.
+#
+# Output for given seed and options must not change between
+# versions, and must not depend on number of generating threads.
+
+
+cwgen=./cwgen
+failed=0
+
+
+# $1 - description, $2 - expected output (groups end with a space),
+# rest - cwgen options
+check_output()
+{
+	description=$1
+	expected=$2
+	shift 2
+
+	output=`$cwgen "$@" 2>/dev/null`
+	if [ "$output" != "$expected" ]; then
+		echo "cwgen: $description: expected '$expected', got '$output'"
+		failed=1
+	fi
+}
+
+
+# Output of several blocks (~11 MB) generated with different numbers
+# of threads. $@ - cwgen options
+check_jobs()
+{
+	reference=`$cwgen "$@" -j1 2>/dev/null | cksum`
+	for jobs in 2 3 8; do
+		output=`$cwgen "$@" -j$jobs 2>/dev/null | cksum`
+		if [ "$output" != "$reference" ]; then
+			echo "cwgen: output with -j$jobs differs from output with -j1 for options: $*"
+			failed=1
+		fi
+	done
+}
+
+
+check_output "default charset" "ZSUOZ FCN5T 787YV 6CRBC " -s 1 -g 4 -n 5
+check_output "repeated groups" "11c2a 11c2a c31 c31 33213a 33213a aacc aacc " -s 1 -g 4 -n 3-6 -c abc123 -r 1
+check_output "weights" "EENN EEEE ANN AEE EE AEE " -s 7 -g 6 -n 2-4 -w E:5,T:0 -c ETAN
+check_output "limit" "ZK49 95CD OF " -s 7 -g 6 -n 4 -x 10
+
+check_jobs -s 3 -g 2000000 -n 2-7
+check_jobs -s 3 -g 1000000 -n 5 -r 1 -w E:5,T:0
+check_jobs -s 3 -g 2000000 -n 2-7 -x 5000000
+
+
+if [ $failed -eq 0 ]; then
+	echo "cwgen: test result: success"
+else
+	echo "cwgen: test result: failure"
+fi
+exit $failed
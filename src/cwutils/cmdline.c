@@ -312,23 +312,25 @@ void cw_print_help(cw_config_t *config)
 	fprintf(stderr, "%s", _("Audio system options:\n"));
 	fprintf(stderr, "%s", _("  -s, --system=SYSTEM\n"));
 	fprintf(stderr, "%s", _("        generate sound using SYSTEM audio system\n"));
-	fprintf(stderr, "%s", _("        SYSTEM: {null|console|oss|alsa|pulseaudio|soundcard}\n"));
+	fprintf(stderr, "%s", _("        SYSTEM: {null|console|oss|alsa|pulseaudio|jack|soundcard}\n"));
 	fprintf(stderr, "%s", _("        'null': don't use any sound output\n"));
 	fprintf(stderr, "%s", _("        'console': use system console/buzzer\n"));
 	fprintf(stderr, "%s", _("               this output may require root privileges\n"));
 	fprintf(stderr, "%s", _("        'oss': use OSS output\n"));
 	fprintf(stderr, "%s", _("        'alsa' use ALSA output\n"));
 	fprintf(stderr, "%s", _("        'pulseaudio' use PulseAudio output\n"));
+	fprintf(stderr, "%s", _("        'jack' use JACK output (JACK server or PipeWire)\n"));
 	fprintf(stderr, "%s", _("        'soundcard': use either PulseAudio, OSS or ALSA\n"));
 	fprintf(stderr, "%s", _("        default sound system: 'pulseaudio'->'oss'->'alsa'\n\n"));
 	fprintf(stderr, "%s", _("  -d, --device=DEVICE\n"));
 	fprintf(stderr, "%s", _("        use DEVICE as output device instead of default one;\n"));
-	fprintf(stderr, "%s", _("        optional for {console|oss|alsa|pulseaudio};\n"));
+	fprintf(stderr, "%s", _("        optional for {console|oss|alsa|pulseaudio|jack};\n"));
 	fprintf(stderr, "%s", _("        default devices are:\n"));
 	fprintf(stderr,       _("        'console': \"%s\"\n"), CW_DEFAULT_CONSOLE_DEVICE);
 	fprintf(stderr,       _("        'oss': \"%s\"\n"), CW_DEFAULT_OSS_DEVICE);
 	fprintf(stderr,       _("        'alsa': \"%s\"\n"), CW_DEFAULT_ALSA_DEVICE);
-	fprintf(stderr,       _("        'pulseaudio': %s\n\n"), CW_DEFAULT_PA_DEVICE);
+	fprintf(stderr,       _("        'pulseaudio': %s\n"), CW_DEFAULT_PA_DEVICE);
+	fprintf(stderr,       _("        'jack': %s (name of destination port)\n\n"), CW_DEFAULT_JACK_DEVICE);
 
 	fprintf(stderr, "%s", _("Sending options:\n"));
 
@@ -357,6 +359,13 @@ void cw_print_help(cw_config_t *config)
 		fprintf(stderr, "%s", _("  -c, --nocommands       disable executing embedded commands\n"));
 		fprintf(stderr, "%s", _("  -o, --nocombinations   disallow [...] combinations\n"));
 		fprintf(stderr, "%s", _("  -p, --nocomments       disallow {...} comments\n"));
+		fprintf(stderr, "%s", _("  -P, --pipeline         parse input ahead of sending\n"));
+		fprintf(stderr, "%s", _("  -F, --outfile=FILE     write sound to WAV file FILE instead of\n"));
+		fprintf(stderr, "%s", _("                         playing it\n"));
+		fprintf(stderr, "%s", _("  -B, --batch=DIR        write sound of each input file given after\n"));
+		fprintf(stderr, "%s", _("                         options to a WAV file in DIR\n"));
+		fprintf(stderr, "%s", _("  -j, --jobs=N           render N input files in parallel\n"));
+		fprintf(stderr, "%s", _("                         default value: number of processors\n"));
 	}
 	if (config->has_practice_time) {
 		fprintf(stderr, "%s", _("  -T, --time=TIME        set initial practice time (in minutes)\n"));
@@ -369,6 +378,12 @@ void cw_print_help(cw_config_t *config)
 	if (config->has_outfile) {
 		fprintf(stderr, "%s", _("  -F, --outfile=FILE     write current practice words to FILE\n"));
 	}
+	if (config->has_character_weights) {
+		fprintf(stderr, "%s", _("  -W, --weights=WEIGHTS  make some chars more or less frequent in\n"));
+		fprintf(stderr, "%s", _("                         practice words; WEIGHTS is\n"));
+		fprintf(stderr, "%s", _("                         CHARS:WEIGHT[,CHARS:WEIGHT...]\n"));
+		fprintf(stderr, "%s", _("                         default weight of each char: 1\n"));
+	}
 	if (config->is_cw) {
 		fprintf(stderr, "%s", _("                         default file: stdin\n"));
 	}
@@ -394,7 +409,12 @@ int cw_process_argv(int argc, char *const argv[], const char *options, cw_config
 		}
 	}
 
-	if (get_optind() != argc) {
+	if (get_optind() != argc && config->is_cw && config->batch_dir) {
+		/* Input files of batch mode. */
+		config->batch_files = argv + get_optind();
+		config->n_batch_files = argc - get_optind();
+		return CW_SUCCESS;
+	} else if (get_optind() != argc) {
 		fprintf(stderr, "%s: expected argument after options\n", config->program_name);
 		cw_print_usage(config->program_name);
 		return CW_FAILURE;
@@ -427,6 +447,10 @@ int cw_process_option(int opt, const char *optarg, cw_config_t *config)
 			   || !strcmp(optarg, "p")) {
 
 			config->audio_system = CW_AUDIO_PA;
+		} else if (!strcmp(optarg, "jack")
+			   || !strcmp(optarg, "j")) {
+
+			config->audio_system = CW_AUDIO_JACK;
 		} else if (!strcmp(optarg, "console")
 			   || !strcmp(optarg, "c")) {
 
@@ -570,6 +594,41 @@ int cw_process_option(int opt, const char *optarg, cw_config_t *config)
 		config->do_comments = false;
 		break;
 
+        case 'P':
+		config->pipeline = true;
+		break;
+
+	case 'W':
+		if (optarg && strlen(optarg)) {
+			free(config->character_weights);
+			config->character_weights = strdup(optarg);
+		} else {
+			fprintf(stderr, "%s: no weights specified for option -W\n", config->program_name);
+			return CW_FAILURE;
+		}
+		break;
+
+	case 'B':
+		if (optarg && strlen(optarg)) {
+			config->batch_dir = strdup(optarg);
+		} else {
+			fprintf(stderr, "%s: no output directory specified for option -B\n", config->program_name);
+			return CW_FAILURE;
+		}
+		break;
+
+	case 'j':
+		{
+			int jobs = atoi(optarg);
+			if (jobs < 1) {
+				fprintf(stderr, "%s: number of jobs must be positive\n", config->program_name);
+				return CW_FAILURE;
+			} else {
+				config->jobs = jobs;
+			}
+			break;
+		}
+
 	case 'h':
 		cw_print_help(config);
 		exit(EXIT_SUCCESS);
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+   \file cw_alias.c
+
+   \brief Weighted random selection in constant time
+
+   Each of n columns of an alias table holds a threshold and an
+   alias. A draw picks a column uniformly, then returns either the
+   column's own index or its alias, depending on how a second
+   random number compares with the threshold. Thresholds and aliases
+   are computed so that index i is returned with probability
+   weights[i] / sum(weights).
+*/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+#include "cw_alias.h"
+#include "memory.h"
+
+
+
+
+struct cw_alias_table_s {
+	size_t n;
+	uint32_t *threshold;  /* Column i returns i if 32-bit random number is below threshold[i]... */
+	uint32_t *alias;      /* ... and alias[i] otherwise. */
+};
+
+
+
+
+/**
+   \brief Build alias table for given weights
+
+   Weights don't have to be normalized. A weight may be zero (the
+   index will never be drawn), but not all weights may be zero.
+
+   \errno EINVAL - \p n is zero or too large, a weight is negative or not finite, or all weights are zero
+
+   \param weights - weights of indices 0 to \p n - 1
+   \param n - number of weights
+
+   \return new table on success
+   \return NULL on failure
+*/
+cw_alias_table_t *cw_alias_table_new(const double *weights, size_t n)
+{
+	if (!weights || n == 0 || n > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	double sum = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		if (!isfinite(weights[i]) || weights[i] < 0.0) {
+			errno = EINVAL;
+			return NULL;
+		}
+		sum += weights[i];
+	}
+	if (!(sum > 0.0) || !isfinite(sum)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cw_alias_table_t *table = safe_malloc(sizeof (cw_alias_table_t));
+	table->n = n;
+	table->threshold = safe_malloc(n * sizeof (uint32_t));
+	table->alias = safe_malloc(n * sizeof (uint32_t));
+
+	/* Probabilities scaled so that their mean is 1.0. Columns
+	   with scaled probability below 1.0 are "small" and get
+	   topped up from "large" ones. Both work lists share one
+	   array: small from the front, large from the back. */
+	double *scaled = safe_malloc(n * sizeof (double));
+	uint32_t *work = safe_malloc(n * sizeof (uint32_t));
+	size_t n_small = 0;
+	size_t large_start = n;
+	for (size_t i = 0; i < n; i++) {
+		scaled[i] = weights[i] * (double) n / sum;
+		if (scaled[i] < 1.0) {
+			work[n_small++] = i;
+		} else {
+			work[--large_start] = i;
+		}
+	}
+
+	while (n_small > 0 && large_start < n) {
+		const uint32_t s = work[--n_small];
+		const uint32_t l = work[large_start];
+
+		/* Rounding errors may make scaled[s] slightly negative. */
+		table->threshold[s] = scaled[s] > 0.0 ? (uint32_t) (scaled[s] * 4294967296.0) : 0;
+		table->alias[s] = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large_start++;
+			work[n_small++] = l;
+		}
+	}
+
+	/* Remaining columns are full; with exact arithmetic only
+	   large ones would be left, but rounding errors can leave
+	   small ones with probability very close to 1.0. */
+	while (n_small > 0) {
+		const uint32_t i = work[--n_small];
+		table->threshold[i] = UINT32_MAX;
+		table->alias[i] = i;
+	}
+	while (large_start < n) {
+		const uint32_t i = work[large_start++];
+		table->threshold[i] = UINT32_MAX;
+		table->alias[i] = i;
+	}
+
+	free(scaled);
+	free(work);
+
+	return table;
+}
+
+
+
+
+/**
+   \brief Delete alias table
+
+   \param table - pointer to table to delete; the table pointer is set to NULL
+*/
+void cw_alias_table_delete(cw_alias_table_t **table)
+{
+	if (!table || !*table) {
+		return;
+	}
+
+	free((*table)->threshold);
+	free((*table)->alias);
+	free(*table);
+	*table = NULL;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Draw a weighted random index from alias table
+
+   One 64-bit random number is used per draw: its upper half
+   selects a column, its lower half is compared with the column's
+   threshold. Columns are selected by multiplication instead of
+   division; the resulting bias is below n / 2^32, negligible for
+   any real set of characters or words.
+
+   \param table - table to draw from
+   \param rng - state of random number generator
+
+   \return index in range 0 to n - 1
+*/
+size_t cw_alias_table_draw(const cw_alias_table_t *table, cw_random_t *rng)
+{
+	const uint64_t r = cw_random_next(rng);
+	const size_t column = (size_t) (((r >> 32) * (uint64_t) table->n) >> 32);
+
+	return (uint32_t) r < table->threshold[column] ? column : table->alias[column];
+}
+
+
+
+
+
+#ifdef CW_ALIAS_UNIT_TESTS
+
+
+#include <stdio.h>
+
+#include "libcw_debug.h"
+
+
+static unsigned int test_cw_alias_table_new(void);
+static unsigned int test_cw_alias_table_draw_single(void);
+static unsigned int test_cw_alias_table_draw_zero_weights(void);
+static unsigned int test_cw_alias_table_draw_distribution(void);
+
+
+typedef unsigned int (*cw_alias_test_function_t)(void);
+
+static cw_alias_test_function_t cw_alias_unit_tests[] = {
+	test_cw_alias_table_new,
+	test_cw_alias_table_draw_single,
+	test_cw_alias_table_draw_zero_weights,
+	test_cw_alias_table_draw_distribution,
+	NULL
+};
+
+
+
+int main(void)
+{
+	fprintf(stderr, "unit tests for \"alias\" functions\n\n");
+
+	int i = 0;
+	while (cw_alias_unit_tests[i]) {
+		cw_alias_unit_tests[i]();
+		i++;
+	}
+
+	/* "make check" facility requires this message to be
+	   printed on stdout; don't localize it */
+	fprintf(stdout, "\nalias: test result: success\n\n");
+
+	return 0;
+}
+
+
+
+
+/* Invalid sets of weights are rejected with EINVAL. */
+unsigned int test_cw_alias_table_new(void)
+{
+	int p = fprintf(stderr, "alias: cw_alias_table_new():");
+
+	const double valid[] = { 1.0, 2.0 };
+	const double zeros[] = { 0.0, 0.0, 0.0 };
+	const double negative[] = { 1.0, -1.0 };
+	const double not_a_number[] = { 1.0, NAN };
+	const double infinite[] = { 1.0, INFINITY };
+
+	struct {
+		const double *weights;
+		size_t n;
+	} invalid[] = {
+		{ NULL,          2 },
+		{ valid,         0 },
+		{ zeros,         3 },
+		{ negative,      2 },
+		{ not_a_number,  2 },
+		{ infinite,      2 },
+	};
+
+	for (size_t i = 0; i < sizeof (invalid) / sizeof (invalid[0]); i++) {
+		errno = 0;
+		cw_alias_table_t *table = cw_alias_table_new(invalid[i].weights, invalid[i].n);
+		cw_assert (!table, "table created for invalid weights #%zu", i);
+		cw_assert (errno == EINVAL, "errno for invalid weights #%zu: %d", i, errno);
+	}
+
+	cw_alias_table_t *table = cw_alias_table_new(valid, 2);
+	cw_assert (table, "failed to create table for valid weights");
+	cw_alias_table_delete(&table);
+	cw_assert (!table, "table pointer not reset by delete");
+
+	/* Deleting NULL table is a no-op. */
+	cw_alias_table_delete(&table);
+	cw_alias_table_delete(NULL);
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Table with one entry always returns that entry, regardless of
+   its weight. */
+unsigned int test_cw_alias_table_draw_single(void)
+{
+	int p = fprintf(stderr, "alias: cw_alias_table_draw(), single entry:");
+
+	const double weights[] = { 1e-9, 1.0, 1e9 };
+	cw_random_t rng;
+	cw_random_seed(&rng, 1);
+
+	for (size_t w = 0; w < sizeof (weights) / sizeof (weights[0]); w++) {
+		cw_alias_table_t *table = cw_alias_table_new(&weights[w], 1);
+		cw_assert (table, "failed to create table for weight %g", weights[w]);
+		for (int i = 0; i < 10000; i++) {
+			const size_t index = cw_alias_table_draw(table, &rng);
+			cw_assert (index == 0, "draw #%d for weight %g returned %zu", i, weights[w], index);
+		}
+		cw_alias_table_delete(&table);
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Entries with zero weight are never drawn, wherever they are in
+   the table. */
+unsigned int test_cw_alias_table_draw_zero_weights(void)
+{
+	int p = fprintf(stderr, "alias: cw_alias_table_draw(), zero weights:");
+
+	const double weights[] = { 0.0, 3.0, 0.0, 0.0, 1.0, 0.0, 1e-6, 0.0 };
+	const size_t n = sizeof (weights) / sizeof (weights[0]);
+
+	cw_alias_table_t *table = cw_alias_table_new(weights, n);
+	cw_assert (table, "failed to create table");
+
+	cw_random_t rng;
+	cw_random_seed(&rng, 2);
+	for (int i = 0; i < 1000000; i++) {
+		const size_t index = cw_alias_table_draw(table, &rng);
+		cw_assert (index < n, "draw #%d returned %zu, out of range", i, index);
+		cw_assert (weights[index] > 0.0, "draw #%d returned %zu, with zero weight", i, index);
+	}
+
+	cw_alias_table_delete(&table);
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Frequencies of drawn indices match weights. Seed is fixed, so
+   the test is deterministic; the chi-square limit is the 0.001
+   critical value for five degrees of freedom. */
+unsigned int test_cw_alias_table_draw_distribution(void)
+{
+	int p = fprintf(stderr, "alias: cw_alias_table_draw(), distribution:");
+
+	const double weights[] = { 1.0, 2.0, 3.0, 4.0, 10.0, 0.5 };
+	const size_t n = sizeof (weights) / sizeof (weights[0]);
+	const int n_draws = 1000000;
+
+	cw_alias_table_t *table = cw_alias_table_new(weights, n);
+	cw_assert (table, "failed to create table");
+
+	unsigned long counts[sizeof (weights) / sizeof (weights[0])] = { 0 };
+	cw_random_t rng;
+	cw_random_seed(&rng, 3);
+	for (int i = 0; i < n_draws; i++) {
+		counts[cw_alias_table_draw(table, &rng)]++;
+	}
+	cw_alias_table_delete(&table);
+
+	double sum = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		sum += weights[i];
+	}
+	double chi_square = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		const double expected = n_draws * weights[i] / sum;
+		chi_square += (counts[i] - expected) * (counts[i] - expected) / expected;
+	}
+	cw_assert (chi_square < 20.52, "chi-square too large: %f", chi_square);
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+#endif /* #ifdef CW_ALIAS_UNIT_TESTS */
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef H_CW_ALIAS
+#define H_CW_ALIAS
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cw_random.h"
+
+
+/* Alias table (Walker's alias method, built with Vose's algorithm)
+   for drawing indices 0 to n - 1 with given weights in constant time.
+
+   Building a table takes time proportional to n, so build it once
+   per set of weights and draw from it many times. A table isn't
+   modified by draws, so it can be shared by threads, each drawing
+   with its own cw_random_t. */
+typedef struct cw_alias_table_s cw_alias_table_t;
+
+extern cw_alias_table_t *cw_alias_table_new(const double *weights, size_t n);
+extern void              cw_alias_table_delete(cw_alias_table_t **table);
+extern size_t            cw_alias_table_draw(const cw_alias_table_t *table, cw_random_t *rng);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif  /* H_CW_ALIAS */
@@ -94,6 +94,9 @@ cw_config_t *cw_config_new(const char *program_name)
 	config->has_practice_time = false;
 	config->has_outfile = false;
 	config->has_infile = true;
+	config->has_character_weights = false;
+
+	config->character_weights = NULL;
 
 	config->do_echo = true;
 	config->do_errors = true;
@@ -101,6 +104,13 @@ cw_config_t *cw_config_new(const char *program_name)
 	config->do_combinations = true;
 	config->do_comments = true;
 
+	config->pipeline = false;
+
+	config->batch_dir = NULL;
+	config->jobs = 0;
+	config->batch_files = NULL;
+	config->n_batch_files = 0;
+
 	return config;
 }
 
@@ -134,6 +144,14 @@ void cw_config_delete(cw_config_t **config)
 			free((*config)->output_file);
 			(*config)->output_file = NULL;
 		}
+		if ((*config)->batch_dir) {
+			free((*config)->batch_dir);
+			(*config)->batch_dir = NULL;
+		}
+		if ((*config)->character_weights) {
+			free((*config)->character_weights);
+			(*config)->character_weights = NULL;
+		}
 		free(*config);
 		*config = NULL;
 	}
@@ -167,11 +185,11 @@ int cw_config_is_valid(cw_config_t *config)
         if (config->audio_device) {
 		if (config->audio_system == CW_AUDIO_SOUNDCARD) {
 			fprintf(stderr, "libcw: a device has been specified for 'soundcard' sound system\n");
-			fprintf(stderr, "libcw: a device can be specified only for 'console', 'oss', 'alsa' or 'pulseaudio'\n");
+			fprintf(stderr, "libcw: a device can be specified only for 'console', 'oss', 'alsa', 'pulseaudio' or 'jack'\n");
 			return false;
 		} else if (config->audio_system == CW_AUDIO_NULL) {
 			fprintf(stderr, "libcw: a device has been specified for 'null' sound system\n");
-			fprintf(stderr, "libcw: a device can be specified only for 'console', 'oss', 'alsa' or 'pulseaudio'\n");
+			fprintf(stderr, "libcw: a device can be specified only for 'console', 'oss', 'alsa', 'pulseaudio' or 'jack'\n");
 			return false;
 		} else {
 			; /* audio_system is one that accepts custom "audio device" */
@@ -221,6 +239,30 @@ int cw_generator_new_from_config(cw_config_t *config)
 	}
 
 
+	if (config->audio_system == CW_AUDIO_JACK) {
+		/* JACK is not a part of "soundcard" sound systems,
+		   and is not tried by default. It's used only when
+		   explicitly requested. */
+		if (cw_is_jack_possible(config->audio_device)) {
+			if (cw_generator_new(CW_AUDIO_JACK, config->audio_device)) {
+				if (cw_generator_apply_config(config)) {
+					return CW_SUCCESS;
+				} else {
+					fprintf(stderr, "%s: failed to apply configuration\n", config->program_name);
+					return CW_FAILURE;
+				}
+			} else {
+				fprintf(stderr, "%s: failed to open JACK output\n", config->program_name);
+			}
+		} else {
+			fprintf(stderr, "%s: JACK output not available (device: %s)\n",
+				config->program_name,
+				config->audio_device ? config->audio_device : CW_DEFAULT_JACK_DEVICE);
+		}
+		/* fall through to try with next audio system type */
+	}
+
+
 	if (config->audio_system == CW_AUDIO_NONE
 	    || config->audio_system == CW_AUDIO_PA
 	    || config->audio_system == CW_AUDIO_SOUNDCARD) {
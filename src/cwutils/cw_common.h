@@ -53,6 +53,12 @@ typedef struct {
 	int has_practice_time;
 	int has_outfile;
 	bool has_infile;
+	bool has_character_weights;
+
+	/* Weights of characters in random words,
+	   "CHARS:WEIGHT[,CHARS:WEIGHT...]" (used only in cwcp and
+	   xcwcp). */
+	char *character_weights;
 
 	/*
 	 * Program-specific state variables, settable from the command line, or from
@@ -67,6 +73,17 @@ typedef struct {
 	int do_commands;       /* Execute embedded commands */
 	int do_combinations;   /* Execute [...] combinations */
 	int do_comments;       /* Allow {...} as comments */
+
+	/* Parse input stream ahead of sending (used only in cw). */
+	bool pipeline;
+
+	/* Rendering input files to WAV files in batch mode (used
+	   only in cw). Input files are given as arguments after
+	   options. */
+	char *batch_dir;           /* Directory for WAV files. */
+	int jobs;                  /* Number of files rendered in parallel. */
+	char *const *batch_files;  /* Input files, owned by caller of cw_process_argv(). */
+	int n_batch_files;
 } cw_config_t;
 
 
@@ -0,0 +1,223 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+
+
+
+/*
+  Benchmark of reading dictionaries from file.
+
+  The program writes a synthetic dictionary file with a number of
+  callsign-like words (e.g. "DL4ABC"), split into sections of equal
+  size, ten words per line. Then it measures the time of reading the
+  file with cw_dictionaries_read(), and the time of drawing random
+  words from the largest dictionary, without and with weights of
+  characters (the first weighted draw includes building of alias
+  table).
+
+  Use "-f <file>" to measure reading of an existing file instead.
+*/
+
+
+
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+
+#include "dictionary.h"
+
+
+
+
+#define DEFAULT_N_WORDS     2000000
+#define DEFAULT_N_SECTIONS  4
+#define DEFAULT_N_DRAWS     10000000
+#define WORDS_PER_LINE      10
+
+
+
+
+static bool   write_synthetic_file(const char * path, long n_words, int n_sections);
+static double draw_words(const cw_dictionary_t * dict, long n_draws);
+static double now_seconds(void);
+static void   usage(const char * name);
+
+
+
+
+int main(int argc, char * const argv[])
+{
+	long n_words = DEFAULT_N_WORDS;
+	int n_sections = DEFAULT_N_SECTIONS;
+	long n_draws = DEFAULT_N_DRAWS;
+	const char * file = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:d:f:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			n_words = atol(optarg);
+			break;
+		case 's':
+			n_sections = atoi(optarg);
+			break;
+		case 'd':
+			n_draws = atol(optarg);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (n_words < 1 || n_sections < 1 || n_sections > n_words || n_draws < 0) {
+		fprintf(stderr, "Invalid number of words, sections or draws\n");
+		return EXIT_FAILURE;
+	}
+
+	char path[] = "/tmp/cw_dictionary_bench_XXXXXX";
+	if (!file) {
+		const int fd = mkstemp(path);
+		if (fd == -1) {
+			fprintf(stderr, "Failed to create temporary file\n");
+			return EXIT_FAILURE;
+		}
+		close(fd);
+		if (!write_synthetic_file(path, n_words, n_sections)) {
+			fprintf(stderr, "Failed to write temporary file\n");
+			unlink(path);
+			return EXIT_FAILURE;
+		}
+		file = path;
+	}
+
+	const double start = now_seconds();
+	const bool success = cw_dictionaries_read(file);
+	const double read_time = now_seconds() - start;
+	if (file == path) {
+		unlink(path);
+	}
+	if (!success) {
+		fprintf(stderr, "Failed to read dictionaries\n");
+		return EXIT_FAILURE;
+	}
+
+	int n_dictionaries = 0;
+	const cw_dictionary_t * largest = NULL;
+	for (const cw_dictionary_t * dict = cw_dictionaries_iterate(NULL); dict; dict = cw_dictionaries_iterate(dict)) {
+		n_dictionaries++;
+		largest = dict;
+	}
+
+	fprintf(stdout, "dictionaries:                 %d\n", n_dictionaries);
+	fprintf(stdout, "reading time:                 %.3f s\n", read_time);
+
+	if (n_draws > 0) {
+		double elapsed = draw_words(largest, n_draws);
+		fprintf(stdout, "uniform draws:                %.1f ns/draw\n", elapsed * 1e9 / n_draws);
+
+		cw_dictionaries_set_character_weight('Q', 5.0);
+		elapsed = draw_words(largest, 1);
+		fprintf(stdout, "building of alias table:      %.3f s\n", elapsed);
+		elapsed = draw_words(largest, n_draws);
+		fprintf(stdout, "weighted draws:               %.1f ns/draw\n", elapsed * 1e9 / n_draws);
+	}
+
+	cw_dictionaries_unload();
+
+	return EXIT_SUCCESS;
+}
+
+
+
+
+/**
+   Write dictionary file with n_words random callsign-like words in
+   n_sections sections.
+*/
+static bool write_synthetic_file(const char * path, long n_words, int n_sections)
+{
+	FILE * stream = fopen(path, "w");
+	if (!stream) {
+		return false;
+	}
+
+	srand(1);
+	const long words_per_section = n_words / n_sections;
+	long word = 0;
+	for (int s = 0; s < n_sections; s++) {
+		fprintf(stream, "; Synthetic section %d\n[ Callsigns %d ]\n", s + 1, s + 1);
+
+		const long end = s == n_sections - 1 ? n_words : word + words_per_section;
+		for (long column = 0; word < end; word++, column++) {
+			fprintf(stream, "%c%c%d%c%c%c%c",
+				'A' + rand() % 26, 'A' + rand() % 26, rand() % 10,
+				'A' + rand() % 26, 'A' + rand() % 26, 'A' + rand() % 26,
+				(column + 1) % WORDS_PER_LINE && word + 1 < end ? ' ' : '\n');
+		}
+		fprintf(stream, "\n");
+	}
+
+	return fclose(stream) == 0;
+}
+
+
+
+
+/**
+   Draw n_draws random words from given dictionary, return time it took.
+*/
+static double draw_words(const cw_dictionary_t * dict, long n_draws)
+{
+	unsigned long sum = 0;
+	const double start = now_seconds();
+	for (long i = 0; i < n_draws; i++) {
+		sum += (unsigned char) cw_dictionary_get_random_word(dict)[0];
+	}
+	const double elapsed = now_seconds() - start;
+
+	/* Use the words, so that the loop isn't optimized out. */
+	if (sum == 1) {
+		fprintf(stdout, "\n");
+	}
+
+	return elapsed;
+}
+
+
+
+
+static double now_seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+
+
+static void usage(const char * name)
+{
+	fprintf(stdout, "Usage: %s [-n <count>] [-s <count>] [-d <count>] [-f <file>]\n", name);
+	fprintf(stdout, "    -n: number of words in synthetic file (default %d)\n", DEFAULT_N_WORDS);
+	fprintf(stdout, "    -s: number of sections in synthetic file (default %d)\n", DEFAULT_N_SECTIONS);
+	fprintf(stdout, "    -d: number of random words to draw (default %d)\n", DEFAULT_N_DRAWS);
+	fprintf(stdout, "    -f: read given file instead of synthetic one\n");
+
+	return;
+}
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+   \file cw_random.c
+
+   \brief Pseudo-random numbers for generating practice texts
+
+   random() and rand() have one, hidden state per process, their
+   sequences differ between C libraries, and their quality on some
+   platforms is poor. Programs generating practice texts use
+   xoshiro256** (by David Blackman and Sebastiano Vigna) instead: it
+   is fast, its state is a plain variable owned by caller, and given
+   seed produces the same sequence everywhere.
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <unistd.h>     /* getpid() */
+#include <sys/time.h>   /* gettimeofday() */
+
+#include "cw_random.h"
+
+
+
+
+static uint64_t cw_random_rotl(uint64_t x, int k);
+static uint64_t cw_random_splitmix64(uint64_t *x);
+
+
+
+
+/**
+   \brief Initialize state of generator with given seed
+
+   The seed is expanded into full state with splitmix64, so
+   consecutive seeds (e.g. 1, 2, 3) give unrelated sequences.
+
+   \param rng - state of generator
+   \param seed - seed
+*/
+void cw_random_seed(cw_random_t *rng, uint64_t seed)
+{
+	for (int i = 0; i < 4; i++) {
+		rng->s[i] = cw_random_splitmix64(&seed);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get a seed that is different in each run of a program
+
+   Use it when user hasn't asked for a specific seed. Time is
+   combined with process ID, so programs started within the same
+   microsecond still get different seeds.
+
+   \return seed
+*/
+uint64_t cw_random_seed_from_time(void)
+{
+	struct timeval t;
+	gettimeofday(&t, NULL);
+
+	uint64_t x = ((uint64_t) t.tv_sec << 20) ^ (uint64_t) t.tv_usec ^ ((uint64_t) getpid() << 40);
+	return cw_random_splitmix64(&x);
+}
+
+
+
+
+/**
+   \brief Get next pseudo-random 64-bit number
+
+   \param rng - state of generator
+
+   \return pseudo-random number
+*/
+uint64_t cw_random_next(cw_random_t *rng)
+{
+	uint64_t *s = rng->s;
+	const uint64_t result = cw_random_rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+
+	s[2] ^= t;
+	s[3] = cw_random_rotl(s[3], 45);
+
+	return result;
+}
+
+
+
+
+/**
+   \brief Get pseudo-random number in range 0 to \p n - 1
+
+   Unlike "random() % n", the function has no bias towards lower
+   numbers, and in most calls it needs no division (Lemire's
+   method).
+
+   \param rng - state of generator
+   \param n - size of range, must be greater than zero
+
+   \return pseudo-random number in range 0 to \p n - 1
+*/
+uint32_t cw_random_uniform(cw_random_t *rng, uint32_t n)
+{
+	uint64_t m = (cw_random_next(rng) >> 32) * (uint64_t) n;
+	uint32_t low = (uint32_t) m;
+	if (low < n) {
+		/* Reject the values that would make some results
+		   more likely than others. */
+		const uint32_t threshold = -n % n;
+		while (low < threshold) {
+			m = (cw_random_next(rng) >> 32) * (uint64_t) n;
+			low = (uint32_t) m;
+		}
+	}
+
+	return (uint32_t) (m >> 32);
+}
+
+
+
+
+/**
+   \brief Advance state of generator by 2^128 numbers
+
+   Use the function to make independent streams of numbers from
+   one seed: after N calls, the state is a start of a sequence that
+   doesn't overlap with sequences of the previous N states, unless
+   2^128 numbers are drawn from one of them.
+
+   \param rng - state of generator
+*/
+void cw_random_jump(cw_random_t *rng)
+{
+	static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+
+	uint64_t s[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 4; i++) {
+		for (int b = 0; b < 64; b++) {
+			if (JUMP[i] & ((uint64_t) 1 << b)) {
+				s[0] ^= rng->s[0];
+				s[1] ^= rng->s[1];
+				s[2] ^= rng->s[2];
+				s[3] ^= rng->s[3];
+			}
+			cw_random_next(rng);
+		}
+	}
+
+	for (int i = 0; i < 4; i++) {
+		rng->s[i] = s[i];
+	}
+
+	return;
+}
+
+
+
+
+uint64_t cw_random_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+
+
+/* Next value of splitmix64 sequence, used to expand seeds. */
+uint64_t cw_random_splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+
+
+
+
+#ifdef CW_RANDOM_UNIT_TESTS
+
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "libcw_debug.h"
+
+
+static unsigned int test_cw_random_next(void);
+static unsigned int test_cw_random_seed(void);
+static unsigned int test_cw_random_uniform(void);
+static unsigned int test_cw_random_jump(void);
+
+
+typedef unsigned int (*cw_random_test_function_t)(void);
+
+static cw_random_test_function_t cw_random_unit_tests[] = {
+	test_cw_random_next,
+	test_cw_random_seed,
+	test_cw_random_uniform,
+	test_cw_random_jump,
+	NULL
+};
+
+
+
+int main(void)
+{
+	fprintf(stderr, "unit tests for \"random\" functions\n\n");
+
+	int i = 0;
+	while (cw_random_unit_tests[i]) {
+		cw_random_unit_tests[i]();
+		i++;
+	}
+
+	/* "make check" facility requires this message to be
+	   printed on stdout; don't localize it */
+	fprintf(stdout, "\nrandom: test result: success\n\n");
+
+	return 0;
+}
+
+
+
+
+/* Output of xoshiro256** from state { 1, 2, 3, 4 }, as given by
+   reference implementation of the algorithm. */
+unsigned int test_cw_random_next(void)
+{
+	int p = fprintf(stderr, "random: cw_random_next():");
+
+	static const uint64_t expected[] = {
+		11520ULL, 0ULL, 1509978240ULL, 1215971899390074240ULL,
+		1216172134540287360ULL, 607988272756665600ULL, 16172922978634559625ULL,
+		8476171486693032832ULL, 10595114339597558777ULL, 2904607092377533576ULL
+	};
+
+	cw_random_t rng = { .s = { 1, 2, 3, 4 } };
+	for (size_t i = 0; i < sizeof (expected) / sizeof (expected[0]); i++) {
+		const uint64_t value = cw_random_next(&rng);
+		cw_assert (value == expected[i], "number #%zu: %llu != %llu",
+			   i, (unsigned long long) value, (unsigned long long) expected[i]);
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* State made from a seed is the first four numbers of splitmix64
+   sequence for the seed, as given by reference implementation of
+   splitmix64. */
+unsigned int test_cw_random_seed(void)
+{
+	int p = fprintf(stderr, "random: cw_random_seed():");
+
+	static const uint64_t expected[] = {
+		6457827717110365317ULL, 3203168211198807973ULL, 9817491932198370423ULL, 4593380528125082431ULL
+	};
+
+	cw_random_t rng;
+	cw_random_seed(&rng, 1234567);
+	for (int i = 0; i < 4; i++) {
+		cw_assert (rng.s[i] == expected[i], "state word #%d: %llu != %llu",
+			   i, (unsigned long long) rng.s[i], (unsigned long long) expected[i]);
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Numbers in a range for a fixed seed. Text generated by cwgen for
+   given seed depends on them, so they must not change. */
+unsigned int test_cw_random_uniform(void)
+{
+	int p = fprintf(stderr, "random: cw_random_uniform():");
+
+	static const uint32_t expected_small[] = { 2, 9, 17, 24, 25, 20, 18, 22, 19, 15, 17, 7 };
+	static const uint32_t expected_large[] = { 1136940751, 2040130232, 2774078835, 2157775733 };
+
+	cw_random_t rng;
+	cw_random_seed(&rng, 42);
+	for (size_t i = 0; i < sizeof (expected_small) / sizeof (expected_small[0]); i++) {
+		const uint32_t value = cw_random_uniform(&rng, 26);
+		cw_assert (value == expected_small[i], "number #%zu in range 26: %u != %u", i, value, expected_small[i]);
+	}
+
+	/* Range in which most of numbers are rejected. */
+	cw_random_seed(&rng, 42);
+	for (size_t i = 0; i < sizeof (expected_large) / sizeof (expected_large[0]); i++) {
+		const uint32_t value = cw_random_uniform(&rng, 3000000000U);
+		cw_assert (value == expected_large[i], "number #%zu in large range: %u != %u", i, value, expected_large[i]);
+	}
+
+	/* Range with one number. */
+	for (int i = 0; i < 10; i++) {
+		cw_assert (0 == cw_random_uniform(&rng, 1), "number in range 1 is not zero");
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* State after a jump from state { 1, 2, 3, 4 }. cwgen makes streams
+   of its blocks with jumps, so the state must not change. */
+unsigned int test_cw_random_jump(void)
+{
+	int p = fprintf(stderr, "random: cw_random_jump():");
+
+	static const uint64_t expected_state[] = {
+		0x8c7a153956b5f3d1ULL, 0x701f1a713401d85eULL, 0x6527f66a65469085ULL, 0x8386b786c4408050ULL
+	};
+	static const uint64_t expected_next[] = {
+		13534147089533256664ULL, 7126240192422241655ULL, 3805973808039778091ULL
+	};
+
+	cw_random_t rng = { .s = { 1, 2, 3, 4 } };
+	cw_random_jump(&rng);
+	for (int i = 0; i < 4; i++) {
+		cw_assert (rng.s[i] == expected_state[i], "state word #%d: %llx != %llx",
+			   i, (unsigned long long) rng.s[i], (unsigned long long) expected_state[i]);
+	}
+	for (int i = 0; i < 3; i++) {
+		const uint64_t value = cw_random_next(&rng);
+		cw_assert (value == expected_next[i], "number #%d: %llu != %llu",
+			   i, (unsigned long long) value, (unsigned long long) expected_next[i]);
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+#endif /* #ifdef CW_RANDOM_UNIT_TESTS */
+
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef H_CW_RANDOM
+#define H_CW_RANDOM
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+/* State of pseudo-random number generator (xoshiro256**).
+
+   Sequence of numbers depends only on the seed, so it is the same
+   on every platform. Each thread should use its own state; states
+   for independent streams are made with cw_random_jump(). */
+typedef struct {
+	uint64_t s[4];
+} cw_random_t;
+
+extern void     cw_random_seed(cw_random_t *rng, uint64_t seed);
+extern uint64_t cw_random_seed_from_time(void);
+extern uint64_t cw_random_next(cw_random_t *rng);
+extern uint32_t cw_random_uniform(cw_random_t *rng, uint32_t n);
+extern void     cw_random_jump(cw_random_t *rng);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif  /* H_CW_RANDOM */
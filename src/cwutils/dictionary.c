@@ -22,8 +22,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
-#include <time.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #if defined(HAVE_STRING_H)
 # include <string.h>
@@ -38,6 +44,8 @@
 #include "dictionary.h"
 #include "cw_words.h"
 #include "cw_common.h"
+#include "cw_random.h"
+#include "cw_alias.h"
 #include "memory.h"
 #include "i18n.h"
 
@@ -61,6 +69,21 @@
    Dictionaries can be stored in a text file between two sessions of
    a program.
 
+   A file is read with one pass over its memory-mapped contents.
+   Words and descriptions of all dictionaries from the file are
+   copied into one arena (a single allocation), and each dictionary
+   has an array of offsets of its words in the arena, so reading
+   time is proportional to size of the file, and there are no
+   allocations per word or per line.
+
+   Dictionaries can also be stored in a binary file (written by
+   cw_dictionaries_write() to a file with ".cwd" suffix). A binary
+   file contains the arena, offsets of words and table of
+   dictionaries, with words already checked for unsendable
+   characters. It is used directly from mapped memory, without
+   parsing. cw_dictionaries_read() recognizes binary files by their
+   magic number, and reads any other file as text.
+
    Dictionaries stored in a memory are put on a linked list. There can
    be only one such list at a time.
 
@@ -96,19 +119,35 @@
    \li getting description of a specified dictionary,
    \li getting 'group size' information about given dictionary,
    \li getting a random word from given dictionary.
+
+   Random words can be weighted: each character has a weight (1.0
+   by default, e.g. higher for characters that a trainee often
+   gets wrong), and weight of a word is the mean weight of its
+   characters. A dictionary builds an alias table of weights of its
+   words on first draw after the weights have changed, so each draw
+   takes constant time, regardless of size of the dictionary.
 */
 
 
 
 
 static void cw_dictionary_trim(char *buffer);
-static bool cw_dictionary_parse_is_comment(const char *line);
-static bool cw_dictionary_parse_is_section(const char *line, char **name_ptr);
-
-static cw_dictionary_t *cw_dictionaries_create_from_stream(FILE *stream, const char *file);
+static bool cw_dictionary_parse_is_comment(const char *line, size_t len);
+static bool cw_dictionary_parse_is_section(const char *line, size_t len, const char **name, size_t *name_len);
+
+static cw_dictionary_t *cw_dictionaries_create_from_buffer(const char *data, size_t size, const char *file);
+static cw_dictionary_t *cw_dictionaries_create_from_binary(const char *data, size_t size, const char *file);
+static bool cw_dictionary_is_binary(const char *data, size_t size);
+static bool cw_dictionaries_write_binary(const char *file);
+static FILE *cw_dictionary_open_temporary(const char *file, char **temporary);
+static bool cw_dictionary_close_temporary(FILE *stream, char *temporary, const char *file);
+static char *cw_dictionary_read_fd(int fd, size_t *size);
 static cw_dictionary_t *cw_dictionaries_create_default(void);
 
 static char *cw_dictionary_check_line(const char *line);
+static void cw_dictionary_report_unsendable(const char *line, size_t len, const char *file, int line_number);
+static const char *cw_dictionary_get_word(const cw_dictionary_t *dict, int index);
+static void cw_dictionary_build_alias_table(cw_dictionary_t *dict);
 
 
 
@@ -116,25 +155,63 @@ static char *cw_dictionary_check_line(const char *line);
 /*  Dictionary data                                                    */
 /*---------------------------------------------------------------------*/
 
-enum { MAX_LINE = 8192 };
-
 /* Aggregate dictionary data into a structure. */
 struct cw_dictionary_s {
 	const char *description;      /* Dictionary description */
-	const char *const *wordlist;  /* Dictionary word list */
+	const char *const *wordlist;  /* Dictionary word list; NULL for dictionary read from file */
+	const char *arena;            /* Words of dictionary read from file, each terminated with NUL */
+	const uint32_t *word_offsets; /* Offsets of words in arena */
 	int wordlist_length;          /* Length of word list */
 	int group_size;               /* Size of a group */
 
 	void *mutable_description;    /* Freeable (aliased) description string */
 	void *mutable_wordlist;       /* Freeable (aliased) word list */
 	void *mutable_wordlist_data;  /* Freeable bulk word list data */
+	void *mapping;                /* Unmappable contents of binary file */
+	size_t mapping_size;          /* Size of mapping */
+
+	cw_alias_table_t *alias;      /* Weighted selection of words, built on demand */
+	unsigned int alias_weights_generation;  /* Value of weights_generation for which alias has been built */
 
 	dictionary *next;             /* List pointer */
 };
 
+/* Binary dictionary file: header, table of dictionaries, offsets of
+   words, then arena with descriptions and words, all in native byte
+   order. */
+static const char CW_DICTIONARY_MAGIC[8] = { 'C', 'W', 'D', 'I', 'C', 'T', '0', '1' };
+#define CW_DICTIONARY_BYTE_ORDER     0x01020304
+#define CW_DICTIONARY_BINARY_SUFFIX  ".cwd"
+
+typedef struct {
+	char magic[8];
+	uint32_t byte_order;      /* CW_DICTIONARY_BYTE_ORDER; other value - file written on machine with other byte order. */
+	uint32_t n_dictionaries;
+	uint32_t n_words;
+	uint32_t arena_size;
+} cw_dictionary_binary_header_t;
+
+typedef struct {
+	uint32_t description;     /* Offset of description in arena. */
+	uint32_t first_word;      /* Index of first word in offsets. */
+	uint32_t n_words;
+	uint32_t group_size;
+} cw_dictionary_binary_entry_t;
+
 /* Head of a list storing currently loaded dictionaries. */
 static cw_dictionary_t *dictionaries_head = NULL;
 
+/* Weights of characters, indexed with upper-case characters. They
+   are used only if has_character_weights is true; otherwise words
+   are drawn uniformly. weights_generation changes on every change
+   of weights, making alias tables of all dictionaries out of date. */
+static double character_weights[UCHAR_MAX + 1];
+static bool has_character_weights = false;
+static unsigned int weights_generation = 0;
+
+/* Generator of random numbers used to draw words. */
+static cw_random_t dictionary_random;
+
 
 /*---------------------------------------------------------------------*/
 /*  Dictionary implementation                                          */
@@ -143,7 +220,6 @@ static cw_dictionary_t *dictionaries_head = NULL;
 /*
  * dictionary_new()
  * dictionary_new_const()
- * dictionary_new_mutable()
  *
  * Create a new dictionary, and add to any list tail passed in, returning
  * the entry created (the new list tail).  The main function adds the data,
@@ -172,14 +248,20 @@ static dictionary *dictionary_new(dictionary *tail,
 	dictionary *dict = safe_malloc(sizeof (*dict));
 	dict->description = description;
 	dict->wordlist = wordlist;
+	dict->arena = NULL;
+	dict->word_offsets = NULL;
 	dict->wordlist_length = words;
 	dict->group_size = is_multicharacter ? 1 : 5;
+	dict->alias = NULL;
+	dict->alias_weights_generation = 0;
 	dict->next = NULL;
 
 	/* Add mutable pointers passed in. */
 	dict->mutable_description = mutable_description;
 	dict->mutable_wordlist = mutable_wordlist;
 	dict->mutable_wordlist_data = mutable_wordlist_data;
+	dict->mapping = NULL;
+	dict->mapping_size = 0;
 
 	/* Add to the list tail passed in, if any. */
 	if (tail) {
@@ -204,13 +286,46 @@ static dictionary *dictionary_new_const(dictionary *tail,
 
 
 
-static dictionary *dictionary_new_mutable(dictionary *tail,
-					  char *description,
-					  const char *wordlist[],
-					  void *wordlist_data)
+/*
+ * dictionary_new_arena()
+ *
+ * Create a new dictionary from words in an arena, and add to any list
+ * tail passed in, returning the entry created.  All dictionaries read
+ * from one file share the arena and the array of offsets; only the
+ * first of them gets them as mutable pointers, to be freed on
+ * destroying it.
+ */
+static dictionary *dictionary_new_arena(dictionary *tail,
+					const char *description,
+					const char *arena,
+					const uint32_t *word_offsets,
+					int words,
+					bool is_multicharacter,
+					void *mutable_word_offsets,
+					void *mutable_arena)
 {
-	return dictionary_new(tail, description, wordlist,
-			      description, wordlist, wordlist_data);
+	dictionary *dict = safe_malloc(sizeof (*dict));
+	dict->description = description;
+	dict->wordlist = NULL;
+	dict->arena = arena;
+	dict->word_offsets = word_offsets;
+	dict->wordlist_length = words;
+	dict->group_size = is_multicharacter ? 1 : 5;
+	dict->alias = NULL;
+	dict->alias_weights_generation = 0;
+	dict->next = NULL;
+
+	dict->mutable_description = NULL;
+	dict->mutable_wordlist = mutable_word_offsets;
+	dict->mutable_wordlist_data = mutable_arena;
+	dict->mapping = NULL;
+	dict->mapping_size = 0;
+
+	if (tail) {
+		tail->next = dict;
+	}
+
+	return dict;
 }
 
 
@@ -236,6 +351,10 @@ void cw_dictionaries_unload(void)
 		free(entry->mutable_wordlist);
 		free(entry->mutable_description);
 		free(entry->mutable_wordlist_data);
+		if (entry->mapping) {
+			munmap(entry->mapping, entry->mapping_size);
+		}
+		cw_alias_table_delete(&entry->alias);
 
 		/* Free the dictionary itself. */
 		free(entry);
@@ -274,15 +393,23 @@ void dictionary_unload(void)
    A comment is a line starting with ';' or '#' char, or a line consisting
    entirely of spaces and TAB characters
 
-   \param line - line to parse
+   \param line - line to parse (not terminated with NUL)
+   \param len - length of the line
 
    \return true if line is a line with comment
    \return false otherwise
 */
-bool cw_dictionary_parse_is_comment(const char *line)
+bool cw_dictionary_parse_is_comment(const char *line, size_t len)
 {
-	size_t index = strspn(line, " \t");
-	return index == strlen(line) || strchr(";#", line[0]);
+	if (len == 0 || line[0] == ';' || line[0] == '#') {
+		return true;
+	}
+
+	size_t index = 0;
+	while (index < len && (line[index] == ' ' || line[index] == '\t')) {
+		index++;
+	}
+	return index == len;
 }
 
 
@@ -294,72 +421,52 @@ bool cw_dictionary_parse_is_comment(const char *line)
 
    Function parses given \p line and checks if it looks like a name of
    a section (a string in square brackets). If it is a section name,
-   then the function stores the name in \p name_ptr and returns true.
-   Otherwise it returns false.
-
-   On success the function allocates memory and sets *name_ptr pointer
-   to this memory.
+   then the function points \p name to the name in the line, stores
+   its length (including any trailing spaces) in \p name_len and
+   returns true. Otherwise it returns false.
 
-   \param line - line to parse
-   \param name_ptr - output, place for name of a section
+   \param line - line to parse (not terminated with NUL)
+   \param len - length of the line
+   \param name - output, start of name of a section
+   \param name_len - output, length of name of a section
 
    \return true if line contains section name
    \return false otherwise
 */
-bool cw_dictionary_parse_is_section(const char *line, char **name_ptr)
+bool cw_dictionary_parse_is_section(const char *line, size_t len, const char **name, size_t *name_len)
 {
-	char *name = safe_malloc(strlen(line) + 1);
-
-	char dummy;
-	int count = sscanf(line, " [ %[^]] ] %c", name, &dummy);
-	if (count == 1) {
-		*name_ptr = safe_realloc(name, strlen(name) + 1);
-		return true;
+	size_t i = 0;
+	while (i < len && isspace((unsigned char) line[i])) {
+		i++;
+	}
+	if (i == len || line[i] != '[') {
+		return false;
+	}
+	i++;
+	while (i < len && isspace((unsigned char) line[i])) {
+		i++;
 	}
 
-	free(name);
-	return false;
-}
-
-
-
-
-
-/*
- * dictionary_build_wordlist()
- *
- * Build and return a wordlist from a string of space-separated words.  The
- * wordlist_data is changed by this function.
- */
-static const char **
-dictionary_build_wordlist (char *wordlist_data)
-{
-  const char **wordlist, *word;
-  int size, allocation;
-
-  /* Split contents into a wordlist, and store each word retrieved. */
-  size = allocation = 0;
-  wordlist = NULL;
-  for (word = strtok (wordlist_data, " \t"); word; word = strtok (NULL, " \t"))
-    {
-      if (size == allocation)
-        {
-          allocation = allocation == 0 ? 1 : allocation << 1;
-          wordlist = safe_realloc (wordlist, sizeof (*wordlist) * allocation);
-        }
-
-      wordlist[size++] = word;
-    }
+	const size_t start = i;
+	while (i < len && line[i] != ']') {
+		i++;
+	}
+	if (i == start) {
+		return false;
+	}
+	*name = line + start;
+	*name_len = i - start;
 
-  /* Add a null sentinel. */
-  if (size == allocation)
-    {
-      allocation++;
-      wordlist = safe_realloc (wordlist, sizeof (*wordlist) * allocation);
-    }
-  wordlist[size++] = NULL;
+	/* Closing bracket may be omitted, but nothing but spaces
+	   may follow it. */
+	if (i < len) {
+		i++;
+		while (i < len && isspace((unsigned char) line[i])) {
+			i++;
+		}
+	}
 
-  return wordlist;
+	return i == len;
 }
 
 
@@ -441,102 +548,197 @@ char *cw_dictionary_check_line(const char *line)
 
 
 /**
-   \brief Create a dictionary list from a stream
+   \brief Report unsendable characters in a line
+
+   Helper function for cw_dictionaries_create_from_buffer().
+
+   \param line - line with unsendable characters (not terminated with NUL)
+   \param len - length of the line
+   \param file - human-readable name of the file with the line
+   \param line_number - number of the line in the file
+*/
+void cw_dictionary_report_unsendable(const char *line, size_t len, const char *file, int line_number)
+{
+	char *copy = safe_malloc(len + 1);
+	memcpy(copy, line, len);
+	copy[len] = '\0';
+
+	char *errors = cw_dictionary_check_line(copy);
+	if (errors) {
+		fprintf(stderr, "%s:%d: unsendable character found:\n",
+			file, line_number);
+		fprintf(stderr, "%s\n%s\n", copy, errors);
+		free(errors);
+	}
+
+	free(copy);
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Create a dictionary list from contents of a file
 
-   Load dictionaries from a \p stream into memory. The \p stream needs to
-   be already open for reading. \p file is a name of the stream, used in
-   error messages. \p stream should be open and closed by caller of the
-   function.
+   Load dictionaries from \p data (contents of a file, usually mapped
+   into memory) into memory. \p file is a name of the file, used in
+   error messages. \p data doesn't have to be terminated with NUL,
+   and isn't modified.
 
    The file format is expected to be ini-style.
 
+   Dictionaries are built with one pass over \p data: words and
+   descriptions are copied into one arena, and offsets of words in
+   the arena are stored in one array. Every word and description
+   takes in the arena at most as many bytes as it took in \p data
+   with its separator, so the arena is allocated once, with the
+   size of \p data.
+
    This is a lower level function, to be used by cw_dictionaries_read().
 
-   \param stream - stream to read data from
-   \param file - human-readable name of the stream
+   \param data - contents of file
+   \param size - size of \p data
+   \param file - human-readable name of the file
 
    \return head of list of loaded dictionaries on success
    \return NULL if loading fails.
 */
-cw_dictionary_t *cw_dictionaries_create_from_stream(FILE *stream, const char *file)
+cw_dictionary_t *cw_dictionaries_create_from_buffer(const char *data, size_t size, const char *file)
 {
-	const char **wordlist;
+	/* Offsets of words are 32-bit. */
+	if (size >= UINT32_MAX) {
+		fprintf(stderr, "%s: file is too large\n", file);
+		return NULL;
+	}
 
-	/* Clear the variables used to accumulate stream data. */
-	char *line = safe_malloc(MAX_LINE);
-	int line_number = 0;
-	char *name = NULL;
-	char *content = NULL;
-	dictionary *head = NULL;
-	dictionary *tail = NULL;
+	/* Each word except the last one is followed by at least one
+	   separator, so there are at most (size + 1) / 2 words. */
+	char *arena = safe_malloc(size + 1);
+	uint32_t arena_len = 0;
+	uint32_t *offsets = safe_malloc(((size + 1) / 2 + 1) * sizeof (uint32_t));
+	uint32_t n_words = 0;
+
+	/* Sections are collected first, and dictionaries are created
+	   from them when the arena and the offsets have their final
+	   addresses. */
+	struct section {
+		uint32_t name;        /* Offset of name in arena. */
+		uint32_t first_word;  /* Index of first word in offsets. */
+		uint32_t n_words;
+		bool is_multicharacter;
+	} *sections = NULL;
+	int n_sections = 0;
+	int sections_allocation = 0;
+	bool in_section = false;
 
-	/* Parse input lines to create a new dictionary. */
-	while (cw_getline(stream, line, MAX_LINE + 1)) {
+	int line_number = 0;
+	const char *end = data + size;
+	for (const char *line = data; line < end; ) {
+		const char *eol = memchr(line, '\n', end - line);
+		const char *next = eol ? eol + 1 : end;
+		size_t len = (eol ? eol : end) - line;
+		while (len > 0 && line[len - 1] == '\r') {
+			len--;
+		}
 		line_number++;
 
-		char *new_name;
-
-		if (cw_dictionary_parse_is_comment(line)) {
-			continue;
-		} else if (cw_dictionary_parse_is_section(line, &new_name)) {
-			/* New section, so handle data accumulated so far.
-			   Or if no data accumulated, forget it. */
-			if (content) {
-				wordlist = dictionary_build_wordlist(content);
-				tail = dictionary_new_mutable(tail, name, wordlist, content);
-				head = head ? head : tail;
-			} else {
-				free(name);
-				name = NULL;
+		const char *name;
+		size_t name_len;
+		if (cw_dictionary_parse_is_comment(line, len)) {
+			;
+		} else if (cw_dictionary_parse_is_section(line, len, &name, &name_len)) {
+			/* New section, so forget previous one if it has
+			   no words. */
+			if (in_section && sections[n_sections - 1].n_words == 0) {
+				n_sections--;
+			}
+			if (n_sections == sections_allocation) {
+				sections_allocation = sections_allocation == 0 ? 16 : sections_allocation << 1;
+				sections = safe_realloc(sections, sizeof (*sections) * sections_allocation);
 			}
 
-			/* Start new accumulation of words. */
-			cw_dictionary_trim(new_name);
-			name = new_name;
-			content = NULL;
-		} else if (name) {
+			struct section *section = &sections[n_sections++];
+			section->name = arena_len;
+			section->first_word = n_words;
+			section->n_words = 0;
+			section->is_multicharacter = false;
+			in_section = true;
+
+			memcpy(arena + arena_len, name, name_len);
+			arena[arena_len + name_len] = '\0';
+			cw_dictionary_trim(arena + arena_len);
+			arena_len += strlen(arena + arena_len) + 1;
+		} else if (in_section) {
 			/* Check the line for unsendable characters. */
-			char *errors = cw_dictionary_check_line(line);
-			if (errors) {
-				fprintf(stderr, "%s:%d: unsendable character found:\n",
-					file, line_number);
-				fprintf(stderr, "%s\n%s\n", line, errors);
-				free(errors);
+			for (size_t i = 0; i < len; i++) {
+				if (!cw_character_is_valid(line[i])) {
+					cw_dictionary_report_unsendable(line, len, file, line_number);
+					break;
+				}
 			}
 
-			/* Accumulate this line into the current content. */
-			cw_dictionary_trim(line);
-			if (content) {
-				content = safe_realloc(content,
-						       strlen(content) + strlen(line) + 2);
-				strcat(content, " ");
-				strcat(content, line);
-			} else {
-				content = safe_malloc(strlen(line) + 1);
-				strcpy(content, line);
+			/* Copy words of the line into the arena. */
+			struct section *section = &sections[n_sections - 1];
+			size_t i = 0;
+			while (i < len) {
+				while (i < len && isspace((unsigned char) line[i])) {
+					i++;
+				}
+				const size_t start = i;
+				while (i < len && !isspace((unsigned char) line[i])) {
+					i++;
+				}
+				if (i > start) {
+					offsets[n_words++] = arena_len;
+					memcpy(arena + arena_len, line + start, i - start);
+					arena_len += i - start;
+					arena[arena_len++] = '\0';
+
+					section->n_words++;
+					section->is_multicharacter |= i - start > 1;
+				}
 			}
 		} else {
 			fprintf(stderr,
 				"%s:%d: unrecognized line, expected [section] or commentary\n",
 				file, line_number);
 		}
+
+		line = next;
 	}
 
-	/* Handle any final accumulated data. */
-	if (content) {
-		wordlist = dictionary_build_wordlist(content);
-		tail = dictionary_new_mutable(tail, name, wordlist, content);
-		head = head ? head : tail;
+	if (in_section && sections[n_sections - 1].n_words == 0) {
+		n_sections--;
 	}
 
-	if (!head) {
+	dictionary *head = NULL;
+	dictionary *tail = NULL;
+	if (n_sections > 0) {
+		/* Give back unused memory; from now on addresses of
+		   the arena and the offsets don't change. */
+		arena = safe_realloc(arena, arena_len);
+		offsets = safe_realloc(offsets, n_words * sizeof (uint32_t));
+
+		for (int s = 0; s < n_sections; s++) {
+			tail = dictionary_new_arena(tail, arena + sections[s].name,
+						    arena, offsets + sections[s].first_word,
+						    sections[s].n_words, sections[s].is_multicharacter,
+						    s == 0 ? offsets : NULL,
+						    s == 0 ? arena : NULL);
+			head = head ? head : tail;
+		}
+	} else {
 		fprintf(stderr,
 			"%s:%d: no usable dictionary data found in the file\n",
 			file, line_number);
+		free(arena);
+		free(offsets);
 	}
 
-	free(line);
-	line = NULL;
+	free(sections);
 
 	return head;
 }
@@ -618,24 +820,71 @@ cw_dictionary_t *cw_dictionaries_create_default(void)
 */
 bool cw_dictionaries_read(const char *file)
 {
-	/* Open the input stream, or fail if unopenable. */
-	FILE *stream = fopen(file, "r");
-	if (!stream) {
+	/* Open the input file, or fail if unopenable. */
+	int fd = open(file, O_RDONLY);
+	if (fd == -1) {
 		fprintf(stderr, "%s: open error: %s\n", file, strerror(errno));
 		return false;
 	}
 
+	/* Map a regular file into memory. Files that can't be
+	   mapped (e.g. pipes) are read into a buffer. */
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "%s: stat error: %s\n", file, strerror(errno));
+		close(fd);
+		return false;
+	}
+	size_t size = 0;
+	void *mapped = MAP_FAILED;
+	char *buffer = NULL;
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		size = (size_t) st.st_size;
+		mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (mapped == MAP_FAILED) {
+		buffer = cw_dictionary_read_fd(fd, &size);
+		if (!buffer) {
+			fprintf(stderr, "%s: read error: %s\n", file, strerror(errno));
+			close(fd);
+			return false;
+		}
+	}
+
 	/* If we can generate a dictionary list, free any currently
 	   allocated one and store the details of what we loaded into
 	   module variables. */
-	cw_dictionary_t *head = cw_dictionaries_create_from_stream(stream, file);
+	const char *data = mapped != MAP_FAILED ? (const char *) mapped : buffer;
+	cw_dictionary_t *head = NULL;
+	if (cw_dictionary_is_binary(data, size)) {
+		/* Dictionaries use contents of binary file in
+		   place, so the first of them takes the contents. */
+		head = cw_dictionaries_create_from_binary(data, size, file);
+		if (head && mapped != MAP_FAILED) {
+			head->mapping = mapped;
+			head->mapping_size = size;
+			mapped = MAP_FAILED;
+		} else if (head) {
+			head->mutable_wordlist_data = buffer;
+			buffer = NULL;
+		}
+	} else {
+		if (mapped != MAP_FAILED) {
+			madvise(mapped, size, MADV_SEQUENTIAL);
+		}
+		head = cw_dictionaries_create_from_buffer(data, size, file);
+	}
 	if (head) {
 		cw_dictionaries_unload();
 		dictionaries_head = head;
 	}
 
-	/* Close stream and return true if we loaded a dictionary. */
-	fclose(stream);
+	/* Release file contents and return true if we loaded a dictionary. */
+	if (mapped != MAP_FAILED) {
+		munmap(mapped, size);
+	}
+	free(buffer);
+	close(fd);
 	return head != NULL;
 }
 
@@ -643,6 +892,141 @@ bool cw_dictionaries_read(const char *file)
 
 
 
+/**
+   \brief Check if contents of file are a binary dictionary file
+
+   \param data - contents of file
+   \param size - size of \p data
+
+   \return true if \p data starts with magic number of binary dictionary file
+   \return false otherwise
+*/
+bool cw_dictionary_is_binary(const char *data, size_t size)
+{
+	return size >= sizeof (CW_DICTIONARY_MAGIC)
+		&& !memcmp(data, CW_DICTIONARY_MAGIC, sizeof (CW_DICTIONARY_MAGIC));
+}
+
+
+
+
+
+/**
+   \brief Create a dictionary list from contents of binary file
+
+   Dictionaries are created from \p data in place: they point to
+   descriptions, words and offsets of words in \p data, so \p data
+   must exist as long as the dictionaries exist.
+
+   There is no parsing, but the function checks that the header and
+   the table of dictionaries are consistent with size of the file,
+   and that offsets of all words are inside of the arena, so a
+   damaged file can't make the program read outside of it.
+
+   \param data - contents of file, aligned to at least 4 bytes
+   \param size - size of \p data
+   \param file - human-readable name of the file
+
+   \return head of list of loaded dictionaries on success
+   \return NULL if file is invalid
+*/
+cw_dictionary_t *cw_dictionaries_create_from_binary(const char *data, size_t size, const char *file)
+{
+	const cw_dictionary_binary_header_t *header = (const cw_dictionary_binary_header_t *) data;
+	if (size < sizeof (*header) || header->byte_order != CW_DICTIONARY_BYTE_ORDER) {
+		fprintf(stderr, "%s: binary dictionary file written on incompatible machine\n", file);
+		return NULL;
+	}
+
+	const size_t table_size = (size_t) header->n_dictionaries * sizeof (cw_dictionary_binary_entry_t);
+	const size_t offsets_size = (size_t) header->n_words * sizeof (uint32_t);
+	if (header->n_dictionaries == 0
+	    || header->arena_size == 0
+	    || size != sizeof (*header) + table_size + offsets_size + header->arena_size) {
+
+		fprintf(stderr, "%s: invalid binary dictionary file\n", file);
+		return NULL;
+	}
+
+	const cw_dictionary_binary_entry_t *table = (const cw_dictionary_binary_entry_t *) (data + sizeof (*header));
+	const uint32_t *offsets = (const uint32_t *) (data + sizeof (*header) + table_size);
+	const char *arena = data + sizeof (*header) + table_size + offsets_size;
+
+	/* Last string of arena must be terminated, then each string
+	   starting inside of arena is terminated. */
+	bool is_valid = arena[header->arena_size - 1] == '\0';
+	for (uint32_t i = 0; is_valid && i < header->n_words; i++) {
+		is_valid = offsets[i] < header->arena_size;
+	}
+	for (uint32_t d = 0; is_valid && d < header->n_dictionaries; d++) {
+		is_valid = table[d].description < header->arena_size
+			&& table[d].n_words > 0
+			&& table[d].n_words <= INT_MAX
+			&& table[d].first_word <= header->n_words
+			&& table[d].n_words <= header->n_words - table[d].first_word
+			&& (table[d].group_size == 1 || table[d].group_size == 5);
+	}
+	if (!is_valid) {
+		fprintf(stderr, "%s: invalid binary dictionary file\n", file);
+		return NULL;
+	}
+
+	dictionary *head = NULL;
+	dictionary *tail = NULL;
+	for (uint32_t d = 0; d < header->n_dictionaries; d++) {
+		tail = dictionary_new_arena(tail, arena + table[d].description,
+					    arena, offsets + table[d].first_word,
+					    (int) table[d].n_words, table[d].group_size == 1,
+					    NULL, NULL);
+		head = head ? head : tail;
+	}
+
+	return head;
+}
+
+
+
+
+
+/**
+   \brief Read whole contents of a file descriptor into a buffer
+
+   Helper function for cw_dictionaries_read(), for files that can't
+   be mapped into memory.
+
+   \param fd - file descriptor to read from
+   \param size - output, number of bytes read
+
+   \return allocated buffer on success, to be freed by caller
+   \return NULL on read error (errno is set)
+*/
+char *cw_dictionary_read_fd(int fd, size_t *size)
+{
+	size_t allocation = 64 * 1024;
+	char *buffer = safe_malloc(allocation);
+	*size = 0;
+
+	for (;;) {
+		if (*size == allocation) {
+			allocation <<= 1;
+			buffer = safe_realloc(buffer, allocation);
+		}
+		ssize_t n = read(fd, buffer + *size, allocation - *size);
+		if (n == 0) {
+			return buffer;
+		} else if (n > 0) {
+			*size += (size_t) n;
+		} else if (errno != EINTR) {
+			free(buffer);
+			return NULL;
+		}
+	}
+}
+
+
+
+
+
 int dictionary_load(const char *file)
 {
 	return cw_dictionaries_read(file);
@@ -701,6 +1085,16 @@ const dictionary *dictionary_iterate(const dictionary *current)
 
    Write the currently loaded (or default) dictionaries out to a given file.
 
+   If name of the file ends with ".cwd", the dictionaries are written
+   in binary format, that cw_dictionaries_read() reads faster than
+   text.
+
+   The file is replaced atomically: the dictionaries are written to
+   a temporary file in the same directory, which is then renamed to
+   \p file. The dictionaries may be the ones read from \p file, and
+   binary ones use contents of the file in place, so \p file itself
+   must not be truncated.
+
    \param file - file to write to
 
    \return true on success
@@ -708,10 +1102,16 @@ const dictionary *dictionary_iterate(const dictionary *current)
 */
 bool cw_dictionaries_write(const char *file)
 {
+	const size_t len = strlen(file);
+	const size_t suffix_len = strlen(CW_DICTIONARY_BINARY_SUFFIX);
+	if (len > suffix_len && !strcmp(file + len - suffix_len, CW_DICTIONARY_BINARY_SUFFIX)) {
+		return cw_dictionaries_write_binary(file);
+	}
+
 	/* Open the output stream, or fail if unopenable. */
-	FILE *stream = fopen(file, "w");
+	char *temporary = NULL;
+	FILE *stream = cw_dictionary_open_temporary(file, &temporary);
 	if (!stream) {
-		fprintf(stderr, "%s: open error: %s\n", file, strerror(errno));
 		return false;
 	}
 
@@ -726,8 +1126,9 @@ bool cw_dictionaries_write(const char *file)
 
 		int chars = 0;
 		for (int i = 0; i < dict->wordlist_length; i++) {
-			fprintf(stream, " %s", dict->wordlist[i]);
-			chars += strlen(dict->wordlist[i]) + 1;
+			const char *word = cw_dictionary_get_word(dict, i);
+			fprintf(stream, " %s", word);
+			chars += strlen(word) + 1;
 			if (chars > 72) {
 				fprintf(stream, "\n");
 				chars = 0;
@@ -736,46 +1137,98 @@ bool cw_dictionaries_write(const char *file)
 		fprintf(stream, chars > 0 ? "\n\n" : "\n");
 	}
 
-	fclose(stream);
-	return true;
+	return cw_dictionary_close_temporary(stream, temporary, file);
 }
 
 
 
 
 
-int dictionary_write(const char *file)
-{
-	return cw_dictionaries_write(file);
-}
-
-
-
+/**
+   \brief Write current dictionaries to given file in binary format
 
+   Helper function for cw_dictionaries_write().
 
-/**
-   \brief Get description of a given dictionary
+   \param file - file to write to
 
-   \return a string
+   \return true on success
+   \return false if writing fails
 */
-const char *cw_dictionary_get_description(const cw_dictionary_t *dict)
+bool cw_dictionaries_write_binary(const char *file)
 {
-	return dict->description;
-}
+	if (!dictionaries_head) {
+		dictionaries_head = cw_dictionaries_create_default();
+	}
+
+	/* Arena contains description of each dictionary, followed by
+	   its words. */
+	cw_dictionary_binary_header_t header;
+	memcpy(header.magic, CW_DICTIONARY_MAGIC, sizeof (header.magic));
+	header.byte_order = CW_DICTIONARY_BYTE_ORDER;
+	header.n_dictionaries = 0;
+	header.n_words = 0;
+	uint64_t arena_size = 0;
+	for (const cw_dictionary_t *dict = dictionaries_head; dict; dict = dict->next) {
+		header.n_dictionaries++;
+		header.n_words += dict->wordlist_length;
+		arena_size += strlen(dict->description) + 1;
+		for (int i = 0; i < dict->wordlist_length; i++) {
+			arena_size += strlen(cw_dictionary_get_word(dict, i)) + 1;
+		}
+	}
+	if (arena_size >= UINT32_MAX) {
+		errno = EFBIG;
+		fprintf(stderr, "%s: dictionaries are too large for binary file\n", file);
+		return false;
+	}
+	header.arena_size = (uint32_t) arena_size;
+
+	char *temporary = NULL;
+	FILE *stream = cw_dictionary_open_temporary(file, &temporary);
+	if (!stream) {
+		return false;
+	}
 
+	fwrite(&header, sizeof (header), 1, stream);
 
+	/* Table of dictionaries. */
+	uint32_t offset = 0;
+	uint32_t first_word = 0;
+	for (const cw_dictionary_t *dict = dictionaries_head; dict; dict = dict->next) {
+		cw_dictionary_binary_entry_t entry;
+		entry.description = offset;
+		entry.first_word = first_word;
+		entry.n_words = dict->wordlist_length;
+		entry.group_size = dict->group_size;
+		fwrite(&entry, sizeof (entry), 1, stream);
+
+		offset += strlen(dict->description) + 1;
+		for (int i = 0; i < dict->wordlist_length; i++) {
+			offset += strlen(cw_dictionary_get_word(dict, i)) + 1;
+		}
+		first_word += dict->wordlist_length;
+	}
 
+	/* Offsets of words. */
+	offset = 0;
+	for (const cw_dictionary_t *dict = dictionaries_head; dict; dict = dict->next) {
+		offset += strlen(dict->description) + 1;
+		for (int i = 0; i < dict->wordlist_length; i++) {
+			fwrite(&offset, sizeof (offset), 1, stream);
+			offset += strlen(cw_dictionary_get_word(dict, i)) + 1;
+		}
+	}
 
+	/* Arena. */
+	for (const cw_dictionary_t *dict = dictionaries_head; dict; dict = dict->next) {
+		fwrite(dict->description, strlen(dict->description) + 1, 1, stream);
+		for (int i = 0; i < dict->wordlist_length; i++) {
+			const char *word = cw_dictionary_get_word(dict, i);
+			fwrite(word, strlen(word) + 1, 1, stream);
+		}
+	}
 
-/*
- * get_dictionary_description()
- * get_dictionary_group_size()
- *
- * Return the text description and group size for a given dictionary.
- */
-const char *get_dictionary_description(const dictionary *dict)
-{
-	return dict->description;
+	return cw_dictionary_close_temporary(stream, temporary, file);
 }
 
 
@@ -783,22 +1236,48 @@ const char *get_dictionary_description(const dictionary *dict)
 
 
 /**
-   \brief Get group size of a given dictionary
+   \brief Create temporary file for writing dictionaries to given file
 
-   \param dict - dictionary to query
+   Helper function for cw_dictionaries_write(). The temporary file
+   is created in the same directory as \p file, so that it can be
+   renamed to \p file, with permissions that a new \p file would get.
+
+   \param file - file to write to
+   \param temporary - output, name of the temporary file, to be passed to cw_dictionary_close_temporary()
+
+   \return stream of the temporary file on success
+   \return NULL on failure
 */
-int cw_dictionary_get_group_size(const cw_dictionary_t *dict)
+FILE *cw_dictionary_open_temporary(const char *file, char **temporary)
 {
-	return dict->group_size;
-}
-
+	const char *const template = ".XXXXXX";
+	char *name = safe_malloc(strlen(file) + strlen(template) + 1);
+	strcpy(name, file);
+	strcat(name, template);
 
+	int fd = mkstemp(name);
+	if (fd == -1) {
+		fprintf(stderr, "%s: open error: %s\n", file, strerror(errno));
+		free(name);
+		return NULL;
+	}
 
+	/* mkstemp() creates file readable only by its owner. */
+	const mode_t mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
 
+	FILE *stream = fdopen(fd, "wb");
+	if (!stream) {
+		fprintf(stderr, "%s: open error: %s\n", file, strerror(errno));
+		close(fd);
+		unlink(name);
+		free(name);
+		return NULL;
+	}
 
-int get_dictionary_group_size(const dictionary *dict)
-{
-	return dict->group_size;
+	*temporary = name;
+	return stream;
 }
 
 
@@ -806,23 +1285,301 @@ int get_dictionary_group_size(const dictionary *dict)
 
 
 /**
-   \brief Get a random word from given dictionary
+   \brief Finish writing dictionaries to given file
 
-   \param dict - dictionary to query
+   Helper function for cw_dictionaries_write(). Contents of the
+   temporary file are synchronized to disc, and the temporary file
+   is renamed to \p file. On any error the temporary file is
+   removed, and \p file is left intact.
 
-   \return a string
+   \param stream - stream returned by cw_dictionary_open_temporary()
+   \param temporary - name of the temporary file; it is freed by the function
+   \param file - file to write to
+
+   \return true on success
+   \return false if writing fails
 */
-const char *cw_dictionary_get_random_word(const cw_dictionary_t *dict)
+bool cw_dictionary_close_temporary(FILE *stream, char *temporary, const char *file)
 {
-	static bool is_initialized = false;
+	bool is_error = fflush(stream) != 0 || ferror(stream) || fsync(fileno(stream)) == -1;
+	if (fclose(stream) != 0) {
+		is_error = true;
+	}
+	if (!is_error && rename(temporary, file) == -1) {
+		is_error = true;
+	}
 
-	/* On the first call, seed the random number generator. */
-	if (!is_initialized) {
-		srand(time(NULL));
-		is_initialized = true;
+	if (is_error) {
+		fprintf(stderr, "%s: write error: %s\n", file, strerror(errno));
+		unlink(temporary);
 	}
+	free(temporary);
 
-	return dict->wordlist[rand() % dict->wordlist_length];
+	return !is_error;
+}
+
+
+
+
+
+int dictionary_write(const char *file)
+{
+	return cw_dictionaries_write(file);
+}
+
+
+
+
+
+/**
+   \brief Get description of a given dictionary
+
+   \return a string
+*/
+const char *cw_dictionary_get_description(const cw_dictionary_t *dict)
+{
+	return dict->description;
+}
+
+
+
+
+
+/*
+ * get_dictionary_description()
+ * get_dictionary_group_size()
+ *
+ * Return the text description and group size for a given dictionary.
+ */
+const char *get_dictionary_description(const dictionary *dict)
+{
+	return dict->description;
+}
+
+
+
+
+
+/**
+   \brief Get group size of a given dictionary
+
+   \param dict - dictionary to query
+*/
+int cw_dictionary_get_group_size(const cw_dictionary_t *dict)
+{
+	return dict->group_size;
+}
+
+
+
+
+
+int get_dictionary_group_size(const dictionary *dict)
+{
+	return dict->group_size;
+}
+
+
+
+
+
+/**
+   \brief Get a random word from given dictionary
+
+   \param dict - dictionary to query
+
+   \return a string
+*/
+const char *cw_dictionary_get_random_word(const cw_dictionary_t *dict)
+{
+	static bool is_initialized = false;
+
+	/* On the first call, seed the random number generator. */
+	if (!is_initialized) {
+		cw_random_seed(&dictionary_random, cw_random_seed_from_time());
+		is_initialized = true;
+	}
+
+	if (has_character_weights) {
+		/* Callers get dictionaries as const, but the alias
+		   table is only a cache, so update it in the module's
+		   own (non-const) list entry. */
+		cw_dictionary_t *entry = dictionaries_head;
+		while (entry && entry != dict) {
+			entry = entry->next;
+		}
+		/* Table is not built again until weights change, also
+		   when the build has failed because weights of all
+		   words are zero. */
+		if (entry && entry->alias_weights_generation != weights_generation) {
+			cw_dictionary_build_alias_table(entry);
+		}
+		if (entry && entry->alias) {
+			return cw_dictionary_get_word(entry, cw_alias_table_draw(entry->alias, &dictionary_random));
+		}
+	}
+
+	return cw_dictionary_get_word(dict, cw_random_uniform(&dictionary_random, dict->wordlist_length));
+}
+
+
+
+
+
+/**
+   \brief Get word with given index from dictionary
+
+   \param dict - dictionary
+   \param index - index of word, in range 0 to dict->wordlist_length - 1
+
+   \return the word
+*/
+const char *cw_dictionary_get_word(const cw_dictionary_t *dict, int index)
+{
+	return dict->wordlist ? dict->wordlist[index] : dict->arena + dict->word_offsets[index];
+}
+
+
+
+
+
+/**
+   \brief Build alias table of weights of words in dictionary
+
+   Weight of a word is the mean weight of its characters. If weights
+   of all words are zero, dict->alias is left NULL, and words are
+   drawn uniformly.
+
+   \param dict - dictionary
+*/
+void cw_dictionary_build_alias_table(cw_dictionary_t *dict)
+{
+	cw_alias_table_delete(&dict->alias);
+
+	double *weights = safe_malloc(dict->wordlist_length * sizeof (double));
+	for (int i = 0; i < dict->wordlist_length; i++) {
+		double sum = 0.0;
+		size_t n = 0;
+		for (const char *c = cw_dictionary_get_word(dict, i); *c; c++, n++) {
+			sum += character_weights[toupper((unsigned char) *c)];
+		}
+		weights[i] = n ? sum / n : 0.0;
+	}
+
+	dict->alias = cw_alias_table_new(weights, dict->wordlist_length);
+	dict->alias_weights_generation = weights_generation;
+	free(weights);
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Set weight of a character in random words
+
+   Words with characters of higher weight are drawn from all
+   dictionaries more often. Weight of each character is 1.0 until
+   it is changed. Weights of lower-case and upper-case letters are
+   the same.
+
+   \param c - character
+   \param weight - new weight of the character, non-negative
+
+   \return true on success
+   \return false if \p weight is negative or not finite
+*/
+bool cw_dictionaries_set_character_weight(int c, double weight)
+{
+	if (!isfinite(weight) || weight < 0.0) {
+		return false;
+	}
+
+	if (!has_character_weights) {
+		for (int i = 0; i <= UCHAR_MAX; i++) {
+			character_weights[i] = 1.0;
+		}
+		has_character_weights = true;
+	}
+
+	character_weights[toupper((unsigned char) c)] = weight;
+	weights_generation++;
+
+	return true;
+}
+
+
+
+
+
+/**
+   \brief Set weights of characters in random words from a string
+
+   The string has format "CHARS:WEIGHT[,CHARS:WEIGHT...]", e.g.
+   "QZ:3,E:0.5" (the format of cwgen's -w option): each of CHARS
+   gets weight WEIGHT. Weights of other characters don't change.
+   Nothing is changed if the string is invalid or empty.
+
+   \param spec - weights of characters
+
+   \return true on success
+   \return false if \p spec is invalid
+*/
+bool cw_dictionaries_set_character_weights(const char *spec)
+{
+	char *copy = safe_strdup(spec);
+
+	/* Validate all items before changing any weight. */
+	for (int pass = 0; pass < 2; pass++) {
+		strcpy(copy, spec);
+
+		char *saveptr = NULL;
+		char *item = strtok_r(copy, ",", &saveptr);
+		if (!item) {
+			free(copy);
+			return false;
+		}
+		for (; item; item = strtok_r(NULL, ",", &saveptr)) {
+
+			/* Chars may include ':', so split the item at its last ':'. */
+			char *colon = strrchr(item, ':');
+			char *end = NULL;
+			const double weight = colon ? strtod(colon + 1, &end) : -1.0;
+			if (!colon || colon == item || end == colon + 1 || *end != '\0'
+			    || !(weight >= 0.0) || weight > 1e9) {
+
+				free(copy);
+				return false;
+			}
+
+			for (const char *c = item; pass == 1 && c < colon; c++) {
+				cw_dictionaries_set_character_weight(*c, weight);
+			}
+		}
+	}
+
+	free(copy);
+
+	return true;
+}
+
+
+
+
+
+/**
+   \brief Reset weights of all characters to 1.0
+
+   After the call words are again drawn from dictionaries uniformly.
+*/
+void cw_dictionaries_reset_character_weights(void)
+{
+	has_character_weights = false;
+	weights_generation++;
+
+	return;
 }
 
 
@@ -846,16 +1603,36 @@ const char *get_dictionary_random_word(const dictionary *dict)
 #ifdef CW_DICTIONARY_UNIT_TESTS
 
 
-#include "tests/libcw_test_framework.h"
-
-
 static unsigned int test_cw_dictionary_check_line(void);
+static unsigned int test_cw_dictionaries_set_character_weights(void);
+static unsigned int test_cw_dictionary_get_random_word_weighted(void);
+static unsigned int test_cw_dictionary_get_random_word_zero_weights(void);
+static unsigned int test_cw_dictionary_get_random_word_single(void);
+static unsigned int test_cw_dictionaries_create_from_buffer(void);
+static unsigned int test_cw_dictionaries_create_from_buffer_unsendable(void);
+static unsigned int test_cw_dictionaries_write_binary(void);
+static unsigned int test_cw_dictionaries_create_from_binary_invalid(void);
+
+static void test_read_text(const char *text);
+static void test_capture_stderr_start(void);
+static void test_capture_stderr_stop(char *errors, size_t errors_size);
+static cw_dictionary_t *test_create_from_buffer(const char *text, char *errors, size_t errors_size);
+static void test_dump(const cw_dictionary_t *head, char *buffer, size_t size);
+static void test_count_words(const cw_dictionary_t *dict, int n_draws, int *counts);
 
 
 typedef unsigned int (*cw_dict_test_function_t)(void);
 
 static cw_dict_test_function_t cw_dict_unit_tests[] = {
 	test_cw_dictionary_check_line,
+	test_cw_dictionaries_set_character_weights,
+	test_cw_dictionary_get_random_word_weighted,
+	test_cw_dictionary_get_random_word_zero_weights,
+	test_cw_dictionary_get_random_word_single,
+	test_cw_dictionaries_create_from_buffer,
+	test_cw_dictionaries_create_from_buffer_unsendable,
+	test_cw_dictionaries_write_binary,
+	test_cw_dictionaries_create_from_binary_invalid,
 	NULL
 };
 
@@ -954,7 +1731,587 @@ unsigned int test_cw_dictionary_check_line(void)
 	}
 
 
-	CW_TEST_PRINT_TEST_RESULT(false, p);
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Write \p text to a temporary file, and read dictionaries from it
+   with cw_dictionaries_read(). */
+void test_read_text(const char *text)
+{
+	char path[] = "/tmp/cw_dictionary_tests.XXXXXX";
+	int fd = mkstemp(path);
+	cw_assert (fd != -1, "failed to create temporary file: %s", strerror(errno));
+
+	const size_t len = strlen(text);
+	cw_assert (write(fd, text, len) == (ssize_t) len, "failed to write temporary file");
+	close(fd);
+
+	const bool rv = cw_dictionaries_read(path);
+	unlink(path);
+	cw_assert (rv, "failed to read dictionaries from \"%s\"", text);
+
+	return;
+}
+
+
+
+
+/* Draw \p n_draws words from \p dict, and count how many times
+   each of its words has been drawn. */
+void test_count_words(const cw_dictionary_t *dict, int n_draws, int *counts)
+{
+	for (int i = 0; i < dict->wordlist_length; i++) {
+		counts[i] = 0;
+	}
+
+	for (int i = 0; i < n_draws; i++) {
+		const char *word = cw_dictionary_get_random_word(dict);
+		int w = 0;
+		while (w < dict->wordlist_length && strcmp(word, cw_dictionary_get_word(dict, w))) {
+			w++;
+		}
+		cw_assert (w < dict->wordlist_length, "drawn word \"%s\" is not in dictionary", word);
+		counts[w]++;
+	}
+
+	return;
+}
+
+
+
+
+/* Invalid strings with weights are rejected, and don't change any
+   weight. */
+unsigned int test_cw_dictionaries_set_character_weights(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionaries_set_character_weights():");
+
+	cw_dictionaries_reset_character_weights();
+
+	const char *invalid[] = {
+		"", ",", "A", "A:", ":1", "A:x", "A:1x", "A:-1", "A:nan", "A:inf", "A:2e9",
+		"A:1,B", "A:1,,B:", "B:2,C:-0.5",
+		NULL /* Guard. */
+	};
+	for (int i = 0; invalid[i]; i++) {
+		const unsigned int generation = weights_generation;
+		cw_assert (!cw_dictionaries_set_character_weights(invalid[i]),
+			   "accepted invalid weights \"%s\"", invalid[i]);
+		cw_assert (!has_character_weights && generation == weights_generation,
+			   "invalid weights \"%s\" changed weights", invalid[i]);
+	}
+
+	cw_assert (cw_dictionaries_set_character_weights("QZ:3,e:0.5,::2,A:0"), "failed to set valid weights");
+	cw_assert (fabs(character_weights['Q'] - 3.0) < 1e-9 && fabs(character_weights['Z'] - 3.0) < 1e-9,
+		   "wrong weights of 'Q' and 'Z': %f, %f", character_weights['Q'], character_weights['Z']);
+	cw_assert (fabs(character_weights['E'] - 0.5) < 1e-9, "wrong weight of 'e': %f", character_weights['E']);
+	cw_assert (fabs(character_weights[':'] - 2.0) < 1e-9, "wrong weight of ':': %f", character_weights[':']);
+	cw_assert (fabs(character_weights['A'] - 0.0) < 1e-9, "wrong weight of 'A': %f", character_weights['A']);
+	cw_assert (fabs(character_weights['B'] - 1.0) < 1e-9, "wrong weight of 'B': %f", character_weights['B']);
+
+	cw_dictionaries_reset_character_weights();
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Words are drawn with frequencies proportional to their weights,
+   and words with zero weight are never drawn. */
+unsigned int test_cw_dictionary_get_random_word_weighted(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionary_get_random_word(), weights:");
+
+	test_read_text("[Test]\nAA BB CC AB\n");
+	const cw_dictionary_t *dict = cw_dictionaries_iterate(NULL);
+
+	/* Weights of words: AA - 0, BB - 1, CC - 3, AB - 0.5. */
+	cw_dictionaries_set_character_weights("A:0,C:3");
+
+	const int n_draws = 100000;
+	int counts[4];
+	test_count_words(dict, n_draws, counts);
+	cw_assert (counts[0] == 0, "word with zero weight drawn %d times", counts[0]);
+
+	/* Standard deviations of fractions are below 0.0016, so
+	   the limits are far from a random failure. */
+	const double expected[] = { 0.0, 1.0 / 4.5, 3.0 / 4.5, 0.5 / 4.5 };
+	for (int i = 1; i < 4; i++) {
+		const double fraction = (double) counts[i] / n_draws;
+		cw_assert (fabs(fraction - expected[i]) < 0.02,
+			   "word #%d drawn with frequency %f, expected %f", i, fraction, expected[i]);
+	}
+
+	/* After reset words are drawn uniformly again. */
+	cw_dictionaries_reset_character_weights();
+	test_count_words(dict, n_draws, counts);
+	for (int i = 0; i < 4; i++) {
+		const double fraction = (double) counts[i] / n_draws;
+		cw_assert (fabs(fraction - 0.25) < 0.02,
+			   "word #%d drawn with frequency %f after reset", i, fraction);
+	}
+
+	cw_dictionaries_unload();
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* If weights of all words are zero, words are drawn uniformly, and
+   the table isn't built again on each draw. */
+unsigned int test_cw_dictionary_get_random_word_zero_weights(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionary_get_random_word(), zero weights:");
+
+	test_read_text("[Test]\nAB BA AAB\n");
+	cw_dictionary_t *dict = dictionaries_head;
+
+	cw_dictionaries_set_character_weights("AB:0");
+
+	const int n_draws = 30000;
+	int counts[3];
+	test_count_words(dict, n_draws, counts);
+	for (int i = 0; i < 3; i++) {
+		const double fraction = (double) counts[i] / n_draws;
+		cw_assert (fabs(fraction - 1.0 / 3) < 0.02,
+			   "word #%d drawn with frequency %f", i, fraction);
+	}
+	cw_assert (!dict->alias, "table built for zero weights");
+	cw_assert (dict->alias_weights_generation == weights_generation,
+		   "generation of table is out of date: %u != %u",
+		   dict->alias_weights_generation, weights_generation);
+
+	/* Change a weight behind the module's back: a table built
+	   again would use it. */
+	character_weights['A'] = 1.0;
+	cw_dictionary_get_random_word(dict);
+	cw_assert (!dict->alias, "table built again without change of weights");
+
+	/* Proper change of weights makes the table be built. */
+	cw_dictionaries_set_character_weights("A:1");
+	cw_dictionary_get_random_word(dict);
+	cw_assert (dict->alias, "table not built after change of weights");
+
+	cw_dictionaries_reset_character_weights();
+	cw_dictionaries_unload();
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Dictionary with one word always gives that word, whatever its
+   weight is. */
+unsigned int test_cw_dictionary_get_random_word_single(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionary_get_random_word(), single word:");
+
+	test_read_text("[Test]\nQ\n");
+	const cw_dictionary_t *dict = cw_dictionaries_iterate(NULL);
+
+	const char *weights[] = { NULL, "Q:5", "Q:0", "Q:1e-9", NULL };
+	for (int w = 0; w < 4; w++) {
+		if (weights[w]) {
+			cw_dictionaries_set_character_weights(weights[w]);
+		}
+		for (int i = 0; i < 1000; i++) {
+			const char *word = cw_dictionary_get_random_word(dict);
+			cw_assert (!strcmp(word, "Q"), "drawn word \"%s\" for weights \"%s\"",
+				   word, weights[w] ? weights[w] : "none");
+		}
+	}
+
+	cw_dictionaries_reset_character_weights();
+	cw_dictionaries_unload();
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+static FILE *test_captured_stderr = NULL;
+static int test_saved_stderr = -1;
+
+
+
+
+/* Redirect stderr to a temporary file. */
+void test_capture_stderr_start(void)
+{
+	test_captured_stderr = tmpfile();
+	cw_assert (test_captured_stderr, "failed to create temporary file: %s", strerror(errno));
+
+	fflush(stderr);
+	test_saved_stderr = dup(STDERR_FILENO);
+	dup2(fileno(test_captured_stderr), STDERR_FILENO);
+
+	return;
+}
+
+
+
+
+/* Restore stderr, and put messages printed on it since
+   test_capture_stderr_start() in \p errors. */
+void test_capture_stderr_stop(char *errors, size_t errors_size)
+{
+	fflush(stderr);
+	dup2(test_saved_stderr, STDERR_FILENO);
+	close(test_saved_stderr);
+
+	rewind(test_captured_stderr);
+	const size_t n = fread(errors, 1, errors_size - 1, test_captured_stderr);
+	errors[n] = '\0';
+	fclose(test_captured_stderr);
+
+	return;
+}
+
+
+
+
+/* Create dictionaries from \p text, with "test" as name of file.
+   Messages printed on stderr during that are put in \p errors. */
+cw_dictionary_t *test_create_from_buffer(const char *text, char *errors, size_t errors_size)
+{
+	test_capture_stderr_start();
+	cw_dictionary_t *head = cw_dictionaries_create_from_buffer(text, strlen(text), "test");
+	test_capture_stderr_stop(errors, errors_size);
+
+	return head;
+}
+
+
+
+
+/* Describe list of dictionaries as one string: for each dictionary
+   its description, group size and words, e.g. "Letters/5: A B C|". */
+void test_dump(const cw_dictionary_t *head, char *buffer, size_t size)
+{
+	size_t len = 0;
+	buffer[0] = '\0';
+	for (const cw_dictionary_t *dict = head; dict; dict = dict->next) {
+		len += snprintf(buffer + len, size - len, "%s/%d:",
+				cw_dictionary_get_description(dict), cw_dictionary_get_group_size(dict));
+		for (int i = 0; i < dict->wordlist_length; i++) {
+			len += snprintf(buffer + len, size - len, " %s", cw_dictionary_get_word(dict, i));
+		}
+		len += snprintf(buffer + len, size - len, "|");
+		cw_assert (len < size, "buffer too small for dictionaries");
+	}
+
+	return;
+}
+
+
+
+
+/* Dictionaries created from text files are the same as those
+   created by the original line-based reader (the one using
+   cw_getline() and strtok()), also for the corner cases of the
+   file format. */
+unsigned int test_cw_dictionaries_create_from_buffer(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionaries_create_from_buffer():");
+
+	struct {
+		const char *in;
+		const char *expected_out;     /* NULL - no dictionaries. */
+		const char *expected_errors;
+	} test_data[] = {
+		/* Plain file. */
+		{ "[Letters]\nA B C\n[Words]\nCQ DE\nTEST\n",
+		  "Letters/5: A B C|Words/1: CQ DE TEST|", "" },
+
+		/* CR of DOS line ends is stripped, from section names too. */
+		{ "[Letters]\r\nA B\r\nC\r\n[ Words ]\r\nCQ\r\r\n",
+		  "Letters/5: A B C|Words/1: CQ|", "" },
+
+		/* Missing closing bracket; spaces around the name are trimmed. */
+		{ "[Letters\nA B\n[  Words  \t\nCQ\n",
+		  "Letters/5: A B|Words/1: CQ|", "" },
+
+		/* Text after closing bracket: not a section. */
+		{ "[Letters] A\nB\n",
+		  NULL, "test:1: unrecognized line, expected [section] or commentary\n"
+		  "test:2: unrecognized line, expected [section] or commentary\n"
+		  "test:2: no usable dictionary data found in the file\n" },
+
+		/* Empty sections are dropped, also those with comments only. */
+		{ "[Empty]\n[Letters]\nA\n[Comments]\n; comment\n# comment\n \t\n\n[Words]\nCQ\n[Last]\n",
+		  "Letters/5: A|Words/1: CQ|", "" },
+
+		/* File with empty sections only. */
+		{ "[Empty]\n\n[Also empty]\n",
+		  NULL, "test:3: no usable dictionary data found in the file\n" },
+
+		/* Word at end of file without newline. */
+		{ "[Letters]\nA B",
+		  "Letters/5: A B|", "" },
+		{ "[Words]\nA\nCQ\r",
+		  "Words/1: A CQ|", "" },
+
+		/* Lines before first section. */
+		{ "; comment\nA B\n[Letters]\nA\n",
+		  "Letters/5: A|", "test:2: unrecognized line, expected [section] or commentary\n" },
+
+		/* Words separated with any number of spaces and TABs
+		   (TABs are reported as unsendable); comments between
+		   words. */
+		{ "[Letters]\n  A\t\tB  \n# C\n\tD\n",
+		  "Letters/5: A B D|",
+		  "test:2: unsendable character found:\n  A\t\tB  \n   ^^   \n"
+		  "test:4: unsendable character found:\n\tD\n^ \n" },
+
+		{ NULL, NULL, NULL } /* Guard. */
+	};
+
+	for (int i = 0; test_data[i].in; i++) {
+		char errors[1024];
+		char out[1024];
+		cw_dictionary_t *head = test_create_from_buffer(test_data[i].in, errors, sizeof (errors));
+
+		cw_assert (!strcmp(errors, test_data[i].expected_errors),
+			   "errors for input #%d:\n\"%s\"\nexpected:\n\"%s\"\n",
+			   i, errors, test_data[i].expected_errors);
+
+		if (!test_data[i].expected_out) {
+			cw_assert (!head, "dictionaries created from input #%d", i);
+			continue;
+		}
+		cw_assert (head, "no dictionaries created from input #%d", i);
+
+		test_dump(head, out, sizeof (out));
+		cw_assert (!strcmp(out, test_data[i].expected_out),
+			   "dictionaries for input #%d:\n\"%s\"\nexpected:\n\"%s\"\n",
+			   i, out, test_data[i].expected_out);
+
+		cw_dictionaries_unload();
+		dictionaries_head = head;
+		cw_dictionaries_unload();
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Unsendable characters are reported with number of the line and
+   their positions in the line, but words with them are kept. */
+unsigned int test_cw_dictionaries_create_from_buffer_unsendable(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionaries_create_from_buffer(), unsendable:");
+
+	char errors[1024];
+	char out[1024];
+	cw_dictionary_t *head = test_create_from_buffer("[Words]\r\nCQ DE\r\n; {comment}\r\nA|B C%\r\n\r\n[Letters]\nA\n\tB`",
+							errors, sizeof (errors));
+
+	const char *expected_errors =
+		"test:4: unsendable character found:\n"
+		"A|B C%\n"
+		" ^   ^\n"
+		"test:8: unsendable character found:\n"
+		"\tB`\n"
+		"^ ^\n";
+	cw_assert (!strcmp(errors, expected_errors), "errors:\n\"%s\"\nexpected:\n\"%s\"\n", errors, expected_errors);
+
+	test_dump(head, out, sizeof (out));
+	cw_assert (!strcmp(out, "Words/1: CQ DE A|B C%|Letters/1: A B`|"), "dictionaries: \"%s\"", out);
+
+	dictionaries_head = head;
+	cw_dictionaries_unload();
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+/* Dictionaries written to binary file and read back are the same
+   as the original ones, also when the file is written over the
+   file that the dictionaries have been read from. */
+unsigned int test_cw_dictionaries_write_binary(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionaries_write_binary():");
+
+	char directory[] = "/tmp/cw_dictionary_tests.XXXXXX";
+	cw_assert (mkdtemp(directory), "failed to create temporary directory: %s", strerror(errno));
+	char binary[sizeof (directory) + 16];
+	char text[sizeof (directory) + 16];
+	snprintf(binary, sizeof (binary), "%s/words.cwd", directory);
+	snprintf(text, sizeof (text), "%s/words.txt", directory);
+
+	const char *expected = "Letters/5: A B C|Words/1: CQ DE TEST|Callsigns/1: SP5XYZ DL1ABC|";
+	char out[1024];
+
+	test_read_text("[Letters]\nA B C\n[Words]\nCQ DE\nTEST\n[ Callsigns ]\nSP5XYZ DL1ABC");
+	cw_assert (cw_dictionaries_write(binary), "failed to write binary file");
+
+	struct stat st;
+	cw_assert (stat(binary, &st) == 0, "failed to stat binary file: %s", strerror(errno));
+	const mode_t mask = umask(0);
+	umask(mask);
+	cw_assert ((st.st_mode & 0777) == (0666 & ~mask), "wrong permissions of binary file: %o", st.st_mode & 0777);
+
+	/* Binary file is read from mapped memory; write the file
+	   again from the dictionaries that use the mapping. Old
+	   mapping must stay valid. */
+	for (int i = 0; i < 3; i++) {
+		cw_assert (cw_dictionaries_read(binary), "failed to read binary file, iteration #%d", i);
+		cw_assert (dictionaries_head->mapping, "binary file not mapped, iteration #%d", i);
+		test_dump(dictionaries_head, out, sizeof (out));
+		cw_assert (!strcmp(out, expected), "dictionaries read from binary file, iteration #%d: \"%s\"", i, out);
+
+		cw_assert (cw_dictionaries_write(binary), "failed to write binary file over itself, iteration #%d", i);
+		test_dump(dictionaries_head, out, sizeof (out));
+		cw_assert (!strcmp(out, expected), "dictionaries after writing binary file, iteration #%d: \"%s\"", i, out);
+	}
+
+	/* Text file written from binary dictionaries is the same as
+	   the original text, too. */
+	cw_assert (cw_dictionaries_write(text), "failed to write text file");
+	cw_assert (cw_dictionaries_read(text), "failed to read text file");
+	test_dump(dictionaries_head, out, sizeof (out));
+	cw_assert (!strcmp(out, expected), "dictionaries read from text file: \"%s\"", out);
+	cw_dictionaries_unload();
+
+	/* Failed write leaves no temporary files behind. */
+	char missing[sizeof (directory) + 32];
+	snprintf(missing, sizeof (missing), "%s/missing/words.cwd", directory);
+	char errors[1024];
+	test_capture_stderr_start();
+	const bool rv = cw_dictionaries_write(missing);
+	test_capture_stderr_stop(errors, sizeof (errors));
+	cw_assert (!rv, "writing to non-existent directory succeeded");
+	cw_dictionaries_unload();
+
+	cw_assert (unlink(binary) == 0, "failed to remove binary file: %s", strerror(errno));
+	cw_assert (unlink(text) == 0, "failed to remove text file: %s", strerror(errno));
+	cw_assert (rmdir(directory) == 0, "temporary files left in directory: %s", strerror(errno));
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
+
+	return 0;
+}
+
+
+
+
+/* Damaged binary files are rejected without reading outside of
+   them. */
+unsigned int test_cw_dictionaries_create_from_binary_invalid(void)
+{
+	int p = fprintf(stderr, "dictionary: cw_dictionaries_create_from_binary(), invalid:");
+
+	char path[] = "/tmp/cw_dictionary_tests.XXXXXX.cwd";
+	const int fd = mkstemps(path, 4);
+	cw_assert (fd != -1, "failed to create temporary file: %s", strerror(errno));
+	close(fd);
+
+	test_read_text("[Letters]\nA B C\n[Words]\nCQ DE\n");
+	cw_assert (cw_dictionaries_write(path), "failed to write binary file");
+	cw_dictionaries_unload();
+
+	/* Contents of the file, and their copy to be damaged; both
+	   aligned to 4 bytes, as mapped file would be. */
+	static uint32_t valid[256];
+	static uint32_t damaged[256];
+	FILE *stream = fopen(path, "rb");
+	cw_assert (stream, "failed to open binary file: %s", strerror(errno));
+	const size_t size = fread(valid, 1, sizeof (valid), stream);
+	fclose(stream);
+	unlink(path);
+	cw_assert (size > sizeof (cw_dictionary_binary_header_t) && size < sizeof (valid), "unexpected size of binary file: %zu", size);
+
+	cw_dictionary_binary_header_t *header = (cw_dictionary_binary_header_t *) damaged;
+	cw_dictionary_binary_entry_t *table = (cw_dictionary_binary_entry_t *) (header + 1);
+	uint32_t *offsets = (uint32_t *) (table + 2);
+	char *arena = (char *) (offsets + 5);
+	char errors[1024];
+	char out[1024];
+
+	/* Undamaged copy. */
+	memcpy(damaged, valid, size);
+	cw_assert (header->n_dictionaries == 2 && header->n_words == 5, "unexpected header");
+	cw_assert (arena + header->arena_size == (char *) damaged + size, "unexpected layout of file");
+	cw_dictionary_t *head = cw_dictionaries_create_from_binary((char *) damaged, size, "test");
+	test_dump(head, out, sizeof (out));
+	cw_assert (!strcmp(out, "Letters/5: A B C|Words/1: CQ DE|"), "dictionaries: \"%s\"", out);
+	dictionaries_head = head;
+	cw_dictionaries_unload();
+
+	/* Truncated file, at every possible length. */
+	for (size_t len = 0; len < size; len++) {
+		test_capture_stderr_start();
+		head = cw_dictionaries_create_from_binary((char *) valid, len, "test");
+		test_capture_stderr_stop(errors, sizeof (errors));
+		cw_assert (!head, "accepted file truncated to %zu bytes", len);
+		cw_assert (!strcmp(errors, len < sizeof (*header)
+				   ? "test: binary dictionary file written on incompatible machine\n"
+				   : "test: invalid binary dictionary file\n"),
+			   "message for file truncated to %zu bytes: \"%s\"", len, errors);
+	}
+
+	/* Wrong byte order. */
+	memcpy(damaged, valid, size);
+	header->byte_order = 0x04030201;
+	test_capture_stderr_start();
+	head = cw_dictionaries_create_from_binary((char *) damaged, size, "test");
+	test_capture_stderr_stop(errors, sizeof (errors));
+	cw_assert (!head, "accepted file with wrong byte order");
+	cw_assert (!strcmp(errors, "test: binary dictionary file written on incompatible machine\n"),
+		   "message for wrong byte order: \"%s\"", errors);
+
+	/* Bad offsets and counts. */
+	for (int i = 0; i < 12; i++) {
+		memcpy(damaged, valid, size);
+		switch (i) {
+		case 0:  offsets[4] = header->arena_size; break;
+		case 1:  offsets[0] = UINT32_MAX; break;
+		case 2:  table[1].description = header->arena_size; break;
+		case 3:  table[1].first_word = 4; break;
+		case 4:  table[1].first_word = UINT32_MAX; break;
+		case 5:  table[0].n_words = 0; break;
+		case 6:  table[1].n_words = UINT32_MAX; break;
+		case 7:  table[0].group_size = 3; break;
+		case 8:  arena[header->arena_size - 1] = 'X'; break;
+		case 9:  header->n_dictionaries = 3; break;
+		case 10: header->n_words = 4; break;
+		case 11: header->arena_size++; break;
+		default: break;
+		}
+
+		test_capture_stderr_start();
+		head = cw_dictionaries_create_from_binary((char *) damaged, size, "test");
+		test_capture_stderr_stop(errors, sizeof (errors));
+		cw_assert (!head, "accepted damaged file #%d", i);
+		cw_assert (!strcmp(errors, "test: invalid binary dictionary file\n"),
+			   "message for damaged file #%d: \"%s\"", i, errors);
+	}
+
+	fprintf(stderr, "%*s\n", 75 - p, "OK");
 
 	return 0;
 }
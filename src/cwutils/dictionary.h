@@ -39,6 +39,10 @@ extern const char *cw_dictionary_get_description(const cw_dictionary_t *dict);
 extern int         cw_dictionary_get_group_size(const cw_dictionary_t *dict);
 extern const char *cw_dictionary_get_random_word(const cw_dictionary_t *dict);
 
+extern bool cw_dictionaries_set_character_weight(int c, double weight);
+extern bool cw_dictionaries_set_character_weights(const char *spec);
+extern void cw_dictionaries_reset_character_weights(void);
+
 
 
 /* Everything below is deprecated. */
@@ -33,6 +33,7 @@
 
 #include "libcw.h"
 #include "libcw_debug.h"
+#include "libcw_context.h"
 #include "libcw_gen.h"
 #include "libcw_key.h"
 #include "libcw_rec.h"
@@ -45,21 +46,6 @@
 
 
 
-/* Main container for data related to generating audible Morse code.
-   This is a global variable in library file, but in future the
-   variable will be moved from the file to client code.
-
-   This is a global variable that should be converted into a function
-   argument; this pointer should exist only in client's code, should
-   initially be returned by new(), and deleted by delete().
-
-   TODO: perform the conversion later, when you figure out ins and
-   outs of the library. */
-cw_gen_t *cw_generator = NULL;
-
-
-
-
 /* From libcw_debug.c. */
 extern cw_debug_t cw_debug_object;
 extern cw_debug_t cw_debug_object_ev;
@@ -125,13 +111,39 @@ static cw_rec_t cw_receiver = {
 
 	.dot_averaging  = { {0}, 0, 0, 0 },
 	.dash_averaging = { {0}, 0, 0, 0 },
+
+
+	.events = CW_EVENT_SOURCE_INITIALIZER,
 };
 
 
 
 
 
-static volatile cw_key_t cw_key = {
+static cw_key_t cw_key;
+
+
+/* Legacy keyer is timed by legacy generator, but it still needs
+   the timing data to let clients wait for keyer's state. */
+static cw_key_ik_timing_t cw_key_timing = {
+	.timer = {
+		.deadline = 0,
+		.callback = cw_key_ik_timer_callback_internal,
+		.callback_arg = &cw_key,
+		.wheel = NULL,
+		.is_armed = false,
+		.slot = 0,
+		.prev = NULL,
+		.next = NULL
+	},
+
+	.wait_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.wait_var = PTHREAD_COND_INITIALIZER,
+	.n_waiters = 0
+};
+
+
+static cw_key_t cw_key = {
 	.gen = NULL,
 
 
@@ -153,16 +165,21 @@ static volatile cw_key_t cw_key = {
 		.graph_state = KS_IDLE,
 		.key_value = CW_KEY_STATE_OPEN,
 
-		.dot_paddle = false,
-		.dash_paddle = false,
+		.inputs = 0,
 
-		.dot_latch = false,
-		.dash_latch = false,
+		.mode = CW_KEY_IK_MODE_IAMBIC_A,
+		.memory = CW_KEY_IK_DOT_LATCH | CW_KEY_IK_DASH_LATCH,
+		.memory_window = 0,
+		.mark_start = 0,
+		.mark_len = 0,
+		.manual = false,
 
-		.curtis_mode_b = false,
-		.curtis_b_latch = false,
+		.running = 0,
+		.pending = 0,
 
-		.lock = false,
+		.timing = &cw_key_timing,
+		.dot_len = CW_DOT_CALIBRATION / CW_SPEED_INITIAL,
+		.element_len = 0,
 	},
 
 
@@ -175,6 +192,38 @@ static volatile cw_key_t cw_key = {
 
 
 
+/* Default context, used by all functions of legacy API. The
+   receiver and the key are statically initialized, so that the
+   legacy API works without any explicit initialization. The
+   generator is created by cw_generator_new().
+
+   Clients that need more than one station in a process should use
+   their own contexts (cw_context_new()) instead of the legacy API. */
+static cw_context_t cw_default_context = {
+	.gen = NULL,
+	.rec = &cw_receiver,
+	.key = &cw_key,
+	.wheel = NULL      /* Use libcw's default timer wheel. */
+};
+
+
+
+
+
+/**
+   \brief Get default context, used by legacy API
+
+   \return default context
+*/
+cw_context_t * cw_context_default_internal(void)
+{
+	return &cw_default_context;
+}
+
+
+
+
+
 /* ******************************************************************** */
 /*                              Generator                               */
 /* ******************************************************************** */
@@ -192,10 +241,9 @@ static volatile cw_key_t cw_key = {
    a sound), you have to use cw_generator_start() for this.
 
    Notice that the function doesn't return a generator variable. There
-   is at most one generator variable at any given time. You can't have
-   two generators. In some future version of the library the function
-   will return pointer to newly allocated generator, and then you
-   could have as many of them as you want, but not yet.
+   is at most one generator of legacy API at any given time. Use
+   cw_context_new() and cw_context_generator_new() to have as many
+   generators as you want.
 
    \p audio_system can be one of following: NULL, console, OSS, ALSA,
    PulseAudio, soundcard. See "enum cw_audio_systems" in libcw.h for
@@ -206,18 +254,7 @@ static volatile cw_key_t cw_key = {
 */
 int cw_generator_new(int audio_system, const char *device)
 {
-	cw_generator = cw_gen_new(audio_system, device);
-	if (!cw_generator) {
-		cw_debug_msg ((&cw_debug_object), CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
-			      MSG_PREFIX "can't create generator");
-		return CW_FAILURE;
-	} else {
-		/* For some (all?) applications a key needs to have
-		   some generator associated with it. */
-		cw_key_register_generator(&cw_key, cw_generator);
-
-		return CW_SUCCESS;
-	}
+	return cw_context_generator_new(&cw_default_context, audio_system, device);
 }
 
 
@@ -233,7 +270,7 @@ int cw_generator_new(int audio_system, const char *device)
 */
 void cw_generator_delete(void)
 {
-	cw_gen_delete(&cw_generator);
+	cw_context_generator_delete(&cw_default_context);
 
 	return;
 }
@@ -255,7 +292,7 @@ void cw_generator_delete(void)
 */
 int cw_generator_start(void)
 {
-	return cw_gen_start(cw_generator);
+	return cw_gen_start(cw_default_context.gen);
 }
 
 
@@ -275,7 +312,7 @@ int cw_generator_start(void)
 */
 void cw_generator_stop(void)
 {
-	cw_gen_stop(cw_generator);
+	cw_gen_stop(cw_default_context.gen);
 
 	return;
 }
@@ -289,9 +326,7 @@ void cw_generator_stop(void)
 */
 void cw_generator_delete_internal(void)
 {
-	if (cw_generator) {
-		cw_gen_delete(&cw_generator);
-	}
+	cw_context_generator_delete(&cw_default_context);
 
 	return;
 }
@@ -319,7 +354,7 @@ void cw_generator_delete_internal(void)
 */
 int cw_set_send_speed(int new_value)
 {
-	int rv = cw_gen_set_speed(cw_generator, new_value);
+	int rv = cw_gen_set_speed(cw_default_context.gen, new_value);
 	return rv;
 }
 
@@ -346,7 +381,7 @@ int cw_set_send_speed(int new_value)
 */
 int cw_set_frequency(int new_value)
 {
-	int rv = cw_gen_set_frequency(cw_generator, new_value);
+	int rv = cw_gen_set_frequency(cw_default_context.gen, new_value);
 	return rv;
 }
 
@@ -376,7 +411,7 @@ int cw_set_frequency(int new_value)
 */
 int cw_set_volume(int new_value)
 {
-	int rv = cw_gen_set_volume(cw_generator, new_value);
+	int rv = cw_gen_set_volume(cw_default_context.gen, new_value);
 	return rv;
 }
 
@@ -401,7 +436,7 @@ int cw_set_volume(int new_value)
 */
 int cw_set_gap(int new_value)
 {
-	int rv = cw_gen_set_gap(cw_generator, new_value);
+	int rv = cw_gen_set_gap(cw_default_context.gen, new_value);
 	if (rv != CW_FAILURE) {
 		/* Ideally generator and receiver should have their
 		   own, separate cw_set_gap() functions. Unfortunately
@@ -409,7 +444,7 @@ int cw_set_gap(int new_value)
 		   here for receiver as well.
 
 		   TODO: add cw_set_gap() function for receiver. */
-		rv = cw_rec_set_gap(&cw_receiver, new_value);
+		rv = cw_rec_set_gap(cw_default_context.rec, new_value);
 	}
 	return rv;
 }
@@ -432,7 +467,7 @@ int cw_set_gap(int new_value)
 */
 int cw_set_weighting(int new_value)
 {
-	int rv = cw_gen_set_weighting(cw_generator, new_value);
+	int rv = cw_gen_set_weighting(cw_default_context.gen, new_value);
 	return rv;
 }
 
@@ -447,7 +482,7 @@ int cw_set_weighting(int new_value)
 */
 int cw_get_send_speed(void)
 {
-	return cw_gen_get_speed(cw_generator);
+	return cw_gen_get_speed(cw_default_context.gen);
 }
 
 
@@ -464,7 +499,7 @@ int cw_get_send_speed(void)
 */
 int cw_get_frequency(void)
 {
-	return cw_gen_get_frequency(cw_generator);
+	return cw_gen_get_frequency(cw_default_context.gen);
 }
 
 
@@ -481,7 +516,7 @@ int cw_get_frequency(void)
 */
 int cw_get_volume(void)
 {
-	return cw_gen_get_volume(cw_generator);
+	return cw_gen_get_volume(cw_default_context.gen);
 }
 
 
@@ -495,7 +530,7 @@ int cw_get_volume(void)
 */
 int cw_get_gap(void)
 {
-	return cw_gen_get_gap(cw_generator);
+	return cw_gen_get_gap(cw_default_context.gen);
 }
 
 
@@ -509,7 +544,7 @@ int cw_get_gap(void)
 */
 int cw_get_weighting(void)
 {
-	return cw_gen_get_weighting(cw_generator);
+	return cw_gen_get_weighting(cw_default_context.gen);
 }
 
 
@@ -538,7 +573,7 @@ void cw_get_send_parameters(int *dot_usecs, int *dash_usecs,
 			    int *end_of_character_usecs, int *end_of_word_usecs,
 			    int *additional_usecs, int *adjustment_usecs)
 {
-	cw_gen_get_timing_parameters_internal(cw_generator,
+	cw_gen_get_timing_parameters_internal(cw_default_context.gen,
 					      dot_usecs, dash_usecs,
 					      end_of_element_usecs,
 					      end_of_character_usecs, end_of_word_usecs,
@@ -563,7 +598,7 @@ void cw_get_send_parameters(int *dot_usecs, int *dash_usecs,
 */
 int cw_send_dot(void)
 {
-	return cw_gen_enqueue_mark_internal(cw_generator, CW_DOT_REPRESENTATION, false);
+	return cw_gen_enqueue_mark_internal(cw_default_context.gen, CW_DOT_REPRESENTATION, false);
 }
 
 
@@ -582,7 +617,7 @@ int cw_send_dot(void)
 */
 int cw_send_dash(void)
 {
-	return cw_gen_enqueue_mark_internal(cw_generator, CW_DASH_REPRESENTATION, false);
+	return cw_gen_enqueue_mark_internal(cw_default_context.gen, CW_DASH_REPRESENTATION, false);
 }
 
 
@@ -599,7 +634,7 @@ int cw_send_dash(void)
 */
 int cw_send_character_space(void)
 {
-	return cw_gen_enqueue_eoc_space_internal(cw_generator);
+	return cw_gen_enqueue_eoc_space_internal(cw_default_context.gen);
 }
 
 
@@ -616,7 +651,7 @@ int cw_send_character_space(void)
 */
 int cw_send_word_space(void)
 {
-	return cw_gen_enqueue_eow_space_internal(cw_generator);
+	return cw_gen_enqueue_eow_space_internal(cw_default_context.gen);
 }
 
 
@@ -644,7 +679,7 @@ int cw_send_word_space(void)
 */
 int cw_send_representation(const char *representation)
 {
-	return cw_gen_enqueue_representation_partial_internal(cw_generator, representation);
+	return cw_gen_enqueue_representation_partial_internal(cw_default_context.gen, representation);
 }
 
 
@@ -667,7 +702,7 @@ int cw_send_representation(const char *representation)
 */
 int cw_send_representation_partial(const char *representation)
 {
-	return cw_gen_enqueue_representation_partial_internal(cw_generator, representation);
+	return cw_gen_enqueue_representation_partial_internal(cw_default_context.gen, representation);
 }
 
 
@@ -701,7 +736,7 @@ int cw_send_representation_partial(const char *representation)
 */
 int cw_send_character(char c)
 {
-	return cw_gen_enqueue_valid_character_internal(cw_generator, c);
+	return cw_gen_enqueue_valid_character_internal(cw_default_context.gen, c);
 }
 
 
@@ -735,7 +770,7 @@ int cw_send_character(char c)
 */
 int cw_send_character_partial(char c)
 {
-	return cw_gen_enqueue_character_partial(cw_generator, c);
+	return cw_gen_enqueue_character_partial(cw_default_context.gen, c);
 }
 
 
@@ -771,7 +806,7 @@ int cw_send_character_partial(char c)
 */
 int cw_send_string(const char *string)
 {
-	return cw_gen_enqueue_string(cw_generator, string);
+	return cw_gen_enqueue_string(cw_default_context.gen, string);
 }
 
 
@@ -788,12 +823,12 @@ int cw_send_string(const char *string)
 */
 void cw_reset_send_receive_parameters(void)
 {
-	cw_gen_reset_parameters_internal(cw_generator);
-	cw_rec_reset_parameters_internal(&cw_receiver);
+	cw_gen_reset_parameters_internal(cw_default_context.gen);
+	cw_rec_reset_parameters_internal(cw_default_context.rec);
 
 	/* Reset requires resynchronization. */
-	cw_gen_sync_parameters_internal(cw_generator);
-	cw_rec_sync_parameters_internal(&cw_receiver);
+	cw_gen_sync_parameters_internal(cw_default_context.gen);
+	cw_rec_sync_parameters_internal(cw_default_context.rec);
 
 	return;
 }
@@ -811,7 +846,7 @@ void cw_reset_send_receive_parameters(void)
 */
 const char *cw_get_console_device(void)
 {
-	return cw_generator->audio_device;
+	return cw_default_context.gen->audio_device;
 }
 
 
@@ -827,7 +862,7 @@ const char *cw_get_console_device(void)
 */
 const char *cw_get_soundcard_device(void)
 {
-	return cw_generator->audio_device;
+	return cw_default_context.gen->audio_device;
 }
 
 
@@ -844,7 +879,7 @@ const char *cw_get_soundcard_device(void)
 */
 const char *cw_generator_get_audio_system_label(void)
 {
-	return cw_get_audio_system_label(cw_generator->audio_system);
+	return cw_get_audio_system_label(cw_default_context.gen->audio_system);
 }
 
 
@@ -884,7 +919,7 @@ const char *cw_generator_get_audio_system_label(void)
 */
 int cw_register_tone_queue_low_callback(void (*callback_func)(void*), void *callback_arg, int level)
 {
-	return cw_tq_register_low_level_callback_internal(cw_generator->tq, callback_func, callback_arg, level);
+	return cw_tq_register_low_level_callback_internal(cw_default_context.gen->tq, callback_func, callback_arg, level);
 }
 
 
@@ -905,7 +940,7 @@ int cw_register_tone_queue_low_callback(void (*callback_func)(void*), void *call
 */
 bool cw_is_tone_busy(void)
 {
-	return cw_tq_is_busy_internal(cw_generator->tq);
+	return cw_tq_is_busy_internal(cw_default_context.gen->tq);
 }
 
 
@@ -915,16 +950,12 @@ bool cw_is_tone_busy(void)
 /**
    \brief Wait for the current tone to complete
 
-   The routine returns CW_SUCCESS on success.  If called with SIGALRM
-   blocked, the routine returns CW_FAILURE, with errno set to EDEADLK,
-   to avoid indefinite waits.
-
    \return CW_SUCCESS on success
    \return CW_FAILURE on failure
 */
 int cw_wait_for_tone(void)
 {
-	return cw_tq_wait_for_tone_internal(cw_generator->tq);
+	return cw_tq_wait_for_tone_internal(cw_default_context.gen->tq);
 }
 
 
@@ -934,10 +965,6 @@ int cw_wait_for_tone(void)
 /**
    \brief Wait for the tone queue to drain
 
-   The routine returns CW_SUCCESS on success. If called with SIGALRM
-   blocked, the routine returns false, with errno set to EDEADLK,
-   to avoid indefinite waits.
-
    Notice that generator must be running (started with
    cw_generator_start()) when this function is called, otherwise it
    will be waiting forever for a change of tone queue's level that
@@ -948,7 +975,7 @@ int cw_wait_for_tone(void)
 */
 int cw_wait_for_tone_queue(void)
 {
-	return cw_tq_wait_for_level_internal(cw_generator->tq, 0);
+	return cw_tq_wait_for_level_internal(cw_default_context.gen->tq, 0);
 }
 
 
@@ -963,10 +990,6 @@ int cw_wait_for_tone_queue(void)
    to avoid the cleanup that happens when the tone queue drains completely;
    such programs have a short time in which to add more tones to the queue.
 
-   The routine returns CW_SUCCESS on success.  If called with SIGALRM
-   blocked, the routine returns false, with errno set to EDEADLK, to
-   avoid indefinite waits.
-
    Notice that generator must be running (started with
    cw_generator_start()) when this function is called, otherwise it
    will be waiting forever for a change of tone queue's level that
@@ -979,7 +1002,7 @@ int cw_wait_for_tone_queue(void)
 */
 int cw_wait_for_tone_queue_critical(int level)
 {
-	return cw_tq_wait_for_level_internal(cw_generator->tq, (size_t) level);
+	return cw_tq_wait_for_level_internal(cw_default_context.gen->tq, (size_t) level);
 }
 
 
@@ -994,7 +1017,7 @@ int cw_wait_for_tone_queue_critical(int level)
 */
 bool cw_is_tone_queue_full(void)
 {
-	return cw_tq_is_full_internal(cw_generator->tq);
+	return cw_tq_is_full_internal(cw_default_context.gen->tq);
 }
 
 
@@ -1006,7 +1029,7 @@ bool cw_is_tone_queue_full(void)
 */
 int cw_get_tone_queue_capacity(void)
 {
-	return (int) cw_tq_get_capacity_internal(cw_generator->tq);
+	return (int) cw_tq_get_capacity_internal(cw_default_context.gen->tq);
 }
 
 
@@ -1018,7 +1041,47 @@ int cw_get_tone_queue_capacity(void)
 */
 int cw_get_tone_queue_length(void)
 {
-	return (int) cw_tq_length_internal(cw_generator->tq);
+	return (int) cw_tq_length_internal(cw_default_context.gen->tq);
+}
+
+
+
+
+
+/**
+   \brief Get file descriptor that becomes readable on tone queue's events
+
+   The descriptor can be watched by an event loop of client code
+   (e.g. with poll() or epoll), instead of polling
+   cw_get_tone_queue_length() at regular intervals. When it becomes
+   readable, call cw_read_tone_queue_events() to get the events.
+   See cw_gen_get_event_fd() for details.
+
+   \errno ENOSYS - the descriptor is not supported on this platform
+
+   \return file descriptor on success
+   \return -1 on failure
+*/
+int cw_get_tone_queue_event_fd(void)
+{
+	return cw_gen_get_event_fd(cw_default_context.gen);
+}
+
+
+
+
+
+/**
+   \brief Fetch and clear events of tone queue
+
+   See cw_get_tone_queue_event_fd(). The function never blocks.
+
+   \return CW_EVENT_* bits of events that have occurred since previous call
+   \return zero if no events have occurred
+*/
+unsigned int cw_read_tone_queue_events(void)
+{
+	return cw_gen_read_events(cw_default_context.gen);
 }
 
 
@@ -1030,20 +1093,15 @@ int cw_get_tone_queue_length(void)
 
    If there is a tone in progress, the function will wait until this
    last one has completed, then silence the tones.
-
-   This function may be called with SIGALRM blocked, in which case it
-   will empty the queue as best it can, then return without waiting for
-   the final tone to complete.  In this case, it may not be possible to
-   guarantee silence after the call.
 */
 void cw_flush_tone_queue(void)
 {
 	/* This function locks and unlocks mutex. */
-	cw_tq_flush_internal(cw_generator->tq);
+	cw_tq_flush_internal(cw_default_context.gen->tq);
 
 	/* Force silence on the speaker anyway, and stop any background
 	   soundcard tone generation. */
-	cw_gen_silence_internal(cw_generator);
+	cw_gen_silence_internal(cw_default_context.gen);
 	//cw_finalization_schedule_internal();
 
 	return;
@@ -1060,10 +1118,10 @@ void cw_flush_tone_queue(void)
 */
 void cw_reset_tone_queue(void)
 {
-	cw_tq_flush_internal(cw_generator->tq);
+	cw_tq_flush_internal(cw_default_context.gen->tq);
 
 	/* Silence sound and stop any background soundcard tone generation. */
-	cw_gen_silence_internal(cw_generator);
+	cw_gen_silence_internal(cw_default_context.gen);
 	//cw_finalization_schedule_internal();
 
 	cw_debug_msg ((&cw_debug_object), CW_DEBUG_TONE_QUEUE, CW_DEBUG_INFO,
@@ -1106,7 +1164,7 @@ int cw_queue_tone(int usecs, int frequency)
 
 	cw_tone_t tone;
 	CW_TONE_INIT(&tone, frequency, usecs, CW_SLOPE_MODE_STANDARD_SLOPES);
-	int rv = cw_tq_enqueue_internal(cw_generator->tq, &tone);
+	int rv = cw_tq_enqueue_internal(cw_default_context.gen->tq, &tone);
 
 	return rv;
 }
@@ -1140,7 +1198,7 @@ int cw_queue_tone(int usecs, int frequency)
 */
 int cw_set_receive_speed(int new_value)
 {
-	return cw_rec_set_speed(&cw_receiver, new_value);
+	return cw_rec_set_speed(cw_default_context.rec, new_value);
 }
 
 
@@ -1154,7 +1212,7 @@ int cw_set_receive_speed(int new_value)
 */
 int cw_get_receive_speed(void)
 {
-	return (int) cw_rec_get_speed(&cw_receiver);
+	return (int) cw_rec_get_speed(cw_default_context.rec);
 }
 
 
@@ -1175,7 +1233,7 @@ int cw_get_receive_speed(void)
 */
 int cw_set_tolerance(int new_value)
 {
-	return cw_rec_set_tolerance(&cw_receiver, new_value);
+	return cw_rec_set_tolerance(cw_default_context.rec, new_value);
 }
 
 
@@ -1189,7 +1247,7 @@ int cw_set_tolerance(int new_value)
 */
 int cw_get_tolerance(void)
 {
-	return cw_rec_get_tolerance(&cw_receiver);
+	return cw_rec_get_tolerance(cw_default_context.rec);
 }
 
 
@@ -1230,7 +1288,7 @@ void cw_get_receive_parameters(int *dot_usecs, int *dash_usecs,
 			       int *end_of_character_ideal_usecs,
 			       int *adaptive_threshold)
 {
-	cw_rec_get_parameters_internal(&cw_receiver,
+	cw_rec_get_parameters_internal(cw_default_context.rec,
 				       dot_usecs, dash_usecs,
 				       dot_min_usecs, dot_max_usecs,
 				       dash_min_usecs, dash_max_usecs,
@@ -1270,7 +1328,7 @@ void cw_get_receive_parameters(int *dot_usecs, int *dash_usecs,
 */
 int cw_set_noise_spike_threshold(int new_value)
 {
-	return cw_rec_set_noise_spike_threshold(&cw_receiver, new_value);
+	return cw_rec_set_noise_spike_threshold(cw_default_context.rec, new_value);
 }
 
 
@@ -1286,7 +1344,7 @@ int cw_set_noise_spike_threshold(int new_value)
 */
 int cw_get_noise_spike_threshold(void)
 {
-	return cw_rec_get_noise_spike_threshold(&cw_receiver);
+	return cw_rec_get_noise_spike_threshold(cw_default_context.rec);
 }
 
 
@@ -1313,7 +1371,7 @@ int cw_get_noise_spike_threshold(void)
 void cw_get_receive_statistics(double *dot_sd, double *dash_sd,
 			       double *element_end_sd, double *character_end_sd)
 {
-	cw_rec_get_statistics_internal(&cw_receiver, dot_sd, dash_sd,
+	cw_rec_get_statistics_internal(cw_default_context.rec, dot_sd, dash_sd,
 				       element_end_sd, character_end_sd);
 
 	return;
@@ -1331,7 +1389,7 @@ void cw_get_receive_statistics(double *dot_sd, double *dash_sd,
 */
 void cw_reset_receive_statistics(void)
 {
-	cw_rec_reset_statistics(&cw_receiver);
+	cw_rec_reset_statistics(cw_default_context.rec);
 
 	return;
 }
@@ -1355,7 +1413,7 @@ void cw_reset_receive_statistics(void)
 */
 void cw_enable_adaptive_receive(void)
 {
-	cw_rec_set_adaptive_mode_internal(&cw_receiver, true);
+	cw_rec_set_adaptive_mode_internal(cw_default_context.rec, true);
 	return;
 }
 
@@ -1370,7 +1428,7 @@ void cw_enable_adaptive_receive(void)
 */
 void cw_disable_adaptive_receive(void)
 {
-	cw_rec_set_adaptive_mode_internal(&cw_receiver, false);
+	cw_rec_set_adaptive_mode_internal(cw_default_context.rec, false);
 	return;
 }
 
@@ -1389,7 +1447,7 @@ void cw_disable_adaptive_receive(void)
 */
 bool cw_get_adaptive_receive_state(void)
 {
-	return cw_rec_get_adaptive_mode(&cw_receiver);
+	return cw_rec_get_adaptive_mode(cw_default_context.rec);
 }
 
 
@@ -1418,7 +1476,7 @@ bool cw_get_adaptive_receive_state(void)
 */
 int cw_start_receive_tone(const struct timeval *timestamp)
 {
-	return cw_rec_mark_begin(&cw_receiver, timestamp);
+	return cw_rec_mark_begin(cw_default_context.rec, timestamp);
 }
 
 
@@ -1453,7 +1511,7 @@ int cw_start_receive_tone(const struct timeval *timestamp)
 */
 int cw_end_receive_tone(const struct timeval *timestamp)
 {
-	return cw_rec_mark_end(&cw_receiver, timestamp);
+	return cw_rec_mark_end(cw_default_context.rec, timestamp);
 }
 
 
@@ -1490,7 +1548,7 @@ int cw_end_receive_tone(const struct timeval *timestamp)
 */
 int cw_receive_buffer_dot(const struct timeval *timestamp)
 {
-	return cw_rec_add_mark(&cw_receiver, timestamp, CW_DOT_REPRESENTATION);
+	return cw_rec_add_mark(cw_default_context.rec, timestamp, CW_DOT_REPRESENTATION);
 }
 
 
@@ -1509,7 +1567,7 @@ int cw_receive_buffer_dot(const struct timeval *timestamp)
 */
 int cw_receive_buffer_dash(const struct timeval *timestamp)
 {
-	return cw_rec_add_mark(&cw_receiver, timestamp, CW_DASH_REPRESENTATION);
+	return cw_rec_add_mark(cw_default_context.rec, timestamp, CW_DASH_REPRESENTATION);
 }
 
 
@@ -1565,7 +1623,7 @@ int cw_receive_representation(const struct timeval *timestamp,
 			      /* out */ bool *is_end_of_word,
 			      /* out */ bool *is_error)
 {
-	int rv = cw_rec_poll_representation(&cw_receiver,
+	int rv = cw_rec_poll_representation(cw_default_context.rec,
 					    timestamp,
 					    representation,
 					    is_end_of_word,
@@ -1620,7 +1678,7 @@ int cw_receive_character(const struct timeval *timestamp,
 			 /* out */ bool *is_end_of_word,
 			 /* out */ bool *is_error)
 {
-	int rv = cw_rec_poll_character(&cw_receiver, timestamp, c, is_end_of_word, is_error);
+	int rv = cw_rec_poll_character(cw_default_context.rec, timestamp, c, is_end_of_word, is_error);
 	return rv;
 }
 
@@ -1641,7 +1699,7 @@ int cw_receive_character(const struct timeval *timestamp,
 */
 void cw_clear_receive_buffer(void)
 {
-	cw_rec_reset_state(&cw_receiver);
+	cw_rec_reset_state(cw_default_context.rec);
 
 	return;
 }
@@ -1650,6 +1708,49 @@ void cw_clear_receive_buffer(void)
 
 
 
+/**
+   \brief Get file descriptor that becomes readable on receiver's events
+
+   Client code can watch the descriptor instead of polling the
+   receiver with cw_receive_character() at regular intervals. The
+   descriptor becomes readable when receiver detects end-of-character
+   gap (CW_EVENT_CHARACTER, a character can be received now) or
+   end-of-word gap (CW_EVENT_WORD) after a mark passed to
+   cw_end_receive_tone(). When the descriptor becomes readable, call
+   cw_read_receiver_events() to get the events. See
+   cw_rec_get_event_fd() for details.
+
+   \errno ENOSYS - the descriptor is not supported on this platform
+
+   \return file descriptor on success
+   \return -1 on failure
+*/
+int cw_get_receiver_event_fd(void)
+{
+	return cw_rec_get_event_fd(cw_default_context.rec);
+}
+
+
+
+
+
+/**
+   \brief Fetch and clear events of receiver
+
+   See cw_get_receiver_event_fd(). The function never blocks.
+
+   \return CW_EVENT_* bits of events that have occurred since previous call
+   \return zero if no events have occurred
+*/
+unsigned int cw_read_receiver_events(void)
+{
+	return cw_rec_read_events(cw_default_context.rec);
+}
+
+
+
+
+
 /**
    \brief Get the number of elements (dots/dashes) the receiver's buffer can accommodate
 
@@ -1675,7 +1776,7 @@ int cw_get_receive_buffer_capacity(void)
 */
 int cw_get_receive_buffer_length(void)
 {
-	return cw_rec_get_buffer_length_internal(&cw_receiver);
+	return cw_rec_get_buffer_length_internal(cw_default_context.rec);
 }
 
 
@@ -1691,7 +1792,7 @@ int cw_get_receive_buffer_length(void)
 */
 void cw_reset_receive(void)
 {
-	cw_rec_reset_state(&cw_receiver);
+	cw_rec_reset_state(cw_default_context.rec);
 
 	return;
 }
@@ -1729,7 +1830,7 @@ void cw_reset_receive(void)
 */
 void cw_register_keying_callback(void (*callback_func)(void*, int), void *callback_arg)
 {
-	cw_key_register_legacy_keying_callback_internal(&cw_key, callback_func, callback_arg);
+	cw_key_register_legacy_keying_callback_internal(cw_default_context.key, callback_func, callback_arg);
 	return;
 }
 
@@ -1750,7 +1851,7 @@ void cw_register_keying_callback(void (*callback_func)(void*, int), void *callba
 */
 void cw_enable_iambic_curtis_mode_b(void)
 {
-	cw_key_ik_enable_curtis_mode_b(&cw_key);
+	cw_key_ik_enable_curtis_mode_b(cw_default_context.key);
 	return;
 }
 
@@ -1763,7 +1864,7 @@ void cw_enable_iambic_curtis_mode_b(void)
 */
 void cw_disable_iambic_curtis_mode_b(void)
 {
-	cw_key_ik_disable_curtis_mode_b(&cw_key);
+	cw_key_ik_disable_curtis_mode_b(cw_default_context.key);
 	return;
 }
 
@@ -1776,7 +1877,7 @@ void cw_disable_iambic_curtis_mode_b(void)
 */
 int cw_get_iambic_curtis_mode_b_state(void)
 {
-	return (int) cw_key_ik_get_curtis_mode_b(&cw_key);
+	return (int) cw_key_ik_get_curtis_mode_b(cw_default_context.key);
 }
 
 
@@ -1810,7 +1911,7 @@ int cw_get_iambic_curtis_mode_b_state(void)
 */
 int cw_notify_keyer_paddle_event(int dot_paddle_state, int dash_paddle_state)
 {
-	return cw_key_ik_notify_paddle_event(&cw_key, dot_paddle_state, dash_paddle_state);
+	return cw_key_ik_notify_paddle_event(cw_default_context.key, dot_paddle_state, dash_paddle_state);
 }
 
 
@@ -1830,7 +1931,7 @@ int cw_notify_keyer_paddle_event(int dot_paddle_state, int dash_paddle_state)
 */
 int cw_notify_keyer_dot_paddle_event(int dot_paddle_state)
 {
-	return cw_notify_keyer_paddle_event(dot_paddle_state, cw_key.ik.dash_paddle);
+	return cw_key_ik_notify_dot_paddle_event(cw_default_context.key, dot_paddle_state);
 }
 
 
@@ -1842,7 +1943,7 @@ int cw_notify_keyer_dot_paddle_event(int dot_paddle_state)
 */
 int cw_notify_keyer_dash_paddle_event(int dash_paddle_state)
 {
-	return cw_notify_keyer_paddle_event(cw_key.ik.dot_paddle, dash_paddle_state);
+	return cw_key_ik_notify_dash_paddle_event(cw_default_context.key, dash_paddle_state);
 }
 
 
@@ -1857,7 +1958,7 @@ int cw_notify_keyer_dash_paddle_event(int dash_paddle_state)
 */
 void cw_get_keyer_paddles(int *dot_paddle_state, int *dash_paddle_state)
 {
-	cw_key_ik_get_paddles(&cw_key, dot_paddle_state, dash_paddle_state);
+	cw_key_ik_get_paddles(cw_default_context.key, dot_paddle_state, dash_paddle_state);
 	return;
 }
 
@@ -1878,7 +1979,7 @@ void cw_get_keyer_paddles(int *dot_paddle_state, int *dash_paddle_state)
 */
 void cw_get_keyer_paddle_latches(int *dot_paddle_latch_state, int *dash_paddle_latch_state)
 {
-	cw_key_ik_get_paddle_latches_internal(&cw_key, dot_paddle_latch_state, dash_paddle_latch_state);
+	cw_key_ik_get_paddle_latches_internal(cw_default_context.key, dot_paddle_latch_state, dash_paddle_latch_state);
 	return;
 }
 
@@ -1894,7 +1995,7 @@ void cw_get_keyer_paddle_latches(int *dot_paddle_latch_state, int *dash_paddle_l
 */
 bool cw_is_keyer_busy(void)
 {
-	return cw_key_ik_is_busy_internal(&cw_key);
+	return cw_key_ik_is_busy_internal(cw_default_context.key);
 }
 
 
@@ -1906,15 +2007,12 @@ bool cw_is_keyer_busy(void)
 
    Waits until the end of the current element, dot or dash, from the keyer.
 
-   On error the function returns CW_FAILURE, with errno set to
-   EDEADLK if SIGALRM is blocked.
-
    \return CW_SUCCESS on success
    \return CW_FAILURE on failure
 */
 int cw_wait_for_keyer_element(void)
 {
-	return cw_key_ik_wait_for_element(&cw_key);
+	return cw_key_ik_wait_for_element(cw_default_context.key);
 }
 
 
@@ -1925,15 +2023,15 @@ int cw_wait_for_keyer_element(void)
    \brief Wait for the current keyer cycle to complete
 
    The routine returns CW_SUCCESS on success.  On error, it returns
-   CW_FAILURE, with errno set to EDEADLK if SIGALRM is blocked or if
-   either paddle state is true.
+   CW_FAILURE, with errno set to EDEADLK if either paddle state is
+   true.
 
    \return CW_SUCCESS on success
    \return CW_FAILURE on failure
 */
 int cw_wait_for_keyer(void)
 {
-	return cw_key_ik_wait_for_keyer(&cw_key);
+	return cw_key_ik_wait_for_keyer(cw_default_context.key);
 }
 
 
@@ -1949,45 +2047,9 @@ int cw_wait_for_keyer(void)
 */
 void cw_reset_keyer(void)
 {
-	cw_key_ik_reset_internal(&cw_key);
-	return;
-}
-
-
-
-
-
-#if 0 /* unused */
-/* Period of constant tone generation after which we need another timeout,
-   to ensure that the soundcard doesn't run out of data. */
-static const int STRAIGHT_KEY_TIMEOUT = 500000;
-
-
-
-
-
-/**
-   \brief Generate a tone while straight key is down
-
-   Soundcard tone data is only buffered to last about a second on each
-   cw_generate_sound_internal() call, and holding down the straight key
-   for longer than this could cause a soundcard data underrun.  To guard
-   against this, a timeout is generated every half-second or so while the
-   straight key is down.  The timeout generates a chunk of sound data for
-   the soundcard.
-*/
-void cw_straight_key_clock_internal(void)
-{
-	if (cw_straight_key->key_value == CW_KEY_STATE_CLOSED) {
-		/* Generate a quantum of tone data, and request another
-		   timeout. */
-		// cw_generate_sound_internal();
-		cw_timer_run_with_handler_internal(STRAIGHT_KEY_TIMEOUT, NULL);
-	}
-
+	cw_key_ik_reset_internal(cw_default_context.key);
 	return;
 }
-#endif
 
 
 
@@ -2007,7 +2069,7 @@ void cw_straight_key_clock_internal(void)
 */
 int cw_notify_straight_key_event(int key_state)
 {
-	return cw_key_sk_notify_event(&cw_key, key_state);
+	return cw_key_sk_notify_event(cw_default_context.key, key_state);
 }
 
 
@@ -2024,7 +2086,7 @@ int cw_notify_straight_key_event(int key_state)
 */
 int cw_get_straight_key_state(void)
 {
-	return cw_key_sk_get_value(&cw_key);
+	return cw_key_sk_get_value(cw_default_context.key);
 }
 
 
@@ -2042,7 +2104,7 @@ int cw_get_straight_key_state(void)
 */
 bool cw_is_straight_key_busy(void)
 {
-	return cw_key_sk_is_busy(&cw_key);
+	return cw_key_sk_is_busy(cw_default_context.key);
 }
 
 
@@ -2056,6 +2118,6 @@ bool cw_is_straight_key_busy(void)
 */
 void cw_reset_straight_key(void)
 {
-	cw_key_sk_reset_internal(&cw_key);
+	cw_key_sk_reset_internal(cw_default_context.key);
 	return;
 }
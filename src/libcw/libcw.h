@@ -28,6 +28,7 @@
 
 
 static const int        CW_AUDIO_CHANNELS = 1;                /* Sound in mono */
+#define CW_AUDIO_CHANNELS_MAX 8                                 /* Upper limit of channels in generator's output */
 
 
 #if defined(__cplusplus)
@@ -48,7 +49,8 @@ enum cw_audio_systems {
 	CW_AUDIO_OSS,
 	CW_AUDIO_ALSA,
 	CW_AUDIO_PA,        /* PulseAudio */
-	CW_AUDIO_SOUNDCARD  /* OSS, ALSA or PulseAudio (PA) */
+	CW_AUDIO_SOUNDCARD, /* OSS, ALSA or PulseAudio (PA) */
+	CW_AUDIO_JACK       /* JACK, or PipeWire's JACK interface */
 };
 
 enum {
@@ -59,6 +61,12 @@ enum {
 
 typedef int16_t cw_sample_t;
 
+/* Formats of samples produced by generator. */
+enum cw_sample_formats {
+	CW_SAMPLE_FORMAT_S16 = 0,  /* cw_sample_t: signed 16 bit, native endianness (default) */
+	CW_SAMPLE_FORMAT_FLOAT     /* float: 32 bit, native endianness, range <-1.0; 1.0> */
+};
+
 
 
 /* Default outputs for audio systems. Used by libcw unless
@@ -68,6 +76,7 @@ typedef int16_t cw_sample_t;
 #define CW_DEFAULT_OSS_DEVICE       "/dev/audio"
 #define CW_DEFAULT_ALSA_DEVICE      "default"
 #define CW_DEFAULT_PA_DEVICE        "( default )"
+#define CW_DEFAULT_JACK_DEVICE      "( default )"
 
 
 /* Limits on values of CW send and timing parameters */
@@ -83,6 +92,9 @@ typedef int16_t cw_sample_t;
 #define CW_VOLUME_MAX          100   /* Loudest volume allowed */
 #define CW_VOLUME_INITIAL       70   /* Initial volume percent */
 #define CW_VOLUME_STEP           1
+#define CW_PAN_MIN            -100   /* First channel only */
+#define CW_PAN_MAX             100   /* Last channel only */
+#define CW_PAN_INITIAL           0   /* Center of sound stage */
 #define CW_GAP_MIN               0   /* Lowest extra gap allowed */
 #define CW_GAP_MAX              60   /* Highest extra gap allowed */
 #define CW_GAP_INITIAL           0   /* Initial gap setting */
@@ -292,6 +304,7 @@ extern bool cw_is_console_possible(const char *device);
 extern bool cw_is_oss_possible(const char *device);
 extern bool cw_is_alsa_possible(const char *device);
 extern bool cw_is_pa_possible(const char *device);
+extern bool cw_is_jack_possible(const char *device);
 
 
 
@@ -325,6 +338,21 @@ extern void cw_flush_tone_queue(void);
 extern int  cw_queue_tone(int usecs, int frequency);
 extern void cw_reset_tone_queue(void);
 
+/* Events reported through file descriptors of generators and
+   receivers, see cw_get_tone_queue_event_fd(),
+   cw_get_receiver_event_fd(), cw_gen_get_event_fd() and
+   cw_rec_get_event_fd(). */
+enum {
+	CW_EVENT_LOW_WATER  = 1 << 0,  /* Generator: tone queue has dropped to low water mark. */
+	CW_EVENT_TONE       = 1 << 1,  /* Generator: tone has been dequeued. */
+	CW_EVENT_KEYER_IDLE = 1 << 2,  /* Generator or receiver of iambic keyer: keyer has become idle. */
+	CW_EVENT_CHARACTER  = 1 << 3,  /* Receiver: end-of-character gap, a character can be polled. */
+	CW_EVENT_WORD       = 1 << 4   /* Receiver: end-of-word gap. */
+};
+
+extern int          cw_get_tone_queue_event_fd(void);
+extern unsigned int cw_read_tone_queue_events(void);
+
 
 
 /* Sending */
@@ -382,6 +410,11 @@ extern int cw_receive_character(const struct timeval *timestamp,
    space in the receiver's buffer for next character. */
 extern void cw_clear_receive_buffer(void);
 
+/* Notification alternative to the polling: descriptor becomes
+   readable on end-of-character and end-of-word gaps (CW_EVENT_*). */
+extern int          cw_get_receiver_event_fd(void);
+extern unsigned int cw_read_receiver_events(void);
+
 extern int cw_get_receive_buffer_capacity(void);
 extern int cw_get_receive_buffer_length(void);
 extern void cw_reset_receive(void);
@@ -5,6 +5,8 @@
 
 
 #include "libcw_gen.h"
+#include "libcw_context.h"
+#include "libcw_input.h"
 
 
 
@@ -32,18 +34,25 @@ cw_ret cw_get_package_version(int * major, int * minor, int * maintenance);
 
 /* Basic generator functions. */
 cw_gen_t * cw_gen_new(int audio_system, const char * device);
+cw_gen_t * cw_gen_new_with_format(int audio_system, const char * device, int sample_format, int n_channels);
 void       cw_gen_delete(cw_gen_t ** gen);
 int        cw_gen_stop(cw_gen_t * gen);
 int        cw_gen_start(cw_gen_t * gen);
 
 int cw_gen_set_tone_slope(cw_gen_t * gen, int slope_shape, int slope_len);
 
+/* Pull mode: client code asks generator for samples. */
+int cw_gen_set_sample_rate(cw_gen_t * gen, int sample_rate);
+int cw_gen_fill(cw_gen_t * gen, void * samples, size_t n_samples);
+int cw_gen_fill_queued(cw_gen_t * gen, void * samples, size_t n_samples, size_t * n_rendered);
+
 /* Setters of generator's basic parameters. */
 int cw_gen_set_speed(cw_gen_t * gen, int new_value);
 int cw_gen_set_frequency(cw_gen_t * gen, int new_value);
 int cw_gen_set_volume(cw_gen_t * gen, int new_value);
 int cw_gen_set_gap(cw_gen_t * gen, int new_value);
 int cw_gen_set_weighting(cw_gen_t * gen, int new_value);
+int cw_gen_set_pan(cw_gen_t * gen, int new_value);
 
 
 /* Getters of generator's basic parameters. */
@@ -52,6 +61,7 @@ int cw_gen_get_frequency(const cw_gen_t * gen);
 int cw_gen_get_volume(const cw_gen_t * gen);
 int cw_gen_get_gap(const cw_gen_t * gen);
 int cw_gen_get_weighting(const cw_gen_t * gen);
+int cw_gen_get_pan(const cw_gen_t * gen);
 
 int cw_gen_enqueue_character(cw_gen_t * gen, char c);
 int cw_gen_enqueue_string(cw_gen_t * gen, const char * string);
@@ -65,6 +75,20 @@ int cw_gen_register_low_level_callback(cw_gen_t * gen, cw_queue_low_callback_t c
 int cw_gen_wait_for_tone(cw_gen_t * gen);
 bool cw_gen_is_queue_full(cw_gen_t const * gen);
 
+/* Pollable file descriptor of generator's events (CW_EVENT_*). */
+int          cw_gen_get_event_fd(cw_gen_t * gen);
+unsigned int cw_gen_read_events(cw_gen_t * gen);
+
+/* Starting tones at given time. */
+int cw_gen_enqueue_start_time(cw_gen_t * gen, clockid_t clock_id, const struct timespec * start);
+int cw_gen_get_start_error(cw_gen_t * gen, int64_t * error);
+int cw_gen_get_output_latency(cw_gen_t * gen, int64_t * latency);
+
+/* Measuring latency of key events. */
+int cw_gen_set_latency_probe(cw_gen_t * gen, bool enable);
+int cw_gen_set_latency_probe_edge(cw_gen_t * gen, int key_state);
+int cw_gen_get_latency_sample(cw_gen_t * gen, cw_latency_sample_t * sample);
+
 
 
 
@@ -78,6 +102,12 @@ void cw_key_register_receiver(volatile cw_key_t * key, cw_rec_t * rec);
 void cw_key_ik_enable_curtis_mode_b(volatile cw_key_t * key);
 void cw_key_ik_disable_curtis_mode_b(volatile cw_key_t * key);
 bool cw_key_ik_get_curtis_mode_b(const volatile cw_key_t * key);
+int  cw_key_ik_set_mode(volatile cw_key_t * key, int mode);
+int  cw_key_ik_get_mode(const volatile cw_key_t * key);
+int  cw_key_ik_set_memory(volatile cw_key_t * key, bool dot_memory, bool dash_memory, int window);
+void cw_key_ik_get_memory(const volatile cw_key_t * key, bool * dot_memory, bool * dash_memory, int * window);
+int  cw_key_ik_set_speed(volatile cw_key_t * key, int new_value);
+int  cw_key_ik_get_speed(const volatile cw_key_t * key);
 int  cw_key_ik_notify_paddle_event(volatile cw_key_t * key, int dot_paddle_state, int dash_paddle_state);
 int  cw_key_ik_notify_dash_paddle_event(volatile cw_key_t * key, int dash_paddle_state);
 int  cw_key_ik_notify_dot_paddle_event(volatile cw_key_t * key, int dot_paddle_state);
@@ -129,6 +159,31 @@ int  cw_rec_poll_representation(cw_rec_t * rec, const struct timeval * timestamp
 void cw_rec_enable_adaptive_mode(cw_rec_t * rec);
 void cw_rec_disable_adaptive_mode(cw_rec_t * rec);
 bool cw_rec_poll_is_pending_inter_word_space(cw_rec_t const * rec);
+void cw_rec_register_gap_callback(cw_rec_t * rec, cw_rec_gap_callback_t callback_func, void * callback_arg);
+
+/* Pollable file descriptor of receiver's events (CW_EVENT_*). */
+int          cw_rec_get_event_fd(cw_rec_t * rec);
+unsigned int cw_rec_read_events(cw_rec_t * rec);
+
+
+
+
+/* Input drivers: paddles and straight keys connected to evdev device or serial port. */
+cw_input_t * cw_input_new(int type, const char * device);
+void         cw_input_delete(cw_input_t ** input);
+int          cw_input_set_mapping(cw_input_t * input, int dot_code, int dash_code);
+int          cw_input_register_key(cw_input_t * input, volatile cw_key_t * key, int key_mode);
+int          cw_input_start(cw_input_t * input);
+int          cw_input_stop(cw_input_t * input);
+
+
+
+
+/* Library context: generator, receiver and key of one station. */
+cw_context_t * cw_context_new(void);
+void           cw_context_delete(cw_context_t ** context);
+int            cw_context_generator_new(cw_context_t * context, int audio_system, const char * device);
+void           cw_context_generator_delete(cw_context_t * context);
 
 
 
@@ -76,6 +76,7 @@ extern const unsigned int cw_supported_sample_rates[];
 
 /* Constants specific to ALSA audio system configuration */
 static const snd_pcm_format_t CW_ALSA_SAMPLE_FORMAT = SND_PCM_FORMAT_S16; /* "Signed 16 bit CPU endian"; I'm guessing that "CPU endian" == "native endianess" */
+static const snd_pcm_format_t CW_ALSA_SAMPLE_FORMAT_FLOAT = SND_PCM_FORMAT_FLOAT; /* "Float 32 bit CPU endian". */
 
 
 static int  cw_alsa_set_hw_params_internal(cw_gen_t *gen, snd_pcm_hw_params_t * hw_params);
@@ -108,6 +109,7 @@ static struct {
 	int (* snd_pcm_prepare)(snd_pcm_t *pcm);
 	int (* snd_pcm_drop)(snd_pcm_t *pcm);
 	snd_pcm_sframes_t (* snd_pcm_writei)(snd_pcm_t *pcm, const void *buffer, snd_pcm_uframes_t size);
+	int (* snd_pcm_delay)(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp); /* Optional. */
 
 	const char *(* snd_strerror)(int errnum);
 
@@ -130,6 +132,7 @@ static struct {
 	.snd_pcm_prepare = NULL,
 	.snd_pcm_drop = NULL,
 	.snd_pcm_writei = NULL,
+	.snd_pcm_delay = NULL,
 
 	.snd_strerror = NULL,
 
@@ -244,6 +247,20 @@ int cw_alsa_write_internal(cw_gen_t *gen)
 	   ALSA's period, so there should be no underruns */
 	int rv = cw_alsa.snd_pcm_writei(gen->alsa_data.handle, gen->buffer, gen->buffer_n_samples);
 	rv = cw_alsa_debug_evaluate_write_internal(gen, rv); /* TODO: fix reusing rv variable. */
+
+	/* Samples written now will be played after ALSA's current
+	   delay. Start-time scheduling and latency probe depend
+	   on it. */
+	snd_pcm_sframes_t delay = 0;
+	if (CW_SUCCESS == rv
+	    && cw_alsa.snd_pcm_delay
+	    && 0 == cw_alsa.snd_pcm_delay(gen->alsa_data.handle, &delay)) {
+
+		if (delay < 0) {
+			delay = 0;
+		}
+		cw_gen_set_output_latency_internal(gen, (int64_t) delay * CW_USECS_PER_SEC / gen->sample_rate);
+	}
 	/*
 	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_INFO,
 		      MSG_PREFIX "write: written %d/%d samples", rv, gen->buffer_n_samples);
@@ -431,7 +448,8 @@ int cw_alsa_set_hw_params_internal(cw_gen_t *gen, snd_pcm_hw_params_t *hw_params
 
 
 	/* Set the sample format */
-	rv = cw_alsa.snd_pcm_hw_params_set_format(gen->alsa_data.handle, hw_params, CW_ALSA_SAMPLE_FORMAT);
+	const snd_pcm_format_t format = gen->sample_format == CW_SAMPLE_FORMAT_FLOAT ? CW_ALSA_SAMPLE_FORMAT_FLOAT : CW_ALSA_SAMPLE_FORMAT;
+	rv = cw_alsa.snd_pcm_hw_params_set_format(gen->alsa_data.handle, hw_params, format);
 	if (rv < 0) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "set hw params: can't set sample format: %s", cw_alsa.snd_strerror(rv));
@@ -478,7 +496,7 @@ int cw_alsa_set_hw_params_internal(cw_gen_t *gen, snd_pcm_hw_params_t *hw_params
 	}
 
 	/* Set number of channels */
-	rv = cw_alsa.snd_pcm_hw_params_set_channels(gen->alsa_data.handle, hw_params, CW_AUDIO_CHANNELS);
+	rv = cw_alsa.snd_pcm_hw_params_set_channels(gen->alsa_data.handle, hw_params, gen->n_channels);
 	if (rv < 0) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "set hw params: can't set number of channels: %s", cw_alsa.snd_strerror(rv));
@@ -773,6 +791,9 @@ static int cw_alsa_dlsym_internal(void *handle)
 	*(void **) &(cw_alsa.snd_pcm_hw_params_get_buffer_size)      = dlsym(handle, "snd_pcm_hw_params_get_buffer_size");
 	if (!cw_alsa.snd_pcm_hw_params_get_buffer_size)     { return -30; }
 
+	/* Not required: without it output latency is just unknown. */
+	*(void **) &(cw_alsa.snd_pcm_delay) = dlsym(handle, "snd_pcm_delay");
+
 	return 0;
 }
 
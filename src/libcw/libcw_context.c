@@ -0,0 +1,204 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+/**
+   \file libcw_context.c
+
+   \brief Library context: generator, receiver and key of one station.
+
+   A context owns a generator, a receiver and a key, and binds them
+   together the way the legacy API (libcw.h) binds its global
+   generator, receiver and key. Many contexts can be used in one
+   process, each of them by its own threads, without any state or
+   locks shared between them: each context has also its own timer
+   wheel (see libcw_timer.c) that times its receiver and its
+   generator-less keyer.
+
+   The legacy API is implemented as a set of wrappers over a default
+   context, see cw_context_default_internal() in libcw.c.
+*/
+
+
+
+
+#include <errno.h>
+#include <stdlib.h>
+
+
+
+
+#include "libcw2.h"
+#include "libcw_context.h"
+#include "libcw_debug.h"
+
+
+
+
+#define MSG_PREFIX "libcw/context: "
+
+
+
+
+/* From libcw_debug.c. */
+extern cw_debug_t cw_debug_object;
+extern cw_debug_t cw_debug_object_ev;
+extern cw_debug_t cw_debug_object_dev;
+
+
+
+
+/**
+   \brief Create new context
+
+   The context has a receiver and a key, bound together. Use
+   cw_context_generator_new() to add a generator to the context.
+
+   \errno ENOMEM - failed to allocate memory
+
+   \return pointer to new context on success
+   \return NULL on failure
+*/
+cw_context_t * cw_context_new(void)
+{
+	cw_context_t * context = (cw_context_t *) calloc(1, sizeof (cw_context_t));
+	if (!context) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: calloc()");
+		errno = ENOMEM;
+		return (cw_context_t *) NULL;
+	}
+
+	context->rec = cw_rec_new();
+	context->key = cw_key_new();
+	context->wheel = cw_timer_wheel_new_internal();
+	if (!context->rec || !context->key || !context->wheel) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: failed to create receiver, key or timer wheel");
+		cw_context_delete(&context);
+		errno = ENOMEM;
+		return (cw_context_t *) NULL;
+	}
+
+	cw_timer_set_wheel_internal(&context->rec->gap_timer, context->wheel);
+	cw_timer_set_wheel_internal(&context->key->ik.timing->timer, context->wheel);
+
+	cw_key_register_receiver(context->key, context->rec);
+
+	return context;
+}
+
+
+
+
+/**
+   \brief Delete context
+
+   Generator, receiver and key of the context are deleted together
+   with the context. Pointer to \p context is set to NULL.
+
+   \param context - pointer to context
+*/
+void cw_context_delete(cw_context_t ** context)
+{
+	cw_assert (context, MSG_PREFIX "delete: context is NULL");
+
+	if (!*context) {
+		return;
+	}
+
+	cw_context_generator_delete(*context);
+	cw_key_delete(&(*context)->key);
+	cw_rec_delete(&(*context)->rec);
+	/* Key and receiver have canceled their timers, so the
+	   wheel's thread can be stopped now. */
+	cw_timer_wheel_delete_internal(&(*context)->wheel);
+
+	free(*context);
+	*context = (cw_context_t *) NULL;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Create generator of context
+
+   The generator is registered with context's key. The function
+   doesn't start the generator, use cw_gen_start() for this.
+
+   See cw_gen_new() for description of \p audio_system and \p device.
+
+   \errno EEXIST - context already has a generator
+
+   \param context - context
+   \param audio_system - audio system to be used by the generator
+   \param device - name of audio device to be used; if NULL then library will use default device.
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_context_generator_new(cw_context_t * context, int audio_system, const char * device)
+{
+	if (context->gen) {
+		errno = EEXIST;
+		return CW_FAILURE;
+	}
+
+	context->gen = cw_gen_new(audio_system, device);
+	if (!context->gen) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "can't create generator");
+		return CW_FAILURE;
+	}
+
+	/* For some (all?) applications a key needs to have some
+	   generator associated with it. */
+	cw_key_register_generator(context->key, context->gen);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Delete generator of context
+
+   The generator is stopped if necessary, and unregistered from
+   context's key. It's not an error to call the function for a
+   context without generator.
+
+   \param context - context
+*/
+void cw_context_generator_delete(cw_context_t * context)
+{
+	if (!context->gen) {
+		return;
+	}
+
+	if (context->key && context->key->gen == context->gen) {
+		context->key->gen = (cw_gen_t *) NULL;
+	}
+	cw_gen_delete(&context->gen);
+
+	return;
+}
@@ -0,0 +1,49 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_CONTEXT
+#define H_LIBCW_CONTEXT
+
+
+
+
+#include "libcw_gen.h"
+#include "libcw_key.h"
+#include "libcw_rec.h"
+#include "libcw_timer.h"
+
+
+
+
+/* One "station": a generator, a receiver and a key bound
+   together. Stations in separate contexts share no state, so a
+   process can run many of them at the same time.
+
+   Legacy cw_* functions from libcw.h operate on a default context,
+   owned by the library. */
+struct cw_context_struct {
+	/* Generator is created separately (it needs an audio
+	   system), see cw_context_generator_new(). */
+	cw_gen_t * gen;
+	cw_rec_t * rec;
+	cw_key_t * key;
+
+	/* Timer wheel of receiver's gap timer and of timer of key
+	   that has no generator. NULL in default context: legacy API
+	   uses libcw's default wheel. */
+	cw_timer_wheel_t * wheel;
+};
+
+typedef struct cw_context_struct cw_context_t;
+
+
+
+
+cw_context_t * cw_context_default_internal(void);
+
+
+
+
+#endif /* #ifndef H_LIBCW_CONTEXT */
@@ -38,6 +38,7 @@
 
 
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <limits.h> /* UCHAR_MAX */
@@ -67,6 +68,42 @@ extern cw_debug_t cw_debug_object_dev;
 
 
 
+/* Entry of procedural signals table (CW_PROSIGN_TABLE). */
+typedef struct {
+	const char character;            /* Character represented */
+	const char *const expansion;     /* Procedural expansion of the character */
+	const bool is_usually_expanded;  /* If expanded display is usual */
+} cw_prosign_entry_t;
+
+
+
+
+/* Fast lookup tables giving direct access to entries of CW_TABLE
+   and CW_PROSIGN_TABLE, and counts and lengths derived from the
+   tables. They are filled exactly once, by
+   cw_data_lookup_init_internal() called through pthread_once(), and
+   are read-only afterwards, so lookup functions may be called
+   concurrently from threads of many generators and receivers. */
+static struct {
+	const cw_entry_t * by_character[UCHAR_MAX + 1];
+	const cw_entry_t * by_hash[UCHAR_MAX + 1];
+	bool by_hash_is_complete;   /* Set to false if there are any lookup table entries not in the fast lookup table. */
+	const cw_prosign_entry_t * prosign_by_character[UCHAR_MAX + 1];
+
+	int character_count;
+	int maximum_representation_length;
+	int procedural_character_count;
+	int maximum_procedural_expansion_length;
+	int maximum_phonetic_length;
+} cw_data_lookup;
+
+static pthread_once_t cw_data_lookup_once = PTHREAD_ONCE_INIT;
+
+static void cw_data_lookup_init_internal(void);
+
+
+
+
 /*
   Morse code characters table.  This table allows lookup of the Morse
   representation of a given alphanumeric character.  Representations
@@ -149,15 +186,8 @@ const cw_entry_t CW_TABLE[] = { /* TODO: make it accessible through function onl
 */
 int cw_get_character_count(void)
 {
-	static int character_count = 0;
-
-	if (character_count == 0) {
-		for (const cw_entry_t *cw_entry = CW_TABLE; cw_entry->character; cw_entry++) {
-			character_count++;
-		}
-	}
-
-	return character_count;
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	return cw_data_lookup.character_count;
 }
 
 
@@ -216,19 +246,8 @@ void cw_list_characters(char *list)
 */
 int cw_get_maximum_representation_length(void)
 {
-	static int maximum_length = 0;
-
-	if (maximum_length == 0) {
-		/* Traverse the main lookup table, finding the longest representation. */
-		for (const cw_entry_t *cw_entry = CW_TABLE; cw_entry->character; cw_entry++) {
-			int length = (int) strlen(cw_entry->representation);
-			if (length > maximum_length) {
-				maximum_length = length;
-			}
-		}
-	}
-
-	return maximum_length;
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	return cw_data_lookup.maximum_representation_length;
 }
 
 
@@ -254,21 +273,9 @@ int cw_get_maximum_representation_length(void)
 */
 const char *cw_character_to_representation_internal(int c)
 {
-	static const cw_entry_t *lookup[UCHAR_MAX];  /* Fast lookup table */
-	static bool is_initialized = false;
-
-	/* If this is the first call, set up the fast lookup table to give
-	   direct access to the CW table for a given character. */
-	if (!is_initialized) {
-		cw_debug_msg (&cw_debug_object, CW_DEBUG_LOOKUPS, CW_DEBUG_INFO,
-			      MSG_PREFIX "initializing fast lookup table");
-
-		for (const cw_entry_t *cw_entry = CW_TABLE; cw_entry->character; cw_entry++) {
-			lookup[(unsigned char) cw_entry->character] = cw_entry;
-		}
-
-		is_initialized = true;
-	}
+	/* If this is the first call, set up the fast lookup tables. */
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	const cw_entry_t * const * lookup = cw_data_lookup.by_character;
 
 	/* There is no differentiation in the lookup and
 	   representation table between upper and lower case
@@ -280,7 +287,7 @@ const char *cw_character_to_representation_internal(int c)
 	/* Now use the table to lookup the table entry.  Unknown characters
 	   return NULL, courtesy of the fact that explicitly uninitialized
 	   static variables are initialized to zero, so lookup[x] is NULL
-	   if it's not assigned to in the above loop. */
+	   if it's not assigned to in cw_data_lookup_init_internal(). */
 	const cw_entry_t *cw_entry = lookup[(unsigned char) c];
 
 	if (cw_debug_has_flag((&cw_debug_object), CW_DEBUG_LOOKUPS)) {
@@ -465,20 +472,10 @@ uint8_t cw_representation_to_hash_internal(const char *representation)
 */
 int cw_representation_to_character_internal(const char *representation)
 {
-	static const cw_entry_t *lookup[UCHAR_MAX];   /* Fast lookup table */
-	static bool is_complete = true;               /* Set to false if there are any
-							 lookup table entries not in
-							 the fast lookup table */
-	static bool is_initialized = false;
-
-	/* If this is the first call, set up the fast lookup table to give direct
-	   access to the CW table for a hashed representation. */
-	if (!is_initialized) {
-		cw_debug_msg (&cw_debug_object, CW_DEBUG_LOOKUPS, CW_DEBUG_INFO,
-			      MSG_PREFIX "initialize hash lookup table");
-		is_complete = cw_representation_lookup_init_internal(lookup);
-		is_initialized = true;
-	}
+	/* If this is the first call, set up the fast lookup tables. */
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	const cw_entry_t * const * lookup = cw_data_lookup.by_hash;
+	const bool is_complete = cw_data_lookup.by_hash_is_complete;
 
 	/* Hash the representation to get an index for the fast lookup. */
 	uint8_t hash = cw_representation_to_hash_internal(representation);
@@ -825,15 +822,6 @@ int cw_representation_to_character(const char *representation)
 /* Ancillary procedural signals table.  This table maps procedural signal
    characters in the main table to their expansions, along with a flag noting
    if the character is usually expanded for display. */
-typedef struct {
-	const char character;            /* Character represented */
-	const char *const expansion;     /* Procedural expansion of the character */
-	const bool is_usually_expanded;  /* If expanded display is usual */
-} cw_prosign_entry_t;
-
-
-
-
 static const cw_prosign_entry_t CW_PROSIGN_TABLE[] = {
 	/* Standard procedural signals */
 	{'"', "AF",  false},   {'\'', "WG", false},  {'$', "SX",  false},
@@ -867,16 +855,8 @@ static const cw_prosign_entry_t CW_PROSIGN_TABLE[] = {
 */
 int cw_get_procedural_character_count(void)
 {
-	static int character_count = 0;
-
-	if (character_count == 0) {
-
-		for (const cw_prosign_entry_t *e = CW_PROSIGN_TABLE; e->character; e++) {
-			character_count++;
-		}
-	}
-
-	return character_count;
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	return cw_data_lookup.procedural_character_count;
 }
 
 
@@ -924,19 +904,8 @@ void cw_list_procedural_characters(char *list)
 */
 int cw_get_maximum_procedural_expansion_length(void)
 {
-	static size_t maximum_length = 0;
-
-	if (maximum_length == 0) {
-		/* Traverse the prosign table, finding the longest expansion. */
-		for (const cw_prosign_entry_t *e = CW_PROSIGN_TABLE; e->character; e++) {
-			size_t length = strlen(e->expansion);
-			if (length > maximum_length) {
-				maximum_length = length;
-			}
-		}
-	}
-
-	return (int) maximum_length;
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	return cw_data_lookup.maximum_procedural_expansion_length;
 }
 
 
@@ -960,22 +929,9 @@ int cw_get_maximum_procedural_expansion_length(void)
 */
 const char *cw_lookup_procedural_character_internal(int c, bool *is_usually_expanded)
 {
-	static const cw_prosign_entry_t *lookup[UCHAR_MAX];  /* Fast lookup table. */
-	static bool is_initialized = false;
-
-	/* If this is the first call, set up the fast lookup table to
-	   give direct access to the procedural expansions table for
-	   a given character. */
-	if (!is_initialized) {
-		cw_debug_msg (&cw_debug_object, CW_DEBUG_LOOKUPS, CW_DEBUG_INFO,
-			      MSG_PREFIX "initialize prosign fast lookup table");
-
-		for (const cw_prosign_entry_t *e = CW_PROSIGN_TABLE; e->character; e++) {
-			lookup[(unsigned char) e->character] = e;
-
-			is_initialized = true;
-		}
-	}
+	/* If this is the first call, set up the fast lookup tables. */
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	const cw_prosign_entry_t * const * lookup = cw_data_lookup.prosign_by_character;
 
 	/* Lookup the procedural signal table entry.  Unknown characters
 	   return NULL.  All procedural signals are non-alphabetical, so no
@@ -1099,25 +1055,63 @@ static const char *const CW_PHONETICS[] = {
 
 
 /**
-   \brief Get maximum length of a phonetic
+   \brief Initialize fast lookup tables, counts and lengths
 
-   \return the string length of the longest phonetic in the phonetics lookup table
+   Called once per process, through pthread_once().
 */
-int cw_get_maximum_phonetic_length(void)
+static void cw_data_lookup_init_internal(void)
 {
-	static size_t maximum_length = 0;
-
-	if (maximum_length == 0) {
-		/* Traverse the phonetics table, finding the longest phonetic string. */
-		for (int phonetic = 0; CW_PHONETICS[phonetic]; phonetic++) {
-			size_t length = strlen(CW_PHONETICS[phonetic]);
-			if (length > maximum_length) {
-				maximum_length = length;
-			}
+	cw_debug_msg (&cw_debug_object, CW_DEBUG_LOOKUPS, CW_DEBUG_INFO,
+		      MSG_PREFIX "initializing fast lookup tables");
+
+	for (const cw_entry_t *cw_entry = CW_TABLE; cw_entry->character; cw_entry++) {
+		cw_data_lookup.by_character[(unsigned char) cw_entry->character] = cw_entry;
+	}
+
+	cw_data_lookup.by_hash_is_complete = CW_SUCCESS == cw_representation_lookup_init_internal(cw_data_lookup.by_hash);
+
+	for (const cw_prosign_entry_t *e = CW_PROSIGN_TABLE; e->character; e++) {
+		cw_data_lookup.prosign_by_character[(unsigned char) e->character] = e;
+	}
+
+	for (const cw_entry_t *cw_entry = CW_TABLE; cw_entry->character; cw_entry++) {
+		cw_data_lookup.character_count++;
+		const int length = (int) strlen(cw_entry->representation);
+		if (length > cw_data_lookup.maximum_representation_length) {
+			cw_data_lookup.maximum_representation_length = length;
+		}
+	}
+
+	for (const cw_prosign_entry_t *e = CW_PROSIGN_TABLE; e->character; e++) {
+		cw_data_lookup.procedural_character_count++;
+		const int length = (int) strlen(e->expansion);
+		if (length > cw_data_lookup.maximum_procedural_expansion_length) {
+			cw_data_lookup.maximum_procedural_expansion_length = length;
 		}
 	}
 
-	return (int) maximum_length;
+	for (int phonetic = 0; CW_PHONETICS[phonetic]; phonetic++) {
+		const int length = (int) strlen(CW_PHONETICS[phonetic]);
+		if (length > cw_data_lookup.maximum_phonetic_length) {
+			cw_data_lookup.maximum_phonetic_length = length;
+		}
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get maximum length of a phonetic
+
+   \return the string length of the longest phonetic in the phonetics lookup table
+*/
+int cw_get_maximum_phonetic_length(void)
+{
+	pthread_once(&cw_data_lookup_once, cw_data_lookup_init_internal);
+	return cw_data_lookup.maximum_phonetic_length;
 }
 
 
@@ -358,7 +358,7 @@ int cw_dev_debug_raw_sink_write_internal(cw_gen_t *gen)
 		gen->buffer[samples - 1] = 0x8000;
 #endif
 
-		int n_bytes = sizeof (gen->buffer[0]) * gen->buffer_n_samples;
+		int n_bytes = gen->frame_size * gen->buffer_n_samples;
 
 		int rv = write(gen->dev_raw_sink, gen->buffer, n_bytes);
 		if (rv == -1) {
@@ -0,0 +1,235 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+/**
+   \file libcw_event.c
+
+   \brief Pollable sources of events of generators and receivers.
+
+   Instead of dedicating a thread to each generator or receiver,
+   blocked in cw_gen_wait_for_queue_level() or polling receiver
+   periodically, client code can get a file descriptor from a
+   generator or receiver, and watch it with poll(), epoll or any
+   event loop, together with descriptors of thousands of other
+   objects. The descriptor becomes readable when an event has
+   occurred, and the events are then fetched with
+   cw_gen_read_events() or cw_rec_read_events().
+
+   The descriptor is an eventfd, created on first request, so
+   objects that nobody watches don't pay for it. Events of one
+   object are coalesced: until client code reads them, further
+   events only set bits in a mask, without system calls.
+*/
+
+
+
+
+#include "config.h"
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_EVENTFD_H)
+# include <sys/eventfd.h>
+#endif
+
+
+
+
+#include "libcw.h"
+#include "libcw_debug.h"
+#include "libcw_event.h"
+
+
+
+
+#define MSG_PREFIX "libcw/event: "
+
+
+
+
+extern cw_debug_t cw_debug_object;
+
+
+
+
+/**
+   \brief Initialize source of events
+
+   No file descriptor is created here, see
+   cw_event_source_get_fd_internal().
+
+   \param source - source of events
+*/
+void cw_event_source_init_internal(cw_event_source_t * source)
+{
+	source->fd = -1;
+	source->pending = 0;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Close file descriptor of source of events
+
+   \param source - source of events
+*/
+void cw_event_source_close_internal(cw_event_source_t * source)
+{
+	const int fd = __atomic_exchange_n(&source->fd, -1, __ATOMIC_ACQ_REL);
+	if (fd >= 0) {
+		close(fd);
+	}
+	source->pending = 0;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get file descriptor of source of events, create it if necessary
+
+   \errno ENOSYS - eventfd is not available on this platform
+   \errno other - errors of eventfd()
+
+   \param source - source of events
+
+   \return file descriptor on success
+   \return -1 on failure
+*/
+int cw_event_source_get_fd_internal(cw_event_source_t * source)
+{
+	int fd = __atomic_load_n(&source->fd, __ATOMIC_ACQUIRE);
+	if (fd >= 0) {
+		return fd;
+	}
+
+#if defined(HAVE_SYS_EVENTFD_H)
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "get fd: eventfd() failed: %d", errno);
+		return -1;
+	}
+
+	/* Two threads may be asking for the descriptor at the same
+	   time. Only one of them wins. */
+	int expected = -1;
+	if (!__atomic_compare_exchange_n(&source->fd, &expected, fd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		return expected;
+	}
+
+	/* Events posted before the descriptor has been created
+	   have been dropped, so there is nothing to report yet. */
+	return fd;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+
+
+/**
+   \brief Check if client code watches the source of events
+
+   \param source - source of events
+
+   \return true if file descriptor of the source has been created
+   \return false otherwise
+*/
+bool cw_event_source_is_open_internal(const cw_event_source_t * source)
+{
+	return __atomic_load_n(&source->fd, __ATOMIC_ACQUIRE) >= 0;
+}
+
+
+
+
+/**
+   \brief Report events
+
+   The function never blocks. It is a no-op if client code hasn't
+   asked for file descriptor of the source.
+
+   \param source - source of events
+   \param events - CW_EVENT_* bits
+*/
+void cw_event_source_post_internal(cw_event_source_t * source, unsigned int events)
+{
+	const int fd = __atomic_load_n(&source->fd, __ATOMIC_ACQUIRE);
+	if (fd < 0) {
+		return;
+	}
+
+	const unsigned int old = __atomic_fetch_or(&source->pending, events, __ATOMIC_ACQ_REL);
+	if (0 == old) {
+		/* First event since client code has read the events:
+		   make the descriptor readable. */
+		const uint64_t one = 1;
+		if (sizeof (one) != write(fd, &one, sizeof (one))) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_WARNING,
+				      MSG_PREFIX "post: write() failed: %d", errno);
+		}
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Fetch and clear events reported by source of events
+
+   The descriptor is drained first, and the events are fetched
+   afterwards, so no event is lost: an event posted in the meantime
+   makes the descriptor readable again. Therefore the function may
+   occasionally return no events for readable descriptor.
+
+   \param source - source of events
+
+   \return CW_EVENT_* bits, zero if there are no events
+*/
+unsigned int cw_event_source_read_internal(cw_event_source_t * source)
+{
+	const int fd = __atomic_load_n(&source->fd, __ATOMIC_ACQUIRE);
+	if (fd < 0) {
+		return 0;
+	}
+
+	uint64_t counter = 0;
+	while (-1 == read(fd, &counter, sizeof (counter)) && errno == EINTR) {
+		;
+	}
+
+	return __atomic_exchange_n(&source->pending, 0, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,49 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_EVENT
+#define H_LIBCW_EVENT
+
+
+
+
+#include <stdbool.h>
+
+
+
+
+/* CW_EVENT_* bits are defined in libcw.h, for client code. */
+#include "libcw.h"
+
+
+
+
+/* Source of events, embedded in tone queue and in receiver.
+
+   Events are accumulated as bits in 'pending'. The eventfd is
+   written to only when first event is added to empty set, so a
+   busy source doesn't make a system call for each event. */
+typedef struct {
+	int fd;                /* eventfd, -1 until client code asks for it. */
+	unsigned int pending;  /* CW_EVENT_* bits not read by client code yet. */
+} cw_event_source_t;
+
+
+#define CW_EVENT_SOURCE_INITIALIZER { .fd = -1, .pending = 0 }
+
+
+
+
+void         cw_event_source_init_internal(cw_event_source_t * source);
+void         cw_event_source_close_internal(cw_event_source_t * source);
+int          cw_event_source_get_fd_internal(cw_event_source_t * source);
+bool         cw_event_source_is_open_internal(const cw_event_source_t * source);
+void         cw_event_source_post_internal(cw_event_source_t * source, unsigned int events);
+unsigned int cw_event_source_read_internal(cw_event_source_t * source);
+
+
+
+
+#endif /* #ifndef H_LIBCW_EVENT */
@@ -63,6 +63,9 @@
 #include <signal.h>
 #include <errno.h>
 #include <inttypes.h> /* uint32_t */
+#include <limits.h>   /* INT_MAX */
+#include <time.h>     /* clock_nanosleep() */
+#include <sched.h>    /* sched_yield() */
 
 #if defined(HAVE_STRING_H)
 # include <string.h>
@@ -78,11 +81,11 @@
 #include "libcw_gen.h"
 #include "libcw_debug.h"
 #include "libcw_utils.h"
-#include "libcw_signal.h"
 #include "libcw_data.h"
 #include "libcw_null.h"
 #include "libcw_console.h"
 #include "libcw_oss.h"
+#include "libcw_timer.h"
 #include "libcw2.h"
 #include "libcw_gen_internal.h"
 
@@ -142,7 +145,8 @@ static const char *default_audio_devices[] = {
 	CW_DEFAULT_OSS_DEVICE,
 	CW_DEFAULT_ALSA_DEVICE,
 	CW_DEFAULT_PA_DEVICE,
-	(char *) NULL }; /* just in case someone decided to index the table with CW_AUDIO_SOUNDCARD */
+	(char *) NULL,          /* just in case someone decided to index the table with CW_AUDIO_SOUNDCARD */
+	CW_DEFAULT_JACK_DEVICE };
 
 
 
@@ -170,7 +174,7 @@ static const int CW_AUDIO_QUANTUM_LEN_INITIAL = 100;  /* [us] */
 
    The function returns newly allocated pointer to one of following
    strings: "None", "Null", "Console", "OSS", "ALSA", "PulseAudio",
-   "Soundcard".
+   "Soundcard", "JACK".
 
    The returned pointer is owned by caller.
 
@@ -220,7 +224,8 @@ int cw_gen_start(cw_gen_t * gen)
 	    && gen->audio_system != CW_AUDIO_CONSOLE
 	    && gen->audio_system != CW_AUDIO_OSS
 	    && gen->audio_system != CW_AUDIO_ALSA
-	    && gen->audio_system != CW_AUDIO_PA) {
+	    && gen->audio_system != CW_AUDIO_PA
+	    && gen->audio_system != CW_AUDIO_JACK) {
 
 		gen->do_dequeue_and_generate = false;
 
@@ -229,6 +234,18 @@ int cw_gen_start(cw_gen_t * gen)
 		return CW_FAILURE;
 	}
 
+	if (gen->audio_system == CW_AUDIO_JACK) {
+		/* JACK server pulls samples from generator in its
+		   own thread, there is no need for generator's
+		   thread. Setting gen->do_dequeue_and_generate above
+		   was enough to make the server's process callback
+		   start rendering tones from tone queue. */
+#ifdef LIBCW_WITH_DEV
+		cw_dev_debug_print_generator_setup(gen);
+#endif
+		return CW_SUCCESS;
+	}
+
 
 	/* cw_gen_dequeue_and_generate_internal() is THE
 	   function that does the main job of generating
@@ -339,12 +356,19 @@ int cw_gen_silence_internal(cw_gen_t *gen)
 		return CW_SUCCESS;
 	}
 
-	if (!gen->thread.running) {
+	/* Stop generating mark of straight key (if any). */
+	cw_gen_set_sk_key_down_internal(gen, false);
+
+	if (!gen->thread.running
+	    && !(gen->audio_system == CW_AUDIO_JACK && gen->do_dequeue_and_generate)) {
 		/* Silencing a generator means enqueueing and generating
 		   a tone with zero frequency.  We shouldn't do this
 		   when a "dequeue-and-generate-a-tone" function is not
 		   running (anymore). This is not an error situation,
-		   so return CW_SUCCESS. */
+		   so return CW_SUCCESS.
+
+		   JACK sink doesn't use generator's thread, tones are
+		   rendered as long as generator is started. */
 		return CW_SUCCESS;
 	}
 
@@ -359,7 +383,8 @@ int cw_gen_silence_internal(cw_gen_t *gen)
 	if (gen->audio_system == CW_AUDIO_NULL
 	    || gen->audio_system == CW_AUDIO_OSS
 	    || gen->audio_system == CW_AUDIO_ALSA
-	    || gen->audio_system == CW_AUDIO_PA) {
+	    || gen->audio_system == CW_AUDIO_PA
+	    || gen->audio_system == CW_AUDIO_JACK) {
 
 		/* Allow some time for playing the last tone. */
 		usleep(2 * gen->quantum_len); /* TODO: this should be usleep(2 * tone->len). */
@@ -395,8 +420,41 @@ int cw_gen_silence_internal(cw_gen_t *gen)
 /**
    \brief Create new generator
 
+   Generator produces 16-bit samples (CW_SAMPLE_FORMAT_S16) in mono.
+   Use cw_gen_new_with_format() to select other format of output.
 */
 cw_gen_t * cw_gen_new(int audio_system, const char * device)
+{
+	return cw_gen_new_with_format(audio_system, device, CW_SAMPLE_FORMAT_S16, CW_AUDIO_CHANNELS);
+}
+
+
+
+
+/**
+   \brief Create new generator with given format of output
+
+   \p sample_format (one of CW_SAMPLE_FORMAT_*) and \p n_channels
+   are used when negotiating parameters with audio sink, and when
+   rendering samples with cw_gen_fill(). The samples of all channels
+   are interleaved in frames. Every channel carries the same tone,
+   and gains of channels are controlled with cw_gen_set_pan().
+
+   ALSA, PulseAudio, JACK and Null audio sinks support all formats
+   (JACK sink registers one output port per channel). OSS supports
+   only CW_SAMPLE_FORMAT_S16.
+
+   \errno EINVAL - \p sample_format or \p n_channels is invalid
+
+   \param audio_system - audio system to be used by generator
+   \param device - name of audio device to be used by generator
+   \param sample_format - format of samples, one of CW_SAMPLE_FORMAT_*
+   \param n_channels - number of channels, 1 to CW_AUDIO_CHANNELS_MAX
+
+   \return pointer to new generator on success
+   \return NULL on failure
+*/
+cw_gen_t * cw_gen_new_with_format(int audio_system, const char * device, int sample_format, int n_channels)
 {
 #ifdef LIBCW_WITH_DEV
 	fprintf(stderr, "libcw build %s %s\n", __DATE__, __TIME__);
@@ -404,6 +462,15 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 
 	cw_assert (audio_system != CW_AUDIO_NONE, MSG_PREFIX "can't create generator with audio system '%s'", cw_get_audio_system_label(audio_system));
 
+	if ((sample_format != CW_SAMPLE_FORMAT_S16 && sample_format != CW_SAMPLE_FORMAT_FLOAT)
+	    || n_channels < 1 || n_channels > CW_AUDIO_CHANNELS_MAX) {
+
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "invalid format of output: sample format = %d, channels = %d", sample_format, n_channels);
+		errno = EINVAL;
+		return (cw_gen_t *) NULL;
+	}
+
 	cw_gen_t *gen = (cw_gen_t *) malloc(sizeof (cw_gen_t));
 	if (!gen) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR, MSG_PREFIX "malloc()");
@@ -435,6 +502,7 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 		gen->volume_abs = (gen->volume_percent * CW_AUDIO_VOLUME_RANGE) / 100;
 		gen->gap = CW_GAP_INITIAL;
 		gen->weighting = CW_WEIGHTING_INITIAL;
+		gen->pan = CW_PAN_INITIAL;
 
 
 		/* Generator's timing parameters. */
@@ -446,6 +514,7 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 
 		gen->additional_space_len = 0;
 		gen->adjustment_space_len = 0;
+		memset(&gen->len_ns, 0, sizeof (gen->len_ns));
 
 
 		/* Generator's misc parameters. */
@@ -462,10 +531,15 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 		/* Audio buffer and related items. */
 		gen->buffer = NULL;
 		gen->buffer_n_samples = -1;
+		gen->sample_format = sample_format;
+		gen->n_channels = n_channels;
+		gen->frame_size = n_channels * (sample_format == CW_SAMPLE_FORMAT_FLOAT ? sizeof (float) : sizeof (cw_sample_t));
+		cw_gen_calculate_channel_gains_internal(gen);
 		gen->buffer_sub_start = 0;
 		gen->buffer_sub_stop  = 0;
 
 		gen->sample_rate = -1;
+		gen->samples_remainder = 0;
 		gen->phase_offset = -1;
 
 
@@ -483,6 +557,30 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 
 		/* CW key associated with this generator. */
 		gen->key = (cw_key_t *) NULL;
+
+
+		/* Rendering samples on request of audio sink. */
+		CW_TONE_INIT(&gen->render.tone, 0, 0, CW_SLOPE_MODE_STANDARD_SLOPES);
+		gen->render.dequeued_prev = CW_FAILURE;
+		gen->render.elapsed_notified = false;
+		gen->render.waiters_pending = false;
+
+
+		gen->sk_key_down = 0;
+		gen->sk_edges = 0;
+
+
+		/* Latency probe is disabled by default. */
+		gen->latency.next_point = CW_LATENCY_PROBE_DISABLED;
+		memset(&gen->latency.sample, 0, sizeof (gen->latency.sample));
+		gen->latency.sample.key_state = CW_KEY_STATE_CLOSED;
+		gen->latency.mark_offset = 0;
+
+
+		gen->schedule.error = 0;
+		gen->schedule.n_starts = 0;
+		gen->schedule.last_write = 0;
+		gen->schedule.output_latency = -1;
 	}
 
 
@@ -527,7 +625,11 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 
 		/* Audio system - PulseAudio. */
 #ifdef LIBCW_WITH_PULSEAUDIO
-		gen->pa_data.s = NULL;
+		gen->pa_data.mainloop = NULL;
+		gen->pa_data.context = NULL;
+		gen->pa_data.stream = NULL;
+		gen->pa_data.latency_usecs = 0;
+		gen->pa_data.n_underflows = 0;
 
 		gen->pa_data.ba.prebuf    = (uint32_t) -1;
 		gen->pa_data.ba.tlength   = (uint32_t) -1;
@@ -536,6 +638,12 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 		gen->pa_data.ba.fragsize  = (uint32_t) -1;
 #endif
 
+		/* Audio system - JACK. */
+#ifdef LIBCW_WITH_JACK
+		gen->jack_data.client = NULL;
+		memset(gen->jack_data.ports, 0, sizeof (gen->jack_data.ports));
+#endif
+
 		int rv = cw_gen_new_open_internal(gen, audio_system, device);
 		if (rv == CW_FAILURE) {
 			cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
@@ -549,7 +657,7 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 
 			; /* The two types of audio output don't require audio buffer. */
 		} else {
-			gen->buffer = (cw_sample_t *) malloc(gen->buffer_n_samples * sizeof (cw_sample_t));
+			gen->buffer = malloc(gen->buffer_n_samples * gen->frame_size);
 			if (!gen->buffer) {
 				cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
 					      MSG_PREFIX "malloc()");
@@ -570,7 +678,6 @@ cw_gen_t * cw_gen_new(int audio_system, const char * device)
 		}
 	}
 
-	cw_sigalrm_install_top_level_handler_internal(); /* TODO: still needed? */
 	return gen;
 }
 
@@ -603,18 +710,21 @@ void cw_gen_delete(cw_gen_t **gen)
 	   with algorithm for calculating the value. */
 	usleep(500);
 
-	free((*gen)->audio_device);
-	(*gen)->audio_device = NULL;
-
-	free((*gen)->buffer);
-	(*gen)->buffer = NULL;
-
+	/* Close the device before freeing the buffer: audio sinks
+	   pulling samples from generator (JACK) may access the buffer
+	   until they are closed. */
 	if ((*gen)->close_device) {
 		(*gen)->close_device(*gen);
 	} else {
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_WARNING, MSG_PREFIX "WARNING: 'close' function pointer is NULL, something went wrong");
 	}
 
+	free((*gen)->audio_device);
+	(*gen)->audio_device = NULL;
+
+	free((*gen)->buffer);
+	(*gen)->buffer = NULL;
+
 	pthread_attr_destroy(&(*gen)->thread.attr);
 
 	free((*gen)->client.name);
@@ -892,6 +1002,15 @@ int cw_gen_new_open_internal(cw_gen_t *gen, int audio_system, const char *device
 		}
 	}
 
+	if (audio_system == CW_AUDIO_JACK) {
+
+		const char *dev = device ? device : default_audio_devices[CW_AUDIO_JACK];
+		if (cw_is_jack_possible(dev)) {
+			cw_jack_configure(gen, dev);
+			return gen->open_device(gen);
+		}
+	}
+
 	/* There is no next audio system type to try. */
 	return CW_FAILURE;
 }
@@ -970,36 +1089,13 @@ void *cw_gen_dequeue_and_generate_internal(void *arg)
 
 		bool is_empty_tone = !dequeued_now && dequeued_prev;
 
-		if (gen->key) {
-			int state = CW_KEY_STATE_OPEN;
-
-			if ((dequeued_now && dequeued_prev) || (dequeued_now && !dequeued_prev)) {
-				/* Flag combinations 1 and 2.
-				   A valid tone has been dequeued just now. */
-				state = tone.frequency ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
-
-			} else if (!dequeued_now && dequeued_prev) {
-				/* Flag combination 3.
-				   Tone queue just went empty. No tone == no sound. */
-				state = CW_KEY_STATE_OPEN;
+		if (dequeued_now
+		    && cw_gen_latency_stamp_edge_internal(gen, CW_LATENCY_DEQUEUE, cw_gen_tone_key_state_internal(&tone))) {
 
-			} else {
-				/* !dequeued_now && !dequeued_prev */
-				/* Flag combination 4.
-				   Tone queue continues to be empty.
-				   This combination was handled right
-				   after cw_tq_dequeue_internal(), we
-				   should be waiting there for kick
-				   from tone queue.  Us being here is
-				   an error. */
-				cw_assert (0, MSG_PREFIX "uncaught combination of flags: dequeued_now = %d, dequeued_prev = %d",
-					   dequeued_now, dequeued_prev);
-			}
-			cw_key_tk_set_value_internal(gen->key, state);
-
-
-			cw_key_ik_increment_timer_internal(gen->key, tone.len);
+			gen->latency.mark_offset = gen->buffer_sub_start;
 		}
+
+		cw_gen_update_key_on_dequeue_internal(gen, &tone, dequeued_now, dequeued_prev);
 		dequeued_prev = dequeued_now;
 
 
@@ -1007,66 +1103,30 @@ void *cw_gen_dequeue_and_generate_internal(void *arg)
 		cw_debug_ev (&cw_debug_object_ev, 0, tone.frequency ? CW_DEBUG_EVENT_TONE_HIGH : CW_DEBUG_EVENT_TONE_LOW);
 #endif
 
-		if (gen->audio_system == CW_AUDIO_NULL) {
+		if (dequeued_now && cw_gen_is_released_mark_internal(gen, &tone)) {
+			/* Quantum of a mark of straight key that has
+			   been released in the meantime. Don't play
+			   it, go straight to falling slope. */
+		} else if (dequeued_now && tone.start_at
+		    && (gen->audio_system == CW_AUDIO_NULL || gen->audio_system == CW_AUDIO_CONSOLE)) {
+			/* These audio systems don't consume samples,
+			   they only take time. */
+			cw_gen_sleep_until_start_time_internal(gen, &tone);
+		} else if (gen->audio_system == CW_AUDIO_NULL) {
+			const int64_t written_at = cw_timer_now_internal();
+			cw_gen_latency_stamp_internal(gen, CW_LATENCY_WRITE);
 			cw_null_write(gen, &tone);
+			cw_gen_latency_stamp_audible_internal(gen, written_at, 0);
 		} else if (gen->audio_system == CW_AUDIO_CONSOLE) {
+			const int64_t written_at = cw_timer_now_internal();
+			cw_gen_latency_stamp_internal(gen, CW_LATENCY_WRITE);
 			cw_console_write(gen, &tone);
+			cw_gen_latency_stamp_audible_internal(gen, written_at, 0);
 		} else {
 			cw_gen_write_to_soundcard_internal(gen, &tone, is_empty_tone);
 		}
 
-		/*
-		  When sending text from text input, the signal:
-		   - allows client code to observe moment when state of tone
-		     queue is "low/critical"; client code then can add more
-		     characters to the queue; the observation is done using
-		     cw_tq_wait_for_level_internal();
-
-		   - allows client code to observe any dequeue event
-                     by waiting for signal in
-                     cw_tq_wait_for_tone_internal();
-		*/
-
-		//fprintf(stderr, MSG_PREFIX "      sending signal on dequeue, target thread id = %ld\n", gen->client.thread_id);
-
-		pthread_mutex_lock(&gen->tq->wait_mutex);
-		/* There may be many listeners, so use broadcast(). */
-		pthread_cond_broadcast(&gen->tq->wait_var);
-		pthread_mutex_unlock(&gen->tq->wait_mutex);
-
-
-#if 0           /* Original implementation using signals. */ /* This code has been disabled some time before 2017-01-19. */
-		pthread_kill(gen->client.thread_id, SIGALRM);
-#endif
-
-		/* Generator may be used by iambic keyer to measure
-		   periods of time (lengths of Mark and Space) - this
-		   is achieved by enqueueing Marks and Spaces by keyer
-		   in generator. A soundcard playing samples is
-		   surprisingly good at measuring time intervals.
-
-		   At this point the generator has finished generating
-		   a tone of specified length. A duration of Mark or
-		   Space has elapsed. Inform iambic keyer that the
-		   tone it has enqueued has elapsed. The keyer may
-		   want to change its state.
-
-		   (Whether iambic keyer has enqueued any tones or
-		   not, and whether it is waiting for the
-		   notification, is a different story. We will let the
-		   iambic keyer function called below to decide what
-		   to do with the notification. If keyer is in idle
-		   state, it will ignore the notification.)
-
-		   Notice that this mechanism is needed only for
-		   iambic keyer. Inner workings of straight key are
-		   much more simple, the straight key doesn't need to
-		   use generator as a timer. */
-		if (!cw_key_ik_update_graph_state_internal(gen->key)) {
-			/* just try again, once */
-			usleep(1000);
-			cw_key_ik_update_graph_state_internal(gen->key);
-		}
+		cw_gen_notify_tone_elapsed_internal(gen);
 
 #ifdef LIBCW_WITH_DEV
 		cw_debug_ev (&cw_debug_object_ev, 0, tone.frequency ? CW_DEBUG_EVENT_TONE_LOW : CW_DEBUG_EVENT_TONE_HIGH);
@@ -1091,8 +1151,7 @@ void *cw_gen_dequeue_and_generate_internal(void *arg)
 	cw_nanosleep_internal(&req);
 
 	pthread_mutex_lock(&gen->tq->wait_mutex);
-	/* There may be many listeners, so use broadcast(). */
-	pthread_cond_broadcast(&gen->tq->wait_var);
+	cw_tq_notify_tone_waiters_internal(gen->tq);
 	pthread_mutex_unlock(&gen->tq->wait_mutex);
 
 #if 0   /* Original implementation using signals. */ /* This code has been disabled some time before 2017-01-19. */
@@ -1107,14 +1166,154 @@ void *cw_gen_dequeue_and_generate_internal(void *arg)
 
 
 /**
-   \brief Calculate a fragment of sine wave
+   \brief Inform key associated with generator about a dequeue event
+
+   Update state of tone queue key and timer of iambic keyer
+   associated with \p gen (if any) after generator has tried to
+   dequeue a tone.
+
+   \param gen - generator
+   \param tone - tone dequeued from queue (if dequeueing was successful)
+   \param dequeued_now - status of current call to dequeue()
+   \param dequeued_prev - status of previous call to dequeue()
+*/
+void cw_gen_update_key_on_dequeue_internal(cw_gen_t *gen, const cw_tone_t *tone, int dequeued_now, int dequeued_prev)
+{
+	if (!gen->key) {
+		return;
+	}
+
+	int state = CW_KEY_STATE_OPEN;
+
+	if ((dequeued_now && dequeued_prev) || (dequeued_now && !dequeued_prev)) {
+		/* Flag combinations 1 and 2.
+		   A valid tone has been dequeued just now. */
+		state = tone->frequency ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
+
+	} else if (!dequeued_now && dequeued_prev) {
+		/* Flag combination 3.
+		   Tone queue just went empty. No tone == no sound. */
+		state = CW_KEY_STATE_OPEN;
+
+	} else {
+		/* !dequeued_now && !dequeued_prev */
+		/* Flag combination 4.
+		   Tone queue continues to be empty.
+		   This combination was handled right
+		   after cw_tq_dequeue_internal(), we
+		   should be waiting there for kick
+		   from tone queue.  Us being here is
+		   an error. */
+		cw_assert (0, MSG_PREFIX "uncaught combination of flags: dequeued_now = %d, dequeued_prev = %d",
+			   dequeued_now, dequeued_prev);
+	}
+	cw_key_tk_set_value_internal(gen->key, state);
+
+
+	cw_key_ik_increment_timer_internal(gen->key, tone->len);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Inform interested parties that generator has finished generating a tone
+
+   \param gen - generator
+*/
+void cw_gen_notify_tone_elapsed_internal(cw_gen_t *gen)
+{
+	/*
+	  When sending text from text input, the signal:
+	   - allows client code to observe end of last tone in
+	     queue by waiting for signal in
+	     cw_tq_wait_for_tone_internal();
+
+	  Client code observing moment when state of tone queue is
+	  "low/critical" (cw_tq_wait_for_level_internal()), or
+	  observing any other dequeue event, is notified by tone
+	  queue itself, when a tone is dequeued.
+
+	  Mutex is taken only if anyone is waiting.
+	*/
+	if (cw_tq_mark_tone_elapsed_internal(gen->tq)) {
+		cw_tq_wake_tone_waiters_internal(gen->tq, true);
+	}
+
+
+#if 0   /* Original implementation using signals. */ /* This code has been disabled some time before 2017-01-19. */
+	pthread_kill(gen->client.thread_id, SIGALRM);
+#endif
+
+	/* Generator may be used by iambic keyer to measure
+	   periods of time (lengths of Mark and Space) - this
+	   is achieved by enqueueing Marks and Spaces by keyer
+	   in generator. A soundcard playing samples is
+	   surprisingly good at measuring time intervals.
+
+	   At this point the generator has finished generating
+	   a tone of specified length. A duration of Mark or
+	   Space has elapsed. Inform iambic keyer that the
+	   tone it has enqueued has elapsed. The keyer may
+	   want to change its state.
+
+	   (Whether iambic keyer has enqueued any tones or
+	   not, and whether it is waiting for the
+	   notification, is a different story. We will let the
+	   iambic keyer function called below to decide what
+	   to do with the notification. If keyer is in idle
+	   state, it will ignore the notification.)
+
+	   Notice that this mechanism is needed only for
+	   iambic keyer. Inner workings of straight key are
+	   much more simple, the straight key doesn't need to
+	   use generator as a timer. */
+	cw_key_ik_update_graph_state_internal(gen->key);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Inform interested parties that generator has finished generating a tone, without blocking
+
+   Non-blocking counterpart of cw_gen_notify_tone_elapsed_internal(),
+   used when samples are rendered on request of audio sink or client
+   code (cw_gen_render_internal()), possibly in a real-time thread.
+
+   Notifications are marked as pending in gen->render by caller. The
+   function attempts to deliver each of them once: a notification
+   that can't be delivered right now because a lock is held by other
+   thread stays pending and should be retried in next call, instead of
+   putting the caller to sleep.
+
+   \param gen - generator
+*/
+void cw_gen_try_notify_tone_elapsed_internal(cw_gen_t *gen)
+{
+	if (gen->render.waiters_pending) {
+		if (cw_tq_wake_tone_waiters_internal(gen->tq, false)) {
+			gen->render.waiters_pending = false;
+		}
+	}
+
+	return;
+}
+
+
+
 
-   Calculate a fragment of sine wave, as many samples as can be fitted
-   in generator buffer's subarea.
+/**
+   \brief Calculate a fragment of sine wave
 
-   The function calculates values of (gen->buffer_sub_stop - gen->buffer_sub_start + 1)
-   samples and puts them into gen->buffer[], starting from
-   gen->buffer[gen->buffer_sub_start].
+   Calculate a fragment of sine wave, \p n_samples samples long, and
+   put it in \p samples. The generator thread passes here a subarea
+   of generator's buffer, audio sinks pulling samples from generator
+   may pass their own buffer.
 
    The function takes into account all state variables from gen,
    so initial phase of new fragment of sine wave in the buffer matches
@@ -1122,17 +1321,17 @@ void *cw_gen_dequeue_and_generate_internal(void *arg)
 
    \param gen - generator that generates sine wave
    \param tone - generated tone
+   \param samples - output buffer for calculated samples, in generator's sample format
+   \param n_samples - number of samples (frames) to calculate
 
    \return number of calculated samples
 */
-int cw_gen_calculate_sine_wave_internal(cw_gen_t *gen, cw_tone_t *tone)
+int cw_gen_calculate_sine_wave_internal(cw_gen_t *gen, cw_tone_t *tone, void *samples, int n_samples)
 {
-	assert (gen->buffer_sub_stop <= gen->buffer_n_samples);
 
 	/* We need two separate iterators to correctly generate sine wave:
-	    -- i -- for iterating through output buffer (generator
-	            buffer's subarea), it can travel between buffer
-	            cells delimited by start and stop (inclusive);
+	    -- i -- for iterating through output buffer (e.g. generator
+	            buffer's subarea);
 	    -- t -- for calculating phase of a sine wave; 't' always has to
 	            start from zero for every calculated subarea (i.e. for
 		    every call of this function);
@@ -1148,14 +1347,28 @@ int cw_gen_calculate_sine_wave_internal(cw_gen_t *gen, cw_tone_t *tone)
 	double phase = 0.0;
 	int t = 0;
 
-	for (int i = gen->buffer_sub_start; i <= gen->buffer_sub_stop; i++) {
+	for (int i = 0; i < n_samples; i++) {
 		phase = (2.0 * M_PI
 				* (double) tone->frequency * (double) t
 				/ (double) gen->sample_rate)
 			+ gen->phase_offset;
 		int amplitude = cw_gen_calculate_amplitude_internal(gen, tone);
 
-		gen->buffer[i] = amplitude * sin(phase);
+		const double value = amplitude * sin(phase);
+
+		/* Each channel gets the same sample, scaled by
+		   channel's gain. */
+		if (gen->sample_format == CW_SAMPLE_FORMAT_FLOAT) {
+			float *frame = (float *) samples + i * gen->n_channels;
+			for (int c = 0; c < gen->n_channels; c++) {
+				frame[c] = value * gen->channel_gains[c] / CW_AUDIO_VOLUME_RANGE;
+			}
+		} else {
+			cw_sample_t *frame = (cw_sample_t *) samples + i * gen->n_channels;
+			for (int c = 0; c < gen->n_channels; c++) {
+				frame[c] = value * gen->channel_gains[c];
+			}
+		}
 
 		tone->sample_iterator++;
 
@@ -1495,6 +1708,20 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t *gen, cw_tone_t *tone, bool is_e
 		   samples to complete filling buffer, but they have
 		   to be empty samples. */
 		cw_gen_empty_tone_calculate_samples_size_internal(gen, tone);
+	} else if (tone->start_at) {
+		/* Samples that are already in the buffer will be
+		   passed to audio sink before the silence. Writes to
+		   audio sink block, so the stream can be ahead of
+		   current time, but not behind it. Samples passed
+		   to sink are played after sink's output latency
+		   (if the sink reports it). */
+		const int64_t latency = cw_gen_known_output_latency_internal(gen);
+		int64_t next_sample_at = gen->schedule.last_write + latency + (int64_t) gen->buffer_sub_start * CW_USECS_PER_SEC / gen->sample_rate;
+		const int64_t now = cw_timer_now_internal();
+		if (next_sample_at < now + latency) {
+			next_sample_at = now + latency;
+		}
+		cw_gen_start_time_calculate_samples_size_internal(gen, tone, next_sample_at);
 	} else {
 		/* Valid tone dequeued from tone queue. Use it to
 		   calculate samples in buffer. */
@@ -1521,6 +1748,15 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t *gen, cw_tone_t *tone, bool is_e
 	// cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_DEBUG, MSG_PREFIX "%lld samples, %d us, %d Hz", tone->n_samples, tone->len, gen->frequency);
 	while (samples_to_write > 0) {
 
+		if (cw_gen_is_released_mark_internal(gen, tone)) {
+			/* Straight key has been released. End the
+			   mark at this sample, also in the middle of
+			   a quantum or right after a write that has
+			   blocked. Falling slope is waiting in tone
+			   queue. */
+			break;
+		}
+
 		int64_t free_space = gen->buffer_n_samples - gen->buffer_sub_start;
 		if (samples_to_write > free_space) {
 			/* There will be some tone samples left for
@@ -1557,7 +1793,7 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t *gen, cw_tone_t *tone, bool is_e
 			      MSG_PREFIX "sub start: %d, sub stop: %d, sub size: %d / %d", gen->buffer_sub_start, gen->buffer_sub_stop, buffer_sub_n_samples, samples_to_write);
 #endif
 
-		const int calculated = cw_gen_calculate_sine_wave_internal(gen, tone);
+		const int calculated = cw_gen_calculate_sine_wave_internal(gen, tone, (uint8_t *) gen->buffer + gen->buffer_sub_start * gen->frame_size, buffer_sub_n_samples);
 		cw_assert (calculated == buffer_sub_n_samples, MSG_PREFIX "calculated wrong number of samples: %d != %d", calculated, buffer_sub_n_samples);
 
 		if (gen->buffer_sub_stop == gen->buffer_n_samples - 1) {
@@ -1565,7 +1801,13 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t *gen, cw_tone_t *tone, bool is_e
 			/* We have a buffer full of samples. The
 			   buffer is ready to be pushed to audio
 			   sink. */
+			cw_gen_latency_stamp_internal(gen, CW_LATENCY_WRITE);
 			gen->write(gen);
+			gen->schedule.last_write = cw_timer_now_internal();
+			/* Output latency reported by the sink after the
+			   write is a latency of sample following the
+			   last sample of the buffer. */
+			cw_gen_latency_stamp_audible_internal(gen, gen->schedule.last_write, gen->latency.mark_offset - gen->buffer_n_samples);
 #if CW_DEV_RAW_SINK
 			cw_dev_debug_raw_sink_write_internal(gen);
 #endif
@@ -1584,6 +1826,18 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t *gen, cw_tone_t *tone, bool is_e
 
 		samples_to_write -= buffer_sub_n_samples;
 
+		if (samples_to_write <= 0
+		    && gen->do_dequeue_and_generate
+		    && cw_gen_is_held_mark_internal(gen, tone)) {
+
+			/* Straight key is still closed. Generate next
+			   quantum of the mark right away, there is
+			   nothing else to dequeue from tone queue
+			   anyway. */
+			samples_to_write = tone->n_samples;
+			tone->sample_iterator = 0;
+		}
+
 #if 0           /* Debug code. */
 
 		if (samples_to_write < 0) {
@@ -1604,135 +1858,559 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t *gen, cw_tone_t *tone, bool is_e
 
 
 /**
-   \brief Construct empty tone with correct/needed values of samples count
-
-   The function sets values tone->..._n_samples fields of empty \p
-   tone based on information from \p gen (i.e. looking on how many
-   samples of silence need to be "created").  The sample count values
-   are set in a way that allows filling remainder of generator's
-   buffer with silence.
-
-   After this point tone length should not be used - it's the samples count that is correct.
+   \brief Render samples from tone queue on request of audio sink
+
+   This is a counterpart of cw_gen_dequeue_and_generate_internal() for
+   audio sinks that pull samples from generator (e.g. JACK, or client
+   code calling cw_gen_fill()), instead of having generator push the
+   samples to them. The function is called whenever the sink needs
+   more samples, usually in sink's real-time thread.
+
+   The function calculates exactly \p n_samples samples (frames) in
+   generator's sample format and puts them in \p samples. Tones are dequeued from generator's tone queue as
+   needed. A tone that doesn't fit in the buffer is continued in next
+   call. When tone queue is empty, remainder of the buffer is filled
+   with silence.
+
+   The function doesn't wait for tones, doesn't allocate memory and
+   doesn't sleep on locks. If tone queue is locked by other thread at
+   the moment when next tone is needed, remainder of the buffer is
+   filled with silence and the dequeue is retried in next call.
+   Notifications about elapsed tones are handled in the same manner,
+   see cw_gen_try_notify_tone_elapsed_internal().
 
-   \reviewed on 2017-01-22
+   \param gen - generator
+   \param samples - output buffer
+   \param n_samples - number of samples to render
 
-   \param gen
-   \param tone - tone for which to calculate samples count.
+   \return number of samples rendered before the function started to fill the buffer with silence
 */
-void cw_gen_empty_tone_calculate_samples_size_internal(cw_gen_t const * gen, cw_tone_t * tone)
+size_t cw_gen_render_internal(cw_gen_t *gen, void *samples, size_t n_samples)
 {
-	/* All tones have been already dequeued from tone queue.
-
-	   \p tone does not represent a valid tone to generate. At
-	   first sight there is no need to write anything to
-	   soundcard. But...
-
-	   It may happen that during previous call to the function
-	   there were too few samples in a tone to completely fill a
-	   buffer (see #needmoresamples tag below).
-
-	   We need to fill the buffer until it is full and ready to be
-	   sent to audio sink.
+	cw_tone_t *tone = &gen->render.tone;
 
-	   Since there are no new tones for which we could generate
-	   samples, we need to generate silence samples.
-
-	   Padding the buffer with silence seems to be a good idea (it
-	   will work regardless of value (Mark/Space) of last valid
-	   tone). We just need to know how many samples of the silence
-	   to produce.
+	/* Time of first sample of the buffer, for tones with
+	   scheduled start. */
+	const int64_t render_start = cw_timer_now_internal();
 
-	   Number of these samples will be stored in
-	   samples_to_write. */
+	size_t n_rendered = n_samples;
 
-	/* We don't have a valid tone, so let's construct a fake one
-	   for purposes of padding. */
+	if (gen->render.waiters_pending) {
+		/* Leftovers from previous call. */
+		cw_gen_try_notify_tone_elapsed_internal(gen);
+	}
 
-	/* Required length of padding space is from end of last buffer
-	   subarea to end of buffer. */
-	tone->n_samples = gen->buffer_n_samples - (gen->buffer_sub_stop + 1);;
+	size_t i = 0;
+	while (i < n_samples) {
 
-	tone->len = 0;         /* This value matters no more, because now we only deal with samples. */
-	tone->frequency = 0;   /* This fake tone is a piece of silence. */
+		if (tone->sample_iterator < tone->n_samples
+		    && cw_gen_is_released_mark_internal(gen, tone)) {
 
-	/* The silence tone used for padding doesn't require any
-	   slopes. A slope falling to silence has been already
-	   provided by last non-fake and non-silent tone. */
-	tone->slope_mode = CW_SLOPE_MODE_NO_SLOPES;
-	tone->rising_slope_n_samples = 0;
-	tone->falling_slope_n_samples = 0;
+			/* Straight key has been released. End the
+			   mark at this sample instead of at end of
+			   quantum. This also skips a mark that has
+			   been released before it has been
+			   dequeued. */
+			tone->sample_iterator = tone->n_samples;
+		}
 
-	tone->sample_iterator = 0;
+		if (tone->sample_iterator >= tone->n_samples
+		    && tone->n_samples > 0
+		    && gen->render.dequeued_prev
+		    && cw_gen_is_held_mark_internal(gen, tone)) {
 
-	//fprintf(stderr, "++++ length of padding silence = %d [samples]\n", tone->n_samples);
+			/* Straight key is still closed. Render next
+			   quantum of the mark without dequeueing it
+			   again. */
+			tone->sample_iterator = 0;
+		}
 
-	return;
-}
+		if (tone->sample_iterator >= tone->n_samples) {
+			/* Tone has been fully rendered (or there was
+			   no tone at all). Get next one. */
+			if (gen->render.dequeued_prev && !gen->render.elapsed_notified) {
+				gen->render.waiters_pending = cw_tq_mark_tone_elapsed_internal(gen->tq);
+				gen->render.elapsed_notified = true;
+				cw_gen_try_notify_tone_elapsed_internal(gen);
+				/* Iambic keyer never blocks the caller, see
+				   cw_key_ik_run_internal(). */
+				cw_key_ik_update_graph_state_internal(gen->key);
+			}
 
+			errno = 0;
+			const int dequeued_now = cw_tq_try_dequeue_internal(gen->tq, tone);
+			if (!dequeued_now && errno == EAGAIN) {
+				/* Tone queue is busy. Don't wait for it,
+				   fill rest of the buffer with silence
+				   and try again in next call. State of
+				   key is left as it is. */
+				memset((uint8_t *) samples + i * gen->frame_size, 0, (n_samples - i) * gen->frame_size);
+				n_rendered = i;
+				break;
+			}
 
+			if (dequeued_now || gen->render.dequeued_prev) {
+				cw_gen_update_key_on_dequeue_internal(gen, tone, dequeued_now, gen->render.dequeued_prev);
+			}
+			gen->render.dequeued_prev = dequeued_now;
+
+			if (!dequeued_now) {
+				/* Tone queue is empty. Fill rest of
+				   the buffer with silence, and try
+				   again in next call. */
+				memset((uint8_t *) samples + i * gen->frame_size, 0, (n_samples - i) * gen->frame_size);
+				tone->n_samples = 0;
+				tone->sample_iterator = 0;
+				n_rendered = i;
+				break;
+			}
 
+			gen->render.elapsed_notified = false;
+			if (cw_gen_latency_stamp_edge_internal(gen, CW_LATENCY_DEQUEUE, cw_gen_tone_key_state_internal(tone))) {
+				gen->latency.mark_offset = (int) i;
+			}
+			if (tone->start_at) {
+				cw_gen_start_time_calculate_samples_size_internal(gen, tone, render_start + cw_gen_known_output_latency_internal(gen) + (int64_t) i * CW_USECS_PER_SEC / gen->sample_rate);
+			} else {
+				cw_gen_tone_calculate_samples_size_internal(gen, tone);
+			}
+			continue; /* Tone may be too short to have even one sample. */
+		}
 
-/**
-   \brief Recalculate non-empty tone parameters from microseconds into samples
+		/* Render as much of current tone as fits in the
+		   output buffer. */
+		int64_t n = tone->n_samples - tone->sample_iterator;
+		if ((uint64_t) n > n_samples - i) {
+			n = n_samples - i;
+		}
+		if (n > INT_MAX) {
+			n = INT_MAX;
+		}
 
-   The function sets tone->..._n_samples fields of non-empty \p tone
-   based on other information from \p tone and from \p gen.
+		cw_gen_calculate_sine_wave_internal(gen, tone, (uint8_t *) samples + i * gen->frame_size, n);
 
-   After this point tone length should not be used - it's the samples count that is correct.
+		i += n;
+	}
 
-   \reviewed on 2017-01-22
+	/* Samples are passed to audio sink when caller returns them
+	   to host. */
+	cw_gen_latency_stamp_internal(gen, CW_LATENCY_WRITE);
+	cw_gen_latency_stamp_audible_internal(gen, cw_timer_now_internal(), gen->latency.mark_offset);
 
-   \param gen
-   \param tone - tone for which to calculate samples count.
-*/
-void cw_gen_tone_calculate_samples_size_internal(cw_gen_t const * gen, cw_tone_t * tone)
-{
+	return n_rendered;
+}
 
-	/* 100 * 10000 = 1.000.000 usecs per second. */
-	tone->n_samples = gen->sample_rate / 100;
-	tone->n_samples *= tone->len;
-	tone->n_samples /= 10000;
 
-	//fprintf(stderr, MSG_PREFIX "length of regular tone = %d [samples]\n", tone->n_samples);
 
-	/* Length of a single slope (rising or falling). */
-	int slope_n_samples = gen->sample_rate / 100;
-	slope_n_samples *= gen->tone_slope.len;
-	slope_n_samples /= 10000;
 
-	if (tone->slope_mode == CW_SLOPE_MODE_RISING_SLOPE) {
-		tone->rising_slope_n_samples = slope_n_samples;
-		tone->falling_slope_n_samples = 0;
+/**
+   \brief Render samples of enqueued tones into client's buffer
+
+   Pull-model alternative to starting a generator with
+   cw_gen_start(): client code (e.g. an audio callback of SDR or DAW
+   host, or a plugin) asks the generator for exactly \p n_samples
+   samples, and the generator puts them in \p samples. Samples are
+   in format selected with cw_gen_new_with_format(); for generators
+   with more than one channel \p n_samples is a count of frames. Tones are
+   dequeued from generator's tone queue as needed, a tone that
+   doesn't fit in \p samples is continued in next call, and when
+   the queue is empty, the remainder of \p samples is filled with
+   silence.
+
+   The generator should be created with CW_AUDIO_NULL audio system
+   and should not be started. Use cw_gen_set_sample_rate() to match
+   sample rate of the host.
+
+   The function doesn't create threads, doesn't allocate memory and
+   doesn't sleep, so it can be called from a real-time audio thread.
+   If tone queue is locked by other thread at the moment when a new
+   tone is needed, the function renders silence in place of the
+   remaining samples and picks up the tone in next call.
+
+   Low water callback registered for generator's tone queue and
+   keying callbacks of key associated with the generator are called
+   in caller's thread, from within this function.
+
+   \errno EINVAL - \p gen or \p samples is NULL, or generator
+   can't be used in pull mode (it has been started, or its audio
+   system is not CW_AUDIO_NULL)
 
-	} else if (tone->slope_mode == CW_SLOPE_MODE_FALLING_SLOPE) {
-		tone->rising_slope_n_samples = 0;
-		tone->falling_slope_n_samples = slope_n_samples;
+   \param gen - generator
+   \param samples - output buffer, at least \p n_samples frames long
+   \param n_samples - number of samples to render
 
-	} else if (tone->slope_mode == CW_SLOPE_MODE_STANDARD_SLOPES) {
-		tone->rising_slope_n_samples = slope_n_samples;
-		tone->falling_slope_n_samples = slope_n_samples;
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_fill(cw_gen_t * gen, void * samples, size_t n_samples)
+{
+	if (!gen || !samples) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
 
-	} else if (tone->slope_mode == CW_SLOPE_MODE_NO_SLOPES) {
-		tone->rising_slope_n_samples = 0;
-		tone->falling_slope_n_samples = 0;
+	if (gen->audio_system != CW_AUDIO_NULL
+	    || gen->do_dequeue_and_generate) {
 
-	} else {
-		cw_assert (0, MSG_PREFIX "unknown tone slope mode %d", tone->slope_mode);
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "fill: generator can't be used in pull mode (audio system %s, started = %d)",
+			      cw_get_audio_system_label(gen->audio_system), gen->do_dequeue_and_generate);
+		errno = EINVAL;
+		return CW_FAILURE;
 	}
 
-	tone->sample_iterator = 0;
+	cw_gen_render_internal(gen, samples, n_samples);
 
-	return;
+	return CW_SUCCESS;
 }
 
 
 
 
 /**
-   \brief Set sending speed of generator
+   \brief Render samples of enqueued tones, stop when tone queue is empty
 
-   See libcw.h/CW_SPEED_{INITIAL|MIN|MAX} for initial/minimal/maximal value
-   of send speed.
+   Variant of cw_gen_fill() for rendering offline, e.g. to a file:
+   the function doesn't fill the buffer with silence when tone queue
+   runs out of tones. It stops at the last sample of the last tone,
+   and reports how many samples it has rendered. Client code can
+   enqueue more tones and call the function again, and the
+   concatenated samples form a continuous stream, with no gaps
+   between tones enqueued in separate calls.
+
+   Fewer than \p n_samples samples are rendered also when tone queue
+   is locked by other thread at the moment when next tone is
+   needed. Check length of tone queue to tell the two cases apart.
+
+   \errno EINVAL - \p gen, \p samples or \p n_rendered is NULL, or
+   generator can't be used in pull mode (see cw_gen_fill())
+
+   \param gen - generator
+   \param samples - output buffer, at least \p n_samples frames long
+   \param n_samples - maximal number of samples to render
+   \param n_rendered - number of samples rendered (output)
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_fill_queued(cw_gen_t * gen, void * samples, size_t n_samples, size_t * n_rendered)
+{
+	if (!n_rendered) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	*n_rendered = 0;
+
+	if (!gen || !samples) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (gen->audio_system != CW_AUDIO_NULL
+	    || gen->do_dequeue_and_generate) {
+
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "fill queued: generator can't be used in pull mode (audio system %s, started = %d)",
+			      cw_get_audio_system_label(gen->audio_system), gen->do_dequeue_and_generate);
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	/* Silence after the last tone is rendered into the buffer,
+	   but it isn't reported to the caller. Generator's state
+	   after the silence is the same as at the end of the last
+	   tone, so nothing is lost. */
+	*n_rendered = cw_gen_render_internal(gen, samples, n_samples);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Set sample rate of generator
+
+   Set sample rate of samples produced by cw_gen_fill(), or request
+   sample rate of PulseAudio stream. Length of tone slopes is
+   recalculated for the new sample rate.
+
+   PulseAudio stream of generator is reconnected with requested
+   rate, and generator uses the rate negotiated with PulseAudio
+   server; check it with cw_gen_get_sample_rate(). Other audio
+   systems negotiate sample rate with audio device when the device
+   is opened, so the function accepts only stopped generators using
+   CW_AUDIO_NULL or CW_AUDIO_PA audio system.
+
+   \errno EINVAL - \p sample_rate is not positive, or generator
+   has been started, or its audio system is not CW_AUDIO_NULL or
+   CW_AUDIO_PA
+   \errno EIO - PulseAudio stream can't be reconnected
+
+   \param gen - generator
+   \param sample_rate - new sample rate [Hz]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_set_sample_rate(cw_gen_t * gen, int sample_rate)
+{
+	if (sample_rate <= 0
+	    || (gen->audio_system != CW_AUDIO_NULL && gen->audio_system != CW_AUDIO_PA)
+	    || gen->do_dequeue_and_generate) {
+
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (gen->audio_system == CW_AUDIO_PA) {
+		if (CW_SUCCESS != cw_pa_set_sample_rate_internal(gen, sample_rate)) {
+			errno = EIO;
+			return CW_FAILURE;
+		}
+	} else {
+		gen->sample_rate = sample_rate;
+	}
+	gen->samples_remainder = 0;
+
+	/* Amplitudes of slopes depend on sample rate. */
+	return cw_gen_set_tone_slope(gen, -1, -1);
+}
+
+
+
+
+/**
+   \brief Construct empty tone with correct/needed values of samples count
+
+   The function sets values tone->..._n_samples fields of empty \p
+   tone based on information from \p gen (i.e. looking on how many
+   samples of silence need to be "created").  The sample count values
+   are set in a way that allows filling remainder of generator's
+   buffer with silence.
+
+   After this point tone length should not be used - it's the samples count that is correct.
+
+   \reviewed on 2017-01-22
+
+   \param gen
+   \param tone - tone for which to calculate samples count.
+*/
+void cw_gen_empty_tone_calculate_samples_size_internal(cw_gen_t const * gen, cw_tone_t * tone)
+{
+	/* All tones have been already dequeued from tone queue.
+
+	   \p tone does not represent a valid tone to generate. At
+	   first sight there is no need to write anything to
+	   soundcard. But...
+
+	   It may happen that during previous call to the function
+	   there were too few samples in a tone to completely fill a
+	   buffer (see #needmoresamples tag below).
+
+	   We need to fill the buffer until it is full and ready to be
+	   sent to audio sink.
+
+	   Since there are no new tones for which we could generate
+	   samples, we need to generate silence samples.
+
+	   Padding the buffer with silence seems to be a good idea (it
+	   will work regardless of value (Mark/Space) of last valid
+	   tone). We just need to know how many samples of the silence
+	   to produce.
+
+	   Number of these samples will be stored in
+	   samples_to_write. */
+
+	/* We don't have a valid tone, so let's construct a fake one
+	   for purposes of padding. */
+
+	/* Required length of padding space is from end of last buffer
+	   subarea to end of buffer. */
+	tone->n_samples = gen->buffer_n_samples - (gen->buffer_sub_stop + 1);;
+
+	tone->len = 0;         /* This value matters no more, because now we only deal with samples. */
+	tone->frequency = 0;   /* This fake tone is a piece of silence. */
+
+	/* The silence tone used for padding doesn't require any
+	   slopes. A slope falling to silence has been already
+	   provided by last non-fake and non-silent tone. */
+	tone->slope_mode = CW_SLOPE_MODE_NO_SLOPES;
+	tone->rising_slope_n_samples = 0;
+	tone->falling_slope_n_samples = 0;
+
+	tone->sample_iterator = 0;
+
+	//fprintf(stderr, "++++ length of padding silence = %d [samples]\n", tone->n_samples);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Recalculate non-empty tone parameters from microseconds into samples
+
+   The function sets tone->..._n_samples fields of non-empty \p tone
+   based on other information from \p tone and from \p gen.
+
+   Length of a tone is rarely a whole number of samples. The number
+   of samples is calculated from exact length of \p tone (with
+   tone->len_correction_ns), and the fraction of sample that doesn't
+   fit in \p tone is not dropped, but is carried over to next tone
+   (gen->samples_remainder), so total length of many consecutive
+   tones differs from ideal length by less than one sample, at any
+   sample rate.
+
+   After this point tone length should not be used - it's the samples count that is correct.
+
+   \param gen
+   \param tone - tone for which to calculate samples count.
+*/
+void cw_gen_tone_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone)
+{
+	/* Length of tone in 1/CW_NSECS_PER_SEC of sample, with the
+	   remainder from previous tone. */
+	const int64_t len_ns = (int64_t) tone->len * 1000 + tone->len_correction_ns;
+	const int64_t n_samples_scaled = (int64_t) gen->sample_rate * len_ns + gen->samples_remainder;
+	tone->n_samples = n_samples_scaled / CW_NSECS_PER_SEC;
+	gen->samples_remainder = n_samples_scaled % CW_NSECS_PER_SEC;
+
+	//fprintf(stderr, MSG_PREFIX "length of regular tone = %d [samples]\n", tone->n_samples);
+
+	/* Length of a single slope (rising or falling). */
+	int slope_n_samples = gen->sample_rate / 100;
+	slope_n_samples *= gen->tone_slope.len;
+	slope_n_samples /= 10000;
+
+	if (tone->slope_mode == CW_SLOPE_MODE_RISING_SLOPE) {
+		tone->rising_slope_n_samples = slope_n_samples;
+		tone->falling_slope_n_samples = 0;
+
+	} else if (tone->slope_mode == CW_SLOPE_MODE_FALLING_SLOPE) {
+		tone->rising_slope_n_samples = 0;
+		tone->falling_slope_n_samples = slope_n_samples;
+
+	} else if (tone->slope_mode == CW_SLOPE_MODE_STANDARD_SLOPES) {
+		tone->rising_slope_n_samples = slope_n_samples;
+		tone->falling_slope_n_samples = slope_n_samples;
+
+	} else if (tone->slope_mode == CW_SLOPE_MODE_NO_SLOPES) {
+		tone->rising_slope_n_samples = 0;
+		tone->falling_slope_n_samples = 0;
+
+	} else {
+		cw_assert (0, MSG_PREFIX "unknown tone slope mode %d", tone->slope_mode);
+	}
+
+	tone->sample_iterator = 0;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Turn "start time" tone into silence lasting until its start time
+
+   \p tone is a "start time" tone, see cw_gen_enqueue_start_time().
+   The function sets tone->..._n_samples fields of \p tone so that
+   the tone becomes a silence that ends at tone->start_at, with
+   precision of one sample, and records achieved start error. If
+   the start time has already passed, the silence is empty, and the
+   delay is recorded as the error.
+
+   \param gen - generator
+   \param tone - "start time" tone
+   \param next_sample_at - time at which next sample produced by generator will be played (or passed to audio sink, if its latency is unknown), on CLOCK_MONOTONIC [us]
+*/
+void cw_gen_start_time_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone, int64_t next_sample_at)
+{
+	const int64_t delta = tone->start_at - next_sample_at;
+	tone->n_samples = 0;
+	if (delta > 0) {
+		/* Rounded to nearest sample. */
+		tone->n_samples = (delta * gen->sample_rate + CW_USECS_PER_SEC / 2) / CW_USECS_PER_SEC;
+	}
+
+	tone->frequency = 0;
+	tone->slope_mode = CW_SLOPE_MODE_NO_SLOPES;
+	tone->rising_slope_n_samples = 0;
+	tone->falling_slope_n_samples = 0;
+	tone->sample_iterator = 0;
+
+	/* Tones following the scheduled start are counted from a
+	   whole sample. */
+	gen->samples_remainder = 0;
+
+	const int64_t achieved = next_sample_at + tone->n_samples * CW_USECS_PER_SEC / gen->sample_rate;
+	cw_gen_record_start_error_internal(gen, achieved - tone->start_at);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Wait until start time of "start time" tone
+
+   Counterpart of cw_gen_start_time_calculate_samples_size_internal()
+   for audio systems that don't consume samples (Null, console):
+   generator's thread sleeps until tone->start_at, and the achieved
+   start error is measured after wakeup.
+
+   \param gen - generator
+   \param tone - "start time" tone
+*/
+void cw_gen_sleep_until_start_time_internal(cw_gen_t * gen, const cw_tone_t * tone)
+{
+	struct timespec deadline;
+	deadline.tv_sec = tone->start_at / CW_USECS_PER_SEC;
+	deadline.tv_nsec = (tone->start_at % CW_USECS_PER_SEC) * 1000;
+
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) {
+		;
+	}
+
+	gen->samples_remainder = 0;
+	cw_gen_record_start_error_internal(gen, cw_timer_now_internal() - tone->start_at);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Record achieved error of scheduled start of tone
+
+   See cw_gen_get_start_error().
+
+   \param gen - generator
+   \param error - difference between actual and scheduled start time of tone [us]
+*/
+void cw_gen_record_start_error_internal(cw_gen_t * gen, int64_t error)
+{
+	cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_DEBUG,
+		      MSG_PREFIX "scheduled start: error = %" PRId64 " us", error);
+
+	__atomic_store_n(&gen->schedule.error, error, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&gen->schedule.n_starts, 1, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Set sending speed of generator
+
+   See libcw.h/CW_SPEED_{INITIAL|MIN|MAX} for initial/minimal/maximal value
+   of send speed.
 
    \errno EINVAL - \p new_value is out of range.
 
@@ -1906,35 +2584,112 @@ int cw_gen_set_weighting(cw_gen_t * gen, int new_value)
 
 
 /**
-   \brief Get sending speed from generator
+   \brief Set position of generator's sound in sound stage
 
-   Returned value is in range CW_SPEED_MIN-CW_SPEED_MAX [wpm].
+   \p new_value selects position of sound between first channel
+   (CW_PAN_MIN) and last channel (CW_PAN_MAX) of generator's output.
+   Sound positioned between two adjacent channels is distributed
+   between them with constant power. See libcw.h/CW_PAN_{INITIAL|MIN|MAX}
+   for initial/minimal/maximal value of pan.
 
-   \reviewed on 2017-01-21
+   Pan has no effect on generators with one channel.
 
-   \param gen - generator from which to get the parameter
+   errno is set to EINVAL if \p new_value is out of range.
 
-   \return current value of the generator's send speed
+   \param gen - generator for which to set new pan
+   \param new_value - new value of pan to be assigned for generator
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
 */
-int cw_gen_get_speed(const cw_gen_t * gen)
+int cw_gen_set_pan(cw_gen_t * gen, int new_value)
 {
-	return gen->send_speed;
-}
+	if (new_value < CW_PAN_MIN || new_value > CW_PAN_MAX) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
 
+	if (new_value != gen->pan) {
+		gen->pan = new_value;
+		cw_gen_calculate_channel_gains_internal(gen);
+	}
 
+	return CW_SUCCESS;
+}
 
 
-/**
-   \brief Get frequency from generator
 
-   Function returns "frequency" parameter of generator,
-   even if the generator is stopped, or volume of generated sound is zero.
 
-   Returned value is in range CW_FREQUENCY_MIN-CW_FREQUENCY_MAX [Hz].
+/**
+   \brief Calculate gains of generator's channels
 
-   \reviewed on 2017-01-21
+   Calculate gains of generator's output channels from generator's
+   pan and number of channels. Position of sound is mapped onto line
+   going through all channels; the two channels that are closest to
+   the position share the sound with constant-power (sine/cosine)
+   law, remaining channels are silent.
 
-   \param gen - generator from which to get the parameter
+   \param gen - generator
+*/
+void cw_gen_calculate_channel_gains_internal(cw_gen_t *gen)
+{
+	if (gen->n_channels == 1) {
+		gen->channel_gains[0] = 1.0;
+		return;
+	}
+
+	for (int c = 0; c < gen->n_channels; c++) {
+		gen->channel_gains[c] = 0.0;
+	}
+
+	const double position = (double) (gen->pan - CW_PAN_MIN) / (CW_PAN_MAX - CW_PAN_MIN) * (gen->n_channels - 1);
+	const int left = (int) floor(position);
+	if (left >= gen->n_channels - 1) {
+		/* Sound panned fully to last channel. */
+		gen->channel_gains[gen->n_channels - 1] = 1.0;
+		return;
+	}
+
+	const double fraction = position - left;
+	gen->channel_gains[left] = cos(fraction * M_PI / 2);
+	gen->channel_gains[left + 1] = sin(fraction * M_PI / 2);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get sending speed from generator
+
+   Returned value is in range CW_SPEED_MIN-CW_SPEED_MAX [wpm].
+
+   \reviewed on 2017-01-21
+
+   \param gen - generator from which to get the parameter
+
+   \return current value of the generator's send speed
+*/
+int cw_gen_get_speed(const cw_gen_t * gen)
+{
+	return gen->send_speed;
+}
+
+
+
+
+/**
+   \brief Get frequency from generator
+
+   Function returns "frequency" parameter of generator,
+   even if the generator is stopped, or volume of generated sound is zero.
+
+   Returned value is in range CW_FREQUENCY_MIN-CW_FREQUENCY_MAX [Hz].
+
+   \reviewed on 2017-01-21
+
+   \param gen - generator from which to get the parameter
 
    \return current value of generator's frequency
 */
@@ -2006,6 +2761,23 @@ int cw_gen_get_weighting(const cw_gen_t * gen)
 
 
 
+/**
+   \brief Get position of generator's sound in sound stage
+
+   Returned value is in range CW_PAN_MIN-CW_PAN_MAX.
+
+   \param gen - generator from which to get the parameter
+
+   \return current value of generator's pan
+*/
+int cw_gen_get_pan(const cw_gen_t * gen)
+{
+	return gen->pan;
+}
+
+
+
+
 /**
    \brief Get timing parameters for sending
 
@@ -2083,11 +2855,13 @@ int cw_gen_enqueue_mark_internal(cw_gen_t *gen, char mark, bool is_first)
 	if (mark == CW_DOT_REPRESENTATION) {
 		cw_tone_t tone;
 		CW_TONE_INIT(&tone, gen->frequency, gen->dot_len, CW_SLOPE_MODE_STANDARD_SLOPES);
+		cw_gen_set_exact_len_internal(&tone, gen->len_ns.dot);
 		tone.is_first = is_first;
 		status = cw_tq_enqueue_internal(gen->tq, &tone);
 	} else if (mark == CW_DASH_REPRESENTATION) {
 		cw_tone_t tone;
 		CW_TONE_INIT(&tone, gen->frequency, gen->dash_len, CW_SLOPE_MODE_STANDARD_SLOPES);
+		cw_gen_set_exact_len_internal(&tone, gen->len_ns.dash);
 		tone.is_first = is_first;
 		status = cw_tq_enqueue_internal(gen->tq, &tone);
 	} else {
@@ -2102,6 +2876,7 @@ int cw_gen_enqueue_mark_internal(cw_gen_t *gen, char mark, bool is_first)
 	/* Send the inter-mark space. */
 	cw_tone_t tone;
 	CW_TONE_INIT(&tone, 0, gen->eom_space_len, CW_SLOPE_MODE_NO_SLOPES);
+	cw_gen_set_exact_len_internal(&tone, gen->len_ns.eom_space);
 	if (CW_SUCCESS != cw_tq_enqueue_internal(gen->tq, &tone)) {
 		return CW_FAILURE;
 	} else {
@@ -2137,6 +2912,7 @@ int cw_gen_enqueue_eoc_space_internal(cw_gen_t *gen)
 	/* Enqueue standard inter-character space, plus any additional inter-character gap. */
 	cw_tone_t tone;
 	CW_TONE_INIT(&tone, 0, gen->eoc_space_len + gen->additional_space_len, CW_SLOPE_MODE_NO_SLOPES);
+	cw_gen_set_exact_len_internal(&tone, gen->len_ns.eoc_space + gen->len_ns.additional_space);
 	return cw_tq_enqueue_internal(gen->tq, &tone);
 }
 
@@ -2222,6 +2998,7 @@ int cw_gen_enqueue_eow_space_internal(cw_gen_t *gen)
 	const int n = 2; /* "small integer value" - used to have more tones per eow space. */
 #endif
 	CW_TONE_INIT(&tone, 0, gen->eow_space_len / n, CW_SLOPE_MODE_NO_SLOPES);
+	cw_gen_set_exact_len_internal(&tone, gen->len_ns.eow_space / n);
 	for (int i = 0; i < n; i++) {
 		if (CW_SUCCESS != cw_tq_enqueue_internal(gen->tq, &tone)) {
 			return CW_FAILURE;
@@ -2230,6 +3007,7 @@ int cw_gen_enqueue_eow_space_internal(cw_gen_t *gen)
 	}
 
 	CW_TONE_INIT(&tone, 0, gen->adjustment_space_len, CW_SLOPE_MODE_NO_SLOPES);
+	cw_gen_set_exact_len_internal(&tone, gen->len_ns.adjustment_space);
 	if (CW_SUCCESS != cw_tq_enqueue_internal(gen->tq, &tone)) {
 		return CW_FAILURE;
 	}
@@ -2632,6 +3410,18 @@ void cw_gen_sync_parameters_internal(cw_gen_t *gen)
 	   identifying this in earlier versions of libcw. */
 	gen->adjustment_space_len = (7 * gen->additional_space_len) / 3;
 
+	/* The same lengths, calculated without truncating Unit to
+	   microseconds. */
+	const int64_t unit_len_ns = (int64_t) CW_DOT_CALIBRATION * 1000 / gen->send_speed;
+	const int64_t weighting_len_ns = (2 * (gen->weighting - 50) * unit_len_ns) / 100;
+	gen->len_ns.dot = unit_len_ns + weighting_len_ns;
+	gen->len_ns.dash = 3 * gen->len_ns.dot;
+	gen->len_ns.eom_space = unit_len_ns - (28 * weighting_len_ns) / 22;
+	gen->len_ns.eoc_space = 3 * unit_len_ns - gen->len_ns.eom_space;
+	gen->len_ns.eow_space = 7 * unit_len_ns - gen->len_ns.eoc_space;
+	gen->len_ns.additional_space = gen->gap * unit_len_ns;
+	gen->len_ns.adjustment_space = (7 * gen->len_ns.additional_space) / 3;
+
 	cw_debug_msg (&cw_debug_object, CW_DEBUG_PARAMETERS, CW_DEBUG_INFO,
 		      MSG_PREFIX "send usec timings <%d [wpm]>: dot: %d, dash: %d, %d, %d, %d, %d, %d",
 		      gen->send_speed, gen->dot_len, gen->dash_len,
@@ -2676,7 +3466,9 @@ int cw_gen_enqueue_begin_mark_internal(cw_gen_t *gen)
 	CW_TONE_INIT(&tone, gen->frequency, gen->tone_slope.len, CW_SLOPE_MODE_RISING_SLOPE);
 	int rv = cw_tq_enqueue_internal(gen->tq, &tone);
 
-	if (rv != CW_SUCCESS) {
+	if (rv == CW_SUCCESS) {
+		cw_gen_latency_stamp_edge_internal(gen, CW_LATENCY_ENQUEUE, CW_KEY_STATE_CLOSED);
+	} else {
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
 			      MSG_PREFIX "enqueue begin mark: failed to enqueue rising slope: '%s'", strerror(errno));
 	}
@@ -2687,6 +3479,7 @@ int cw_gen_enqueue_begin_mark_internal(cw_gen_t *gen)
 	   "main" tone, we are allowed to return failure to caller. */
 	CW_TONE_INIT(&tone, gen->frequency, gen->quantum_len, CW_SLOPE_MODE_NO_SLOPES);
 	tone.is_forever = true;
+	tone.sk_edge = __atomic_load_n(&gen->sk_edges, __ATOMIC_ACQUIRE);
 	rv = cw_tq_enqueue_internal(gen->tq, &tone);
 
 	if (rv != CW_SUCCESS) {
@@ -2733,7 +3526,11 @@ int cw_gen_enqueue_begin_space_internal(cw_gen_t *gen)
 		   buzzer from generating a sound to being silent. */
 		cw_tone_t tone;
 		CW_TONE_INIT(&tone, 0, gen->quantum_len, CW_SLOPE_MODE_NO_SLOPES);
-		return cw_tq_enqueue_internal(gen->tq, &tone);
+		const int rv = cw_tq_enqueue_internal(gen->tq, &tone);
+		if (rv == CW_SUCCESS) {
+			cw_gen_latency_stamp_edge_internal(gen, CW_LATENCY_ENQUEUE, CW_KEY_STATE_OPEN);
+		}
+		return rv;
 	} else {
 		/* For soundcards a falling slope with volume from max
 		   to zero should be enough, but... */
@@ -2742,6 +3539,8 @@ int cw_gen_enqueue_begin_space_internal(cw_gen_t *gen)
 		int rv = cw_tq_enqueue_internal(gen->tq, &tone);
 
 		if (rv == CW_SUCCESS) {
+			cw_gen_latency_stamp_edge_internal(gen, CW_LATENCY_ENQUEUE, CW_KEY_STATE_OPEN);
+
 			/* ... but on some occasions, on some
 			   platforms, some sound systems may need to
 			   constantly generate "silent" tone. These four
@@ -2794,18 +3593,26 @@ int cw_gen_enqueue_partial_symbol_internal(cw_gen_t *gen, char symbol)
 
 	if (symbol == CW_DOT_REPRESENTATION) {
 		CW_TONE_INIT(&tone, gen->frequency, gen->dot_len, CW_SLOPE_MODE_STANDARD_SLOPES);
+		cw_gen_set_exact_len_internal(&tone, gen->len_ns.dot);
 
 	} else if (symbol == CW_DASH_REPRESENTATION) {
 		CW_TONE_INIT(&tone, gen->frequency, gen->dash_len, CW_SLOPE_MODE_STANDARD_SLOPES);
+		cw_gen_set_exact_len_internal(&tone, gen->len_ns.dash);
 
 	} else if (symbol == CW_SYMBOL_SPACE) {
 		CW_TONE_INIT(&tone, 0, gen->eom_space_len, CW_SLOPE_MODE_NO_SLOPES);
+		cw_gen_set_exact_len_internal(&tone, gen->len_ns.eom_space);
 
 	} else {
 		cw_assert (0, MSG_PREFIX "unknown key symbol '%d'", symbol);
 	}
 
-	return cw_tq_enqueue_internal(gen->tq, &tone);
+	const int rv = cw_tq_enqueue_internal(gen->tq, &tone);
+	if (rv == CW_SUCCESS && tone.frequency) {
+		cw_gen_latency_stamp_edge_internal(gen, CW_LATENCY_ENQUEUE, CW_KEY_STATE_CLOSED);
+	}
+
+	return rv;
 }
 
 
@@ -2943,3 +3750,612 @@ bool cw_gen_is_queue_full(cw_gen_t const * gen)
 {
 	return cw_tq_is_full_internal(gen->tq);
 }
+
+
+
+
+/**
+   \brief Get file descriptor that becomes readable on generator's events
+
+   The descriptor can be watched with poll(), select(), epoll or by
+   an event loop of client code, instead of dedicating a thread
+   blocked in cw_gen_wait_for_queue_level() or
+   cw_gen_wait_for_tone(). When the descriptor becomes readable,
+   call cw_gen_read_events() to get the events:
+   CW_EVENT_LOW_WATER (tone queue has dropped to level registered
+   with cw_gen_register_low_level_callback(); the callback function
+   may be NULL), CW_EVENT_TONE (tone has been dequeued),
+   CW_EVENT_KEYER_IDLE (iambic keyer using the generator has become
+   idle).
+
+   The descriptor is owned by the generator: don't close it. It is
+   created on first call, events occurring before the first call are
+   not reported.
+
+   \errno ENOSYS - the descriptor is not supported on this platform
+
+   \param gen - generator
+
+   \return file descriptor on success
+   \return -1 on failure
+*/
+int cw_gen_get_event_fd(cw_gen_t * gen)
+{
+	return cw_event_source_get_fd_internal(&gen->tq->events);
+}
+
+
+
+
+/**
+   \brief Fetch and clear events of generator
+
+   See cw_gen_get_event_fd(). The function never blocks.
+
+   \param gen - generator
+
+   \return CW_EVENT_* bits of events that have occurred since previous call
+   \return zero if no events have occurred
+*/
+unsigned int cw_gen_read_events(cw_gen_t * gen)
+{
+	return cw_event_source_read_internal(&gen->tq->events);
+}
+
+
+
+
+/**
+   \brief Schedule start of next enqueued tone at given time
+
+   Tones enqueued after this call (e.g. with cw_gen_enqueue_string())
+   start at \p start. Generator fills the time between end of tones
+   enqueued before this call and \p start with silence, with
+   precision of one sample. This allows many stations (e.g. a
+   network of beacons) to start their transmissions in sync. If the
+   tones enqueued before this call end after \p start, or if they are
+   dequeued too late, next tone starts right after them, and the
+   delay is reported as a start error, see cw_gen_get_start_error().
+
+   \p start is an absolute time on \p clock_id clock. Time on
+   CLOCK_REALTIME is converted to CLOCK_MONOTONIC when the function
+   is called, so later steps of system clock are not followed.
+
+   For audio sinks that report their output latency (PulseAudio,
+   ALSA, see cw_gen_get_output_latency()) the time refers to the
+   moment when first sample of the tone is played. For other sinks
+   it refers to the moment when the sample is passed to audio sink
+   (for cw_gen_fill(): the moment of the call plus position of the
+   sample in output buffer), and latency of audio device can be
+   compensated by moving \p start earlier.
+
+   \errno EINVAL - \p start is NULL or invalid, or \p clock_id is
+   neither CLOCK_MONOTONIC nor CLOCK_REALTIME
+   \errno EAGAIN - tone queue is full
+
+   \param gen - generator
+   \param clock_id - CLOCK_MONOTONIC or CLOCK_REALTIME
+   \param start - start time of next enqueued tone
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_enqueue_start_time(cw_gen_t * gen, clockid_t clock_id, const struct timespec * start)
+{
+	if (!start
+	    || start->tv_sec < 0
+	    || start->tv_nsec < 0 || start->tv_nsec >= CW_NSECS_PER_SEC
+	    || (clock_id != CLOCK_MONOTONIC && clock_id != CLOCK_REALTIME)) {
+
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	int64_t start_at = (int64_t) start->tv_sec * CW_USECS_PER_SEC + (start->tv_nsec + 500) / 1000;
+	if (clock_id == CLOCK_REALTIME) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		start_at += cw_timer_now_internal() - ((int64_t) now.tv_sec * CW_USECS_PER_SEC + now.tv_nsec / 1000);
+	}
+	if (start_at < 1) {
+		/* Zero means "no start time". Such early start
+		   time has passed anyway. */
+		start_at = 1;
+	}
+
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 0, 0, CW_SLOPE_MODE_NO_SLOPES);
+	tone.start_at = start_at;
+
+	return cw_tq_enqueue_internal(gen->tq, &tone);
+}
+
+
+
+
+/**
+   \brief Get achieved error of last scheduled start of tone
+
+   The error is a difference between time at which generator has
+   actually started a tone scheduled with cw_gen_enqueue_start_time()
+   and the scheduled time; positive error means that the tone has
+   started late. Compare errors of different machines to monitor
+   alignment of their transmissions.
+
+   \errno EAGAIN - no scheduled start has been reached yet
+
+   \param gen - generator
+   \param error - output: start error of most recent scheduled start [us]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_get_start_error(cw_gen_t * gen, int64_t * error)
+{
+	if (0 == __atomic_load_n(&gen->schedule.n_starts, __ATOMIC_ACQUIRE)) {
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+
+	*error = __atomic_load_n(&gen->schedule.error, __ATOMIC_RELAXED);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Get output latency of generator's audio sink
+
+   Output latency is a delay between a sample being passed to audio
+   sink and the sample being played, as reported by the sink after
+   last write. Add it to time of a write to get time at which the
+   written samples are heard. Only some audio systems (PulseAudio)
+   report their latency.
+
+   \errno EAGAIN - audio sink hasn't reported its latency
+
+   \param gen - generator
+   \param latency - output: latency of audio sink [us]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_get_output_latency(cw_gen_t * gen, int64_t * latency)
+{
+	const int64_t value = __atomic_load_n(&gen->schedule.output_latency, __ATOMIC_RELAXED);
+	if (value < 0) {
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+
+	*latency = value;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Store output latency reported by audio sink
+
+   Audio sink calls this function after writing samples. See
+   cw_gen_get_output_latency().
+
+   \param gen - generator
+   \param latency - latency of audio sink [us]
+*/
+void cw_gen_set_output_latency_internal(cw_gen_t * gen, int64_t latency)
+{
+	__atomic_store_n(&gen->schedule.output_latency, latency, __ATOMIC_RELAXED);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Enable or disable generator's latency probe
+
+   Latency probe takes timestamps of a key event reported by client
+   code to a key associated with \p gen (straight key or iambic
+   keyer) at consecutive points on the way to audio sink:
+   notification of key (CW_LATENCY_KEY_EVENT), enqueueing of mark in
+   tone queue (CW_LATENCY_ENQUEUE), dequeueing of the mark by
+   generator (CW_LATENCY_DEQUEUE), passing of buffer with first
+   samples of the mark to audio sink (CW_LATENCY_WRITE), and playing
+   of the first samples by audio sink (CW_LATENCY_AUDIBLE). The last
+   one is an estimate based on position of the mark in the buffer
+   and on output latency reported by audio sink (see
+   cw_gen_get_output_latency()); for sinks that don't report their
+   latency it is equal to time of the write.
+
+   By default "key down" events are measured, use
+   cw_gen_set_latency_probe_edge() to measure "key up" events.
+
+   Only one sample is recorded at a time. Use
+   cw_gen_get_latency_sample() to collect a complete sample; the
+   probe then starts waiting for next key event. Key events that
+   come before the sample is collected are not measured.
+
+   The function may be called while generator is running: a
+   timestamp that is being written by other thread is never mixed
+   with the reset sample.
+
+   \param gen - generator
+   \param enable - enable (true) or disable (false) the probe
+
+   \return CW_SUCCESS
+*/
+int cw_gen_set_latency_probe(cw_gen_t * gen, bool enable)
+{
+	cw_gen_reset_latency_probe_internal(gen, enable, __atomic_load_n(&gen->latency.sample.key_state, __ATOMIC_RELAXED));
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Select key event measured by generator's latency probe
+
+   With CW_KEY_STATE_CLOSED the probe measures "key down" events
+   (this is the default). With CW_KEY_STATE_OPEN the probe measures
+   "key up" events of straight key (or of manual Dash paddle of bug
+   keyer): from notification of the key, through enqueueing and
+   dequeueing of falling slope that ends the mark, to the buffer
+   with the falling slope being passed to audio sink. Paddles of
+   iambic keyer don't end marks when they are released, so "key up"
+   events of iambic keyer are not measured.
+
+   The probe is reset, and it stays enabled or disabled.
+
+   \errno EINVAL - \p key_state is invalid
+
+   \param gen - generator
+   \param key_state - CW_KEY_STATE_CLOSED or CW_KEY_STATE_OPEN
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_set_latency_probe_edge(cw_gen_t * gen, int key_state)
+{
+	if (key_state != CW_KEY_STATE_CLOSED && key_state != CW_KEY_STATE_OPEN) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	const bool enabled = __atomic_load_n(&gen->latency.next_point, __ATOMIC_ACQUIRE) != CW_LATENCY_PROBE_DISABLED;
+	cw_gen_reset_latency_probe_internal(gen, enabled, key_state);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Get sample recorded by generator's latency probe
+
+   On success \p sample is filled with timestamps of consecutive
+   CW_LATENCY_* points, and the probe starts waiting for next key
+   event.
+
+   \errno EINVAL - latency probe is disabled
+   \errno EAGAIN - sample is not complete yet
+
+   \param gen - generator
+   \param sample - output: timestamps of the sample
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_gen_get_latency_sample(cw_gen_t * gen, cw_latency_sample_t * sample)
+{
+	const int next_point = __atomic_load_n(&gen->latency.next_point, __ATOMIC_ACQUIRE);
+	if (next_point == CW_LATENCY_PROBE_DISABLED) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (next_point != CW_LATENCY_N_POINTS) {
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+
+	/* No thread takes timestamps of complete sample. */
+	*sample = gen->latency.sample;
+	__atomic_store_n(&gen->latency.next_point, CW_LATENCY_KEY_EVENT, __ATOMIC_RELEASE);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Reset generator's latency probe
+
+   The probe is first disabled, waiting for a thread that may be
+   writing a timestamp at the moment. Only then the sample is
+   cleared and the probe is enabled again (if requested).
+
+   \param gen - generator
+   \param enable - enable the probe after reset
+   \param key_state - key event to be measured (CW_KEY_STATE_*)
+*/
+void cw_gen_reset_latency_probe_internal(cw_gen_t * gen, bool enable, int key_state)
+{
+	int next_point = __atomic_load_n(&gen->latency.next_point, __ATOMIC_ACQUIRE);
+	while (true) {
+		if (next_point == CW_LATENCY_PROBE_BUSY) {
+			/* Timestamp is written by other thread right
+			   now, this takes a few instructions. */
+			sched_yield();
+			next_point = __atomic_load_n(&gen->latency.next_point, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&gen->latency.next_point, &next_point, CW_LATENCY_PROBE_DISABLED,
+						false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+	}
+
+	/* Now no other thread touches the sample. */
+	memset(&gen->latency.sample, 0, sizeof (gen->latency.sample));
+	__atomic_store_n(&gen->latency.sample.key_state, key_state, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&gen->latency.next_point, enable ? CW_LATENCY_KEY_EVENT : CW_LATENCY_PROBE_DISABLED, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Start taking timestamp of latency probe at given point
+
+   If the probe waits for \p point, the function marks the probe as
+   busy and returns true. Caller must then write the timestamp and
+   store next point in gen->latency.next_point.
+
+   \param gen - generator
+   \param point - one of CW_LATENCY_* values
+
+   \return true if caller should take the timestamp
+   \return false otherwise
+*/
+bool cw_gen_latency_claim_internal(cw_gen_t * gen, int point)
+{
+	int expected = point;
+	return __atomic_compare_exchange_n(&gen->latency.next_point, &expected, CW_LATENCY_PROBE_BUSY,
+					   false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+
+
+
+/**
+   \brief Take timestamp of latency probe at given point
+
+   The timestamp is taken only if the probe waits for \p point, so
+   e.g. only the first tone dequeued after the mark has been
+   enqueued is measured.
+
+   \param gen - generator (may be NULL)
+   \param point - one of CW_LATENCY_* values
+
+   \return true if the timestamp has been taken
+   \return false otherwise
+*/
+bool cw_gen_latency_stamp_internal(cw_gen_t * gen, int point)
+{
+	if (!gen) {
+		return false;
+	}
+	if (!cw_gen_latency_claim_internal(gen, point)) {
+		return false;
+	}
+
+	gen->latency.sample.stamps[point] = cw_timer_now_internal();
+	__atomic_store_n(&gen->latency.next_point, point + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+
+
+/**
+   \brief Take timestamp of latency probe at given point of given key event
+
+   Variant of cw_gen_latency_stamp_internal() for points at which
+   "key down" and "key up" events are told apart.
+
+   \param gen - generator (may be NULL)
+   \param point - one of CW_LATENCY_* values
+   \param key_state - key event that reached \p point (CW_KEY_STATE_*)
+
+   \return true if the timestamp has been taken
+   \return false otherwise
+*/
+bool cw_gen_latency_stamp_edge_internal(cw_gen_t * gen, int point, int key_state)
+{
+	if (!gen) {
+		return false;
+	}
+	if (__atomic_load_n(&gen->latency.sample.key_state, __ATOMIC_RELAXED) != key_state) {
+		return false;
+	}
+
+	return cw_gen_latency_stamp_internal(gen, point);
+}
+
+
+
+
+/**
+   \brief Take CW_LATENCY_AUDIBLE timestamp of latency probe
+
+   Time at which first sample of the mark is played is estimated
+   from time of a write, output latency of audio sink, and position
+   of the sample relative to the point of the stream to which the
+   latency applies.
+
+   \param gen - generator
+   \param written_at - time of the write [us]
+   \param offset - position of first sample of the mark, relative to position of sample to which sink's latency applies [samples]
+*/
+void cw_gen_latency_stamp_audible_internal(cw_gen_t * gen, int64_t written_at, int64_t offset)
+{
+	if (!cw_gen_latency_claim_internal(gen, CW_LATENCY_AUDIBLE)) {
+		return;
+	}
+
+	int64_t audible = written_at;
+	const int64_t latency = __atomic_load_n(&gen->schedule.output_latency, __ATOMIC_RELAXED);
+	if (latency >= 0) {
+		audible += latency + offset * CW_USECS_PER_SEC / gen->sample_rate;
+	}
+	/* The mark can't be heard before it is written. */
+	if (audible < gen->latency.sample.stamps[CW_LATENCY_WRITE]) {
+		audible = gen->latency.sample.stamps[CW_LATENCY_WRITE];
+	}
+
+	gen->latency.sample.stamps[CW_LATENCY_AUDIBLE] = audible;
+	__atomic_store_n(&gen->latency.next_point, CW_LATENCY_N_POINTS, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Tell which key event is represented by given tone
+
+   \param tone - tone dequeued by generator
+
+   \return CW_KEY_STATE_CLOSED for tones of mark (including its rising slope)
+   \return CW_KEY_STATE_OPEN for falling slope ending the mark, and for silence
+*/
+int cw_gen_tone_key_state_internal(const cw_tone_t * tone)
+{
+	if (tone->frequency && tone->slope_mode != CW_SLOPE_MODE_FALLING_SLOPE) {
+		return CW_KEY_STATE_CLOSED;
+	} else {
+		return CW_KEY_STATE_OPEN;
+	}
+}
+
+
+
+
+/**
+   \brief Pass state of straight key directly to generator
+
+   Straight key calls this function before it enqueues beginning of
+   mark or beginning of space. See cw_gen_t::sk_key_down.
+
+   \param gen - generator
+   \param key_down - state of straight key
+*/
+void cw_gen_set_sk_key_down_internal(cw_gen_t * gen, bool key_down)
+{
+	const int new_value = key_down ? 1 : 0;
+	if (new_value != __atomic_exchange_n(&gen->sk_key_down, new_value, __ATOMIC_ACQ_REL)) {
+		__atomic_add_fetch(&gen->sk_edges, 1, __ATOMIC_RELEASE);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Check if given tone is a mark of straight key that is still closed
+
+   The key must not have changed since the mark has been enqueued:
+   after key-up and key-down the tone queue holds new falling
+   slope, space and rising slope that have to be played first.
+
+   \param gen - generator
+   \param tone - tone being generated
+
+   \return true if generator should continue \p tone without dequeueing next tone
+   \return false otherwise
+*/
+bool cw_gen_is_held_mark_internal(cw_gen_t * gen, const cw_tone_t * tone)
+{
+	return tone->is_forever
+		&& tone->frequency
+		&& __atomic_load_n(&gen->sk_key_down, __ATOMIC_ACQUIRE)
+		&& tone->sk_edge == __atomic_load_n(&gen->sk_edges, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+/**
+   \brief Check if given tone is a mark of straight key that has been released
+
+   Such mark has to be ended at current sample. This is also the
+   case of "forever" mark dequeued after key-up: the mark has
+   stayed at head of tone queue while it was held (see
+   cw_tq_dequeue_sub_internal()), and now it is dequeued once
+   more, before falling slope.
+
+   \param gen - generator
+   \param tone - tone being generated
+
+   \return true if generator should stop generating \p tone
+   \return false otherwise
+*/
+bool cw_gen_is_released_mark_internal(cw_gen_t * gen, const cw_tone_t * tone)
+{
+	return tone->is_forever
+		&& tone->frequency
+		&& !cw_gen_is_held_mark_internal(gen, tone);
+}
+
+
+
+
+/**
+   \brief Set exact length of tone
+
+   \p tone must have been initialized with its length truncated to
+   microseconds. See cw_tone_t::len_correction_ns.
+
+   \param tone - tone
+   \param len_ns - exact length of tone [ns]
+*/
+void cw_gen_set_exact_len_internal(cw_tone_t * tone, int64_t len_ns)
+{
+	tone->len_correction_ns = (int) (len_ns - (int64_t) tone->len * 1000);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get output latency of audio sink, or zero if it is unknown
+
+   \param gen - generator
+
+   \return output latency reported by audio sink [us]
+   \return 0 if the sink doesn't report its latency
+*/
+int64_t cw_gen_known_output_latency_internal(cw_gen_t * gen)
+{
+	const int64_t latency = __atomic_load_n(&gen->schedule.output_latency, __ATOMIC_RELAXED);
+
+	return latency > 0 ? latency : 0;
+}
@@ -12,6 +12,7 @@
 
 #include "libcw.h"
 #include "libcw_alsa.h"
+#include "libcw_jack.h"
 #include "libcw_key.h"
 #include "libcw_pa.h"
 #include "libcw_tq.h"
@@ -42,6 +43,34 @@ enum { CW_SYMBOL_SPACE = ' ' };
 
 
 
+/* Points on the way of key event from client code to audio sink, at
+   which generator's latency probe takes timestamps. See
+   cw_gen_set_latency_probe(). Descriptions in brackets are for "key
+   up" event, see cw_gen_set_latency_probe_edge(). */
+enum {
+	CW_LATENCY_KEY_EVENT = 0,  /* Client code has notified key about "key down" ("key up") event. */
+	CW_LATENCY_ENQUEUE,        /* Mark (falling slope ending the mark) has been enqueued in generator's tone queue. */
+	CW_LATENCY_DEQUEUE,        /* Mark (falling slope) has been dequeued by generator. */
+	CW_LATENCY_WRITE,          /* Buffer with first samples of the mark (of falling slope) is being passed to audio sink. */
+	CW_LATENCY_AUDIBLE,        /* First samples of the mark (of falling slope) are played by audio sink (estimated from sink's output latency). */
+	CW_LATENCY_N_POINTS
+};
+
+/* Values of cw_gen_t::latency::next_point other than CW_LATENCY_*. */
+enum {
+	CW_LATENCY_PROBE_DISABLED = -1,  /* Probe is disabled. */
+	CW_LATENCY_PROBE_BUSY     = -2   /* A thread is writing a timestamp. */
+};
+
+
+typedef struct {
+	int64_t stamps[CW_LATENCY_N_POINTS];  /* Timestamps taken at CW_LATENCY_* points, on CLOCK_MONOTONIC. [us] */
+	int key_state;                        /* Measured key event: CW_KEY_STATE_CLOSED ("key down") or CW_KEY_STATE_OPEN ("key up"). */
+} cw_latency_sample_t;
+
+
+
+
 /* This is used in libcw_gen and libcw_debug. */
 #ifdef LIBCW_WITH_DEV
 #define CW_DEV_RAW_SINK           1  /* Create and use /tmp/cw_file.<audio system>.raw file with audio samples written as raw data. */
@@ -81,6 +110,7 @@ struct cw_gen_struct {
 	int volume_abs;     /* Level of sound in absolute terms; height of PCM samples. */
 	int gap;            /* Inter-mark gap. [number of dot lengths]. */
 	int weighting;      /* Dot/dash weighting. */
+	int pan;            /* Position in sound stage, from first channel (CW_PAN_MIN) to last channel (CW_PAN_MAX). */
 
 
 
@@ -112,6 +142,21 @@ struct cw_gen_struct {
 	int additional_space_len; /* Length of additional space at the end of a character. [us] */
 	int adjustment_space_len; /* Length of adjustment space at the end of a word. [us] */
 
+	/* Exact lengths of the same elements, calculated with
+	   precision of a nanosecond. Lengths in microseconds are
+	   truncated, and at e.g. 47 wpm a Unit is short by almost a
+	   microsecond, so number of samples of tones is calculated
+	   from these. [ns] */
+	struct {
+		int64_t dot;
+		int64_t dash;
+		int64_t eom_space;
+		int64_t eoc_space;
+		int64_t eow_space;
+		int64_t additional_space;
+		int64_t adjustment_space;
+	} len_ns;
+
 
 
 
@@ -146,10 +191,24 @@ struct cw_gen_struct {
 	   We should also send exactly buffer_n_samples samples to audio
 	   system, in order to avoid situation when audio system waits for
 	   filling its buffer too long - this would result in errors and
-	   probably audible clicks. */
-	cw_sample_t *buffer;
+	   probably audible clicks.
+
+	   Samples are stored in sample_format, as interleaved frames
+	   of n_channels samples. */
+	void *buffer;
 
-	/* Size of data buffer, in samples.
+	/* Format of samples in buffer and in output of
+	   cw_gen_fill() (CW_SAMPLE_FORMAT_*), and number of
+	   channels. Both are selected when generator is created and
+	   don't change afterwards. */
+	int sample_format;
+	int n_channels;
+	size_t frame_size;  /* Size of single frame (samples for all channels) [bytes]. */
+
+	/* Gains of channels, calculated from pan. */
+	double channel_gains[CW_AUDIO_CHANNELS_MAX];
+
+	/* Size of data buffer, in samples (frames).
 
 	   The size may be restricted (min,max) by current audio system
 	   (OSS, ALSA, PulseAudio); the audio system may also accept only
@@ -205,6 +264,13 @@ struct cw_gen_struct {
 	int sample_rate; /* set to the same value of sample rate as
 			    you have used when configuring sound card */
 
+	/* Fraction of sample (in units of 1/CW_NSECS_PER_SEC of
+	   sample) left over when length of previous tone was
+	   converted from nanoseconds to samples. It is carried over
+	   to next tone, so that rounding errors don't accumulate over
+	   consecutive tones. */
+	int64_t samples_remainder;
+
 	/* Used to calculate sine wave.
 	   Phase offset needs to be stored between consecutive calls to
 	   function calculating consecutive fragments of sine wave. */
@@ -301,6 +367,60 @@ struct cw_gen_struct {
 		bool running;
 	} thread;
 
+	/* State of rendering samples on request of audio sink
+	   (cw_gen_render_internal()). Audio sinks that pull samples
+	   from generator (e.g. JACK, cw_gen_fill()) ask for a number
+	   of samples that doesn't match boundaries of tones, so a
+	   tone being rendered must be remembered between consecutive
+	   requests. */
+	struct {
+		cw_tone_t tone;         /* Tone being rendered. Its samples count is valid when dequeued_prev is CW_SUCCESS. */
+		int dequeued_prev;      /* Status of previous call to dequeue(). */
+		bool elapsed_notified;  /* End of the tone has already been reported. */
+		bool waiters_pending;   /* Threads waiting on tone queue haven't been woken up yet. */
+	} render;
+
+	/* State of straight key associated with the generator,
+	   passed directly from the key (1 = key down), and number of
+	   changes of the state. A "forever" mark is held while the
+	   key is down and hasn't changed since the mark has been
+	   enqueued (cw_tone_t::sk_edge == sk_edges). Generator keeps
+	   generating a held mark without going back to tone queue,
+	   and checks the state before each part of the mark, so the
+	   mark ends at the sample at which key-up is noticed. A
+	   "forever" mark that isn't held anymore (key has been
+	   released, maybe closed again) is skipped. */
+	int sk_key_down;
+	unsigned int sk_edges;
+
+	/* Latency probe. Timestamps of a single key event are taken
+	   one by one, in order of CW_LATENCY_* points, by client's
+	   thread and by generator's thread. 'next_point' is the point
+	   at which next timestamp will be taken,
+	   CW_LATENCY_N_POINTS if the sample is complete and waits for
+	   client code to collect it, or one of CW_LATENCY_PROBE_*
+	   values. A thread taking a timestamp sets it to
+	   CW_LATENCY_PROBE_BUSY for the time of writing the timestamp,
+	   so that the sample is never reset under its feet.
+	   'mark_offset' is a position of first sample of the mark in
+	   buffer passed to audio sink, needed to estimate when the
+	   mark becomes audible. */
+	struct {
+		int next_point;
+		cw_latency_sample_t sample;
+		int mark_offset;  /* [samples] */
+	} latency;
+
+	/* Scheduled starts of tones, see
+	   cw_gen_enqueue_start_time(). 'error' is written by thread
+	   producing samples before 'n_starts' is incremented. */
+	struct {
+		int64_t error;          /* Achieved start error of last scheduled start. [us] */
+		unsigned int n_starts;  /* Number of scheduled starts reached so far. */
+		int64_t last_write;     /* Time of last write of buffer to audio sink, on CLOCK_MONOTONIC. [us] */
+		int64_t output_latency; /* Delay between a sample being written to audio sink and the sample being played, as reported by the sink after last write; -1 if unknown. [us] */
+	} schedule;
+
 	/* start/stop flag.
 	   Set to true before running dequeue_and_play thread
 	   function.
@@ -322,7 +442,7 @@ struct cw_gen_struct {
 	   PulseAudio). */
 	int audio_sink;
 
-	/* none/null/console/OSS/ALSA/PulseAudio */
+	/* none/null/console/OSS/ALSA/PulseAudio/JACK */
 	int audio_system;
 
 	bool audio_device_is_open;
@@ -353,6 +473,11 @@ struct cw_gen_struct {
 	cw_pa_data_t pa_data;
 #endif
 
+#ifdef LIBCW_WITH_JACK
+	/* Data used by JACK. */
+	cw_jack_data_t jack_data;
+#endif
+
 };
 
 
@@ -376,6 +501,12 @@ int cw_gen_enqueue_begin_mark_internal(cw_gen_t *gen);
 int cw_gen_enqueue_begin_space_internal(cw_gen_t *gen);
 int cw_gen_enqueue_partial_symbol_internal(cw_gen_t *gen, char symbol);
 
+bool cw_gen_latency_stamp_internal(cw_gen_t * gen, int point);
+bool cw_gen_latency_stamp_edge_internal(cw_gen_t * gen, int point, int key_state);
+void cw_gen_set_output_latency_internal(cw_gen_t * gen, int64_t latency);
+
+void cw_gen_set_sk_key_down_internal(cw_gen_t * gen, bool key_down);
+
 
 
 
@@ -389,6 +520,7 @@ int cw_gen_enqueue_character_partial(cw_gen_t * gen, char c);
 
 int   cw_gen_set_audio_device_internal(cw_gen_t *gen, const char *device);
 int   cw_gen_silence_internal(cw_gen_t *gen);
+size_t cw_gen_render_internal(cw_gen_t *gen, void *samples, size_t n_samples);
 char *cw_gen_get_audio_system_label_internal(cw_gen_t *gen);
 
 void cw_generator_delete_internal(void);
@@ -22,14 +22,29 @@
 
 CW_STATIC_FUNC int    cw_gen_new_open_internal(cw_gen_t * gen, int audio_system, const char * device);
 CW_STATIC_FUNC void * cw_gen_dequeue_and_generate_internal(void * arg);
-CW_STATIC_FUNC int    cw_gen_calculate_sine_wave_internal(cw_gen_t * gen, cw_tone_t * tone);
+CW_STATIC_FUNC int    cw_gen_calculate_sine_wave_internal(cw_gen_t * gen, cw_tone_t * tone, void * samples, int n_samples);
 CW_STATIC_FUNC int    cw_gen_calculate_amplitude_internal(cw_gen_t * gen, const cw_tone_t * tone);
 CW_STATIC_FUNC int    cw_gen_write_to_soundcard_internal(cw_gen_t * gen, cw_tone_t * tone, bool is_empty_tone);
 CW_STATIC_FUNC int    cw_gen_enqueue_valid_character_partial_internal(cw_gen_t * gen, char character);
 CW_STATIC_FUNC void   cw_gen_recalculate_slopes_internal(cw_gen_t * gen);
+CW_STATIC_FUNC void   cw_gen_calculate_channel_gains_internal(cw_gen_t * gen);
 CW_STATIC_FUNC int    cw_gen_join_thread_internal(cw_gen_t * gen);
 CW_STATIC_FUNC void   cw_gen_empty_tone_calculate_samples_size_internal(cw_gen_t const * gen, cw_tone_t * tone);
-CW_STATIC_FUNC void   cw_gen_tone_calculate_samples_size_internal(cw_gen_t const * gen, cw_tone_t * tone);
+CW_STATIC_FUNC void   cw_gen_tone_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone);
+CW_STATIC_FUNC void   cw_gen_start_time_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone, int64_t next_sample_at);
+CW_STATIC_FUNC void   cw_gen_sleep_until_start_time_internal(cw_gen_t * gen, const cw_tone_t * tone);
+CW_STATIC_FUNC void   cw_gen_record_start_error_internal(cw_gen_t * gen, int64_t error);
+CW_STATIC_FUNC void   cw_gen_update_key_on_dequeue_internal(cw_gen_t * gen, const cw_tone_t * tone, int dequeued_now, int dequeued_prev);
+CW_STATIC_FUNC void   cw_gen_notify_tone_elapsed_internal(cw_gen_t * gen);
+CW_STATIC_FUNC void   cw_gen_try_notify_tone_elapsed_internal(cw_gen_t * gen);
+CW_STATIC_FUNC bool   cw_gen_is_held_mark_internal(cw_gen_t * gen, const cw_tone_t * tone);
+CW_STATIC_FUNC bool   cw_gen_is_released_mark_internal(cw_gen_t * gen, const cw_tone_t * tone);
+CW_STATIC_FUNC void   cw_gen_latency_stamp_audible_internal(cw_gen_t * gen, int64_t written_at, int64_t offset);
+CW_STATIC_FUNC void   cw_gen_set_exact_len_internal(cw_tone_t * tone, int64_t len_ns);
+CW_STATIC_FUNC void   cw_gen_reset_latency_probe_internal(cw_gen_t * gen, bool enable, int key_state);
+CW_STATIC_FUNC bool   cw_gen_latency_claim_internal(cw_gen_t * gen, int point);
+CW_STATIC_FUNC int    cw_gen_tone_key_state_internal(const cw_tone_t * tone);
+CW_STATIC_FUNC int64_t cw_gen_known_output_latency_internal(cw_gen_t * gen);
 
 
 
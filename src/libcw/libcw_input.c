@@ -0,0 +1,808 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+/**
+   \file libcw_input.c
+
+   \brief Drivers of hardware paddles and straight keys.
+
+   An input driver reads states of paddles directly from a device and
+   passes them to a key (cw_key_t), so that client code doesn't have
+   to translate input events into calls to
+   cw_key_ik_notify_paddle_event() or cw_key_sk_notify_event().
+
+   Two types of devices are supported:
+   \li Linux input event devices (evdev), e.g. USB paddle adapters
+   that present themselves as keyboards. Events are read together
+   with their kernel timestamps. An evdev device can be emulated
+   with uinput.
+   \li modem control lines (CTS, DSR, DCD, RI) of serial port. The
+   driver sleeps in TIOCMIWAIT until one of the lines changes, and
+   uses counters of transitions (TIOCGICOUNT) to detect changes
+   that happened while it wasn't waiting. TIOCMIWAIT can't be
+   canceled, so cw_input_stop() interrupts it with
+   CW_INPUT_WAKE_SIGNAL sent to driver's thread.
+
+   Each driver reads its device in a dedicated thread, and the
+   thread calls key's functions directly, so the path from a device
+   to generator has no additional queue or polling interval.
+*/
+
+
+
+
+#include "config.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if defined(HAVE_LINUX_INPUT_H)
+# include <linux/input.h>
+# if !defined(input_event_sec)  /* Kernel headers older than 4.16. */
+#  define input_event_sec time.tv_sec
+#  define input_event_usec time.tv_usec
+# endif
+#endif
+
+#if defined(HAVE_LINUX_SERIAL_H)
+# include <linux/serial.h>
+#endif
+
+
+
+
+#include "libcw.h"
+#include "libcw2.h"
+#include "libcw_debug.h"
+#include "libcw_input.h"
+#include "libcw_key.h"
+
+
+
+
+#define MSG_PREFIX "libcw/input: "
+
+
+/* Signal interrupting TIOCMIWAIT of serial driver's thread. Default
+   action of SIGURG is to ignore the signal, so a stray signal can't
+   terminate the program. */
+#define CW_INPUT_WAKE_SIGNAL SIGURG
+
+
+
+
+extern cw_debug_t cw_debug_object;
+extern cw_debug_t cw_debug_object_dev;
+
+
+
+
+static int    cw_input_open_internal(cw_input_t * input);
+static void * cw_input_evdev_thread_internal(void * arg);
+static void * cw_input_serial_thread_internal(void * arg);
+static void   cw_input_notify_key_internal(cw_input_t * input, int dot_state, int dash_state, const struct timeval * timestamp);
+static void   cw_input_thread_exit_internal(cw_input_t * input);
+static void   cw_input_wake_handler_internal(int signal_number);
+static int    cw_input_install_wake_handler_internal(void);
+static bool   cw_input_serial_read_internal(cw_input_t * input, int * lines, unsigned int * counts);
+
+
+
+
+/**
+   \brief Create new input driver
+
+   Dot and Dash inputs are by default mapped to Left Ctrl and Right
+   Ctrl keys of evdev device (common mapping of USB paddle adapters),
+   or to DSR and CTS lines of serial port. Use cw_input_set_mapping()
+   to change the mapping.
+
+   \errno EINVAL - invalid \p type or \p device
+   \errno ENOMEM - failed to allocate memory
+
+   \param type - type of device: CW_INPUT_EVDEV or CW_INPUT_SERIAL
+   \param device - path to device file
+
+   \return pointer to new input driver on success
+   \return NULL on failure
+*/
+cw_input_t * cw_input_new(int type, const char * device)
+{
+	if ((type != CW_INPUT_EVDEV && type != CW_INPUT_SERIAL) || !device) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cw_input_t * input = (cw_input_t *) malloc(sizeof (cw_input_t));
+	if (!input) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: malloc()");
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	input->device = strdup(device);
+	if (!input->device) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: strdup()");
+		free(input);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	input->type = type;
+	input->fd = -1;
+
+	if (type == CW_INPUT_EVDEV) {
+#if defined(HAVE_LINUX_INPUT_H)
+		input->dot_code = KEY_LEFTCTRL;
+		input->dash_code = KEY_RIGHTCTRL;
+#else
+		input->dot_code = 0;
+		input->dash_code = 0;
+#endif
+	} else {
+		input->dot_code = TIOCM_DSR;
+		input->dash_code = TIOCM_CTS;
+	}
+
+	input->key = NULL;
+	input->key_mode = CW_INPUT_KEY_IAMBIC;
+
+	input->dot_state = CW_KEY_STATE_OPEN;
+	input->dash_state = CW_KEY_STATE_OPEN;
+
+	input->thread.created = false;
+	input->thread.running = false;
+	input->thread.stop = false;
+
+	return input;
+}
+
+
+
+
+/**
+   \brief Delete input driver
+
+   The driver is stopped if it is running. \p input is set to NULL.
+
+   \param input - pointer to input driver
+*/
+void cw_input_delete(cw_input_t ** input)
+{
+	cw_assert (input, MSG_PREFIX "delete: 'input' argument can't be NULL\n");
+
+	if (!*input) {
+		return;
+	}
+
+	cw_input_stop(*input);
+
+	free((*input)->device);
+	(*input)->device = NULL;
+
+	free(*input);
+	*input = NULL;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Select inputs of device used as Dot and Dash paddles
+
+   For evdev device the codes are codes of EV_KEY events
+   (e.g. KEY_LEFTCTRL or BTN_LEFT). For serial port the codes are
+   TIOCM_* bits of modem control lines (TIOCM_CTS, TIOCM_DSR,
+   TIOCM_CD, TIOCM_RI).
+
+   A straight key is connected to Dot input.
+
+   \errno EBUSY - driver is running
+
+   \param input - input driver
+   \param dot_code - code of Dot input
+   \param dash_code - code of Dash input
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_input_set_mapping(cw_input_t * input, int dot_code, int dash_code)
+{
+	if (__atomic_load_n(&input->thread.running, __ATOMIC_ACQUIRE)) {
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	input->dot_code = dot_code;
+	input->dash_code = dash_code;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Register key to be fed with paddle events
+
+   \errno EINVAL - invalid \p key_mode
+   \errno EBUSY - driver is running
+
+   \param input - input driver
+   \param key - key to be fed with paddle events
+   \param key_mode - CW_INPUT_KEY_IAMBIC or CW_INPUT_KEY_STRAIGHT
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_input_register_key(cw_input_t * input, volatile cw_key_t * key, int key_mode)
+{
+	if (key_mode != CW_INPUT_KEY_IAMBIC && key_mode != CW_INPUT_KEY_STRAIGHT) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (__atomic_load_n(&input->thread.running, __ATOMIC_ACQUIRE)) {
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	input->key = key;
+	input->key_mode = key_mode;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Open device and start reading paddle events
+
+   Driver that has stopped because of error of device (e.g. USB
+   adapter has been unplugged) can be started again.
+
+   \errno EINVAL - no key has been registered
+   \errno EALREADY - driver is already running
+   \errno ENOSYS - type of device is not supported on this platform
+   \errno EBUSY - client code's handler of CW_INPUT_WAKE_SIGNAL restarts system calls
+   \errno other - errno values set by open() or ioctl() on the device
+
+   \param input - input driver
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_input_start(cw_input_t * input)
+{
+	if (!input->key) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (__atomic_load_n(&input->thread.running, __ATOMIC_ACQUIRE)) {
+		errno = EALREADY;
+		return CW_FAILURE;
+	}
+	if (input->thread.created) {
+		/* Thread has stopped on error of device. Join it
+		   and close the device before opening it again. */
+		cw_input_stop(input);
+	}
+
+	if (input->type == CW_INPUT_SERIAL
+	    && CW_SUCCESS != cw_input_install_wake_handler_internal()) {
+		return CW_FAILURE;
+	}
+	if (CW_SUCCESS != cw_input_open_internal(input)) {
+		return CW_FAILURE;
+	}
+
+	input->dot_state = CW_KEY_STATE_OPEN;
+	input->dash_state = CW_KEY_STATE_OPEN;
+
+	void * (* thread_func)(void *) = input->type == CW_INPUT_EVDEV
+		? cw_input_evdev_thread_internal
+		: cw_input_serial_thread_internal;
+
+	/* Set before the thread is created: the thread clears the
+	   flag when it stops on error. */
+	input->thread.stop = false;
+	__atomic_store_n(&input->thread.running, true, __ATOMIC_RELEASE);
+
+	int rv = pthread_create(&input->thread.id, NULL, thread_func, input);
+	if (rv != 0) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "start: failed to create thread: %d", rv);
+		__atomic_store_n(&input->thread.running, false, __ATOMIC_RELEASE);
+		close(input->fd);
+		input->fd = -1;
+		errno = rv;
+		return CW_FAILURE;
+	}
+	input->thread.created = true;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Stop reading paddle events, close device
+
+   Paddles that are closed at the moment are reported to key as
+   open.
+
+   \param input - input driver
+
+   \return CW_SUCCESS
+*/
+int cw_input_stop(cw_input_t * input)
+{
+	if (!input->thread.created) {
+		return CW_SUCCESS;
+	}
+
+	if (input->type == CW_INPUT_EVDEV) {
+		/* The thread can be canceled only while it waits in
+		   poll() (see cw_input_evdev_thread_internal()),
+		   never while it is inside of key's functions. */
+		pthread_cancel(input->thread.id);
+	} else {
+		/* ioctl(TIOCMIWAIT) is not a cancellation point, the
+		   wait is interrupted with a signal. The signal may
+		   arrive after the thread has checked 'stop' and
+		   before it has entered the ioctl(), so repeat the
+		   signal until the thread returns. */
+		__atomic_store_n(&input->thread.stop, true, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&input->thread.running, __ATOMIC_ACQUIRE)) {
+			pthread_kill(input->thread.id, CW_INPUT_WAKE_SIGNAL);
+			usleep(1000);
+		}
+	}
+	pthread_join(input->thread.id, NULL);
+	input->thread.created = false;
+	__atomic_store_n(&input->thread.running, false, __ATOMIC_RELEASE);
+
+	close(input->fd);
+	input->fd = -1;
+
+	cw_input_notify_key_internal(input, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN, NULL);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Open device file of input driver, check that it can be used
+
+   \param input - input driver
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_input_open_internal(cw_input_t * input)
+{
+	if (input->type == CW_INPUT_EVDEV) {
+#if defined(HAVE_LINUX_INPUT_H)
+		input->fd = open(input->device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (input->fd == -1) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "open: can't open evdev device '%s': %s", input->device, strerror(errno));
+			return CW_FAILURE;
+		}
+		return CW_SUCCESS;
+#else
+		errno = ENOSYS;
+		return CW_FAILURE;
+#endif
+	} else {
+#if defined(TIOCMIWAIT)
+		input->fd = open(input->device, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (input->fd == -1) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "open: can't open serial port '%s': %s", input->device, strerror(errno));
+			return CW_FAILURE;
+		}
+
+		/* Pseudo-terminals and some USB adapters don't have
+		   modem control lines. */
+		int lines = 0;
+		if (-1 == ioctl(input->fd, TIOCMGET, &lines)) {
+			const int e = errno;
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "open: can't get modem lines of '%s': %s", input->device, strerror(e));
+			close(input->fd);
+			input->fd = -1;
+			errno = e;
+			return CW_FAILURE;
+		}
+		return CW_SUCCESS;
+#else
+		errno = ENOSYS;
+		return CW_FAILURE;
+#endif
+	}
+}
+
+
+
+
+/**
+   \brief Pass new states of inputs to key
+
+   Only changes of states are passed to key.
+
+   \param input - input driver
+   \param dot_state - state of Dot input
+   \param dash_state - state of Dash input
+   \param timestamp - time of change of inputs (NULL for current time)
+*/
+void cw_input_notify_key_internal(cw_input_t * input, int dot_state, int dash_state, const struct timeval * timestamp)
+{
+	if (input->key_mode == CW_INPUT_KEY_STRAIGHT) {
+		if (dot_state != input->dot_state) {
+			input->dot_state = dot_state;
+			cw_key_sk_notify_event_at_internal(input->key, dot_state, timestamp);
+		}
+	} else {
+		if (dot_state != input->dot_state || dash_state != input->dash_state) {
+			input->dot_state = dot_state;
+			input->dash_state = dash_state;
+			cw_key_ik_notify_paddle_event_at_internal(input->key, dot_state, dash_state, timestamp);
+		}
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Release paddles and mark driver's thread as stopped
+
+   Called by driver's thread when it returns, also when it stops
+   on error of device, so that key isn't left with closed paddles
+   and cw_input_start() can start the driver again.
+
+   \param input - input driver
+*/
+void cw_input_thread_exit_internal(cw_input_t * input)
+{
+	cw_input_notify_key_internal(input, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN, NULL);
+	__atomic_store_n(&input->thread.running, false, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Handler of CW_INPUT_WAKE_SIGNAL
+
+   The handler does nothing: the signal is used only to make
+   blocking ioctl() return with EINTR.
+
+   \param signal_number - number of signal
+*/
+void cw_input_wake_handler_internal(__attribute__((unused)) int signal_number)
+{
+	return;
+}
+
+
+
+
+/**
+   \brief Install handler of CW_INPUT_WAKE_SIGNAL
+
+   The handler is installed without SA_RESTART, so that the signal
+   interrupts TIOCMIWAIT. Handler installed by client code is left
+   in place if it doesn't restart system calls.
+
+   \errno EBUSY - client code's handler restarts system calls
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_input_install_wake_handler_internal(void)
+{
+	struct sigaction action;
+	if (-1 == sigaction(CW_INPUT_WAKE_SIGNAL, NULL, &action)) {
+		return CW_FAILURE;
+	}
+	if (action.sa_handler == cw_input_wake_handler_internal) {
+		return CW_SUCCESS;
+	}
+	if (action.sa_handler != SIG_DFL && action.sa_handler != SIG_IGN) {
+		if (action.sa_flags & SA_RESTART) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "handler of signal %d restarts system calls", CW_INPUT_WAKE_SIGNAL);
+			errno = EBUSY;
+			return CW_FAILURE;
+		}
+		return CW_SUCCESS;
+	}
+
+	memset(&action, 0, sizeof (action));
+	action.sa_handler = cw_input_wake_handler_internal;
+	action.sa_flags = 0;
+	sigemptyset(&action.sa_mask);
+	if (-1 == sigaction(CW_INPUT_WAKE_SIGNAL, &action, NULL)) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "sigaction(): %s", strerror(errno));
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Thread function reading evdev device
+
+   \param arg - input driver
+
+   \return NULL
+*/
+void * cw_input_evdev_thread_internal(void * arg)
+{
+	cw_input_t * input = (cw_input_t *) arg;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+#if defined(HAVE_LINUX_INPUT_H)
+	struct pollfd pfd = { .fd = input->fd, .events = POLLIN, .revents = 0 };
+	int dot_state = CW_KEY_STATE_OPEN;
+	int dash_state = CW_KEY_STATE_OPEN;
+
+	while (true) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		const int rv = poll(&pfd, 1, -1);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (rv == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "evdev: poll(): %s", strerror(errno));
+			break;
+		}
+
+		/* Read all events available right now. Kernel passes
+		   events in packets terminated with SYN_REPORT. */
+		struct input_event events[16];
+		const ssize_t n_bytes = read(input->fd, events, sizeof (events));
+		if (n_bytes == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "evdev: read(): %s", strerror(errno));
+			break;
+		} else if (n_bytes == 0) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_WARNING,
+				      MSG_PREFIX "evdev: device '%s' has been closed", input->device);
+			break;
+		}
+
+		const size_t n_events = (size_t) n_bytes / sizeof (struct input_event);
+		for (size_t i = 0; i < n_events; i++) {
+			const struct input_event * ev = &events[i];
+			/* Value of 2 is autorepeat, it doesn't change
+			   state of a key. */
+			if (ev->type != EV_KEY || ev->value == 2) {
+				continue;
+			}
+
+			const int state = ev->value ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
+			if (ev->code == input->dot_code) {
+				dot_state = state;
+			} else if (ev->code == input->dash_code) {
+				dash_state = state;
+			} else {
+				continue;
+			}
+
+			const struct timeval timestamp = { .tv_sec = ev->input_event_sec, .tv_usec = ev->input_event_usec };
+			cw_input_notify_key_internal(input, dot_state, dash_state, &timestamp);
+		}
+	}
+#endif
+
+	cw_input_thread_exit_internal(input);
+
+	return NULL;
+}
+
+
+
+
+/**
+   \brief Read modem lines of serial port and counters of their transitions
+
+   \p counts are numbers of transitions of Dot and Dash lines
+   counted by kernel. The counts are zero if driver of serial port
+   doesn't support TIOCGICOUNT.
+
+   \param input - input driver
+   \param lines - modem lines (TIOCM_* bits)
+   \param counts - counts of transitions of Dot and Dash lines
+
+   \return true on success
+   \return false on failure of TIOCMGET
+*/
+bool cw_input_serial_read_internal(cw_input_t * input, int * lines, unsigned int * counts)
+{
+	counts[0] = 0;
+	counts[1] = 0;
+
+#if defined(TIOCGICOUNT) && defined(HAVE_LINUX_SERIAL_H)
+	/* Read the counters before the lines: a transition between
+	   the two calls is then seen as a change of counter at next
+	   read, never missed. */
+	struct serial_icounter_struct icount;
+	if (0 == ioctl(input->fd, TIOCGICOUNT, &icount)) {
+		const int codes[2] = { input->dot_code, input->dash_code };
+		for (int i = 0; i < 2; i++) {
+			switch (codes[i]) {
+			case TIOCM_CTS:
+				counts[i] = (unsigned int) icount.cts;
+				break;
+			case TIOCM_DSR:
+				counts[i] = (unsigned int) icount.dsr;
+				break;
+			case TIOCM_CD:
+				counts[i] = (unsigned int) icount.dcd;
+				break;
+			case TIOCM_RI:
+				/* Kernel counts only trailing edges of RI. */
+				counts[i] = (unsigned int) icount.rng;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+#endif
+
+	if (-1 == ioctl(input->fd, TIOCMGET, lines)) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+			      MSG_PREFIX "serial: TIOCMGET: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+/**
+   \brief Thread function waiting for changes of modem lines of serial port
+
+   \param arg - input driver
+
+   \return NULL
+*/
+void * cw_input_serial_thread_internal(void * arg)
+{
+	cw_input_t * input = (cw_input_t *) arg;
+
+#if defined(TIOCMIWAIT)
+	/* cw_input_stop() interrupts TIOCMIWAIT with the signal. */
+	sigset_t wake_signal;
+	sigemptyset(&wake_signal);
+	sigaddset(&wake_signal, CW_INPUT_WAKE_SIGNAL);
+	pthread_sigmask(SIG_UNBLOCK, &wake_signal, NULL);
+
+	const int mask = input->dot_code | input->dash_code;
+
+	int lines = 0;
+	unsigned int counts[2] = { 0, 0 };
+	bool ok = cw_input_serial_read_internal(input, &lines, counts);
+
+	/* Lines and counters of transitions that have been passed
+	   to key. */
+	int notified_lines = lines & mask;
+	unsigned int notified_counts[2] = { counts[0], counts[1] };
+
+	while (ok) {
+		const int dot_state = (lines & input->dot_code) ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
+		const int dash_state = (lines & input->dash_code) ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
+
+		/* A line that has changed while the thread wasn't
+		   waiting in TIOCMIWAIT may be back in its previous
+		   state, e.g. a paddle has been tapped while key was
+		   notified. Counter of transitions of the line tells
+		   about such tap, pass it to key so that it isn't
+		   lost. */
+		const bool dot_tap = counts[0] != notified_counts[0] && (lines & input->dot_code) == (notified_lines & input->dot_code);
+		const bool dash_tap = counts[1] != notified_counts[1] && (lines & input->dash_code) == (notified_lines & input->dash_code);
+
+		struct timeval timestamp;
+		gettimeofday(&timestamp, NULL);
+		if (dot_tap || dash_tap) {
+			const int dot_tap_state = dot_state == CW_KEY_STATE_CLOSED ? CW_KEY_STATE_OPEN : CW_KEY_STATE_CLOSED;
+			const int dash_tap_state = dash_state == CW_KEY_STATE_CLOSED ? CW_KEY_STATE_OPEN : CW_KEY_STATE_CLOSED;
+			cw_input_notify_key_internal(input,
+						     dot_tap ? dot_tap_state : dot_state,
+						     dash_tap ? dash_tap_state : dash_state,
+						     &timestamp);
+		}
+		cw_input_notify_key_internal(input, dot_state, dash_state, &timestamp);
+		notified_lines = lines & mask;
+		notified_counts[0] = counts[0];
+		notified_counts[1] = counts[1];
+
+		if (__atomic_load_n(&input->thread.stop, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		/* TIOCMIWAIT waits only for changes made after the
+		   call. Read the lines again right before the wait,
+		   so that changes made while key was notified are
+		   passed to key now, not after next change. */
+		ok = cw_input_serial_read_internal(input, &lines, counts);
+		if (!ok) {
+			break;
+		}
+		if ((lines & mask) != notified_lines
+		    || counts[0] != notified_counts[0]
+		    || counts[1] != notified_counts[1]) {
+			continue;
+		}
+
+		if (-1 == ioctl(input->fd, TIOCMIWAIT, mask)) {
+			if (errno == EINTR) {
+				/* Possibly woken by cw_input_stop(). */
+				continue;
+			}
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_ERROR,
+				      MSG_PREFIX "serial: TIOCMIWAIT: %s", strerror(errno));
+			break;
+		}
+		ok = cw_input_serial_read_internal(input, &lines, counts);
+	}
+#endif
+
+	cw_input_thread_exit_internal(input);
+
+	return NULL;
+}
@@ -0,0 +1,75 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_INPUT
+#define H_LIBCW_INPUT
+
+
+
+
+#include <pthread.h>
+#include <stdbool.h>
+
+
+
+
+#include "libcw_key.h"
+
+
+
+
+/* Types of input devices. */
+enum {
+	CW_INPUT_EVDEV = 1,  /* Linux input event device, e.g. /dev/input/event3. */
+	CW_INPUT_SERIAL      /* Modem control lines of serial port, e.g. /dev/ttyS0. */
+};
+
+
+/* How paddle input is passed to a key. */
+enum {
+	CW_INPUT_KEY_IAMBIC = 1,  /* Two paddles of iambic keyer. */
+	CW_INPUT_KEY_STRAIGHT     /* Straight key, connected to Dot input. */
+};
+
+
+
+
+struct cw_input_struct {
+	int type;            /* CW_INPUT_EVDEV or CW_INPUT_SERIAL. */
+	char * device;       /* Path to device file. */
+	int fd;
+
+	/* Codes of Dot and Dash inputs: EV_KEY codes of evdev
+	   device (e.g. KEY_LEFTCTRL), or TIOCM_* bits of serial port
+	   (e.g. TIOCM_DSR). */
+	int dot_code;
+	int dash_code;
+
+	/* Key fed with paddle events. */
+	volatile cw_key_t * key;
+	int key_mode;        /* CW_INPUT_KEY_IAMBIC or CW_INPUT_KEY_STRAIGHT. */
+
+	/* States of inputs reported to key. */
+	int dot_state;       /* CW_KEY_STATE_OPEN or CW_KEY_STATE_CLOSED. */
+	int dash_state;      /* CW_KEY_STATE_OPEN or CW_KEY_STATE_CLOSED. */
+
+	/* 'created' is true from creation of thread until it is
+	   joined by cw_input_stop(). 'running' is true while the
+	   thread reads the device: the thread clears it when it
+	   stops on error. 'stop' asks the thread to return. */
+	struct {
+		pthread_t id;
+		bool created;
+		bool running;
+		bool stop;
+	} thread;
+};
+
+typedef struct cw_input_struct cw_input_t;
+
+
+
+
+#endif /* #ifndef H_LIBCW_INPUT */
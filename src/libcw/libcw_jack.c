@@ -0,0 +1,668 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+/**
+   \file libcw_jack.c
+
+   \brief JACK audio sink.
+
+   The sink works with JACK server, and with PipeWire through its
+   JACK interface (pipewire-jack provides its own libjack.so).
+
+   Unlike other audio sinks, this one doesn't have a "write"
+   function, and generator doesn't run its own thread for it. It is
+   the server that asks for samples: the server calls process
+   callback in its real-time thread, and the callback renders
+   requested number of samples directly from generator's tone queue
+   with cw_gen_render_internal().
+
+   JACK ports are mono, so generator with N channels registers N
+   output ports, and the process callback deinterleaves frames
+   rendered by generator into buffers of the ports.
+
+   The sink can be tested without any hardware, against JACK server
+   with dummy driver:
+
+   jackd --no-realtime -d dummy -r 48000 -p 256 &
+   ./libcw_test_all -s j
+*/
+
+
+
+
+#include "config.h"
+#include "libcw_debug.h"
+
+
+
+
+#define MSG_PREFIX "libcw/jack: "
+
+
+
+
+extern cw_debug_t cw_debug_object;
+extern cw_debug_t cw_debug_object_ev;
+extern cw_debug_t cw_debug_object_dev;
+
+
+
+
+#ifdef LIBCW_WITH_JACK
+
+
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <dlfcn.h> /* dlopen() and related symbols */
+#include <string.h>
+#include <assert.h>
+
+
+
+
+#include "libcw.h"
+#include "libcw_jack.h"
+#include "libcw_utils.h"
+#include "libcw_gen.h"
+
+
+
+
+static int  cw_jack_dlsym_internal(void *handle);
+static bool cw_jack_library_acquire_internal(void);
+static void cw_jack_library_release_internal(void);
+static int  cw_jack_open_device_internal(cw_gen_t *gen);
+static void cw_jack_close_device_internal(cw_gen_t *gen);
+static int  cw_jack_connect_port_internal(cw_gen_t *gen);
+static int  cw_jack_process_cb_internal(jack_nframes_t n_frames, void *arg);
+static void cw_jack_shutdown_cb_internal(void *arg);
+
+
+
+
+/*
+  Handle of JACK library and symbols resolved from it, shared by all
+  JACK generators of the process and by cw_is_jack_possible().
+
+  Every user takes a reference with cw_jack_library_acquire_internal()
+  and drops it with cw_jack_library_release_internal(). The library
+  is loaded and its symbols are resolved when first reference is
+  taken, and the library is closed when last reference is dropped,
+  so pointers to JACK functions don't change while any generator
+  uses them.
+*/
+static struct {
+	pthread_mutex_t mutex;  /* Protects handle and n_users. */
+	void *handle;
+	int n_users;
+
+	jack_client_t *(* jack_client_open)(const char *client_name, jack_options_t options, jack_status_t *status, ...);
+	int            (* jack_client_close)(jack_client_t *client);
+	int            (* jack_activate)(jack_client_t *client);
+	int            (* jack_deactivate)(jack_client_t *client);
+	int            (* jack_set_process_callback)(jack_client_t *client, JackProcessCallback process_callback, void *arg);
+	void           (* jack_on_shutdown)(jack_client_t *client, JackShutdownCallback function, void *arg);
+	jack_nframes_t (* jack_get_sample_rate)(jack_client_t *client);
+	jack_nframes_t (* jack_get_buffer_size)(jack_client_t *client);
+
+	jack_port_t   *(* jack_port_register)(jack_client_t *client, const char *port_name, const char *port_type, unsigned long flags, unsigned long buffer_size);
+	void          *(* jack_port_get_buffer)(jack_port_t *port, jack_nframes_t n_frames);
+	const char    *(* jack_port_name)(const jack_port_t *port);
+	const char   **(* jack_get_ports)(jack_client_t *client, const char *port_name_pattern, const char *type_name_pattern, unsigned long flags);
+	int            (* jack_connect)(jack_client_t *client, const char *source_port, const char *destination_port);
+	void           (* jack_free)(void *ptr);
+} cw_jack = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.handle = NULL,
+	.n_users = 0,
+
+	.jack_client_open = NULL,
+	.jack_client_close = NULL,
+	.jack_activate = NULL,
+	.jack_deactivate = NULL,
+	.jack_set_process_callback = NULL,
+	.jack_on_shutdown = NULL,
+	.jack_get_sample_rate = NULL,
+	.jack_get_buffer_size = NULL,
+
+	.jack_port_register = NULL,
+	.jack_port_get_buffer = NULL,
+	.jack_port_name = NULL,
+	.jack_get_ports = NULL,
+	.jack_connect = NULL,
+	.jack_free = NULL
+};
+
+
+
+
+/* JACK works with floats in <-1.0; 1.0> range. Used to convert
+   samples of generator rendering in CW_SAMPLE_FORMAT_INT16 format;
+   samples in CW_SAMPLE_FORMAT_FLOAT format are already in server's
+   range. */
+static const float CW_JACK_SAMPLE_SCALE = 1.0f / 32768.0f;
+
+/* Used when server doesn't tell us the size of its buffer. Generator
+   renders longer periods in chunks. */
+static const int CW_JACK_BUFFER_N_SAMPLES_DEFAULT = 1024;
+
+
+
+
+/**
+   \brief Check if it is possible to open JACK output
+
+   Function first tries to load JACK library, and then does a test
+   connection to JACK server, but it closes the connection before
+   returning. The function never starts a new JACK server.
+
+   \param device - name of JACK port to connect to, NULL for default (physical playback ports)
+
+   \return true if connecting to JACK server succeeded
+   \return false if connecting to JACK server failed
+*/
+bool cw_is_jack_possible(__attribute__((unused)) const char *device)
+{
+	if (!cw_jack_library_acquire_internal()) {
+		return false;
+	}
+
+	jack_status_t status = 0;
+	jack_client_t *client = cw_jack.jack_client_open("libcw_is_jack_possible", JackNoStartServer, &status);
+	if (!client) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+			      MSG_PREFIX "is possible: can't connect to JACK server, status = 0x%x", (unsigned int) status);
+		cw_jack_library_release_internal();
+		return false;
+	} else {
+		cw_jack.jack_client_close(client);
+		cw_jack_library_release_internal();
+		return true;
+	}
+}
+
+
+
+
+/**
+   \brief Configure given generator to work with JACK audio sink
+
+   \param gen - generator
+   \param dev - name of JACK port to which to connect generator's output port
+
+   \return CW_SUCCESS
+*/
+int cw_jack_configure(cw_gen_t *gen, const char *dev)
+{
+	assert (gen);
+
+	gen->audio_system = CW_AUDIO_JACK;
+	cw_gen_set_audio_device_internal(gen, dev);
+
+	gen->open_device  = cw_jack_open_device_internal;
+	gen->close_device = cw_jack_close_device_internal;
+	gen->write        = NULL; /* Server pulls samples from generator in cw_jack_process_cb_internal(). */
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief JACK's process callback
+
+   Called by JACK server in its real-time thread whenever the server
+   needs \p n_frames samples for generator's output ports.
+
+   Single-channel generator producing float samples renders them
+   directly into port's buffer. Otherwise the callback renders frames
+   into generator's buffer (in chunks, if server's period is longer
+   than the buffer), deinterleaves them into buffers of the ports and
+   converts them into server's sample format. When generator is not
+   started (or has been stopped), the callback outputs silence.
+
+   \param n_frames - number of samples requested by server
+   \param arg - generator
+
+   \return 0
+*/
+int cw_jack_process_cb_internal(jack_nframes_t n_frames, void *arg)
+{
+	cw_gen_t *gen = (cw_gen_t *) arg;
+	const int n_channels = gen->n_channels;
+
+	jack_default_audio_sample_t *out[CW_AUDIO_CHANNELS_MAX];
+	for (int c = 0; c < n_channels; c++) {
+		out[c] = (jack_default_audio_sample_t *) cw_jack.jack_port_get_buffer(gen->jack_data.ports[c], n_frames);
+	}
+
+	if (!gen->do_dequeue_and_generate) {
+		for (int c = 0; c < n_channels; c++) {
+			memset(out[c], 0, n_frames * sizeof (jack_default_audio_sample_t));
+		}
+		return 0;
+	}
+
+	if (gen->sample_format == CW_SAMPLE_FORMAT_FLOAT && n_channels == 1) {
+		/* Generator produces samples in server's format,
+		   render them directly into port's buffer. */
+		cw_gen_render_internal(gen, out[0], n_frames);
+		return 0;
+	}
+
+	jack_nframes_t n_done = 0;
+	while (n_done < n_frames) {
+		int n = n_frames - n_done;
+		if (n > gen->buffer_n_samples) {
+			n = gen->buffer_n_samples;
+		}
+
+		cw_gen_render_internal(gen, gen->buffer, n);
+
+		if (gen->sample_format == CW_SAMPLE_FORMAT_FLOAT) {
+			const float *samples = (const float *) gen->buffer;
+			for (int i = 0; i < n; i++) {
+				for (int c = 0; c < n_channels; c++) {
+					out[c][n_done + i] = samples[i * n_channels + c];
+				}
+			}
+		} else {
+			const cw_sample_t *samples = (const cw_sample_t *) gen->buffer;
+			for (int i = 0; i < n; i++) {
+				for (int c = 0; c < n_channels; c++) {
+					out[c][n_done + i] = samples[i * n_channels + c] * CW_JACK_SAMPLE_SCALE;
+				}
+			}
+		}
+		n_done += n;
+	}
+
+	return 0;
+}
+
+
+
+
+/**
+   \brief Callback called by JACK when server shuts down or disconnects the client
+
+   \param arg - generator
+*/
+void cw_jack_shutdown_cb_internal(void *arg)
+{
+	cw_gen_t *gen = (cw_gen_t *) arg;
+	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+		      MSG_PREFIX "JACK server has shut down, generator's output is gone");
+
+	/* The client handle is no longer valid for anything else
+	   than jack_client_close(). */
+	gen->audio_device_is_open = false;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Resolve/get symbols from JACK library
+
+   Function resolves/gets addresses of few JACK functions used by
+   libcw and stores them in cw_jack global variable.
+
+   On failure the function returns negative value, different for every
+   symbol that the funciton failed to resolve. Function stops and returns
+   on first failure.
+
+   \param handle - handle to open JACK library
+
+   \return 0 on success
+   \return negative value on failure
+*/
+int cw_jack_dlsym_internal(void *handle)
+{
+	*(void **) &(cw_jack.jack_client_open)          = dlsym(handle, "jack_client_open");
+	if (!cw_jack.jack_client_open)          return -1;
+	*(void **) &(cw_jack.jack_client_close)         = dlsym(handle, "jack_client_close");
+	if (!cw_jack.jack_client_close)         return -2;
+	*(void **) &(cw_jack.jack_activate)             = dlsym(handle, "jack_activate");
+	if (!cw_jack.jack_activate)             return -3;
+	*(void **) &(cw_jack.jack_deactivate)           = dlsym(handle, "jack_deactivate");
+	if (!cw_jack.jack_deactivate)           return -4;
+	*(void **) &(cw_jack.jack_set_process_callback) = dlsym(handle, "jack_set_process_callback");
+	if (!cw_jack.jack_set_process_callback) return -5;
+	*(void **) &(cw_jack.jack_on_shutdown)          = dlsym(handle, "jack_on_shutdown");
+	if (!cw_jack.jack_on_shutdown)          return -6;
+	*(void **) &(cw_jack.jack_get_sample_rate)      = dlsym(handle, "jack_get_sample_rate");
+	if (!cw_jack.jack_get_sample_rate)      return -7;
+	*(void **) &(cw_jack.jack_get_buffer_size)      = dlsym(handle, "jack_get_buffer_size");
+	if (!cw_jack.jack_get_buffer_size)      return -8;
+
+	*(void **) &(cw_jack.jack_port_register)        = dlsym(handle, "jack_port_register");
+	if (!cw_jack.jack_port_register)        return -9;
+	*(void **) &(cw_jack.jack_port_get_buffer)      = dlsym(handle, "jack_port_get_buffer");
+	if (!cw_jack.jack_port_get_buffer)      return -10;
+	*(void **) &(cw_jack.jack_port_name)            = dlsym(handle, "jack_port_name");
+	if (!cw_jack.jack_port_name)            return -11;
+	*(void **) &(cw_jack.jack_get_ports)            = dlsym(handle, "jack_get_ports");
+	if (!cw_jack.jack_get_ports)            return -12;
+	*(void **) &(cw_jack.jack_connect)              = dlsym(handle, "jack_connect");
+	if (!cw_jack.jack_connect)              return -13;
+	*(void **) &(cw_jack.jack_free)                 = dlsym(handle, "jack_free");
+	if (!cw_jack.jack_free)                 return -14;
+
+	return 0;
+}
+
+
+
+
+/**
+   \brief Take a reference to JACK library
+
+   Function loads JACK library and resolves its symbols if no other
+   user holds a reference to the library.
+
+   \return true if the library is loaded and its symbols are resolved
+   \return false otherwise
+*/
+bool cw_jack_library_acquire_internal(void)
+{
+	pthread_mutex_lock(&cw_jack.mutex);
+
+	if (cw_jack.n_users == 0) {
+		const char * const library_name = "libjack.so.0";
+		if (!cw_dlopen_internal(library_name, &cw_jack.handle)) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+				      MSG_PREFIX "can't access JACK library \"%s\"", library_name);
+			cw_jack.handle = NULL;
+			pthread_mutex_unlock(&cw_jack.mutex);
+			return false;
+		}
+
+		int rv = cw_jack_dlsym_internal(cw_jack.handle);
+		if (rv < 0) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+				      MSG_PREFIX "failed to resolve JACK symbol #%d, can't correctly load JACK library", rv);
+			dlclose(cw_jack.handle);
+			cw_jack.handle = NULL;
+			pthread_mutex_unlock(&cw_jack.mutex);
+			return false;
+		}
+	}
+	cw_jack.n_users++;
+
+	pthread_mutex_unlock(&cw_jack.mutex);
+
+	return true;
+}
+
+
+
+
+/**
+   \brief Drop a reference to JACK library
+
+   Function closes JACK library when last reference is dropped.
+*/
+void cw_jack_library_release_internal(void)
+{
+	pthread_mutex_lock(&cw_jack.mutex);
+
+	if (cw_jack.n_users > 0) {
+		cw_jack.n_users--;
+		if (cw_jack.n_users == 0) {
+			dlclose(cw_jack.handle);
+			cw_jack.handle = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&cw_jack.mutex);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Open JACK output, associate it with given generator
+
+   Function connects to JACK server, registers generator's output
+   ports (one per channel), activates the client and connects the
+   output ports to destination port(s).
+
+   You must use cw_gen_set_audio_device_internal() before calling
+   this function. Otherwise generator \p gen won't know to which port
+   to connect.
+
+   \param gen - generator
+
+   \return CW_FAILURE on errors
+   \return CW_SUCCESS on success
+*/
+int cw_jack_open_device_internal(cw_gen_t *gen)
+{
+	/* The reference is dropped when the client is closed. */
+	if (!cw_jack_library_acquire_internal()) {
+		return CW_FAILURE;
+	}
+
+	jack_status_t status = 0;
+	gen->jack_data.client = cw_jack.jack_client_open("libcw", JackNoStartServer, &status);
+	if (!gen->jack_data.client) {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+			      MSG_PREFIX "open device: can't connect to JACK server, status = 0x%x", (unsigned int) status);
+		cw_jack_library_release_internal();
+		return CW_FAILURE;
+	}
+
+	for (int c = 0; c < gen->n_channels; c++) {
+		/* Single port of mono generator keeps its old name. */
+		char port_name[16] = "out";
+		if (gen->n_channels > 1) {
+			snprintf(port_name, sizeof (port_name), "out_%d", c + 1);
+		}
+
+		gen->jack_data.ports[c] = cw_jack.jack_port_register(gen->jack_data.client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		if (!gen->jack_data.ports[c]) {
+			cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+				      MSG_PREFIX "open device: can't register output port \"%s\"", port_name);
+			cw_jack.jack_client_close(gen->jack_data.client);
+			gen->jack_data.client = NULL;
+			memset(gen->jack_data.ports, 0, sizeof (gen->jack_data.ports));
+			cw_jack_library_release_internal();
+			return CW_FAILURE;
+		}
+	}
+
+	gen->sample_rate = (int) cw_jack.jack_get_sample_rate(gen->jack_data.client);
+	gen->buffer_n_samples = (int) cw_jack.jack_get_buffer_size(gen->jack_data.client);
+	if (gen->buffer_n_samples <= 0) {
+		gen->buffer_n_samples = CW_JACK_BUFFER_N_SAMPLES_DEFAULT;
+	}
+
+	/* Process callback outputs silence until generator is
+	   started, so it's safe to activate the client now, before
+	   generator's buffer is allocated. */
+	if (0 != cw_jack.jack_set_process_callback(gen->jack_data.client, cw_jack_process_cb_internal, gen)) {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+			      MSG_PREFIX "open device: can't set process callback of JACK client");
+		cw_jack.jack_client_close(gen->jack_data.client);
+		gen->jack_data.client = NULL;
+		memset(gen->jack_data.ports, 0, sizeof (gen->jack_data.ports));
+		cw_jack_library_release_internal();
+		return CW_FAILURE;
+	}
+	cw_jack.jack_on_shutdown(gen->jack_data.client, cw_jack_shutdown_cb_internal, gen);
+
+	if (0 != cw_jack.jack_activate(gen->jack_data.client)) {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+			      MSG_PREFIX "open device: can't activate JACK client");
+		cw_jack.jack_client_close(gen->jack_data.client);
+		gen->jack_data.client = NULL;
+		memset(gen->jack_data.ports, 0, sizeof (gen->jack_data.ports));
+		cw_jack_library_release_internal();
+		return CW_FAILURE;
+	}
+
+	/* Not being connected to any destination port is not an
+	   error: user may want to connect the ports manually, using a
+	   patchbay. */
+	cw_jack_connect_port_internal(gen);
+
+	gen->audio_device_is_open = true;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Connect generator's output ports to destination port(s)
+
+   If generator's audio device is a default JACK device, output port
+   of mono generator is connected to first two physical playback
+   ports (so that mono output can be heard in both channels of
+   headphones), and output ports of multi-channel generator are
+   connected to consecutive physical playback ports. Otherwise the
+   audio device is treated as a name of destination port for first
+   channel; remaining ports are left for user to connect.
+
+   \param gen - generator with registered output ports and active client
+
+   \return CW_SUCCESS if the ports have been connected to at least one destination port
+   \return CW_FAILURE otherwise
+*/
+int cw_jack_connect_port_internal(cw_gen_t *gen)
+{
+	if (gen->audio_device && strcmp(gen->audio_device, CW_DEFAULT_JACK_DEVICE)) {
+		const char *source = cw_jack.jack_port_name(gen->jack_data.ports[0]);
+		if (0 != cw_jack.jack_connect(gen->jack_data.client, source, gen->audio_device)) {
+			cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_WARNING,
+				      MSG_PREFIX "can't connect output port to port \"%s\"", gen->audio_device);
+			return CW_FAILURE;
+		}
+		return CW_SUCCESS;
+	}
+
+	const char **ports = cw_jack.jack_get_ports(gen->jack_data.client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
+	if (!ports) {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_WARNING,
+			      MSG_PREFIX "no physical playback ports");
+		return CW_FAILURE;
+	}
+
+	const int n_destinations = gen->n_channels == 1 ? 2 : gen->n_channels;
+	int n_connected = 0;
+	for (int i = 0; ports[i] && i < n_destinations; i++) {
+		const int c = gen->n_channels == 1 ? 0 : i;
+		const char *source = cw_jack.jack_port_name(gen->jack_data.ports[c]);
+		if (0 == cw_jack.jack_connect(gen->jack_data.client, source, ports[i])) {
+			n_connected++;
+		} else {
+			cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_WARNING,
+				      MSG_PREFIX "can't connect output port to port \"%s\"", ports[i]);
+		}
+	}
+	cw_jack.jack_free(ports);
+
+	return n_connected ? CW_SUCCESS : CW_FAILURE;
+}
+
+
+
+
+/**
+   \brief Close JACK device associated with given generator
+
+   Deactivation of client is synchronous with server's process
+   thread: after the call the process callback will not access the
+   generator anymore.
+
+   \param gen - generator
+*/
+void cw_jack_close_device_internal(cw_gen_t *gen)
+{
+	if (gen->jack_data.client) {
+		if (gen->audio_device_is_open) {
+			cw_jack.jack_deactivate(gen->jack_data.client);
+		}
+		cw_jack.jack_client_close(gen->jack_data.client);
+		gen->jack_data.client = NULL;
+		memset(gen->jack_data.ports, 0, sizeof (gen->jack_data.ports));
+		gen->audio_device_is_open = false;
+
+		/* Drop reference taken when the client was opened. */
+		cw_jack_library_release_internal();
+	} else {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_WARNING,
+			      MSG_PREFIX "close device: called the function for NULL JACK client");
+	}
+
+	return;
+}
+
+
+
+
+#else /* #ifdef LIBCW_WITH_JACK */
+
+
+
+
+#include <stdbool.h>
+
+
+
+
+#include "libcw_jack.h"
+
+
+
+
+bool cw_is_jack_possible(__attribute__((unused)) const char *device)
+{
+	cw_debug_msg ((&cw_debug_object), CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_INFO,
+		      MSG_PREFIX "This audio system has been disabled during compilation");
+	return false;
+}
+
+
+
+
+int cw_jack_configure(__attribute__((unused)) cw_gen_t *gen, __attribute__((unused)) const char *device)
+{
+	cw_debug_msg ((&cw_debug_object), CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_INFO,
+		      MSG_PREFIX "This audio system has been disabled during compilation");
+	return CW_FAILURE;
+}
+
+
+
+
+#endif /* #ifdef LIBCW_WITH_JACK */
@@ -0,0 +1,40 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_JACK
+#define H_LIBCW_JACK
+
+
+
+
+#include "config.h"
+
+
+
+
+#ifdef LIBCW_WITH_JACK
+
+#include <jack/jack.h>
+
+#include "libcw.h"
+
+typedef struct cw_jack_data_struct {
+	jack_client_t *client;                      /* Connection to JACK server (or to PipeWire's JACK interface). */
+	jack_port_t *ports[CW_AUDIO_CHANNELS_MAX];  /* Output ports, one per channel of generator. */
+} cw_jack_data_t;
+
+#endif /* #ifdef LIBCW_WITH_JACK */
+
+
+
+
+#include "libcw_gen.h"
+
+int cw_jack_configure(cw_gen_t *gen, const char *device);
+
+
+
+
+#endif /* #ifndef H_LIBCW_JACK */
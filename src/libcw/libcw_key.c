@@ -42,7 +42,6 @@
 #include "libcw_key.h"
 #include "libcw_gen.h"
 #include "libcw_rec.h"
-#include "libcw_signal.h"
 #include "libcw_utils.h"
 #include "libcw2.h"
 
@@ -129,25 +128,149 @@ extern cw_debug_t cw_debug_object_dev;
 
 
 
-/* See also enum of int values, declared in libcw_key.h. */
-static const char *cw_iambic_keyer_states[] = {
-	"KS_IDLE",
-	"KS_IN_DOT_A",
-	"KS_IN_DASH_A",
-	"KS_AFTER_DOT_A",
-	"KS_AFTER_DASH_A",
-	"KS_IN_DOT_B",
-	"KS_IN_DASH_B",
-	"KS_AFTER_DOT_B",
-	"KS_AFTER_DASH_B"
+/*
+ * Transitions out of KS_AFTER_* states (the "(dot latch)", "(dash
+ * latch)", "_B" and "(all latches clear)" edges of the graph) differ
+ * between modes of the keyer. They are described by tables of rules
+ * (see cw_key_ik_modes[] below). A rule is matched against paddles
+ * and latches, as seen from the element that has just ended: "same"
+ * paddle is the one that has produced the element, "opposite" paddle
+ * is the other one. The first matching rule decides about next
+ * element; if no rule matches, the keyer goes idle.
+ *
+ * Transitions out of KS_IN_* states are the same for all modes.
+ */
+
+
+
+
+/* Properties of states of keyer's state machine, indexed by KS_*
+   values declared in libcw_key.h. */
+static const struct {
+	const char * label;
+	char symbol;     /* Element of the state: Dot or Dash. */
+	bool is_mark;    /* KS_IN_* state. */
+	bool is_b;       /* Trailing element of Curtis mode B. */
+} cw_key_ik_states[] = {
+	{ "KS_IDLE",         CW_SYMBOL_SPACE,        false, false },
+	{ "KS_IN_DOT_A",     CW_DOT_REPRESENTATION,  true,  false },
+	{ "KS_IN_DASH_A",    CW_DASH_REPRESENTATION, true,  false },
+	{ "KS_AFTER_DOT_A",  CW_DOT_REPRESENTATION,  false, false },
+	{ "KS_AFTER_DASH_A", CW_DASH_REPRESENTATION, false, false },
+	{ "KS_IN_DOT_B",     CW_DOT_REPRESENTATION,  true,  true  },
+	{ "KS_IN_DASH_B",    CW_DASH_REPRESENTATION, true,  true  },
+	{ "KS_AFTER_DOT_B",  CW_DOT_REPRESENTATION,  false, true  },
+	{ "KS_AFTER_DASH_B", CW_DASH_REPRESENTATION, false, true  }
+};
+
+
+/* KS_IN_* states, indexed by [is Dash][is B]. */
+static const int cw_key_ik_in_states[2][2] = {
+	{ KS_IN_DOT_A,  KS_IN_DOT_B  },
+	{ KS_IN_DASH_A, KS_IN_DASH_B }
+};
+
+
+/* KS_AFTER_* state following given KS_IN_* state. */
+static const int cw_key_ik_after_states[] = {
+	[KS_IN_DOT_A]  = KS_AFTER_DOT_A,
+	[KS_IN_DASH_A] = KS_AFTER_DASH_A,
+	[KS_IN_DOT_B]  = KS_AFTER_DOT_B,
+	[KS_IN_DASH_B] = KS_AFTER_DASH_B
+};
+
+
+
+
+/* Bits of input of keyer's transition rules. */
+enum {
+	CW_KEY_IK_RULE_SAME_PADDLE = 1 << 0,  /* Same paddle is closed. */
+	CW_KEY_IK_RULE_OPP_PADDLE  = 1 << 1,  /* Opposite paddle is closed. */
+	CW_KEY_IK_RULE_SAME_LATCH  = 1 << 2,  /* Same paddle is closed or latched. */
+	CW_KEY_IK_RULE_OPP_LATCH   = 1 << 3,  /* Opposite paddle is closed or latched. */
+	CW_KEY_IK_RULE_CURTIS_B    = 1 << 4,  /* Curtis Dot&Dash latch is set. */
+	CW_KEY_IK_RULE_OPP_LAST    = 1 << 5,  /* Opposite paddle has been closed after same paddle. */
+	CW_KEY_IK_RULE_B_STATE     = 1 << 6   /* The element was a trailing element of Curtis mode B. */
+};
+
+
+/* Next element selected by keyer's transition rule. */
+enum {
+	CW_KEY_IK_NEXT_SAME,   /* Repeat the element. */
+	CW_KEY_IK_NEXT_OPP,    /* Opposite element. */
+	CW_KEY_IK_NEXT_OPP_B   /* Opposite element, to be followed by trailing element of Curtis mode B. Clears Curtis latch. */
 };
 
 
+typedef struct {
+	unsigned int mask;   /* Bits of input to check. */
+	unsigned int value;  /* Expected value of the bits. */
+	int next;            /* CW_KEY_IK_NEXT_* */
+} cw_key_ik_rule_t;
+
+
+#define CW_KEY_IK_RULES_MAX 4
+
+
+typedef struct {
+	const char * label;
+	bool curtis_b_latch;  /* Latch both paddles being closed at the same time. */
+	bool manual_dash;     /* Dash paddle keys a manual mark, and is not used by state machine. */
+	int n_rules;
+	cw_key_ik_rule_t rules[CW_KEY_IK_RULES_MAX];
+} cw_key_ik_mode_t;
+
+
+#define RULE(bits, next) { (bits), (bits), (next) }
+
+static const cw_key_ik_mode_t cw_key_ik_modes[CW_KEY_IK_MODE_N] = {
+	[CW_KEY_IK_MODE_IAMBIC_A] = {
+		"Iambic A", false, false, 4, {
+			RULE(CW_KEY_IK_RULE_B_STATE,                             CW_KEY_IK_NEXT_OPP),
+			RULE(CW_KEY_IK_RULE_OPP_LATCH | CW_KEY_IK_RULE_CURTIS_B, CW_KEY_IK_NEXT_OPP_B),
+			RULE(CW_KEY_IK_RULE_OPP_LATCH,                           CW_KEY_IK_NEXT_OPP),
+			RULE(CW_KEY_IK_RULE_SAME_LATCH,                          CW_KEY_IK_NEXT_SAME) }
+	},
+	[CW_KEY_IK_MODE_IAMBIC_B] = {
+		"Iambic B", true, false, 4, {
+			RULE(CW_KEY_IK_RULE_B_STATE,                             CW_KEY_IK_NEXT_OPP),
+			RULE(CW_KEY_IK_RULE_OPP_LATCH | CW_KEY_IK_RULE_CURTIS_B, CW_KEY_IK_NEXT_OPP_B),
+			RULE(CW_KEY_IK_RULE_OPP_LATCH,                           CW_KEY_IK_NEXT_OPP),
+			RULE(CW_KEY_IK_RULE_SAME_LATCH,                          CW_KEY_IK_NEXT_SAME) }
+	},
+	[CW_KEY_IK_MODE_ULTIMATIC] = {
+		"Ultimatic", false, false, 3, {
+			/* Both paddles closed, same paddle closed last. */
+			{ CW_KEY_IK_RULE_SAME_PADDLE | CW_KEY_IK_RULE_OPP_PADDLE | CW_KEY_IK_RULE_OPP_LAST,
+			  CW_KEY_IK_RULE_SAME_PADDLE | CW_KEY_IK_RULE_OPP_PADDLE,
+			  CW_KEY_IK_NEXT_SAME },
+			RULE(CW_KEY_IK_RULE_OPP_LATCH,                           CW_KEY_IK_NEXT_OPP),
+			RULE(CW_KEY_IK_RULE_SAME_LATCH,                          CW_KEY_IK_NEXT_SAME) }
+	},
+	[CW_KEY_IK_MODE_BUG] = {
+		"Bug", false, true, 1, {
+			RULE(CW_KEY_IK_RULE_SAME_LATCH,                          CW_KEY_IK_NEXT_SAME) }
+	}
+};
 
+#undef RULE
 
-static int cw_key_ik_update_state_initial_internal(volatile cw_key_t * key);
+
+
+
+static void cw_key_ik_start_internal(volatile cw_key_t * key);
+static void cw_key_ik_update_manual_mark_internal(volatile cw_key_t * key);
+static bool cw_key_ik_is_memory_open_internal(const volatile cw_key_t * key);
+static void cw_key_ik_advance_internal(volatile cw_key_t * key);
+static unsigned int cw_key_ik_clear_latch_if_open_internal(volatile cw_key_t * key, unsigned int paddle, unsigned int latch);
+static int cw_key_ik_notify_paddles_internal(volatile cw_key_t * key, unsigned int paddles, unsigned int closed, const struct timeval * timestamp);
 static int cw_key_ik_set_value_internal(volatile cw_key_t * key, int key_state, char symbol);
-static int cw_key_sk_set_value_internal(volatile cw_key_t * key, int key_state);
+static int cw_key_sk_set_value_internal(volatile cw_key_t * key, int key_state, const struct timeval * timestamp);
+static void cw_key_notify_receiver_internal(volatile cw_key_t * key, int key_state);
+static int cw_key_ik_schedule_element_internal(volatile cw_key_t * key, char symbol);
+static void cw_key_ik_add_waiter_internal(const volatile cw_key_t * key);
+static void cw_key_ik_notify_waiters_internal(volatile cw_key_t * key);
+static void cw_key_ik_post_idle_event_internal(volatile cw_key_t * key);
 
 
 
@@ -302,10 +425,11 @@ void cw_key_tk_set_value_internal(volatile cw_key_t *key, int key_state)
 
 /**
    Comment for key used as iambic keyer:
-   Iambic keyer cannot function without an associated generator. A
-   keyer has to have some generator to function correctly. Generator
-   doesn't care if it has any key registered or not. Thus a function
-   binding a keyer and generator belongs to "iambic keyer" module.
+   Iambic keyer with an associated generator is timed by the
+   generator. Keyer without a generator is timed by libcw's timer
+   wheel, but it produces no sound. Generator doesn't care if it has
+   any key registered or not. Thus a function binding a keyer and
+   generator belongs to "iambic keyer" module.
 
    Remember that a generator can exist without a keyer. In applications
    that do nothing related to keying with iambic keyer, having just a
@@ -378,17 +502,21 @@ void cw_key_register_receiver(volatile cw_key_t * key, cw_rec_t * rec)
 
    \param key - key in use
    \param key_state - key value to be set
+   \param timestamp - time of key event (NULL for current time)
 
    \return CW_SUCCESS on success
    \return CW_FAILURE on failure
 */
-int cw_key_sk_set_value_internal(volatile cw_key_t *key, int key_state)
+int cw_key_sk_set_value_internal(volatile cw_key_t *key, int key_state, const struct timeval * timestamp)
 {
 	cw_assert (key, MSG_PREFIX "sk set value: key is NULL");
-	cw_assert (key->gen, MSG_PREFIX "sk set value: generator is NULL");
 
 	struct timeval t;
-	gettimeofday(&t, NULL);
+	if (timestamp) {
+		t = *timestamp;
+	} else {
+		gettimeofday(&t, NULL);
+	}
 	key->timer.tv_sec = t.tv_sec;
 	key->timer.tv_usec = t.tv_usec;
 
@@ -418,6 +546,18 @@ int cw_key_sk_set_value_internal(volatile cw_key_t *key, int key_state)
 		(*key->key_legacy_callback_func)(key->key_legacy_callback_arg, key->sk.key_value);
 	}
 
+	if (!key->gen) {
+		/* Without a generator there is no tone queue that
+		   would pass key events to receiver. */
+		cw_key_notify_receiver_internal(key, key->sk.key_value);
+		return CW_SUCCESS;
+	}
+
+	/* Tell generator about new state of key before enqueueing
+	   a tone: generator will notice key-up while it is in the
+	   middle of a "forever" mark. */
+	cw_gen_set_sk_key_down_internal(key->gen, key->sk.key_value == CW_KEY_STATE_CLOSED);
+
 	int rv;
 	if (key->sk.key_value == CW_KEY_STATE_CLOSED) {
 		/* In case of straight key we don't know at
@@ -485,7 +625,6 @@ int cw_key_sk_set_value_internal(volatile cw_key_t *key, int key_state)
 int cw_key_ik_set_value_internal(volatile cw_key_t *key, int key_state, char symbol)
 {
 	cw_assert (key, MSG_PREFIX "ik set value: keyer is NULL");
-	cw_assert (key->gen, MSG_PREFIX "ik set value: generator is NULL");
 
 	if (key->ik.key_value == key_state) {
 		/* This is not an error. This may happen when
@@ -500,6 +639,18 @@ int cw_key_ik_set_value_internal(volatile cw_key_t *key, int key_state, char sym
 	/* Remember the new key value. */
 	key->ik.key_value = key_state;
 
+	if (key_state == CW_KEY_STATE_CLOSED && key->ik.memory_window) {
+		/* Beginning of mark, for memory window. */
+		int len = 0;
+		if (key->gen) {
+			len = symbol == CW_DASH_REPRESENTATION ? key->gen->dash_len : key->gen->dot_len;
+		} else {
+			len = symbol == CW_DASH_REPRESENTATION ? 3 * key->ik.dot_len : key->ik.dot_len;
+		}
+		__atomic_store_n(&key->ik.mark_len, len, __ATOMIC_RELEASE);
+		__atomic_store_n(&key->ik.mark_start, cw_timer_now_internal(), __ATOMIC_RELEASE);
+	}
+
 	/* Call a registered callback. */
 	if (key->key_callback_func) {
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_KEYING, CW_DEBUG_INFO,
@@ -514,6 +665,14 @@ int cw_key_ik_set_value_internal(volatile cw_key_t *key, int key_state, char sym
 		(*key->key_legacy_callback_func)(key->key_legacy_callback_arg, key->ik.key_value);
 	}
 
+	if (!key->gen) {
+		cw_key_notify_receiver_internal(key, key->ik.key_value);
+
+		int rv = cw_key_ik_schedule_element_internal(key, symbol);
+		cw_assert (CW_SUCCESS == rv, MSG_PREFIX "ik set value: failed to schedule symbol '%c'", symbol);
+		return rv;
+	}
+
 	/* 'Partial' means without any end-of-mark spaces. */
 	int rv = cw_gen_enqueue_partial_symbol_internal(key->gen, symbol);
 	cw_assert (CW_SUCCESS == rv, MSG_PREFIX "ik set value: failed to key symbol '%c'", symbol);
@@ -523,6 +682,101 @@ int cw_key_ik_set_value_internal(volatile cw_key_t *key, int key_state, char sym
 
 
 
+/**
+   \brief Pass new key value directly to key's receiver
+
+   A key with a generator passes its events to receiver through
+   generator's tone queue (see cw_key_tk_set_value_internal()). A key
+   without a generator has to do this by itself.
+
+   \param key - key with receiver to notify
+   \param key_state - new key value
+*/
+void cw_key_notify_receiver_internal(volatile cw_key_t * key, int key_state)
+{
+	if (!key->rec) {
+		return;
+	}
+
+	if (key_state == CW_KEY_STATE_CLOSED) {
+		cw_rec_mark_begin(key->rec, &key->timer);
+	} else {
+		cw_rec_mark_end(key->rec, &key->timer);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Register end of iambic keyer's element with timer wheel
+
+   This is a replacement of enqueueing a symbol in generator's queue,
+   used when the keyer has no generator. The element begins where
+   previous element has ended (at previous deadline of keyer's
+   timer), so small timing errors of timer wheel's thread don't
+   accumulate over consecutive elements.
+
+   \param key - iambic keyer
+   \param symbol - symbol to time (Space, Dot, Dash)
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_key_ik_schedule_element_internal(volatile cw_key_t * key, char symbol)
+{
+	cw_assert (key->ik.timing, MSG_PREFIX "ik schedule element: keyer without generator and without timing");
+
+	if (symbol == CW_DOT_REPRESENTATION) {
+		key->ik.element_len = key->ik.dot_len;
+	} else if (symbol == CW_DASH_REPRESENTATION) {
+		key->ik.element_len = 3 * key->ik.dot_len;
+	} else {
+		/* Inter-mark space. */
+		key->ik.element_len = key->ik.dot_len;
+	}
+
+	cw_timer_t * timer = &key->ik.timing->timer;
+	int64_t start = timer->deadline;
+
+	const int64_t now = cw_timer_now_internal();
+	if (now - start > key->ik.dot_len / 2) {
+		/* Timer wheel's thread has been delayed for so long
+		   that catching up with the deadlines would
+		   noticeably shorten next elements. Start the element
+		   now instead. */
+		start = now;
+	}
+
+	return cw_timer_schedule_internal(timer, start + key->ik.element_len);
+}
+
+
+
+
+/**
+   \brief Handle end of element of iambic keyer that has no generator
+
+   Function is called in timer wheel's thread when an element
+   scheduled with cw_key_ik_schedule_element_internal() has ended.
+
+   \param arg - iambic keyer
+*/
+void cw_key_ik_timer_callback_internal(void * arg)
+{
+	volatile cw_key_t * key = (volatile cw_key_t *) arg;
+
+	cw_key_ik_increment_timer_internal(key, key->ik.element_len);
+	cw_key_ik_update_graph_state_internal(key);
+
+	return;
+}
+
+
+
+
 /* ******************************************************************** */
 /*                        Section:Iambic keyer                          */
 /* ******************************************************************** */
@@ -547,7 +801,7 @@ int cw_key_ik_set_value_internal(volatile cw_key_t *key, int key_state, char sym
 */
 void cw_key_ik_enable_curtis_mode_b(volatile cw_key_t *key)
 {
-	key->ik.curtis_mode_b = true;
+	cw_key_ik_set_mode(key, CW_KEY_IK_MODE_IAMBIC_B);
 	return;
 }
 
@@ -563,7 +817,9 @@ void cw_key_ik_enable_curtis_mode_b(volatile cw_key_t *key)
 */
 void cw_key_ik_disable_curtis_mode_b(volatile cw_key_t * key)
 {
-	key->ik.curtis_mode_b = false;
+	if (key->ik.mode == CW_KEY_IK_MODE_IAMBIC_B) {
+		cw_key_ik_set_mode(key, CW_KEY_IK_MODE_IAMBIC_A);
+	}
 	return;
 }
 
@@ -582,29 +838,212 @@ void cw_key_ik_disable_curtis_mode_b(volatile cw_key_t * key)
 */
 bool cw_key_ik_get_curtis_mode_b(const volatile cw_key_t *key)
 {
-	return key->ik.curtis_mode_b;
+	return key->ik.mode == CW_KEY_IK_MODE_IAMBIC_B;
 }
 
 
 
 
 /**
-   \brief Update state of iambic keyer, enqueue tone representing state of the iambic keyer
+   \brief Set mode of iambic keyer
+
+   \li CW_KEY_IK_MODE_IAMBIC_A, CW_KEY_IK_MODE_IAMBIC_B - Curtis 8044
+   keyer mode A or B, see cw_key_ik_enable_curtis_mode_b();
+   \li CW_KEY_IK_MODE_ULTIMATIC - when both paddles are closed, the
+   keyer repeats element of the paddle that has been closed last;
+   when that paddle is opened, the keyer continues with element of
+   the other paddle;
+   \li CW_KEY_IK_MODE_BUG - emulation of semi-automatic key ("bug"):
+   Dot paddle produces automatic Dots, Dash paddle is a straight key
+   that keys a mark for as long as it is closed. The Dash paddle is
+   effective only when the keyer is not sending Dots.
+
+   The mode can be changed while the keyer is running, it will be
+   used from next element.
+
+   \errno EINVAL - \p mode is invalid
 
-   It seems that the function is called when a client code informs
-   about change of state of one of paddles. So I think what the
-   function does is that it takes the new state of paddles and
-   re-evaluate internal state of iambic keyer.
+   \param key - iambic keyer
+   \param mode - new mode of keyer
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_key_ik_set_mode(volatile cw_key_t * key, int mode)
+{
+	if (mode < 0 || mode >= CW_KEY_IK_MODE_N) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	__atomic_store_n(&key->ik.mode, mode, __ATOMIC_RELEASE);
+	if (!cw_key_ik_modes[mode].curtis_b_latch) {
+		__atomic_fetch_and(&key->ik.inputs, ~CW_KEY_IK_CURTIS_B_LATCH, __ATOMIC_ACQ_REL);
+	}
+
+	cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_INFO,
+		      MSG_PREFIX "ik set mode: %s", cw_key_ik_modes[mode].label);
+
+	/* Let the keyer end manual mark of bug mode, if necessary. */
+	cw_key_ik_run_internal(key, CW_KEY_IK_PENDING_MANUAL);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   See documentation of cw_key_ik_set_mode() for more information
+
+   \param key - iambic keyer
+
+   \return mode of iambic keyer (CW_KEY_IK_MODE_IAMBIC_A etc.)
+*/
+int cw_key_ik_get_mode(const volatile cw_key_t * key)
+{
+	return __atomic_load_n(&key->ik.mode, __ATOMIC_ACQUIRE);
+}
 
-   The function is also called in generator's thread function
-   cw_generator_dequeue_and_generate_internal() each time a tone is
-   dequeued and pushed to audio system. I don't know why make the call
-   in that place for iambic keyer, but not for straight key.
+
+
+
+/**
+   \brief Configure memory of paddles of iambic keyer
+
+   With paddle memory enabled, a paddle that is closed, even briefly,
+   while the keyer is sending an element, is remembered and its
+   element is sent after the current one. With the memory disabled,
+   only paddles that are closed at the end of element are taken into
+   account.
+
+   \p window is a part of each mark (in percents of length of the
+   mark, counted from its beginning) during which paddles are not
+   remembered. 0 means that paddles are remembered during whole
+   element (this is the default), 50 means that paddles are
+   remembered only from the middle of a mark till the end of the
+   following space.
+
+   \errno EINVAL - \p window is out of range 0-100
+
+   \param key - iambic keyer
+   \param dot_memory - remember Dot paddle
+   \param dash_memory - remember Dash paddle
+   \param window - beginning part of mark during which paddles are not remembered [%]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_key_ik_set_memory(volatile cw_key_t * key, bool dot_memory, bool dash_memory, int window)
+{
+	if (window < 0 || window > 100) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	key->ik.memory = (dot_memory ? CW_KEY_IK_DOT_LATCH : 0) | (dash_memory ? CW_KEY_IK_DASH_LATCH : 0);
+	key->ik.memory_window = window;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   See documentation of cw_key_ik_set_memory() for more information
+
+   Any of the output arguments can be NULL - it won't be updated then.
+
+   \param key - iambic keyer
+   \param dot_memory - output: whether Dot paddle is remembered
+   \param dash_memory - output: whether Dash paddle is remembered
+   \param window - output: memory window [%]
+*/
+void cw_key_ik_get_memory(const volatile cw_key_t * key, bool * dot_memory, bool * dash_memory, int * window)
+{
+	if (dot_memory) {
+		*dot_memory = key->ik.memory & CW_KEY_IK_DOT_LATCH;
+	}
+	if (dash_memory) {
+		*dash_memory = key->ik.memory & CW_KEY_IK_DASH_LATCH;
+	}
+	if (window) {
+		*window = key->ik.memory_window;
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Set speed of iambic keyer that has no generator
+
+   Keyer with a generator is timed by the generator, and the
+   generator's speed is used. This function sets speed of a keyer
+   that isn't associated with any generator and is timed by libcw's
+   timer wheel.
+
+   See libcw.h/CW_SPEED_{INITIAL|MIN|MAX} for initial/minimal/maximal
+   value of speed.
+
+   \errno EINVAL - \p new_value is out of range
+
+   \param key - iambic keyer
+   \param new_value - new value of speed [wpm]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_key_ik_set_speed(volatile cw_key_t * key, int new_value)
+{
+	if (new_value < CW_SPEED_MIN || new_value > CW_SPEED_MAX) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	key->ik.dot_len = CW_DOT_CALIBRATION / new_value;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   See documentation of cw_key_ik_set_speed() for more information
+
+   \param key - iambic keyer
+
+   \return speed of iambic keyer that has no generator [wpm]
+*/
+int cw_key_ik_get_speed(const volatile cw_key_t * key)
+{
+	return CW_DOT_CALIBRATION / key->ik.dot_len;
+}
+
+
+
+
+/**
+   \brief Notify iambic keyer that its current element has ended
+
+   The function is called in generator's thread function
+   cw_generator_dequeue_and_generate_internal() each time a tone
+   enqueued by the keyer has been played. For a keyer without a
+   generator the function is called in thread of timer wheel, at the
+   end of each element.
+
+   The function never blocks and never fails because of other thread
+   using the keyer: if client code is running the keyer's state
+   machine right now, the request is left for the client's thread to
+   handle (see cw_key_ik_run_internal()).
 
    \param key - iambic key
 
-   \return CW_FAILURE if there is a lock and the function cannot proceed
-   \return CW_SUCCESS otherwise
+   \return CW_SUCCESS
 */
 int cw_key_ik_update_graph_state_internal(volatile cw_key_t *key)
 {
@@ -622,177 +1061,355 @@ int cw_key_ik_update_graph_state_internal(volatile cw_key_t *key)
 		return CW_SUCCESS;
 	}
 
-	/* This function is called from generator thread function, so
-	   the generator must exist. Be paranoid and check it, just in
-	   case. */
-	cw_assert (key->gen, MSG_PREFIX "ik update: generator is NULL");
+	cw_key_ik_run_internal(key, CW_KEY_IK_PENDING_UPDATE);
+
+	return CW_SUCCESS;
+}
+
 
 
-	if (key->ik.lock) {
-		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_INTERNAL, CW_DEBUG_ERROR,
-			      MSG_PREFIX "ik update: lock in thread %ld", (long) pthread_self());
-		return CW_FAILURE;
-	}
-	key->ik.lock = true;
 
-	/* Synchronize low level timing parameters if required. */
-	if (key->gen) {
-		cw_gen_sync_parameters_internal(key->gen);
+/**
+   \brief Run iambic keyer's state machine, or leave a request for a thread that is running it
+
+   The state machine is advanced by two kinds of threads: by client
+   code's thread when a paddle is pressed while the keyer is idle
+   (CW_KEY_IK_PENDING_KICK), and by generator's thread (or timer
+   wheel's thread) when an element has ended
+   (CW_KEY_IK_PENDING_UPDATE).
+
+   Only one thread at a time runs the state machine. Instead of
+   waiting for the other thread, a thread that comes second adds its
+   request to key->ik.pending and returns immediately. The thread
+   running the state machine handles all pending requests before
+   returning. This way neither of the threads is ever blocked or
+   delayed by the other one.
+
+   Requests to start or end manual mark of bug mode
+   (CW_KEY_IK_PENDING_MANUAL) are serialized with the state machine
+   in the same way.
+
+   \param key - iambic keyer
+   \param request - CW_KEY_IK_PENDING_UPDATE, CW_KEY_IK_PENDING_KICK or CW_KEY_IK_PENDING_MANUAL
+*/
+void cw_key_ik_run_internal(volatile cw_key_t * key, unsigned int request)
+{
+	__atomic_fetch_or(&key->ik.pending, request, __ATOMIC_SEQ_CST);
+
+	while (true) {
+		int expected = 0;
+		if (!__atomic_compare_exchange_n(&key->ik.running, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			/* Other thread is running the state machine,
+			   it will handle our request. */
+			cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_INTERNAL, CW_DEBUG_DEBUG,
+				      MSG_PREFIX "ik run: request %u left for other thread", request);
+			return;
+		}
+
+		const bool was_busy = key->ik.graph_state != KS_IDLE;
+
+		unsigned int pending = 0;
+		while (0 != (pending = __atomic_exchange_n(&key->ik.pending, 0, __ATOMIC_SEQ_CST))) {
+
+			/* Synchronize low level timing parameters if required. */
+			if (key->gen) {
+				cw_gen_sync_parameters_internal(key->gen);
+			}
+			if (key->rec) {
+				cw_rec_sync_parameters_internal(key->rec);
+			}
+
+			if (pending & CW_KEY_IK_PENDING_UPDATE) {
+				cw_key_ik_advance_internal(key);
+			}
+			if (pending & CW_KEY_IK_PENDING_KICK) {
+				cw_key_ik_start_internal(key);
+			}
+			if (pending & CW_KEY_IK_PENDING_MANUAL) {
+				cw_key_ik_update_manual_mark_internal(key);
+			}
+		}
+
+		cw_key_ik_notify_waiters_internal(key);
+		if (was_busy && key->ik.graph_state == KS_IDLE) {
+			cw_key_ik_post_idle_event_internal(key);
+		}
+
+		__atomic_store_n(&key->ik.running, 0, __ATOMIC_SEQ_CST);
+
+		/* A request might have been added after the last
+		   check of key->ik.pending, but before the state
+		   machine has been released. Its author has given up
+		   on running the state machine, so take care of the
+		   request. */
+		if (0 == __atomic_load_n(&key->ik.pending, __ATOMIC_SEQ_CST)) {
+			return;
+		}
 	}
-	if (key->rec) {
-		cw_rec_sync_parameters_internal(key->rec);
+}
+
+
+
+
+/**
+   \brief Atomically clear paddle latch if its paddle is open
+
+   \param key - iambic keyer
+   \param paddle - CW_KEY_IK_DOT_PADDLE or CW_KEY_IK_DASH_PADDLE
+   \param latch - latch corresponding to \p paddle
+
+   \return paddles and latches after the operation
+*/
+static unsigned int cw_key_ik_clear_latch_if_open_internal(volatile cw_key_t * key, unsigned int paddle, unsigned int latch)
+{
+	unsigned int inputs = __atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE);
+	while (!(inputs & paddle)) {
+		/* If the paddle gets pressed in the meantime, the
+		   exchange fails, and the loop sees the pressed
+		   paddle. */
+		if (__atomic_compare_exchange_n(&key->ik.inputs, &inputs, inputs & ~latch, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			inputs &= ~latch;
+			break;
+		}
 	}
 
-	int old_state = key->ik.graph_state;
+	return inputs;
+}
 
-	/* Decide what to do based on the current state. */
-	switch (key->ik.graph_state) {
-		/* Ignore calls if our state is idle. */
-	case KS_IDLE:
-		key->ik.lock = false;
-		return CW_SUCCESS;
 
 
-	case KS_IN_DOT_A:
-	case KS_IN_DOT_B:
-		/* Verify that key value and keyer graph state are in
-		   sync.  We are *at the end* of Mark (Dot), so key should
-		   be (still) closed. */
-		cw_assert (key->ik.key_value == CW_KEY_STATE_CLOSED,
-			   MSG_PREFIX "ik update: inconsistency between keyer state (%s) ad key value (%d)",
-			   cw_iambic_keyer_states[key->ik.graph_state], key->ik.key_value);
 
-		/* We are ending a Dot, so turn off tone and begin the
-		   after-dot Space.
-		   No routine status checks are made! (TODO) */
-		cw_key_ik_set_value_internal(key, CW_KEY_STATE_OPEN, CW_SYMBOL_SPACE);
-		key->ik.graph_state = key->ik.graph_state == KS_IN_DOT_A ? KS_AFTER_DOT_A : KS_AFTER_DOT_B;
-		break;
+/**
+   \brief Get next state of iambic keyer's state machine
 
-	case KS_IN_DASH_A:
-	case KS_IN_DASH_B:
-		/* Verify that key value and keyer graph state are in
-		   sync.  We are *at the end* of Mark (Dash), so key should
-		   be (still) closed. */
-		cw_assert (key->ik.key_value == CW_KEY_STATE_CLOSED,
-			   MSG_PREFIX "ik update: inconsistency between keyer state (%s) ad key value (%d)",
-			   cw_iambic_keyer_states[key->ik.graph_state], key->ik.key_value);
+   The function doesn't change state of any keyer, it only looks up
+   next state in tables of transitions. The lookup takes constant
+   time.
 
-		/* We are ending a Dash, so turn off tone and begin
-		   the after-dash Space.
-		   No routine status checks are made! (TODO) */
-		cw_key_ik_set_value_internal(key, CW_KEY_STATE_OPEN, CW_SYMBOL_SPACE);
-		key->ik.graph_state = key->ik.graph_state == KS_IN_DASH_A ? KS_AFTER_DASH_A : KS_AFTER_DASH_B;
-		break;
+   \p inputs are paddles and latches (CW_KEY_IK_DOT_PADDLE etc.) at
+   the end of element, after clearing a latch of the element's paddle
+   if the paddle is open.
 
-	case KS_AFTER_DOT_A:
-	case KS_AFTER_DOT_B:
-		/* Verify that key value and keyer graph state are in
-		   sync.  We are *at the end* of Space, so key should
-		   be (still) open. */
-		cw_assert (key->ik.key_value == CW_KEY_STATE_OPEN,
-			   MSG_PREFIX "ik update: inconsistency between keyer state (%s) ad key value (%d)",
-			   cw_iambic_keyer_states[key->ik.graph_state], key->ik.key_value);
-
-		/* If we have just finished a Dot or a Dash and its
-		   post-mark delay, then reset the latches as
-		   appropriate.  Next, if in a _B state, go straight
-		   to the opposite element state.  If in an _A state,
-		   check the latch states; if the opposite latch is
-		   set true, then do the iambic thing and alternate
-		   dots and dashes.  If the same latch is true,
-		   repeat.  And if nothing is true, then revert to
-		   idling. */
-
-		if (!key->ik.dot_paddle) {
-			/* Client has informed us that dot paddle has
-			   been released. Clear the paddle state
-			   memory. */
-			key->ik.dot_latch = false;
+   \param mode - mode of keyer (CW_KEY_IK_MODE_IAMBIC_A etc.)
+   \param state - current state of keyer's state machine
+   \param inputs - paddles and latches
+   \param consume_curtis_b_latch - output: whether the transition clears Curtis Dot&Dash latch
+
+   \return next state of keyer's state machine
+*/
+int cw_key_ik_next_state_internal(int mode, int state, unsigned int inputs, bool * consume_curtis_b_latch)
+{
+	*consume_curtis_b_latch = false;
+
+	if (state == KS_IDLE) {
+		return KS_IDLE;
+	}
+	if (cw_key_ik_states[state].is_mark) {
+		/* End of mark, begin the after-mark Space. */
+		return cw_key_ik_after_states[state];
+	}
+
+	/* End of the after-mark Space. Describe paddles and
+	   latches from point of view of the element that has just
+	   ended. */
+	const bool is_dash = cw_key_ik_states[state].symbol == CW_DASH_REPRESENTATION;
+	const unsigned int same_paddle = is_dash ? CW_KEY_IK_DASH_PADDLE : CW_KEY_IK_DOT_PADDLE;
+	const unsigned int opp_paddle = is_dash ? CW_KEY_IK_DOT_PADDLE : CW_KEY_IK_DASH_PADDLE;
+	const unsigned int same_latch = is_dash ? CW_KEY_IK_DASH_LATCH : CW_KEY_IK_DOT_LATCH;
+	const unsigned int opp_latch = is_dash ? CW_KEY_IK_DOT_LATCH : CW_KEY_IK_DASH_LATCH;
+
+	unsigned int word = 0;
+	if (inputs & same_paddle) {
+		word |= CW_KEY_IK_RULE_SAME_PADDLE | CW_KEY_IK_RULE_SAME_LATCH;
+	}
+	if (inputs & opp_paddle) {
+		word |= CW_KEY_IK_RULE_OPP_PADDLE | CW_KEY_IK_RULE_OPP_LATCH;
+	}
+	if (inputs & same_latch) {
+		word |= CW_KEY_IK_RULE_SAME_LATCH;
+	}
+	if (inputs & opp_latch) {
+		word |= CW_KEY_IK_RULE_OPP_LATCH;
+	}
+	if (inputs & CW_KEY_IK_CURTIS_B_LATCH) {
+		word |= CW_KEY_IK_RULE_CURTIS_B;
+	}
+	if (!(inputs & CW_KEY_IK_DASH_LAST) != !is_dash) {
+		word |= CW_KEY_IK_RULE_OPP_LAST;
+	}
+	if (cw_key_ik_states[state].is_b) {
+		word |= CW_KEY_IK_RULE_B_STATE;
+	}
+
+	const cw_key_ik_mode_t * m = &cw_key_ik_modes[mode];
+	for (int i = 0; i < m->n_rules; i++) {
+		if ((word & m->rules[i].mask) != m->rules[i].value) {
+			continue;
 		}
 
-		if (key->ik.graph_state == KS_AFTER_DOT_B) {
-			cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, CW_DASH_REPRESENTATION);
-			key->ik.graph_state = KS_IN_DASH_A;
-
-		} else if (key->ik.dash_latch) {
-			cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, CW_DASH_REPRESENTATION);
-			if (key->ik.curtis_b_latch) {
-				key->ik.curtis_b_latch = false;
-				key->ik.graph_state = KS_IN_DASH_B;
-			} else {
-				key->ik.graph_state = KS_IN_DASH_A;
-			}
-		} else if (key->ik.dot_latch) {
-			cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, CW_DOT_REPRESENTATION);
-			key->ik.graph_state = KS_IN_DOT_A;
-		} else {
-			key->ik.graph_state = KS_IDLE;
-			//cw_finalization_schedule_internal();
+		switch (m->rules[i].next) {
+		case CW_KEY_IK_NEXT_SAME:
+			return cw_key_ik_in_states[is_dash][0];
+		case CW_KEY_IK_NEXT_OPP:
+			return cw_key_ik_in_states[!is_dash][0];
+		case CW_KEY_IK_NEXT_OPP_B:
+		default:
+			*consume_curtis_b_latch = true;
+			return cw_key_ik_in_states[!is_dash][1];
 		}
+	}
+
+	/* All latches clear. */
+	return KS_IDLE;
+}
+
 
-		break;
 
-	case KS_AFTER_DASH_A:
-	case KS_AFTER_DASH_B:
+
+/**
+   \brief Move iambic keyer's state machine to next state, enqueue tone representing the state
+
+   Call the function at the end of keyer's current element. Keyer's
+   state machine must be held by caller (see cw_key_ik_run_internal()).
+
+   \param key - iambic keyer
+*/
+static void cw_key_ik_advance_internal(volatile cw_key_t * key)
+{
+	const int old_state = key->ik.graph_state;
+	if (old_state == KS_IDLE) {
+		/* Ignore calls if our state is idle. */
+		return;
+	}
+	if (old_state < 0 || old_state > KS_AFTER_DASH_B) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_ERROR,
+			      MSG_PREFIX "ik update: invalid keyer state %d",
+			      old_state);
+		return;
+	}
+
+	unsigned int inputs = 0;
+	if (cw_key_ik_states[old_state].is_mark) {
+		/* Verify that key value and keyer graph state are in
+		   sync.  We are *at the end* of Mark, so key should
+		   be (still) closed. */
+		cw_assert (key->ik.key_value == CW_KEY_STATE_CLOSED,
+			   MSG_PREFIX "ik update: inconsistency between keyer state (%s) ad key value (%d)",
+			   cw_key_ik_states[old_state].label, key->ik.key_value);
+	} else {
 		/* Verify that key value and keyer graph state are in
 		   sync.  We are *at the end* of Space, so key should
 		   be (still) open. */
 		cw_assert (key->ik.key_value == CW_KEY_STATE_OPEN,
 			   MSG_PREFIX "ik update: inconsistency between keyer state (%s) ad key value (%d)",
-			   cw_iambic_keyer_states[key->ik.graph_state], key->ik.key_value);
-
-		if (!key->ik.dash_paddle) {
-			/* Client has informed us that dash paddle has
-			   been released. Clear the paddle state
-			   memory. */
-			key->ik.dash_latch = false;
-		}
-
-		/* If we have just finished a dot or a dash and its
-		   post-mark delay, then reset the latches as
-		   appropriate.  Next, if in a _B state, go straight
-		   to the opposite element state.  If in an _A state,
-		   check the latch states; if the opposite latch is
-		   set true, then do the iambic thing and alternate
-		   dots and dashes.  If the same latch is true,
-		   repeat.  And if nothing is true, then revert to
-		   idling. */
-
-		if (key->ik.graph_state == KS_AFTER_DASH_B) {
-			cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, CW_DOT_REPRESENTATION);
-			key->ik.graph_state = KS_IN_DOT_A;
-
-		} else if (key->ik.dot_latch) {
-			cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, CW_DOT_REPRESENTATION);
-			if (key->ik.curtis_b_latch) {
-				key->ik.curtis_b_latch = false;
-				key->ik.graph_state = KS_IN_DOT_B;
-			} else {
-				key->ik.graph_state = KS_IN_DOT_A;
-			}
-		} else if (key->ik.dash_latch) {
-			cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, CW_DASH_REPRESENTATION);
-			key->ik.graph_state = KS_IN_DASH_A;
+			   cw_key_ik_states[old_state].label, key->ik.key_value);
+
+		/* We have just finished a Dot or a Dash and its
+		   post-mark delay. If client has informed us that
+		   paddle of the element has been released, clear the
+		   paddle state memory. */
+		if (cw_key_ik_states[old_state].symbol == CW_DOT_REPRESENTATION) {
+			inputs = cw_key_ik_clear_latch_if_open_internal(key, CW_KEY_IK_DOT_PADDLE, CW_KEY_IK_DOT_LATCH);
 		} else {
-			key->ik.graph_state = KS_IDLE;
-			//cw_finalization_schedule_internal();
+			inputs = cw_key_ik_clear_latch_if_open_internal(key, CW_KEY_IK_DASH_PADDLE, CW_KEY_IK_DASH_LATCH);
 		}
+	}
+
+	bool consume_curtis_b_latch = false;
+	const int new_state = cw_key_ik_next_state_internal(key->ik.mode, old_state, inputs, &consume_curtis_b_latch);
+	if (consume_curtis_b_latch) {
+		__atomic_fetch_and(&key->ik.inputs, ~CW_KEY_IK_CURTIS_B_LATCH, __ATOMIC_ACQ_REL);
+	}
 
-		break;
-	default:
+	int rv = CW_SUCCESS;
+	if (cw_key_ik_states[old_state].is_mark) {
+		/* We are ending a Mark, so turn off tone and begin
+		   the after-mark Space. */
+		rv = cw_key_ik_set_value_internal(key, CW_KEY_STATE_OPEN, CW_SYMBOL_SPACE);
+	} else if (new_state != KS_IDLE) {
+		rv = cw_key_ik_set_value_internal(key, CW_KEY_STATE_CLOSED, cw_key_ik_states[new_state].symbol);
+	}
+	if (CW_SUCCESS != rv) {
+		/* The state machine moves on anyway: the keyer must
+		   not get stuck because a single element hasn't been
+		   keyed. */
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_ERROR,
-			      MSG_PREFIX "ik update: invalid keyer state %d",
-			      key->ik.graph_state);
-		return CW_FAILURE;
+			      MSG_PREFIX "ik update: failed to key element for state %s", cw_key_ik_states[new_state].label);
 	}
 
+	__atomic_store_n(&key->ik.graph_state, new_state, __ATOMIC_RELEASE);
+
 	cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_INFO,
 		      MSG_PREFIX "ik update: keyer state: %s -> %s",
-		      cw_iambic_keyer_states[old_state], cw_iambic_keyer_states[key->ik.graph_state]);
+		      cw_key_ik_states[old_state].label, cw_key_ik_states[new_state].label);
 
-	key->ik.lock = false;
-	return CW_SUCCESS;
+	if (new_state == KS_IDLE && cw_key_ik_modes[key->ik.mode].manual_dash) {
+		/* Dash paddle of bug may have been closed while the
+		   keyer was sending Dots. */
+		cw_key_ik_update_manual_mark_internal(key);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Key manual mark of bug mode with straight key
+
+   Make state of straight key follow state of Dash paddle of keyer in
+   bug mode. The Dash paddle is effective only when keyer's state
+   machine is idle. Keyer's state machine must be held by caller (see
+   cw_key_ik_run_internal()).
+
+   \param key - iambic keyer
+*/
+static void cw_key_ik_update_manual_mark_internal(volatile cw_key_t * key)
+{
+	const unsigned int inputs = __atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE);
+	const bool closed = cw_key_ik_modes[key->ik.mode].manual_dash
+		&& key->ik.graph_state == KS_IDLE
+		&& (inputs & CW_KEY_IK_DASH_PADDLE);
+
+	if (closed == key->ik.manual) {
+		return;
+	}
+
+	cw_gen_latency_stamp_edge_internal(key->gen, CW_LATENCY_KEY_EVENT, closed ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN);
+	key->ik.manual = closed;
+	cw_key_sk_set_value_internal(key, closed ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN, NULL);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Check if paddles are remembered at this moment
+
+   See cw_key_ik_set_memory().
+
+   \param key - iambic keyer
+
+   \return false if keyer is in the beginning part of mark, in which paddles are not remembered
+   \return true otherwise
+*/
+static bool cw_key_ik_is_memory_open_internal(const volatile cw_key_t * key)
+{
+	const int window = key->ik.memory_window;
+	if (0 == window) {
+		return true;
+	}
+
+	const int state = __atomic_load_n(&key->ik.graph_state, __ATOMIC_ACQUIRE);
+	if (!cw_key_ik_states[state].is_mark) {
+		return true;
+	}
+
+	const int64_t elapsed = cw_timer_now_internal() - __atomic_load_n(&key->ik.mark_start, __ATOMIC_ACQUIRE);
+	return elapsed * 100 >= (int64_t) window * __atomic_load_n(&key->ik.mark_len, __ATOMIC_ACQUIRE);
 }
 
 
@@ -807,9 +1424,6 @@ int cw_key_ik_update_graph_state_internal(volatile cw_key_t *key)
    latches (for iambic functions) are also set.
 
    On success, the routine returns CW_SUCCESS.
-   On failure, it returns CW_FAILURE, with errno set to EBUSY if the
-   tone queue or straight key are using the sound card, console
-   speaker, or keying system.
 
    If appropriate, this routine starts the keyer functions sending the
    relevant element.  Element send and timing occurs in the background,
@@ -817,6 +1431,8 @@ int cw_key_ik_update_graph_state_internal(volatile cw_key_t *key)
    and cw_keyer_wait() for details about how to check the current status of
    iambic keyer background processing.
 
+   The function may be called from many threads at the same time,
+   and it never blocks generator's thread that is timing the keyer.
 
    \param key
    \param dot_paddle_state: CW_KEY_STATE_CLOSED or CW_KEY_STATE_OPEN
@@ -826,6 +1442,56 @@ int cw_key_ik_update_graph_state_internal(volatile cw_key_t *key)
    \return CW_FAILURE on failure
 */
 int cw_key_ik_notify_paddle_event(volatile cw_key_t *key, int dot_paddle_state, int dash_paddle_state)
+{
+	return cw_key_ik_notify_paddle_event_at_internal(key, dot_paddle_state, dash_paddle_state, NULL);
+}
+
+
+
+
+/**
+   \brief Inform iambic keyer about changed state of paddles, with time of the event
+
+   Variant of cw_key_ik_notify_paddle_event() for input drivers that
+   know exact time of paddle event (e.g. kernel timestamp of evdev
+   event). If the event starts the keyer, the time is used as
+   beginning of first element, and is passed to keying callback.
+
+   \param key - iambic keyer
+   \param dot_paddle_state - CW_KEY_STATE_CLOSED or CW_KEY_STATE_OPEN
+   \param dash_paddle_state - CW_KEY_STATE_CLOSED or CW_KEY_STATE_OPEN
+   \param timestamp - time of paddle event (NULL for current time)
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_key_ik_notify_paddle_event_at_internal(volatile cw_key_t * key, int dot_paddle_state, int dash_paddle_state, const struct timeval * timestamp)
+{
+	return cw_key_ik_notify_paddles_internal(key, CW_KEY_IK_DOT_PADDLE | CW_KEY_IK_DASH_PADDLE,
+						 (dot_paddle_state == CW_KEY_STATE_CLOSED ? CW_KEY_IK_DOT_PADDLE : 0)
+						 | (dash_paddle_state == CW_KEY_STATE_CLOSED ? CW_KEY_IK_DASH_PADDLE : 0),
+						 timestamp);
+}
+
+
+
+
+/**
+   \brief Record new state of some of the paddles, set paddle latches
+
+   \p paddles selects paddles (CW_KEY_IK_DOT_PADDLE and/or
+   CW_KEY_IK_DASH_PADDLE) whose state is changed. State of other
+   paddle is preserved, even if it is changed by other thread at the
+   same time.
+
+   \param key - iambic keyer
+   \param paddles - paddles to update
+   \param closed - paddles (from \p paddles) that are closed
+   \param timestamp - time of paddle event (NULL for current time)
+
+   \return CW_SUCCESS
+*/
+static int cw_key_ik_notify_paddles_internal(volatile cw_key_t * key, unsigned int paddles, unsigned int closed, const struct timeval * timestamp)
 {
 #if 0 /* This is disabled, but I'm not sure why. */  /* This code has been disabled some time before 2017-01-31. */
 	/* If the tone queue or the straight key are busy, this is going to
@@ -837,55 +1503,80 @@ int cw_key_ik_notify_paddle_event(volatile cw_key_t *key, int dot_paddle_state,
 	}
 #endif
 
-	/* Clean up and save the paddle states passed in. */
-#if 0    /* This code has been disabled on 2017-01-31. */
-	key->ik.dot_paddle = (dot_paddle_state != 0);
-	key->ik.dash_paddle = (dash_paddle_state != 0);
-#else
-	key->ik.dot_paddle = dot_paddle_state;
-	key->ik.dash_paddle = dash_paddle_state;
-#endif
-
-	/* Update the paddle latches if either paddle goes CLOSED.
-	   The latches are checked in the signal handler, so if the
-	   paddles go back to OPEN during this element, the item still
-	   gets actioned.  The signal handler is also responsible for
-	   clearing down the latches. TODO: verify the comment. */
-	if (key->ik.dot_paddle == CW_KEY_STATE_CLOSED) {
-		key->ik.dot_latch = true;
+	/* Save the paddle states passed in. Update the paddle
+	   latches if either paddle goes CLOSED.  The latches are
+	   checked by the state machine at the end of element, so if
+	   the paddles go back to OPEN during this element, the item
+	   still gets actioned.  The state machine is also
+	   responsible for clearing down the latches.
+
+	   Only paddles with enabled memory are latched, and not in
+	   the beginning part of a mark (see cw_key_ik_set_memory()).
+	   A paddle released while the memory is open is latched too:
+	   it has been closed when the memory was open.
+
+	   For Curtis mode B also latch both paddles being closed at
+	   the same time. This flag is checked by the state machine,
+	   to determine whether to add mode B trailing timing
+	   elements.
+
+	   For Ultimatic mode remember which paddle has been closed
+	   last. */
+	const cw_key_ik_mode_t * mode = &cw_key_ik_modes[__atomic_load_n(&key->ik.mode, __ATOMIC_ACQUIRE)];
+	unsigned int memory = key->ik.memory;
+	if (mode->manual_dash) {
+		memory &= ~CW_KEY_IK_DASH_LATCH;
 	}
-	if (key->ik.dash_paddle == CW_KEY_STATE_CLOSED) {
-		key->ik.dash_latch = true;
+	if (memory && !cw_key_ik_is_memory_open_internal(key)) {
+		memory = 0;
 	}
 
-
-	if (key->ik.curtis_mode_b
-	    && key->ik.dot_paddle == CW_KEY_STATE_CLOSED
-	    && key->ik.dash_paddle == CW_KEY_STATE_CLOSED) {
-
-		/* Both paddles closed at the same time in Curtis mode B.
-
-		   This flag is checked by the signal handler, to
-		   determine whether to add mode B trailing timing
-		   elements. TODO: verify this comment. */
-		key->ik.curtis_b_latch = true;
-	}
+	unsigned int inputs = __atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE);
+	unsigned int new_inputs = 0;
+	do {
+		new_inputs = (inputs & ~paddles) | closed;
+		if ((new_inputs | inputs) & CW_KEY_IK_DOT_PADDLE) {
+			new_inputs |= memory & CW_KEY_IK_DOT_LATCH;
+		}
+		if ((new_inputs | inputs) & CW_KEY_IK_DASH_PADDLE) {
+			new_inputs |= memory & CW_KEY_IK_DASH_LATCH;
+		}
+		if (mode->curtis_b_latch
+		    && (new_inputs & CW_KEY_IK_DOT_PADDLE)
+		    && (new_inputs & CW_KEY_IK_DASH_PADDLE)) {
+			new_inputs |= CW_KEY_IK_CURTIS_B_LATCH;
+		}
+		if (new_inputs & ~inputs & CW_KEY_IK_DASH_PADDLE) {
+			new_inputs |= CW_KEY_IK_DASH_LAST;
+		} else if (new_inputs & ~inputs & CW_KEY_IK_DOT_PADDLE) {
+			new_inputs &= ~CW_KEY_IK_DASH_LAST;
+		}
+	} while (!__atomic_compare_exchange_n(&key->ik.inputs, &inputs, new_inputs, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 
 	cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_INFO,
 		      MSG_PREFIX "ik notify: paddles %d,%d, latches %d,%d, curtis_b %d",
-		      key->ik.dot_paddle, key->ik.dash_paddle,
-		      key->ik.dot_latch, key->ik.dash_latch, key->ik.curtis_b_latch);
+		      !!(new_inputs & CW_KEY_IK_DOT_PADDLE), !!(new_inputs & CW_KEY_IK_DASH_PADDLE),
+		      !!(new_inputs & CW_KEY_IK_DOT_LATCH), !!(new_inputs & CW_KEY_IK_DASH_LATCH),
+		      !!(new_inputs & CW_KEY_IK_CURTIS_B_LATCH));
 
 
-	if (key->ik.graph_state == KS_IDLE) {
-		struct timeval t;
-		gettimeofday(&t, NULL);
-		key->timer.tv_sec = t.tv_sec;
-		key->timer.tv_usec = t.tv_usec;
+	if (mode->manual_dash && ((new_inputs ^ inputs) & CW_KEY_IK_DASH_PADDLE)) {
+		/* Dash paddle of bug keys the mark directly. */
+		cw_key_ik_run_internal(key, CW_KEY_IK_PENDING_MANUAL);
+	}
+
+	const unsigned int automatic = mode->manual_dash ? CW_KEY_IK_DOT_PADDLE : (CW_KEY_IK_DOT_PADDLE | CW_KEY_IK_DASH_PADDLE);
+	if (__atomic_load_n(&key->ik.graph_state, __ATOMIC_ACQUIRE) == KS_IDLE
+	    && (new_inputs & automatic)) {
 
 		/* If the current state is idle, give the state
 		   process an initial impulse. */
-		return cw_key_ik_update_state_initial_internal(key);
+		const int64_t kick_time = timestamp
+			? (int64_t) timestamp->tv_sec * CW_USECS_PER_SEC + timestamp->tv_usec
+			: 0;
+		__atomic_store_n(&key->ik.kick_time, kick_time, __ATOMIC_RELEASE);
+		cw_gen_latency_stamp_edge_internal(key->gen, CW_LATENCY_KEY_EVENT, CW_KEY_STATE_CLOSED);
+		cw_key_ik_run_internal(key, CW_KEY_IK_PENDING_KICK);
 	} else {
 		/* The state machine for iambic keyer is already in
 		   motion, no need to do anything more.
@@ -896,9 +1587,10 @@ int cw_key_ik_notify_paddle_event(volatile cw_key_t *key, int dot_paddle_state,
 
 		   In both cases the main action upon states of
 		   paddles and paddle latches is taken in
-		   cw_key_ik_update_graph_state_internal(). */
-		return CW_SUCCESS;
+		   cw_key_ik_advance_internal(). */
 	}
+
+	return CW_SUCCESS;
 }
 
 
@@ -908,72 +1600,91 @@ int cw_key_ik_notify_paddle_event(volatile cw_key_t *key, int dot_paddle_state,
    \brief Initiate work of iambic keyer state machine
 
    State machine for iambic keyer must be pushed from KS_IDLE
-   state. Call this function to do this.
+   state. Call this function to do this. Keyer's state machine must
+   be held by caller (see cw_key_ik_run_internal()).
 
    \param key
-
-   \return CW_SUCCESS on success
-   \return CW_FAILURE on failure
 */
-int cw_key_ik_update_state_initial_internal(volatile cw_key_t *key)
+static void cw_key_ik_start_internal(volatile cw_key_t *key)
 {
 	cw_assert (key, MSG_PREFIX "ik update initial: keyer is NULL");
-	cw_assert (key->gen, MSG_PREFIX "ik update initial: generator is NULL");
 
-	if (key->ik.dot_paddle == CW_KEY_STATE_OPEN && key->ik.dash_paddle == CW_KEY_STATE_OPEN) {
+	if (key->ik.graph_state != KS_IDLE) {
+		/* Keyer has been started by previous request, or an
+		   element has ended and keyer continues with next
+		   one. */
+		return;
+	}
+
+	const bool manual_dash = cw_key_ik_modes[key->ik.mode].manual_dash;
+	const unsigned int inputs = __atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE);
+	const unsigned int automatic = manual_dash ? CW_KEY_IK_DOT_PADDLE : (CW_KEY_IK_DOT_PADDLE | CW_KEY_IK_DASH_PADDLE);
+	if (!(inputs & automatic)) {
 		/* Both paddles are open/up. We certainly don't want
 		   to start any process upon "both paddles open"
-		   event. But the function shouldn't have been called
-		   in that situation. */
-		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_KEYER_STATES, CW_DEBUG_ERROR,
-			      MSG_PREFIX "ik update initial: called the function when both paddles are open");
-
-		/* Silently accept.
-		   TODO: maybe it's a good idea, or maybe bad one to
-		   return CW_SUCCESS here. */
-		return CW_SUCCESS;
+		   event. The paddles could have been released after
+		   the request to start the keyer has been made. */
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_KEYER_STATES, CW_DEBUG_DEBUG,
+			      MSG_PREFIX "ik update initial: both paddles are open");
+		return;
+	}
+	if (key->ik.manual) {
+		/* Dots of bug don't interrupt manual mark. */
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_KEYER_STATES, CW_DEBUG_DEBUG,
+			      MSG_PREFIX "ik update initial: manual mark in progress");
+		return;
 	}
 
-	int old_state = key->ik.graph_state;
+	/* First element starts at time of paddle event, if input
+	   driver has passed the time. */
+	const int64_t kick_time = __atomic_exchange_n(&key->ik.kick_time, 0, __ATOMIC_ACQ_REL);
+	if (kick_time) {
+		key->timer.tv_sec = kick_time / CW_USECS_PER_SEC;
+		key->timer.tv_usec = kick_time % CW_USECS_PER_SEC;
+	} else {
+		struct timeval t;
+		gettimeofday(&t, NULL);
+		key->timer.tv_sec = t.tv_sec;
+		key->timer.tv_usec = t.tv_usec;
+	}
 
-	if (key->ik.dot_paddle == CW_KEY_STATE_CLOSED) {
+	if (!key->gen && key->ik.timing) {
+		/* First element of keyer timed by timer wheel starts
+		   now. See cw_key_ik_schedule_element_internal(). */
+		key->ik.timing->timer.deadline = cw_timer_now_internal();
+	}
+
+	const bool curtis_b_latch = inputs & CW_KEY_IK_CURTIS_B_LATCH;
+	if (manual_dash) {
+		/* Only Dot paddle of bug is automatic. Pretend that
+		   we are in "after dot" space, so that keyer will
+		   repeat the Dot. */
+		key->ik.graph_state = KS_AFTER_DOT_A;
+
+	} else if (inputs & CW_KEY_IK_DOT_PADDLE) {
 		/* "Dot" paddle pressed. Pretend that we are in "after
 		   dash" space, so that keyer will have to transit
 		   into "dot" mark state. */
-		key->ik.graph_state = key->ik.curtis_b_latch
-			? KS_AFTER_DASH_B : KS_AFTER_DASH_A;
+		key->ik.graph_state = curtis_b_latch ? KS_AFTER_DASH_B : KS_AFTER_DASH_A;
 
-	} else { /* key->ik.dash_paddle == CW_KEY_STATE_CLOSED */
+	} else { /* Dash paddle is closed. */
 		/* "Dash" paddle pressed. Pretend that we are in
 		   "after dot" space, so that keyer will have to
 		   transit into "dash" mark state. */
-
-		key->ik.graph_state = key->ik.curtis_b_latch
-			? KS_AFTER_DOT_B : KS_AFTER_DOT_A;
+		key->ik.graph_state = curtis_b_latch ? KS_AFTER_DOT_B : KS_AFTER_DOT_A;
 	}
 
 	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_KEYER_STATES, CW_DEBUG_DEBUG,
 		      MSG_PREFIX "ik update initial: keyer state: %s -> %s",
-		      cw_iambic_keyer_states[old_state], cw_iambic_keyer_states[key->ik.graph_state]);
+		      cw_key_ik_states[KS_IDLE].label, cw_key_ik_states[key->ik.graph_state].label);
 
 
 	/* Here comes the "real" initial transition - this is why we
 	   called this function. We will transition from state set
 	   above into "real" state, reflecting state of paddles. */
-	int rv = cw_key_ik_update_graph_state_internal(key);
-	if (rv == CW_FAILURE) {
-		cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_ERROR,
-			      MSG_PREFIX "ik update initial: call to update_state_initial() failed first time");
-		/* Just try again, once. */
-		usleep(1000);
-		rv = cw_key_ik_update_graph_state_internal(key);
-		if (rv == CW_FAILURE) {
-			cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_ERROR,
-				      MSG_PREFIX "ik update initial: call to update_state_initial() failed twice");
-		}
-	}
+	cw_key_ik_advance_internal(key);
 
-	return rv;
+	return;
 }
 
 
@@ -995,7 +1706,8 @@ int cw_key_ik_update_state_initial_internal(volatile cw_key_t *key)
 */
 int cw_key_ik_notify_dot_paddle_event(volatile cw_key_t * key, int dot_paddle_state)
 {
-	return cw_key_ik_notify_paddle_event(key, dot_paddle_state, key->ik.dash_paddle);
+	return cw_key_ik_notify_paddles_internal(key, CW_KEY_IK_DOT_PADDLE,
+						 dot_paddle_state == CW_KEY_STATE_CLOSED ? CW_KEY_IK_DOT_PADDLE : 0, NULL);
 }
 
 
@@ -1016,7 +1728,8 @@ int cw_key_ik_notify_dot_paddle_event(volatile cw_key_t * key, int dot_paddle_st
 */
 int cw_key_ik_notify_dash_paddle_event(volatile cw_key_t * key, int dash_paddle_state)
 {
-	return cw_key_ik_notify_paddle_event(key, key->ik.dot_paddle, dash_paddle_state);
+	return cw_key_ik_notify_paddles_internal(key, CW_KEY_IK_DASH_PADDLE,
+						 dash_paddle_state == CW_KEY_STATE_CLOSED ? CW_KEY_IK_DASH_PADDLE : 0, NULL);
 }
 
 
@@ -1033,11 +1746,12 @@ int cw_key_ik_notify_dash_paddle_event(volatile cw_key_t * key, int dash_paddle_
 */
 void cw_key_ik_get_paddles(const volatile cw_key_t * key, int * dot_paddle_state, int * dash_paddle_state)
 {
+	const unsigned int inputs = __atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE);
 	if (dot_paddle_state) {
-		*dot_paddle_state = key->ik.dot_paddle;
+		*dot_paddle_state = inputs & CW_KEY_IK_DOT_PADDLE ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
 	}
 	if (dash_paddle_state) {
-		*dash_paddle_state = key->ik.dash_paddle;
+		*dash_paddle_state = inputs & CW_KEY_IK_DASH_PADDLE ? CW_KEY_STATE_CLOSED : CW_KEY_STATE_OPEN;
 	}
 	return;
 }
@@ -1055,17 +1769,21 @@ void cw_key_ik_get_paddles(const volatile cw_key_t * key, int * dot_paddle_state
 
    Either of the last two arguments can be NULL - it won't be updated then.
 
+   The latches are not states of paddles, so they are returned as
+   true (1) or false (0), not as CW_KEY_STATE_CLOSED/OPEN.
+
    \param key
-   \param dot_paddle_latch_state: will be updated with true or false: TODO: true/false or OPEN/CLOSED?
+   \param dot_paddle_latch_state: will be updated with true or false
    \param dash_paddle_latch_state: will be updated with true or false
 */
 void cw_key_ik_get_paddle_latches_internal(volatile cw_key_t * key, /* out */ int * dot_paddle_latch_state, /* out */ int * dash_paddle_latch_state)
 {
+	const unsigned int inputs = __atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE);
 	if (dot_paddle_latch_state) {
-		*dot_paddle_latch_state = key->ik.dot_latch;
+		*dot_paddle_latch_state = !!(inputs & CW_KEY_IK_DOT_LATCH);
 	}
 	if (dash_paddle_latch_state) {
-		*dash_paddle_latch_state = key->ik.dash_latch;
+		*dash_paddle_latch_state = !!(inputs & CW_KEY_IK_DASH_LATCH);
 	}
 	return;
 }
@@ -1083,7 +1801,7 @@ void cw_key_ik_get_paddle_latches_internal(volatile cw_key_t * key, /* out */ in
 */
 bool cw_key_ik_is_busy_internal(const volatile cw_key_t *key)
 {
-	return key->ik.graph_state != KS_IDLE;
+	return __atomic_load_n(&key->ik.graph_state, __ATOMIC_ACQUIRE) != KS_IDLE;
 }
 
 
@@ -1103,36 +1821,39 @@ bool cw_key_ik_is_busy_internal(const volatile cw_key_t *key)
 */
 int cw_key_ik_wait_for_element(const volatile cw_key_t * key)
 {
+	pthread_mutex_t * wait_mutex = &key->ik.timing->wait_mutex;
+	pthread_cond_t * wait_var = &key->ik.timing->wait_var;
+
 	/* First wait for the state to move to idle (or just do nothing
 	   if it's not), or to one of the after- states. */
-	pthread_mutex_lock(&key->gen->tq->wait_mutex);
+	pthread_mutex_lock(wait_mutex);
+	cw_key_ik_add_waiter_internal(key);
 	while (key->ik.graph_state != KS_IDLE
 	       && key->ik.graph_state != KS_AFTER_DOT_A
 	       && key->ik.graph_state != KS_AFTER_DOT_B
 	       && key->ik.graph_state != KS_AFTER_DASH_A
 	       && key->ik.graph_state != KS_AFTER_DASH_B) {
 
-		pthread_cond_wait(&key->gen->tq->wait_var, &key->gen->tq->wait_mutex);
+		pthread_cond_wait(wait_var, wait_mutex);
 		/* cw_signal_wait_internal(); */ /* Old implementation was using signals. */ /* This code has been disabled some time before 2017-01-31. */
 	}
-	pthread_mutex_unlock(&key->gen->tq->wait_mutex);
 
 
 	/* Now wait for the state to move to idle (unless it is, or was,
 	   already), or one of the in- states, at which point we know
 	   we're actually at the end of the element we were in when we
 	   entered this routine. */
-	pthread_mutex_lock(&key->gen->tq->wait_mutex);
 	while (key->ik.graph_state != KS_IDLE
 	       && key->ik.graph_state != KS_IN_DOT_A
 	       && key->ik.graph_state != KS_IN_DOT_B
 	       && key->ik.graph_state != KS_IN_DASH_A
 	       && key->ik.graph_state != KS_IN_DASH_B) {
 
-		pthread_cond_wait(&key->gen->tq->wait_var, &key->gen->tq->wait_mutex);
+		pthread_cond_wait(wait_var, wait_mutex);
 		/* cw_signal_wait_internal(); */ /* Old implementation was using signals. */ /* This code has been disabled some time before 2017-01-31. */
 	}
-	pthread_mutex_unlock(&key->gen->tq->wait_mutex);
+	__atomic_sub_fetch(&key->ik.timing->n_waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(wait_mutex);
 
 	return CW_SUCCESS;
 }
@@ -1145,8 +1866,9 @@ int cw_key_ik_wait_for_element(const volatile cw_key_t * key)
 
    The routine returns CW_SUCCESS on success.
 
-   It returns CW_FAILURE (with errno set to EDEADLK) if either paddle
-   state is CLOSED.
+   It returns CW_FAILURE (with errno set to EDEADLK) if a paddle that
+   makes the keyer repeat elements is CLOSED (either paddle, or only
+   Dot paddle in bug mode).
 
    \param key
 
@@ -1155,21 +1877,31 @@ int cw_key_ik_wait_for_element(const volatile cw_key_t * key)
 */
 int cw_key_ik_wait_for_keyer(volatile cw_key_t * key)
 {
-	/* Check that neither paddle is CLOSED; if either is, then the
-	   signal cycle is going to continue forever, and we'll never
-	   return from this routine. TODO: verify this comment. */
-	if (key->ik.dot_paddle == CW_KEY_STATE_CLOSED || key->ik.dash_paddle == CW_KEY_STATE_CLOSED) {
+	/* Check that no paddle that repeats elements is CLOSED; if
+	   one is, then the keyer keeps sending elements (see
+	   cw_key_ik_next_state_internal()), and we'll never return
+	   from this routine. Dash paddle of bug keys a manual mark
+	   without the state machine, so it doesn't keep the keyer
+	   busy. */
+	const bool manual_dash = cw_key_ik_modes[__atomic_load_n(&key->ik.mode, __ATOMIC_ACQUIRE)].manual_dash;
+	const unsigned int automatic = manual_dash ? CW_KEY_IK_DOT_PADDLE : (CW_KEY_IK_DOT_PADDLE | CW_KEY_IK_DASH_PADDLE);
+	if (__atomic_load_n(&key->ik.inputs, __ATOMIC_ACQUIRE) & automatic) {
 		errno = EDEADLK;
 		return CW_FAILURE;
 	}
 
+	pthread_mutex_t * wait_mutex = &key->ik.timing->wait_mutex;
+	pthread_cond_t * wait_var = &key->ik.timing->wait_var;
+
 	/* Wait for the keyer state to go idle. */
-	pthread_mutex_lock(&key->gen->tq->wait_mutex);
+	pthread_mutex_lock(wait_mutex);
+	cw_key_ik_add_waiter_internal(key);
 	while (key->ik.graph_state != KS_IDLE) {
-		pthread_cond_wait(&key->gen->tq->wait_var, &key->gen->tq->wait_mutex);
+		pthread_cond_wait(wait_var, wait_mutex);
 		/* cw_signal_wait_internal(); */ /* Old implementation was using signals. */ /* This code has been disabled some time before 2017-01-31. */
 	}
-	pthread_mutex_unlock(&key->gen->tq->wait_mutex);
+	__atomic_sub_fetch(&key->ik.timing->n_waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(wait_mutex);
 
 	return CW_SUCCESS;
 }
@@ -1177,6 +1909,80 @@ int cw_key_ik_wait_for_keyer(volatile cw_key_t * key)
 
 
 
+/**
+   \brief Register calling thread as waiting for change of keyer's state
+
+   Caller must hold key->ik.timing->wait_mutex, and must decrement
+   key->ik.timing->n_waiters before releasing the mutex.
+
+   \param key - iambic keyer
+*/
+void cw_key_ik_add_waiter_internal(const volatile cw_key_t * key)
+{
+	__atomic_add_fetch(&key->ik.timing->n_waiters, 1, __ATOMIC_SEQ_CST);
+
+	/* Pairs with fence in cw_key_ik_notify_waiters_internal():
+	   either we see new state of keyer, or the notifying thread
+	   sees us. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Wake up threads waiting for change of keyer's state
+
+   Threads waiting in cw_key_ik_wait_for_element() and
+   cw_key_ik_wait_for_keyer() are woken up only by their own keyer,
+   and only after the keyer's state has been changed. The mutex is
+   not touched when nobody waits.
+
+   \param key - iambic keyer
+*/
+void cw_key_ik_notify_waiters_internal(volatile cw_key_t * key)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (0 == __atomic_load_n(&key->ik.timing->n_waiters, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	pthread_mutex_lock(&key->ik.timing->wait_mutex);
+	pthread_cond_broadcast(&key->ik.timing->wait_var);
+	pthread_mutex_unlock(&key->ik.timing->wait_mutex);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Report to client code that iambic keyer has become idle
+
+   The event is reported through file descriptor of keyer's
+   generator (see cw_gen_get_event_fd()), or - for keyer without
+   generator - through file descriptor of keyer's receiver (see
+   cw_rec_get_event_fd()).
+
+   \param key - iambic keyer
+*/
+void cw_key_ik_post_idle_event_internal(volatile cw_key_t * key)
+{
+	if (key->gen) {
+		cw_event_source_post_internal(&key->gen->tq->events, CW_EVENT_KEYER_IDLE);
+	} else if (key->rec) {
+		cw_event_source_post_internal(&key->rec->events, CW_EVENT_KEYER_IDLE);
+	}
+
+	return;
+}
+
+
+
+
 /**
    \brief Reset iambic keyer data
 
@@ -1189,24 +1995,29 @@ int cw_key_ik_wait_for_keyer(volatile cw_key_t * key)
 void cw_key_ik_reset_internal(volatile cw_key_t *key)
 {
 	cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYER_STATES, CW_DEBUG_DEBUG,
-		      MSG_PREFIX "ik reset: keyer state %s -> KS_IDLE", cw_iambic_keyer_states[key->ik.graph_state]);
+		      MSG_PREFIX "ik reset: keyer state %s -> KS_IDLE", cw_key_ik_states[key->ik.graph_state].label);
+	if (key->ik.timing) {
+		cw_timer_cancel_internal(&key->ik.timing->timer);
+	}
 	key->ik.graph_state = KS_IDLE;
+	if (key->ik.timing) {
+		cw_key_ik_notify_waiters_internal(key);
+	}
 
 	key->ik.key_value = CW_KEY_STATE_OPEN;
 
-	key->ik.dot_paddle = CW_KEY_STATE_OPEN;
-	key->ik.dash_paddle = CW_KEY_STATE_OPEN;
-	key->ik.dot_latch = false;
-	key->ik.dash_latch = false;
-	key->ik.curtis_mode_b = false;
-	key->ik.curtis_b_latch = false;
+	__atomic_store_n(&key->ik.inputs, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&key->ik.pending, 0, __ATOMIC_RELEASE);
+	key->ik.mode = CW_KEY_IK_MODE_IAMBIC_A;
+	key->ik.memory = CW_KEY_IK_DOT_LATCH | CW_KEY_IK_DASH_LATCH;
+	key->ik.memory_window = 0;
+	key->ik.manual = false;
 
 	/* Silence sound and stop any background soundcard tone generation. */
 	cw_gen_silence_internal(key->gen);
-	cw_finalization_schedule_internal(); /* TODO: do we still need this? */
 
 	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_KEYER_STATES, CW_DEBUG_DEBUG,
-		      MSG_PREFIX "ik reset: keyer state -> %s (reset)", cw_iambic_keyer_states[key->ik.graph_state]);
+		      MSG_PREFIX "ik reset: keyer state -> %s (reset)", cw_key_ik_states[key->ik.graph_state].label);
 
 	return;
 }
@@ -1279,6 +2090,28 @@ void cw_key_ik_increment_timer_internal(volatile cw_key_t *key, int usecs)
    \return CW_FAILURE on failure
 */
 int cw_key_sk_notify_event(volatile cw_key_t * key, int key_state)
+{
+	return cw_key_sk_notify_event_at_internal(key, key_state, NULL);
+}
+
+
+
+
+/**
+   \brief Set new value of straight key, with time of the event
+
+   Variant of cw_key_sk_notify_event() for input drivers that know
+   exact time of key event (e.g. kernel timestamp of evdev event).
+   The time is passed to keying callback and to receiver.
+
+   \param key - straight key to update
+   \param key_state - new state of straight key (CW_KEY_STATE_OPEN / CW_KEY_STATE_CLOSED)
+   \param timestamp - time of key event (NULL for current time)
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_key_sk_notify_event_at_internal(volatile cw_key_t * key, int key_state, const struct timeval * timestamp)
 {
 #if 0 /* This is disabled, but I'm not sure why. */  /* This code has been disabled some time before 2017-01-31. */
 	/* If the tone queue or the keyer are busy, we can't use the
@@ -1289,9 +2122,13 @@ int cw_key_sk_notify_event(volatile cw_key_t * key, int key_state)
 	}
 #endif
 
+	if (key_state != key->sk.key_value) {
+		cw_gen_latency_stamp_edge_internal(key->gen, CW_LATENCY_KEY_EVENT, key_state);
+	}
+
 	/* Do tones and keying, and set up timeouts and soundcard
 	   activities to match the new key state. */
-	return cw_key_sk_set_value_internal(key, key_state);
+	return cw_key_sk_set_value_internal(key, key_state, timestamp);
 }
 
 
@@ -1384,6 +2221,14 @@ cw_key_t * cw_key_new(void)
 		return (cw_key_t *) NULL;
 	}
 
+	key->ik.timing = (cw_key_ik_timing_t *) malloc(sizeof (cw_key_ik_timing_t));
+	if (!key->ik.timing) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: malloc()");
+		free(key);
+		return (cw_key_t *) NULL;
+	}
+
 	key->gen = (cw_gen_t *) NULL;
 	key->rec = (cw_rec_t *) NULL;
 
@@ -1397,15 +2242,25 @@ cw_key_t * cw_key_new(void)
 	key->ik.graph_state = KS_IDLE;
 	key->ik.key_value = CW_KEY_STATE_OPEN;
 
-	key->ik.dot_paddle = CW_KEY_STATE_OPEN;
-	key->ik.dash_paddle = CW_KEY_STATE_OPEN;
-	key->ik.dot_latch = false;
-	key->ik.dash_latch = false;
+	key->ik.inputs = 0;
+
+	key->ik.mode = CW_KEY_IK_MODE_IAMBIC_A;
+	key->ik.memory = CW_KEY_IK_DOT_LATCH | CW_KEY_IK_DASH_LATCH;
+	key->ik.memory_window = 0;
+	key->ik.mark_start = 0;
+	key->ik.mark_len = 0;
+	key->ik.kick_time = 0;
+	key->ik.manual = false;
 
-	key->ik.curtis_mode_b = false;
-	key->ik.curtis_b_latch = false;
+	key->ik.running = 0;
+	key->ik.pending = 0;
 
-	key->ik.lock = false;
+	cw_timer_init_internal(&key->ik.timing->timer, cw_key_ik_timer_callback_internal, key);
+	key->ik.dot_len = CW_DOT_CALIBRATION / CW_SPEED_INITIAL;
+	key->ik.element_len = 0;
+	pthread_mutex_init(&key->ik.timing->wait_mutex, NULL);
+	pthread_cond_init(&key->ik.timing->wait_var, NULL);
+	key->ik.timing->n_waiters = 0;
 
 	key->tk.key_value = CW_KEY_STATE_OPEN;
 
@@ -1440,6 +2295,13 @@ void cw_key_delete(cw_key_t ** key)
 		(*key)->gen->key = NULL;
 	}
 
+	/* Make sure that timer wheel won't call keyer's callback
+	   for deallocated key. */
+	cw_timer_cancel_internal(&(*key)->ik.timing->timer);
+	pthread_mutex_destroy(&(*key)->ik.timing->wait_mutex);
+	pthread_cond_destroy(&(*key)->ik.timing->wait_var);
+	free((*key)->ik.timing);
+
 	free(*key);
 	*key = (cw_key_t *) NULL;
 
@@ -9,6 +9,7 @@
 
 
 
+#include <pthread.h>
 #include <stdbool.h>
 
 
@@ -17,6 +18,7 @@
 
 #include "libcw_gen.h"
 #include "libcw_rec.h"
+#include "libcw_timer.h"
 
 
 
@@ -37,6 +39,52 @@ enum {
 
 
 
+/* Modes of iambic keyer, see cw_key_ik_set_mode(). */
+enum {
+	CW_KEY_IK_MODE_IAMBIC_A = 0,  /* Curtis 8044 mode A. */
+	CW_KEY_IK_MODE_IAMBIC_B,      /* Curtis 8044 mode B. */
+	CW_KEY_IK_MODE_ULTIMATIC,     /* When both paddles are closed, last closed paddle wins. */
+	CW_KEY_IK_MODE_BUG,           /* Automatic Dots, manual Dash (semi-automatic key). */
+	CW_KEY_IK_MODE_N
+};
+
+
+
+/* Bits of cw_key_t.ik.inputs. */
+enum {
+	CW_KEY_IK_DOT_PADDLE     = 1 << 0,  /* Dot paddle is closed. */
+	CW_KEY_IK_DASH_PADDLE    = 1 << 1,  /* Dash paddle is closed. */
+	CW_KEY_IK_DOT_LATCH      = 1 << 2,  /* Dot false->true latch. */
+	CW_KEY_IK_DASH_LATCH     = 1 << 3,  /* Dash false->true latch. */
+	CW_KEY_IK_CURTIS_B_LATCH = 1 << 4,  /* Curtis Dot&Dash latch. */
+	CW_KEY_IK_DASH_LAST      = 1 << 5   /* Dash paddle has been closed after Dot paddle. */
+};
+
+
+/* Bits of cw_key_t.ik.pending. */
+enum {
+	CW_KEY_IK_PENDING_UPDATE = 1 << 0,  /* Current element has ended, move to next state. */
+	CW_KEY_IK_PENDING_KICK   = 1 << 1,  /* Paddle has been pressed while keyer was idle. */
+	CW_KEY_IK_PENDING_MANUAL = 1 << 2   /* Manual (bug mode) Dash paddle has changed state. */
+};
+
+
+
+/* Non-volatile part of iambic keyer, allocated separately from
+   (volatile) cw_key_t. */
+typedef struct {
+	cw_timer_t timer;            /* Deadline of end of current element. */
+
+	/* Used by cw_key_ik_wait_for_*() functions to wait for
+	   changes of keyer's state. The variable is signalled only
+	   if 'n_waiters' is non-zero. */
+	pthread_mutex_t wait_mutex;
+	pthread_cond_t wait_var;
+	unsigned int n_waiters;
+} cw_key_ik_timing_t;
+
+
+
 /* For modern API. */
 typedef void (* cw_key_callback_t)(volatile struct timeval * timestamp, int key_state, void * callback_arg);
 /* For legacy API. */
@@ -59,7 +107,12 @@ struct cw_key_struct {
 	   In any case - a key needs to have access to a generator
 	   (but a generator doesn't need a key). This is why the key
 	   data type has a "generator" field, not the other way
-	   around. */
+	   around.
+
+	   A key without a generator is still possible: iambic
+	   keyer is then timed by libcw's timer wheel, and key
+	   events are passed directly to receiver and to keying
+	   callbacks. No sound is produced. */
 	cw_gen_t *gen;
 
 
@@ -110,20 +163,60 @@ struct cw_key_struct {
 		int graph_state;       /* State of iambic keyer state machine. */
 		int key_value;         /* CW_KEY_STATE_OPEN or CW_KEY_STATE_CLOSED (Space/Mark, NoSound/Sound). */
 
-		bool dot_paddle;       /* Dot paddle value. CW_KEY_STATE_OPEN or CW_KEY_STATE_CLOSED. */
-		bool dash_paddle;      /* Dash paddle value. CW_KEY_STATE_OPEN or CW_KEY_STATE_CLOSED. */
-
-		bool dot_latch;        /* Dot false->true latch */
-		bool dash_latch;       /* Dash false->true latch */
-
-		/* Iambic keyer "Curtis" mode A/B selector.  Mode A and mode B timings
-		   differ slightly, and some people have a preference for one or the other.
-		   Mode A is a bit less timing-critical, so we'll make that the default. */
-		bool curtis_mode_b;
-
-		bool curtis_b_latch;   /* Curtis Dot&Dash latch */
-
-		bool lock;             /* FIXME: describe why we need this flag. */
+		/* Paddles and paddle latches (CW_KEY_IK_DOT_PADDLE
+		   etc.). The bits are modified with atomic operations
+		   by client code's thread (paddle events) and by thread
+		   running keyer's state machine (clearing of latches),
+		   so none of the threads has to wait for the other. */
+		unsigned int inputs;
+
+		/* Mode of keyer (CW_KEY_IK_MODE_IAMBIC_A etc.). Curtis
+		   mode A and mode B timings differ slightly, and some
+		   people have a preference for one or the other.  Mode
+		   A is a bit less timing-critical, so we'll make that
+		   the default. */
+		int mode;
+
+		/* Paddle memory: latches (CW_KEY_IK_DOT_LATCH and/or
+		   CW_KEY_IK_DASH_LATCH) that are set by paddles, and
+		   part of a mark (in percents of its length, counted
+		   from beginning of the mark) during which paddles
+		   are not remembered. */
+		unsigned int memory;
+		int memory_window;
+
+		/* Beginning [us] and length [us] of current mark,
+		   used to check the memory window. */
+		int64_t mark_start;
+		int mark_len;
+
+		/* Time [us] of paddle event that has started keyer
+		   from idle state, passed by input driver (see
+		   cw_key_ik_notify_paddle_event_at_internal()). Zero
+		   if the time is not known. */
+		int64_t kick_time;
+
+		/* Bug mode: Dash paddle is keying a manual mark
+		   through straight key. */
+		bool manual;
+
+		/* Only one thread at a time runs keyer's state
+		   machine. The thread has set 'running' to 1, and
+		   other threads leave their requests
+		   (CW_KEY_IK_PENDING_UPDATE etc.) in 'pending'. See
+		   cw_key_ik_run_internal(). */
+		int running;
+		unsigned int pending;
+
+		/* Timing of iambic keyer that has no generator
+		   registered. Instead of waiting for generator to
+		   play enqueued elements, the keyer registers end of
+		   each element with a timer wheel: wheel of key's
+		   context, or libcw's default wheel. This lets many
+		   keyers share a single timing thread. */
+		cw_key_ik_timing_t * timing;
+		int dot_len;           /* Length of Dot and of inter-mark space. [us] */
+		int element_len;       /* Length of current element. [us] */
 	} ik;
 
 
@@ -150,14 +243,19 @@ void cw_key_register_legacy_keying_callback_internal(volatile cw_key_t * key, cw
 void cw_key_tk_set_value_internal(volatile cw_key_t * key, int key_state);
 
 int  cw_key_ik_update_graph_state_internal(volatile cw_key_t * key);
+void cw_key_ik_run_internal(volatile cw_key_t * key, unsigned int request);
 void cw_key_ik_increment_timer_internal(volatile cw_key_t * key, int usecs);
+void cw_key_ik_timer_callback_internal(void * arg);
 
 
+int  cw_key_ik_next_state_internal(int mode, int state, unsigned int inputs, bool * consume_curtis_b_latch);
 void cw_key_ik_get_paddle_latches_internal(volatile cw_key_t * key, int * dot_paddle_latch_state, int * dash_paddle_latch_state);
 bool cw_key_ik_is_busy_internal(const volatile cw_key_t * key);
 void cw_key_ik_reset_internal(volatile cw_key_t * key);
 
 void cw_key_sk_reset_internal(volatile cw_key_t * key);
+int  cw_key_ik_notify_paddle_event_at_internal(volatile cw_key_t * key, int dot_paddle_state, int dash_paddle_state, const struct timeval * timestamp);
+int  cw_key_sk_notify_event_at_internal(volatile cw_key_t * key, int key_state, const struct timeval * timestamp);
 
 
 
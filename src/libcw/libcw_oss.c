@@ -101,7 +101,7 @@ extern const char *default_audio_devices[];
 static const int CW_OSS_SETFRAGMENT = 7;              /* Sound fragment size, 2^7 samples. */
 static const int CW_OSS_SAMPLE_FORMAT = AFMT_S16_NE;  /* Sound format AFMT_S16_NE = signed 16 bit, native endianess; LE = Little endianess. */
 
-static int  cw_oss_open_device_ioctls_internal(int *fd, int *sample_rate);
+static int  cw_oss_open_device_ioctls_internal(int *fd, int *sample_rate, int n_channels);
 static int  cw_oss_get_version_internal(int fd, int *x, int *y, int *z);
 static int  cw_oss_write_internal(cw_gen_t *gen);
 static int  cw_oss_open_device_internal(cw_gen_t *gen);
@@ -163,7 +163,7 @@ bool cw_is_oss_possible(const char *device)
 	  values from ioctl() and returns CW_FAILURE if one of ioctls()
 	  returns -1. */
 	int dummy;
-	int rv = cw_oss_open_device_ioctls_internal(&soundcard, &dummy);
+	int rv = cw_oss_open_device_ioctls_internal(&soundcard, &dummy, CW_AUDIO_CHANNELS);
 	close(soundcard);
 	if (rv != CW_SUCCESS) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
@@ -220,7 +220,7 @@ int cw_oss_write_internal(cw_gen_t *gen)
 	assert (gen);
 	assert (gen->audio_system == CW_AUDIO_OSS);
 
-	int n_bytes = sizeof (gen->buffer[0]) * gen->buffer_n_samples;
+	int n_bytes = gen->frame_size * gen->buffer_n_samples;
 	int rv = write(gen->audio_sink, gen->buffer, n_bytes);
 	if (rv != n_bytes) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
@@ -253,6 +253,12 @@ int cw_oss_open_device_internal(cw_gen_t *gen)
 	/* TODO: there seems to be some redundancy between
 	   cw_oss_open_device_internal() and is_possible() function. */
 
+	if (gen->sample_format != CW_SAMPLE_FORMAT_S16) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+			      MSG_PREFIX "open: only 16-bit samples are supported");
+		return CW_FAILURE;
+	}
+
 	/* Open the given soundcard device file, for write only. */
 	int soundcard = open(gen->audio_device, O_WRONLY);
 	if (soundcard == -1) {
@@ -262,7 +268,7 @@ int cw_oss_open_device_internal(cw_gen_t *gen)
 	}
 
 	/* FIXME: do we really need to pass pointer to soundcard fd? */
-	int rv = cw_oss_open_device_ioctls_internal(&soundcard, &gen->sample_rate);
+	int rv = cw_oss_open_device_ioctls_internal(&soundcard, &gen->sample_rate, gen->n_channels);
 	if (rv != CW_SUCCESS) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "open: one or more OSS ioctl() calls failed");
@@ -321,11 +327,12 @@ int cw_oss_open_device_internal(cw_gen_t *gen)
 
    \param fd - file descriptor of open OSS file;
    \param sample_rate - sample rate configured by ioctl calls (output parameter)
+   \param n_channels - number of channels to configure
 
    \return CW_FAILURE on errors
    \return CW_SUCCESS on success
 */
-int cw_oss_open_device_ioctls_internal(int *fd, int *sample_rate)
+int cw_oss_open_device_ioctls_internal(int *fd, int *sample_rate, int n_channels)
 {
 	int parameter = 0; /* Ignored. */
 	if (-1 == ioctl(*fd, SNDCTL_DSP_SYNC, &parameter)) {
@@ -368,13 +375,13 @@ int cw_oss_open_device_ioctls_internal(int *fd, int *sample_rate)
 	}
 
 	/* Set up mono/stereo mode. */
-	parameter = CW_AUDIO_CHANNELS;
+	parameter = n_channels;
 	if (-1 == ioctl(*fd, (int) SNDCTL_DSP_CHANNELS, &parameter)) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "ioctls: ioctl(SNDCTL_DSP_CHANNELS): '%s'", strerror(errno));
 		return CW_FAILURE;
 	}
-	if (parameter != CW_AUDIO_CHANNELS) {
+	if (parameter != n_channels) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "ioctls: number of channels not supported");
 		return CW_FAILURE;
@@ -50,6 +50,30 @@ extern cw_debug_t cw_debug_object_dev;
 
 
 
+/*
+  The sink uses asynchronous API of PulseAudio: a playback stream is
+  created in a context driven by PulseAudio's threaded mainloop.
+
+  Generator's thread still fills generator's buffer one buffer at a
+  time, but cw_pa_write_internal() doesn't push the samples blindly
+  into a blocking call. It waits until the server asks for data
+  (stream's write callback signals the mainloop), and writes only as
+  many bytes as the server is ready to accept. This way the generator
+  renders samples on demand, and the amount of audio buffered on
+  server's side stays close to target length of the stream.
+
+  Streams are created with automatic timing updates, so after each
+  write we can cheaply ask for current playback latency, i.e. for the
+  time between a sample being written and the sample being audible.
+
+  All callbacks below are called in mainloop's thread with mainloop's
+  lock held. Code outside of the callbacks must take the lock before
+  touching context or stream.
+*/
+
+
+
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -72,12 +96,26 @@ extern cw_debug_t cw_debug_object_dev;
 
 
 
-static pa_simple *cw_pa_simple_new_internal(pa_sample_spec *ss, pa_buffer_attr *ba, const char *device, const char *stream_name, int *error);
+extern const unsigned int cw_supported_sample_rates[];
+
+
+
+
 static int        cw_pa_dlsym_internal(void *handle);
 static int        cw_pa_open_device_internal(cw_gen_t *gen);
 static void       cw_pa_close_device_internal(cw_gen_t *gen);
 static int        cw_pa_write_internal(cw_gen_t *gen);
 
+static int        cw_pa_connect_internal(cw_pa_data_t *pa_data, const char *device, const char *stream_name, int sample_format, int n_channels, int sample_rate, int *error);
+static void       cw_pa_disconnect_internal(cw_pa_data_t *pa_data, bool drain);
+static void       cw_pa_update_latency_internal(cw_gen_t *gen);
+
+static void       cw_pa_context_state_cb_internal(pa_context *c, void *userdata);
+static void       cw_pa_stream_state_cb_internal(pa_stream *s, void *userdata);
+static void       cw_pa_stream_write_cb_internal(pa_stream *s, size_t n_bytes, void *userdata);
+static void       cw_pa_stream_underflow_cb_internal(pa_stream *s, void *userdata);
+static void       cw_pa_stream_success_cb_internal(pa_stream *s, int success, void *userdata);
+
 
 
 
@@ -92,22 +130,82 @@ static int        cw_pa_write_internal(cw_gen_t *gen);
 static struct {
 	void *handle;
 
-	pa_simple *(* pa_simple_new)(const char *server, const char *name, pa_stream_direction_t dir, const char *dev, const char *stream_name, const pa_sample_spec *ss, const pa_channel_map *map, const pa_buffer_attr *attr, int *error);
-	void       (* pa_simple_free)(pa_simple *s);
-	int        (* pa_simple_write)(pa_simple *s, const void *data, size_t bytes, int *error);
-	pa_usec_t  (* pa_simple_get_latency)(pa_simple *s, int *error);
-	int        (* pa_simple_drain)(pa_simple *s, int *error);
-
-	size_t     (* pa_usec_to_bytes)(pa_usec_t t, const pa_sample_spec *spec);
-	char      *(* pa_strerror)(int error);
+	pa_threaded_mainloop *(* pa_threaded_mainloop_new)(void);
+	void                  (* pa_threaded_mainloop_free)(pa_threaded_mainloop *m);
+	int                   (* pa_threaded_mainloop_start)(pa_threaded_mainloop *m);
+	void                  (* pa_threaded_mainloop_stop)(pa_threaded_mainloop *m);
+	void                  (* pa_threaded_mainloop_lock)(pa_threaded_mainloop *m);
+	void                  (* pa_threaded_mainloop_unlock)(pa_threaded_mainloop *m);
+	void                  (* pa_threaded_mainloop_wait)(pa_threaded_mainloop *m);
+	void                  (* pa_threaded_mainloop_signal)(pa_threaded_mainloop *m, int wait_for_accept);
+	pa_mainloop_api      *(* pa_threaded_mainloop_get_api)(pa_threaded_mainloop *m);
+
+	pa_context         *(* pa_context_new)(pa_mainloop_api *mainloop, const char *name);
+	int                 (* pa_context_connect)(pa_context *c, const char *server, pa_context_flags_t flags, const pa_spawn_api *api);
+	void                (* pa_context_disconnect)(pa_context *c);
+	void                (* pa_context_unref)(pa_context *c);
+	pa_context_state_t  (* pa_context_get_state)(pa_context *c);
+	void                (* pa_context_set_state_callback)(pa_context *c, pa_context_notify_cb_t cb, void *userdata);
+	int                 (* pa_context_errno)(pa_context *c);
+
+	pa_stream          *(* pa_stream_new)(pa_context *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map);
+	int                 (* pa_stream_connect_playback)(pa_stream *s, const char *dev, const pa_buffer_attr *attr, pa_stream_flags_t flags, const pa_cvolume *volume, pa_stream *sync_stream);
+	int                 (* pa_stream_disconnect)(pa_stream *s);
+	void                (* pa_stream_unref)(pa_stream *s);
+	pa_stream_state_t   (* pa_stream_get_state)(pa_stream *s);
+	void                (* pa_stream_set_state_callback)(pa_stream *s, pa_stream_notify_cb_t cb, void *userdata);
+	void                (* pa_stream_set_write_callback)(pa_stream *s, pa_stream_request_cb_t cb, void *userdata);
+	void                (* pa_stream_set_underflow_callback)(pa_stream *s, pa_stream_notify_cb_t cb, void *userdata);
+	size_t              (* pa_stream_writable_size)(pa_stream *s);
+	int                 (* pa_stream_write)(pa_stream *s, const void *data, size_t nbytes, pa_free_cb_t free_cb, int64_t offset, pa_seek_mode_t seek);
+	int                 (* pa_stream_get_latency)(pa_stream *s, pa_usec_t *r_usec, int *negative);
+	const pa_buffer_attr *(* pa_stream_get_buffer_attr)(pa_stream *s);
+	pa_operation       *(* pa_stream_drain)(pa_stream *s, pa_stream_success_cb_t cb, void *userdata);
+	const pa_sample_spec *(* pa_stream_get_sample_spec)(pa_stream *s);
+
+	pa_operation_state_t (* pa_operation_get_state)(pa_operation *o);
+	void                 (* pa_operation_unref)(pa_operation *o);
+
+	size_t      (* pa_usec_to_bytes)(pa_usec_t t, const pa_sample_spec *spec);
+	const char *(* pa_strerror)(int error);
 } cw_pa = {
 	.handle = NULL,
 
-	.pa_simple_new = NULL,
-	.pa_simple_free = NULL,
-	.pa_simple_write = NULL,
-	.pa_simple_get_latency = NULL,
-	.pa_simple_drain = NULL,
+	.pa_threaded_mainloop_new = NULL,
+	.pa_threaded_mainloop_free = NULL,
+	.pa_threaded_mainloop_start = NULL,
+	.pa_threaded_mainloop_stop = NULL,
+	.pa_threaded_mainloop_lock = NULL,
+	.pa_threaded_mainloop_unlock = NULL,
+	.pa_threaded_mainloop_wait = NULL,
+	.pa_threaded_mainloop_signal = NULL,
+	.pa_threaded_mainloop_get_api = NULL,
+
+	.pa_context_new = NULL,
+	.pa_context_connect = NULL,
+	.pa_context_disconnect = NULL,
+	.pa_context_unref = NULL,
+	.pa_context_get_state = NULL,
+	.pa_context_set_state_callback = NULL,
+	.pa_context_errno = NULL,
+
+	.pa_stream_new = NULL,
+	.pa_stream_connect_playback = NULL,
+	.pa_stream_disconnect = NULL,
+	.pa_stream_unref = NULL,
+	.pa_stream_get_state = NULL,
+	.pa_stream_set_state_callback = NULL,
+	.pa_stream_set_write_callback = NULL,
+	.pa_stream_set_underflow_callback = NULL,
+	.pa_stream_writable_size = NULL,
+	.pa_stream_write = NULL,
+	.pa_stream_get_latency = NULL,
+	.pa_stream_get_buffer_attr = NULL,
+	.pa_stream_drain = NULL,
+	.pa_stream_get_sample_spec = NULL,
+
+	.pa_operation_get_state = NULL,
+	.pa_operation_unref = NULL,
 
 	.pa_usec_to_bytes = NULL,
 	.pa_strerror = NULL
@@ -117,8 +215,14 @@ static struct {
 
 
 static const pa_sample_format_t CW_PA_SAMPLE_FORMAT = PA_SAMPLE_S16LE; /* Signed 16 bit, Little Endian */
+static const pa_sample_format_t CW_PA_SAMPLE_FORMAT_FLOAT = PA_SAMPLE_FLOAT32NE; /* Float 32 bit, native endianness */
 static const int CW_PA_BUFFER_N_SAMPLES = 256;
 
+/* Target length of data buffered by server for our playback
+   stream. This is the main factor contributing to latency of the
+   sink. */
+static const pa_usec_t CW_PA_TARGET_LATENCY_USECS = 10000;
+
 
 
 
@@ -135,7 +239,7 @@ static const int CW_PA_BUFFER_N_SAMPLES = 256;
 */
 bool cw_is_pa_possible(const char *device)
 {
-	const char * const library_name = "libpulse-simple.so";
+	const char * const library_name = "libpulse.so.0";
 	if (!cw_dlopen_internal(library_name, &cw_pa.handle)) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "is possible: can't access PulseAudio library \"%s\"", library_name);
@@ -150,19 +254,11 @@ bool cw_is_pa_possible(const char *device)
 		return false;
 	}
 
-	/* TODO: this piece of code is duplicated in cw_pa_simple_new_internal() */
-	const char *dev = (char *) NULL;
-	if (device && strcmp(device, CW_DEFAULT_PA_DEVICE)) {
-		dev = device;
-	}
-
-	pa_sample_spec ss;
-	pa_buffer_attr ba;
+	cw_pa_data_t pa_data;
+	memset(&pa_data, 0, sizeof (pa_data));
 	int error = 0;
 
-	pa_simple *s = cw_pa_simple_new_internal(&ss, &ba, dev, "cw_is_pa_possible()", &error);
-
-	if (!s) {
+	if (CW_SUCCESS != cw_pa_connect_internal(&pa_data, device, "cw_is_pa_possible()", CW_SAMPLE_FORMAT_S16, CW_AUDIO_CHANNELS, (int) cw_supported_sample_rates[0], &error)) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "is possible: can't connect to PulseAudio server: %s", cw_pa.pa_strerror(error));
 		if (cw_pa.handle) {
@@ -171,8 +267,7 @@ bool cw_is_pa_possible(const char *device)
 		return false;
 	} else {
 		/* TODO: verify this comment: We do dlclose(cw_pa.handle) in cw_pa_close_device_internal(). */
-		cw_pa.pa_simple_free(s);
-		s = NULL;
+		cw_pa_disconnect_internal(&pa_data, false);
 		return true;
 	}
 }
@@ -210,7 +305,10 @@ int cw_pa_configure(cw_gen_t *gen, const char *dev)
 /**
    \brief Write generated samples to PulseAudio audio sink configured and opened for generator
 
-   \reviewed on 2017-02-04
+   Function waits for server's requests for data, and writes to
+   playback stream as much of generator's buffer as server is willing
+   to accept at the moment. Function returns when whole buffer has
+   been written, or when the stream has failed.
 
    \param gen - generator
 
@@ -222,76 +320,359 @@ int cw_pa_write_internal(cw_gen_t *gen)
 	assert (gen);
 	assert (gen->audio_system == CW_AUDIO_PA);
 
-	int error = 0;
-	size_t n_bytes = sizeof (gen->buffer[0]) * gen->buffer_n_samples;
-	int rv = cw_pa.pa_simple_write(gen->pa_data.s, gen->buffer, n_bytes, &error);
-	if (rv < 0) {
-		cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
-			      MSG_PREFIX "write: pa_simple_write() failed: %s", cw_pa.pa_strerror(error));
-		return CW_FAILURE;
+	cw_pa_data_t *pa_data = &gen->pa_data;
+
+	const uint8_t *data = (const uint8_t *) gen->buffer;
+	const size_t n_bytes = gen->frame_size * gen->buffer_n_samples;
+	size_t n_written = 0;
+	int rv = CW_SUCCESS;
+
+	cw_pa.pa_threaded_mainloop_lock(pa_data->mainloop);
+
+	while (n_written < n_bytes) {
+		if (cw_pa.pa_stream_get_state(pa_data->stream) != PA_STREAM_READY) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+				      MSG_PREFIX "write: stream is not ready: %s", cw_pa.pa_strerror(cw_pa.pa_context_errno(pa_data->context)));
+			rv = CW_FAILURE;
+			break;
+		}
+
+		size_t n_writable = cw_pa.pa_stream_writable_size(pa_data->stream);
+		if (n_writable == 0) {
+			/* Wait for stream's write callback (or for
+			   stream state change). */
+			cw_pa.pa_threaded_mainloop_wait(pa_data->mainloop);
+			continue;
+		} else if (n_writable == (size_t) -1) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+				      MSG_PREFIX "write: pa_stream_writable_size() failed: %s", cw_pa.pa_strerror(cw_pa.pa_context_errno(pa_data->context)));
+			rv = CW_FAILURE;
+			break;
+		} else {
+			;
+		}
+
+		size_t n = n_bytes - n_written;
+		if (n > n_writable) {
+			n = n_writable;
+		}
+
+		/* NULL free callback: the data is copied to server's
+		   memory block before the function returns. */
+		if (cw_pa.pa_stream_write(pa_data->stream, data + n_written, n, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+				      MSG_PREFIX "write: pa_stream_write() failed: %s", cw_pa.pa_strerror(cw_pa.pa_context_errno(pa_data->context)));
+			rv = CW_FAILURE;
+			break;
+		}
+
+		n_written += n;
+	}
+
+	if (rv == CW_SUCCESS) {
+		cw_pa_update_latency_internal(gen);
+	}
+
+	cw_pa.pa_threaded_mainloop_unlock(pa_data->mainloop);
+
+	//cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_INFO, MSG_PREFIX "written %d samples with PulseAudio", gen->buffer_n_samples);
+	return rv;
+}
+
+
+
+
+/**
+   \brief Pass current latency of playback stream to generator
+
+   Thanks to PA_STREAM_AUTO_TIMING_UPDATE and
+   PA_STREAM_INTERPOLATE_TIMING flags used when connecting the stream,
+   the query doesn't require a round trip to server.
+
+   The latency is a delay between a sample being written to the
+   stream now and the sample becoming audible. Generator uses it to
+   tell client code when its tones are heard, see
+   cw_gen_get_output_latency().
+
+   Call the function with mainloop's lock held.
+
+   \param gen - generator
+*/
+void cw_pa_update_latency_internal(cw_gen_t *gen)
+{
+	pa_usec_t latency_usecs = 0;
+	int negative = 0;
+	if (0 == cw_pa.pa_stream_get_latency(gen->pa_data.stream, &latency_usecs, &negative)) {
+		/* Negative latency is possible only for monitoring
+		   streams, but let's be careful. */
+		cw_gen_set_output_latency_internal(gen, negative ? 0 : (int64_t) latency_usecs);
 	} else {
-		//cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_INFO, MSG_PREFIX "written %d samples with PulseAudio", gen->buffer_n_samples);
-		return CW_SUCCESS;
+		/* PA_ERR_NODATA: no timing info has been received
+		   yet. This is not an error at the beginning of
+		   playback. Keep previous value. */
+		;
 	}
+
+	return;
 }
 
 
 
 
 /**
-   \brief Wrapper for pa_simple_new()
+   \brief Connect to PulseAudio server and create a playback stream
 
-   Wrapper for pa_simple_new() and related code. The code block contained
-   in the function is useful in two different places: when first probing
-   if PulseAudio output is available, and when opening PulseAudio output
-   for writing.
+   Function creates threaded mainloop, context connected to PulseAudio
+   server and playback stream connected to a sink. The function
+   returns when the stream is ready for playback, or when any of the
+   steps has failed.
 
-   On success the function returns pointer to PulseAudio sink open for
-   writing (playback). The function tries to set up buffering parameters
-   for minimal latency, but it doesn't try too hard.
+   On success the function returns with mainloop running. On failure
+   all resources acquired by the function are released.
 
-   The function *does not* set size of audio buffer in libcw's generator.
+   The function tries to set up buffering parameters for minimal
+   latency, but it doesn't try too hard.
 
-   \reviewed on 2017-02-04
+   The function *does not* set size of audio buffer in libcw's generator.
 
-   \param ss - sample spec data, non-NULL pointer to variable owned by caller
-   \param ba - buffer attributes data, non-NULL pointer to variable owned by caller
+   \param pa_data - PulseAudio data, pointer to variable owned by caller
    \param device - name of PulseAudio device to be used, or NULL for default device
-   \param stream_name - descriptive name of client, passed to pa_simple_new
+   \param stream_name - descriptive name of stream
+   \param sample_format - format of samples, one of CW_SAMPLE_FORMAT_*
+   \param n_channels - number of channels
+   \param sample_rate - requested sample rate [Hz]
    \param error - output, pointer to variable storing potential PulseAudio error code
 
-   \return pointer to new PulseAudio sink on success
-   \return NULL on failure
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
 */
-pa_simple *cw_pa_simple_new_internal(pa_sample_spec *ss, pa_buffer_attr *ba, const char *device, const char *stream_name, int *error)
+int cw_pa_connect_internal(cw_pa_data_t *pa_data, const char *device, const char *stream_name, int sample_format, int n_channels, int sample_rate, int *error)
 {
-	ss->format = CW_PA_SAMPLE_FORMAT;
-	ss->rate = 44100;
-	ss->channels = 1;
+	pa_data->ss.format = sample_format == CW_SAMPLE_FORMAT_FLOAT ? CW_PA_SAMPLE_FORMAT_FLOAT : CW_PA_SAMPLE_FORMAT;
+	pa_data->ss.rate = sample_rate;
+	pa_data->ss.channels = n_channels;
 
 	const char *dev = (char *) NULL; /* NULL - let PulseAudio use default device. */
 	if (device && strcmp(device, CW_DEFAULT_PA_DEVICE)) {
 		dev = device; /* Non-default device. */
 	}
 
-	// http://www.mail-archive.com/pulseaudio-tickets@mail.0pointer.de/msg03295.html
-	ba->tlength = cw_pa.pa_usec_to_bytes(10000, ss);
-	ba->minreq = cw_pa.pa_usec_to_bytes(0, ss);
-	ba->maxlength = cw_pa.pa_usec_to_bytes(10000, ss);
-	/* ba->prebuf = ; */ /* ? */
-	/* ba->fragsize = sizeof(uint32_t) -1; */ /* Not relevant to playback. */
-
-	pa_simple *s = cw_pa.pa_simple_new(NULL,                  /* Server name (NULL for default). */
-					   "libcw",               /* Descriptive name of client (application name etc.). */
-					   PA_STREAM_PLAYBACK,    /* Stream direction. */
-					   dev,                   /* Device/sink name (NULL for default). */
-					   stream_name,           /* Stream name, descriptive name for this client (application name, song title, etc.). */
-					   ss,                    /* Sample specification. */
-					   NULL,                  /* Channel map (NULL for default). */
-					   ba,                    /* Buffering attributes (NULL for default). */
-					   error);                /* Error buffer (when routine returns NULL). */
-
-	return s;
+	/* With PA_STREAM_ADJUST_LATENCY tlength is a total latency
+	   of playback, i.e. server's buffer + device's buffer. Leave
+	   other attributes to server. */
+	pa_data->ba.tlength = cw_pa.pa_usec_to_bytes(CW_PA_TARGET_LATENCY_USECS, &pa_data->ss);
+	pa_data->ba.minreq = (uint32_t) -1;
+	pa_data->ba.maxlength = (uint32_t) -1;
+	pa_data->ba.prebuf = (uint32_t) -1;
+	pa_data->ba.fragsize = (uint32_t) -1; /* Not relevant to playback. */
+
+	pa_data->n_underflows = 0;
+
+	pa_data->mainloop = cw_pa.pa_threaded_mainloop_new();
+	if (!pa_data->mainloop) {
+		*error = PA_ERR_INTERNAL;
+		return CW_FAILURE;
+	}
+
+	pa_data->context = cw_pa.pa_context_new(cw_pa.pa_threaded_mainloop_get_api(pa_data->mainloop), "libcw");
+	if (!pa_data->context) {
+		*error = PA_ERR_INTERNAL;
+		cw_pa.pa_threaded_mainloop_free(pa_data->mainloop);
+		pa_data->mainloop = NULL;
+		return CW_FAILURE;
+	}
+	cw_pa.pa_context_set_state_callback(pa_data->context, cw_pa_context_state_cb_internal, pa_data);
+
+	cw_pa.pa_threaded_mainloop_lock(pa_data->mainloop);
+
+	if (cw_pa.pa_context_connect(pa_data->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+		goto error;
+	}
+	if (cw_pa.pa_threaded_mainloop_start(pa_data->mainloop) < 0) {
+		goto error;
+	}
+
+	/* Wait for context to become ready. */
+	while (true) {
+		pa_context_state_t state = cw_pa.pa_context_get_state(pa_data->context);
+		if (state == PA_CONTEXT_READY) {
+			break;
+		}
+		if (!PA_CONTEXT_IS_GOOD(state)) {
+			goto error;
+		}
+		cw_pa.pa_threaded_mainloop_wait(pa_data->mainloop);
+	}
+
+	pa_data->stream = cw_pa.pa_stream_new(pa_data->context, stream_name, &pa_data->ss, NULL);
+	if (!pa_data->stream) {
+		goto error;
+	}
+	cw_pa.pa_stream_set_state_callback(pa_data->stream, cw_pa_stream_state_cb_internal, pa_data);
+	cw_pa.pa_stream_set_write_callback(pa_data->stream, cw_pa_stream_write_cb_internal, pa_data);
+	cw_pa.pa_stream_set_underflow_callback(pa_data->stream, cw_pa_stream_underflow_cb_internal, pa_data);
+
+	const pa_stream_flags_t flags = PA_STREAM_INTERPOLATE_TIMING
+		| PA_STREAM_AUTO_TIMING_UPDATE
+		| PA_STREAM_ADJUST_LATENCY;
+
+	if (cw_pa.pa_stream_connect_playback(pa_data->stream, dev, &pa_data->ba, flags, NULL, NULL) < 0) {
+		goto error;
+	}
+
+	/* Wait for stream to become ready. */
+	while (true) {
+		pa_stream_state_t state = cw_pa.pa_stream_get_state(pa_data->stream);
+		if (state == PA_STREAM_READY) {
+			break;
+		}
+		if (!PA_STREAM_IS_GOOD(state)) {
+			goto error;
+		}
+		cw_pa.pa_threaded_mainloop_wait(pa_data->mainloop);
+	}
+
+	/* Server may have adjusted our buffering attributes. */
+	const pa_buffer_attr *ba = cw_pa.pa_stream_get_buffer_attr(pa_data->stream);
+	if (ba) {
+		pa_data->ba = *ba;
+	}
+
+	/* Server resamples the stream if the sink runs at other rate,
+	   but let's use whatever rate has been negotiated. */
+	const pa_sample_spec *ss = cw_pa.pa_stream_get_sample_spec(pa_data->stream);
+	if (ss) {
+		pa_data->ss.rate = ss->rate;
+	}
+
+	cw_pa.pa_threaded_mainloop_unlock(pa_data->mainloop);
+
+	return CW_SUCCESS;
+
+ error:
+	*error = cw_pa.pa_context_errno(pa_data->context);
+	cw_pa.pa_threaded_mainloop_unlock(pa_data->mainloop);
+	cw_pa_disconnect_internal(pa_data, false);
+
+	return CW_FAILURE;
+}
+
+
+
+
+/**
+   \brief Release PulseAudio resources acquired by cw_pa_connect_internal()
+
+   \param pa_data - PulseAudio data
+   \param drain - whether to wait for all written samples to be played before disconnecting
+*/
+void cw_pa_disconnect_internal(cw_pa_data_t *pa_data, bool drain)
+{
+	if (!pa_data->mainloop) {
+		return;
+	}
+
+	cw_pa.pa_threaded_mainloop_lock(pa_data->mainloop);
+
+	if (pa_data->stream) {
+		if (drain && cw_pa.pa_stream_get_state(pa_data->stream) == PA_STREAM_READY) {
+			/* Make sure that every single sample was played. */
+			pa_operation *o = cw_pa.pa_stream_drain(pa_data->stream, cw_pa_stream_success_cb_internal, pa_data);
+			if (o) {
+				while (cw_pa.pa_operation_get_state(o) == PA_OPERATION_RUNNING) {
+					cw_pa.pa_threaded_mainloop_wait(pa_data->mainloop);
+				}
+				cw_pa.pa_operation_unref(o);
+			} else {
+				cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+					      MSG_PREFIX "disconnect: pa_stream_drain() failed: %s", cw_pa.pa_strerror(cw_pa.pa_context_errno(pa_data->context)));
+			}
+		}
+
+		cw_pa.pa_stream_set_write_callback(pa_data->stream, NULL, NULL);
+		cw_pa.pa_stream_set_underflow_callback(pa_data->stream, NULL, NULL);
+		cw_pa.pa_stream_set_state_callback(pa_data->stream, NULL, NULL);
+		cw_pa.pa_stream_disconnect(pa_data->stream);
+		cw_pa.pa_stream_unref(pa_data->stream);
+		pa_data->stream = NULL;
+	}
+
+	if (pa_data->context) {
+		cw_pa.pa_context_set_state_callback(pa_data->context, NULL, NULL);
+		cw_pa.pa_context_disconnect(pa_data->context);
+		cw_pa.pa_context_unref(pa_data->context);
+		pa_data->context = NULL;
+	}
+
+	cw_pa.pa_threaded_mainloop_unlock(pa_data->mainloop);
+
+	/* Must be called without the lock. Safe to call for a
+	   mainloop that hasn't been started. */
+	cw_pa.pa_threaded_mainloop_stop(pa_data->mainloop);
+	cw_pa.pa_threaded_mainloop_free(pa_data->mainloop);
+	pa_data->mainloop = NULL;
+
+	return;
+}
+
+
+
+
+/* Callbacks called by PulseAudio in mainloop's thread. Most of them
+   only wake up a thread waiting in pa_threaded_mainloop_wait(). */
+
+
+
+
+void cw_pa_context_state_cb_internal(__attribute__((unused)) pa_context *c, void *userdata)
+{
+	cw_pa_data_t *pa_data = (cw_pa_data_t *) userdata;
+	cw_pa.pa_threaded_mainloop_signal(pa_data->mainloop, 0);
+	return;
+}
+
+
+
+
+void cw_pa_stream_state_cb_internal(__attribute__((unused)) pa_stream *s, void *userdata)
+{
+	cw_pa_data_t *pa_data = (cw_pa_data_t *) userdata;
+	cw_pa.pa_threaded_mainloop_signal(pa_data->mainloop, 0);
+	return;
+}
+
+
+
+
+void cw_pa_stream_write_cb_internal(__attribute__((unused)) pa_stream *s, __attribute__((unused)) size_t n_bytes, void *userdata)
+{
+	/* Server asks for data: wake up generator's thread waiting
+	   in cw_pa_write_internal(). */
+	cw_pa_data_t *pa_data = (cw_pa_data_t *) userdata;
+	cw_pa.pa_threaded_mainloop_signal(pa_data->mainloop, 0);
+	return;
+}
+
+
+
+
+void cw_pa_stream_underflow_cb_internal(__attribute__((unused)) pa_stream *s, void *userdata)
+{
+	cw_pa_data_t *pa_data = (cw_pa_data_t *) userdata;
+	pa_data->n_underflows++;
+	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_WARNING,
+		      MSG_PREFIX "stream underflow #%u", pa_data->n_underflows);
+	return;
+}
+
+
+
+
+void cw_pa_stream_success_cb_internal(__attribute__((unused)) pa_stream *s, __attribute__((unused)) int success, void *userdata)
+{
+	cw_pa_data_t *pa_data = (cw_pa_data_t *) userdata;
+	cw_pa.pa_threaded_mainloop_signal(pa_data->mainloop, 0);
+	return;
 }
 
 
@@ -307,8 +688,6 @@ pa_simple *cw_pa_simple_new_internal(pa_sample_spec *ss, pa_buffer_attr *ba, con
    symbol that the funciton failed to resolve. Function stops and returns
    on first failure.
 
-   \reviewed on 2017-02-04
-
    \param handle - handle to open PulseAudio library
 
    \return 0 on success
@@ -316,20 +695,78 @@ pa_simple *cw_pa_simple_new_internal(pa_sample_spec *ss, pa_buffer_attr *ba, con
 */
 int cw_pa_dlsym_internal(void *handle)
 {
-	*(void **) &(cw_pa.pa_simple_new)         = dlsym(handle, "pa_simple_new");
-	if (!cw_pa.pa_simple_new)         return -1;
-	*(void **) &(cw_pa.pa_simple_free)        = dlsym(handle, "pa_simple_free");
-	if (!cw_pa.pa_simple_free)        return -2;
-	*(void **) &(cw_pa.pa_simple_write)       = dlsym(handle, "pa_simple_write");
-	if (!cw_pa.pa_simple_write)       return -3;
-	*(void **) &(cw_pa.pa_strerror)           = dlsym(handle, "pa_strerror");
-	if (!cw_pa.pa_strerror)           return -4;
-	*(void **) &(cw_pa.pa_simple_get_latency) = dlsym(handle, "pa_simple_get_latency");
-	if (!cw_pa.pa_simple_get_latency) return -5;
-	*(void **) &(cw_pa.pa_simple_drain)       = dlsym(handle, "pa_simple_drain");
-	if (!cw_pa.pa_simple_drain)       return -6;
-	*(void **) &(cw_pa.pa_usec_to_bytes)      = dlsym(handle, "pa_usec_to_bytes");
-	if (!cw_pa.pa_usec_to_bytes)      return -7;
+	*(void **) &(cw_pa.pa_threaded_mainloop_new)         = dlsym(handle, "pa_threaded_mainloop_new");
+	if (!cw_pa.pa_threaded_mainloop_new)         return -1;
+	*(void **) &(cw_pa.pa_threaded_mainloop_free)        = dlsym(handle, "pa_threaded_mainloop_free");
+	if (!cw_pa.pa_threaded_mainloop_free)        return -2;
+	*(void **) &(cw_pa.pa_threaded_mainloop_start)       = dlsym(handle, "pa_threaded_mainloop_start");
+	if (!cw_pa.pa_threaded_mainloop_start)       return -3;
+	*(void **) &(cw_pa.pa_threaded_mainloop_stop)        = dlsym(handle, "pa_threaded_mainloop_stop");
+	if (!cw_pa.pa_threaded_mainloop_stop)        return -4;
+	*(void **) &(cw_pa.pa_threaded_mainloop_lock)        = dlsym(handle, "pa_threaded_mainloop_lock");
+	if (!cw_pa.pa_threaded_mainloop_lock)        return -5;
+	*(void **) &(cw_pa.pa_threaded_mainloop_unlock)      = dlsym(handle, "pa_threaded_mainloop_unlock");
+	if (!cw_pa.pa_threaded_mainloop_unlock)      return -6;
+	*(void **) &(cw_pa.pa_threaded_mainloop_wait)        = dlsym(handle, "pa_threaded_mainloop_wait");
+	if (!cw_pa.pa_threaded_mainloop_wait)        return -7;
+	*(void **) &(cw_pa.pa_threaded_mainloop_signal)      = dlsym(handle, "pa_threaded_mainloop_signal");
+	if (!cw_pa.pa_threaded_mainloop_signal)      return -8;
+	*(void **) &(cw_pa.pa_threaded_mainloop_get_api)     = dlsym(handle, "pa_threaded_mainloop_get_api");
+	if (!cw_pa.pa_threaded_mainloop_get_api)     return -9;
+
+	*(void **) &(cw_pa.pa_context_new)                   = dlsym(handle, "pa_context_new");
+	if (!cw_pa.pa_context_new)                   return -10;
+	*(void **) &(cw_pa.pa_context_connect)               = dlsym(handle, "pa_context_connect");
+	if (!cw_pa.pa_context_connect)               return -11;
+	*(void **) &(cw_pa.pa_context_disconnect)            = dlsym(handle, "pa_context_disconnect");
+	if (!cw_pa.pa_context_disconnect)            return -12;
+	*(void **) &(cw_pa.pa_context_unref)                 = dlsym(handle, "pa_context_unref");
+	if (!cw_pa.pa_context_unref)                 return -13;
+	*(void **) &(cw_pa.pa_context_get_state)             = dlsym(handle, "pa_context_get_state");
+	if (!cw_pa.pa_context_get_state)             return -14;
+	*(void **) &(cw_pa.pa_context_set_state_callback)    = dlsym(handle, "pa_context_set_state_callback");
+	if (!cw_pa.pa_context_set_state_callback)    return -15;
+	*(void **) &(cw_pa.pa_context_errno)                 = dlsym(handle, "pa_context_errno");
+	if (!cw_pa.pa_context_errno)                 return -16;
+
+	*(void **) &(cw_pa.pa_stream_new)                    = dlsym(handle, "pa_stream_new");
+	if (!cw_pa.pa_stream_new)                    return -17;
+	*(void **) &(cw_pa.pa_stream_connect_playback)       = dlsym(handle, "pa_stream_connect_playback");
+	if (!cw_pa.pa_stream_connect_playback)       return -18;
+	*(void **) &(cw_pa.pa_stream_disconnect)             = dlsym(handle, "pa_stream_disconnect");
+	if (!cw_pa.pa_stream_disconnect)             return -19;
+	*(void **) &(cw_pa.pa_stream_unref)                  = dlsym(handle, "pa_stream_unref");
+	if (!cw_pa.pa_stream_unref)                  return -20;
+	*(void **) &(cw_pa.pa_stream_get_state)              = dlsym(handle, "pa_stream_get_state");
+	if (!cw_pa.pa_stream_get_state)              return -21;
+	*(void **) &(cw_pa.pa_stream_set_state_callback)     = dlsym(handle, "pa_stream_set_state_callback");
+	if (!cw_pa.pa_stream_set_state_callback)     return -22;
+	*(void **) &(cw_pa.pa_stream_set_write_callback)     = dlsym(handle, "pa_stream_set_write_callback");
+	if (!cw_pa.pa_stream_set_write_callback)     return -23;
+	*(void **) &(cw_pa.pa_stream_set_underflow_callback) = dlsym(handle, "pa_stream_set_underflow_callback");
+	if (!cw_pa.pa_stream_set_underflow_callback) return -24;
+	*(void **) &(cw_pa.pa_stream_writable_size)          = dlsym(handle, "pa_stream_writable_size");
+	if (!cw_pa.pa_stream_writable_size)          return -25;
+	*(void **) &(cw_pa.pa_stream_write)                  = dlsym(handle, "pa_stream_write");
+	if (!cw_pa.pa_stream_write)                  return -26;
+	*(void **) &(cw_pa.pa_stream_get_latency)            = dlsym(handle, "pa_stream_get_latency");
+	if (!cw_pa.pa_stream_get_latency)            return -27;
+	*(void **) &(cw_pa.pa_stream_get_buffer_attr)        = dlsym(handle, "pa_stream_get_buffer_attr");
+	if (!cw_pa.pa_stream_get_buffer_attr)        return -28;
+	*(void **) &(cw_pa.pa_stream_drain)                  = dlsym(handle, "pa_stream_drain");
+	if (!cw_pa.pa_stream_drain)                  return -29;
+	*(void **) &(cw_pa.pa_stream_get_sample_spec)        = dlsym(handle, "pa_stream_get_sample_spec");
+	if (!cw_pa.pa_stream_get_sample_spec)        return -30;
+
+	*(void **) &(cw_pa.pa_operation_get_state)           = dlsym(handle, "pa_operation_get_state");
+	if (!cw_pa.pa_operation_get_state)           return -31;
+	*(void **) &(cw_pa.pa_operation_unref)               = dlsym(handle, "pa_operation_unref");
+	if (!cw_pa.pa_operation_unref)               return -32;
+
+	*(void **) &(cw_pa.pa_usec_to_bytes)                 = dlsym(handle, "pa_usec_to_bytes");
+	if (!cw_pa.pa_usec_to_bytes)                 return -33;
+	*(void **) &(cw_pa.pa_strerror)                      = dlsym(handle, "pa_strerror");
+	if (!cw_pa.pa_strerror)                      return -34;
 
 	return 0;
 }
@@ -343,7 +780,9 @@ int cw_pa_dlsym_internal(void *handle)
    You must use cw_gen_set_audio_device_internal() before calling
    this function. Otherwise generator \p gen won't know which device to open.
 
-   \reviewed on 2017-02-04
+   Stream is opened with sample rate set with
+   cw_pa_set_sample_rate_internal(), or with first of supported
+   sample rates if no rate has been set yet.
 
    \param gen - generator
 
@@ -352,36 +791,27 @@ int cw_pa_dlsym_internal(void *handle)
 */
 int cw_pa_open_device_internal(cw_gen_t *gen)
 {
-	/* TODO: this piece of code is duplicated in cw_pa_simple_new_internal() */
-	const char *dev = (char *) NULL; /* NULL - let PulseAudio use default device. */
-	if (gen->audio_device && strcmp(gen->audio_device, CW_DEFAULT_PA_DEVICE)) {
-		dev = gen->audio_device; /* Non-default device. */
-	}
-
 	int error = 0;
-	gen->pa_data.s = cw_pa_simple_new_internal(&gen->pa_data.ss, &gen->pa_data.ba,
-						   dev,
-						   gen->client.name ? gen->client.name : "app",
-						   &error);
+	if (CW_SUCCESS != cw_pa_connect_internal(&gen->pa_data,
+						 gen->audio_device,
+						 gen->client.name ? gen->client.name : "app",
+						 gen->sample_format,
+						 gen->n_channels,
+						 gen->sample_rate > 0 ? gen->sample_rate : (int) cw_supported_sample_rates[0],
+						 &error)) {
 
- 	if (!gen->pa_data.s) {
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
 			      MSG_PREFIX "open device: can't connect to PulseAudio server: %s", cw_pa.pa_strerror(error));
-		return false;
+		return CW_FAILURE;
 	}
 
 	gen->buffer_n_samples = CW_PA_BUFFER_N_SAMPLES;
 	gen->sample_rate = gen->pa_data.ss.rate;
 
-	if ((gen->pa_data.latency_usecs = cw_pa.pa_simple_get_latency(gen->pa_data.s, &error)) == (pa_usec_t) -1) {
-		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
-			      MSG_PREFIX "open device: pa_simple_get_latency() failed: %s", cw_pa.pa_strerror(error));
-	}
-
 #if CW_DEV_RAW_SINK
 	gen->dev_raw_sink = open("/tmp/cw_file.pa.raw", O_WRONLY | O_TRUNC | O_NONBLOCK);
 #endif
-	assert (gen && gen->pa_data.s);
+	assert (gen && gen->pa_data.stream);
 
 	return CW_SUCCESS;
 }
@@ -392,21 +822,12 @@ int cw_pa_open_device_internal(cw_gen_t *gen)
 /**
    \brief Close PulseAudio device associated with given generator
 
-   \reviewed on 2017-02-04
-
    \param gen - generator
 */
 void cw_pa_close_device_internal(cw_gen_t *gen)
 {
-	if (gen->pa_data.s) {
-		/* Make sure that every single sample was played */
-		int error;
-		if (cw_pa.pa_simple_drain(gen->pa_data.s, &error) < 0) {
-			cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
-				      MSG_PREFIX "close device: pa_simple_drain() failed: %s", cw_pa.pa_strerror(error));
-		}
-		cw_pa.pa_simple_free(gen->pa_data.s);
-		gen->pa_data.s = NULL;
+	if (gen->pa_data.mainloop) {
+		cw_pa_disconnect_internal(&gen->pa_data, true);
 	} else {
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_WARNING,
 			      MSG_PREFIX "close device: called the function for NULL PA sink");
@@ -428,6 +849,44 @@ void cw_pa_close_device_internal(cw_gen_t *gen)
 
 
 
+/**
+   \brief Reconnect PulseAudio stream of stopped generator with new sample rate
+
+   Generator \p gen must not be started. On success generator's
+   sample rate is set to rate negotiated with PulseAudio server.
+
+   \param gen - generator
+   \param sample_rate - requested sample rate [Hz]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_pa_set_sample_rate_internal(cw_gen_t *gen, int sample_rate)
+{
+	cw_pa_disconnect_internal(&gen->pa_data, true);
+
+	int error = 0;
+	if (CW_SUCCESS != cw_pa_connect_internal(&gen->pa_data,
+						 gen->audio_device,
+						 gen->client.name ? gen->client.name : "app",
+						 gen->sample_format,
+						 gen->n_channels,
+						 sample_rate,
+						 &error)) {
+
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_ERROR,
+			      MSG_PREFIX "set sample rate: can't reconnect to PulseAudio server with rate %d: %s", sample_rate, cw_pa.pa_strerror(error));
+		return CW_FAILURE;
+	}
+
+	gen->sample_rate = gen->pa_data.ss.rate;
+
+	return CW_SUCCESS;
+}
+
+
+
+
 #else /* #ifdef LIBCW_WITH_PULSEAUDIO */
 
 
@@ -463,4 +922,14 @@ int cw_pa_configure(__attribute__((unused)) cw_gen_t *gen, __attribute__((unused
 
 
 
+int cw_pa_set_sample_rate_internal(__attribute__((unused)) cw_gen_t *gen, __attribute__((unused)) int sample_rate)
+{
+	cw_debug_msg ((&cw_debug_object), CW_DEBUG_SOUND_SYSTEM, CW_DEBUG_INFO,
+		      MSG_PREFIX "This audio system has been disabled during compilation");
+	return CW_FAILURE;
+}
+
+
+
+
 #endif /* #ifdef LIBCW_WITH_PULSEAUDIO */
@@ -16,13 +16,17 @@
 
 #ifdef LIBCW_WITH_PULSEAUDIO
 
-#include <pulse/simple.h>
-#include <pulse/error.h>
+#include <pulse/pulseaudio.h>
 
 typedef struct cw_pa_data_struct {
-	pa_simple *s;       /* Audio handle. */
+	pa_threaded_mainloop *mainloop; /* Thread running PulseAudio callbacks. */
+	pa_context *context;            /* Connection to PulseAudio server. */
+	pa_stream *stream;              /* Playback stream, the audio handle. */
+
 	pa_sample_spec ss;  /* Sample specification. */
-	pa_usec_t latency_usecs;
+
+	/* Count of underflows reported by server for the stream. */
+	unsigned int n_underflows;
 
 	pa_buffer_attr ba;
 } cw_pa_data_t;
@@ -35,6 +39,7 @@ typedef struct cw_pa_data_struct {
 #include "libcw_gen.h"
 
 int cw_pa_configure(cw_gen_t *gen, const char *device);
+int cw_pa_set_sample_rate_internal(cw_gen_t *gen, int sample_rate);
 
 
 
@@ -222,6 +222,11 @@ cw_rec_t * cw_rec_new(void)
 	rec->push_callback = NULL;
 #endif
 
+	rec->gap_callback_func = NULL;
+	rec->gap_callback_arg = NULL;
+	cw_timer_init_internal(&rec->gap_timer, cw_rec_gap_timer_callback_internal, rec);
+	cw_event_source_init_internal(&rec->events);
+
 	return rec;
 }
 
@@ -246,6 +251,9 @@ void cw_rec_delete(cw_rec_t ** rec)
 		return;
 	}
 
+	cw_timer_cancel_internal(&(*rec)->gap_timer);
+	cw_event_source_close_internal(&(*rec)->events);
+
 	free(*rec);
 	*rec = (cw_rec_t *) NULL;
 
@@ -944,6 +952,10 @@ int cw_rec_mark_begin(cw_rec_t * rec, const volatile struct timeval * timestamp)
 		cw_rec_reset_state(rec);
 	}
 
+	/* Gap after previous mark has ended before reaching
+	   end-of-character or end-of-word length. */
+	cw_timer_cancel_internal(&rec->gap_timer);
+
 	if (rec->state != RS_IDLE && rec->state != RS_IMARK_SPACE) {
 		/* A start of mark can only happen while we are idle,
 		   or in inter-mark-space of a current character. */
@@ -1137,6 +1149,8 @@ int cw_rec_mark_end(cw_rec_t * rec, const volatile struct timeval * timestamp)
 	   state. */
 	CW_REC_SET_STATE (rec, RS_IMARK_SPACE, (&cw_debug_object));
 
+	cw_rec_schedule_gap_internal(rec);
+
 	return CW_SUCCESS;
 }
 
@@ -1401,6 +1415,8 @@ int cw_rec_add_mark(cw_rec_t * rec, const volatile struct timeval * timestamp, c
 	   the inter-mark-space state. */
 	CW_REC_SET_STATE (rec, RS_IMARK_SPACE, (&cw_debug_object));
 
+	cw_rec_schedule_gap_internal(rec);
+
 	return CW_SUCCESS;
 }
 
@@ -1752,6 +1768,8 @@ void cw_rec_reset_state(cw_rec_t * rec)
 
 	rec->is_pending_inter_word_space = false;
 
+	cw_timer_cancel_internal(&rec->gap_timer);
+
 	CW_REC_SET_STATE (rec, RS_IDLE, (&cw_debug_object));
 
 	return;
@@ -1760,6 +1778,179 @@ void cw_rec_reset_state(cw_rec_t * rec)
 
 
 
+/**
+   \brief Register callback for end-of-character and end-of-word gaps
+
+   Register a \p callback_func function that should be called when a
+   space after last mark received by \p rec becomes long enough to be
+   recognized as end-of-character gap, and then again when it becomes
+   long enough to be recognized as end-of-word gap. Second argument of
+   the callback tells which of the two gaps has been reached. This is
+   the right moment to call cw_rec_poll_character() or
+   cw_rec_poll_representation(), so client code doesn't have to poll
+   the receiver periodically.
+
+   Deadlines of the gaps are registered with libcw's timer wheel,
+   which is shared by all receivers and keys. The callback is called
+   from timer wheel's thread: it should return quickly, and
+   synchronization of access to receiver is client's responsibility.
+
+   The gaps are measured from timestamps passed to
+   cw_rec_mark_end()/cw_rec_add_mark(). If these are not related to
+   current time, the gaps are measured from the moment of the call.
+
+   Calling this routine with a NULL function address disables the
+   notifications.
+
+   \param rec - receiver
+   \param callback_func - callback function to be called at end of gaps
+   \param callback_arg - first argument to callback_func
+*/
+void cw_rec_register_gap_callback(cw_rec_t * rec, cw_rec_gap_callback_t callback_func, void * callback_arg)
+{
+	cw_timer_cancel_internal(&rec->gap_timer);
+
+	rec->gap_callback_func = callback_func;
+	rec->gap_callback_arg = callback_arg;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get file descriptor that becomes readable on receiver's events
+
+   The descriptor can be watched with poll(), select(), epoll or by
+   an event loop of client code, instead of polling the receiver
+   periodically. When the descriptor becomes readable, call
+   cw_rec_read_events() to get the events: CW_EVENT_CHARACTER
+   (end-of-character gap, call cw_rec_poll_character()),
+   CW_EVENT_WORD (end-of-word gap), CW_EVENT_KEYER_IDLE (iambic
+   keyer without generator, feeding the receiver, has become idle).
+
+   Gaps are detected in the same way as for
+   cw_rec_register_gap_callback().
+
+   The descriptor is owned by the receiver: don't close it. It is
+   created on first call, events occurring before the first call are
+   not reported.
+
+   \errno ENOSYS - the descriptor is not supported on this platform
+
+   \param rec - receiver
+
+   \return file descriptor on success
+   \return -1 on failure
+*/
+int cw_rec_get_event_fd(cw_rec_t * rec)
+{
+	return cw_event_source_get_fd_internal(&rec->events);
+}
+
+
+
+
+/**
+   \brief Fetch and clear events of receiver
+
+   See cw_rec_get_event_fd(). The function never blocks.
+
+   \param rec - receiver
+
+   \return CW_EVENT_* bits of events that have occurred since previous call
+   \return zero if no events have occurred
+*/
+unsigned int cw_rec_read_events(cw_rec_t * rec)
+{
+	return cw_event_source_read_internal(&rec->events);
+}
+
+
+
+
+/**
+   \brief Register end-of-character gap with timer wheel
+
+   Function should be called when receiver has received end of a mark
+   and moved to inter-mark space.
+
+   \param rec - receiver
+*/
+void cw_rec_schedule_gap_internal(cw_rec_t * rec)
+{
+	if (!rec->gap_callback_func && !cw_event_source_is_open_internal(&rec->events)) {
+		return;
+	}
+
+	if (!rec->gap_timer.callback) {
+		/* Receiver of legacy API is initialized statically,
+		   without cw_rec_new(). */
+		cw_timer_init_internal(&rec->gap_timer, cw_rec_gap_timer_callback_internal, rec);
+	}
+
+	/* Receiver's timestamps are on a different clock than timer
+	   wheel. Translate end of mark to timer wheel's clock. */
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	int elapsed = cw_timestamp_compare_internal(&rec->mark_end, &now);
+	if (elapsed == INT_MAX) {
+		/* Timestamp from the future, or from the distant
+		   past (which also includes timestamps not related
+		   to current time at all). */
+		elapsed = 0;
+	}
+	rec->gap_start = cw_timer_now_internal() - elapsed;
+
+	cw_rec_sync_parameters_internal(rec);
+
+	rec->gap_timer_is_eow = false;
+	if (CW_SUCCESS != cw_timer_schedule_internal(&rec->gap_timer, rec->gap_start + rec->eoc_len_min)) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_RECEIVE_STATES, CW_DEBUG_ERROR,
+			      MSG_PREFIX "schedule gap: failed to schedule end-of-character gap");
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Handle deadline of end-of-character or end-of-word gap
+
+   Function is called in timer wheel's thread. After end-of-character
+   gap the function registers end-of-word gap.
+
+   \param arg - receiver
+*/
+void cw_rec_gap_timer_callback_internal(void * arg)
+{
+	cw_rec_t * rec = (cw_rec_t *) arg;
+
+	const bool is_end_of_word = rec->gap_timer_is_eow;
+	if (!is_end_of_word) {
+		/* Schedule end-of-word before calling client's
+		   callback, so that the callback can cancel it
+		   e.g. by resetting receiver's state. Space longer
+		   than eoc_len_max is end-of-word gap. */
+		rec->gap_timer_is_eow = true;
+		cw_timer_schedule_internal(&rec->gap_timer, rec->gap_start + rec->eoc_len_max + 1);
+	}
+
+	cw_event_source_post_internal(&rec->events, is_end_of_word ? CW_EVENT_WORD : CW_EVENT_CHARACTER);
+
+	if (rec->gap_callback_func) {
+		rec->gap_callback_func(rec->gap_callback_arg, is_end_of_word);
+	}
+
+	return;
+}
+
+
+
+
 /**
    \brief Get the number of elements (Dots/Dashes) the receiver's buffer can accommodate
 
@@ -18,6 +18,8 @@
 
 
 #include "libcw.h"
+#include "libcw_event.h"
+#include "libcw_timer.h"
 
 
 
@@ -85,6 +87,14 @@ typedef enum {
 } stat_type_t;
 
 
+/* Client's callback, called when a gap after last mark becomes long
+   enough to be end-of-character gap (is_end_of_word == false) or
+   end-of-word gap (is_end_of_word == true). */
+typedef void (* cw_rec_gap_callback_t)(void * callback_arg, bool is_end_of_word);
+
+
+
+
 typedef struct {
 	stat_type_t type;  /* Record type */
 	int delta;         /* Difference between actual and ideal length of mark or space. [us] */
@@ -216,6 +226,19 @@ struct cw_rec_struct {
 	   space on a later poll. */
 	bool is_pending_inter_word_space;
 
+	/* Deadlines of end-of-character and end-of-word gaps,
+	   registered with libcw's timer wheel. Thanks to these the
+	   client code doesn't have to keep polling the receiver to
+	   find out when a character is ready. */
+	cw_rec_gap_callback_t gap_callback_func;
+	void * gap_callback_arg;
+	cw_timer_t gap_timer;
+	int64_t gap_start;          /* End of last mark, on timer wheel's clock. [us] */
+	bool gap_timer_is_eow;      /* Is gap_timer waiting for end-of-word gap? */
+
+	/* End-of-character and end-of-word gaps are also reported
+	   through pollable file descriptor. */
+	cw_event_source_t events;
 };
 
 
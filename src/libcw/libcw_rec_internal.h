@@ -29,6 +29,10 @@ CW_STATIC_FUNC double cw_rec_get_stats_internal(cw_rec_t * rec, stat_type_t type
 CW_STATIC_FUNC void cw_rec_poll_representation_eoc_internal(cw_rec_t * rec, int space_len, char * representation, bool * is_end_of_word, bool * is_error);
 CW_STATIC_FUNC void cw_rec_poll_representation_eow_internal(cw_rec_t * rec, char * representation, bool * is_end_of_word, bool * is_error);
 
+/* Notifications about end-of-character and end-of-word gaps. */
+CW_STATIC_FUNC void cw_rec_schedule_gap_internal(cw_rec_t * rec);
+CW_STATIC_FUNC void cw_rec_gap_timer_callback_internal(void * arg);
+
 
 
 
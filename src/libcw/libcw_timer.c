@@ -0,0 +1,876 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2019  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+/**
+   \file libcw_timer.c
+
+   \brief Timer wheels used by keys, receivers and by library itself.
+
+   Keys and receivers that need to be notified when some period of
+   time has elapsed (end of iambic keyer's element, end of
+   inter-character gap) register their deadlines with a timer
+   wheel. A wheel is one thread, sleeping on a timerfd that is armed
+   to the earliest registered deadline, and on an eventfd that is
+   used to stop the thread.
+
+   Each library context has its own wheel, so timers of different
+   contexts don't share a thread or a lock. Timers that don't belong
+   to any context (keys and receivers created with cw_key_new() and
+   cw_rec_new(), legacy API, library's finalization) are scheduled
+   on a default wheel.
+
+   Timers are kept in a hashed timer wheel: a deadline is hashed into
+   one of CW_TIMER_WHEEL_SLOTS slots, each slot covering
+   CW_TIMER_WHEEL_TICK_LEN microseconds. Scheduling and canceling a
+   timer is O(1), and finding the next deadline only requires looking
+   at slots ahead of current position of the wheel, regardless of
+   number of registered timers.
+
+   The timerfd is armed with exact deadline of a timer, not with
+   a beginning of a tick, so tick length doesn't limit precision of
+   the timers.
+
+   Thread of a wheel is started on first use. Thread of default wheel
+   lives until the process exits, thread of context's wheel is
+   stopped when the context is deleted.
+
+   No signals are used: the timers don't interfere with SIGALRM
+   handlers of client code, and don't interrupt system calls made by
+   client's threads.
+*/
+
+
+
+
+#include "config.h"
+
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H)
+# include <sys/eventfd.h>
+# include <sys/timerfd.h>
+#endif
+
+
+
+
+#include "libcw.h"
+#include "libcw_debug.h"
+#include "libcw_timer.h"
+#include "libcw_utils.h"
+
+
+
+
+#define MSG_PREFIX "libcw/timer: "
+
+
+
+
+extern cw_debug_t cw_debug_object;
+extern cw_debug_t cw_debug_object_dev;
+
+
+
+
+struct cw_timer_wheel_struct {
+	pthread_mutex_t mutex;
+
+	/* Used by cw_timer_cancel_internal() to wait for a callback
+	   being executed by the wheel's thread. */
+	pthread_cond_t callback_done_var;
+
+	bool thread_started;
+	pthread_t thread_id;
+	bool do_run;         /* Set to false to stop the thread. */
+	int timer_fd;        /* timerfd armed to the earliest deadline. */
+	int wakeup_fd;       /* eventfd used to wake the thread up when it should stop. */
+
+	/* Deadline to which the timerfd is currently armed, zero if
+	   the timerfd is disarmed. */
+	int64_t armed_deadline;
+
+	/* Position of the wheel: all timers with deadlines in earlier
+	   ticks have been processed. */
+	int64_t current_tick;
+
+	int n_armed;
+	cw_timer_t * slots[CW_TIMER_WHEEL_SLOTS];
+
+	/* Timer whose callback is being executed right now. */
+	cw_timer_t * running;
+};
+
+
+
+
+/* Wheel for timers that don't belong to any library context. */
+static cw_timer_wheel_t cw_timer_default_wheel = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.callback_done_var = PTHREAD_COND_INITIALIZER,
+
+	.thread_started = false,
+	.do_run = true,
+	.timer_fd = -1,
+	.wakeup_fd = -1,
+	.armed_deadline = 0,
+	.current_tick = 0,
+	.n_armed = 0,
+	.running = NULL
+};
+
+
+
+
+static cw_timer_wheel_t * cw_timer_wheel_of_internal(const cw_timer_t * timer);
+
+#if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H)
+static int          cw_timer_wheel_start_internal(cw_timer_wheel_t * wheel, bool detached);
+static void *       cw_timer_wheel_thread_internal(void * arg);
+static void         cw_timer_wheel_expire_internal(cw_timer_wheel_t * wheel);
+static cw_timer_t * cw_timer_wheel_pop_expired_internal(cw_timer_wheel_t * wheel, int64_t now);
+static void         cw_timer_wheel_rearm_internal(cw_timer_wheel_t * wheel);
+static void         cw_timer_wheel_arm_internal(cw_timer_wheel_t * wheel, int64_t deadline);
+static void         cw_timer_wheel_link_internal(cw_timer_wheel_t * wheel, cw_timer_t * timer);
+static void         cw_timer_wheel_unlink_internal(cw_timer_wheel_t * wheel, cw_timer_t * timer);
+#endif
+
+
+
+
+/**
+   \brief Create a new timer wheel
+
+   Thread of the wheel is started when first timer is scheduled on
+   the wheel.
+
+   \errno ENOMEM - failed to allocate memory
+
+   \return pointer to new wheel on success
+   \return NULL on failure
+*/
+cw_timer_wheel_t * cw_timer_wheel_new_internal(void)
+{
+	cw_timer_wheel_t * wheel = (cw_timer_wheel_t *) calloc(1, sizeof (cw_timer_wheel_t));
+	if (!wheel) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: calloc()");
+		errno = ENOMEM;
+		return (cw_timer_wheel_t *) NULL;
+	}
+
+	pthread_mutex_init(&wheel->mutex, NULL);
+	pthread_cond_init(&wheel->callback_done_var, NULL);
+
+	wheel->thread_started = false;
+	wheel->do_run = true;
+	wheel->timer_fd = -1;
+	wheel->wakeup_fd = -1;
+
+	return wheel;
+}
+
+
+
+
+/**
+   \brief Delete a timer wheel
+
+   Thread of the wheel is stopped. Owners of timers must cancel their
+   timers before the wheel is deleted. The function must not be
+   called from a callback of a timer on the wheel.
+
+   Pointer to \p wheel is set to NULL.
+
+   \param wheel - pointer to wheel
+*/
+void cw_timer_wheel_delete_internal(cw_timer_wheel_t ** wheel)
+{
+	cw_assert (wheel, MSG_PREFIX "delete: wheel is NULL");
+
+	if (!*wheel) {
+		return;
+	}
+
+	cw_assert (*wheel != &cw_timer_default_wheel, MSG_PREFIX "delete: trying to delete default wheel");
+	cw_assert ((*wheel)->n_armed == 0, MSG_PREFIX "delete: %d timers are still armed", (*wheel)->n_armed);
+
+	pthread_mutex_lock(&(*wheel)->mutex);
+	(*wheel)->do_run = false;
+	const bool thread_started = (*wheel)->thread_started;
+	pthread_mutex_unlock(&(*wheel)->mutex);
+
+#if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H)
+	if (thread_started) {
+		cw_assert (!pthread_equal(pthread_self(), (*wheel)->thread_id), MSG_PREFIX "delete: called from wheel's thread");
+
+		const uint64_t value = 1;
+		if (-1 == write((*wheel)->wakeup_fd, &value, sizeof (value))) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+				      MSG_PREFIX "delete: write(): %d", errno);
+		}
+		pthread_join((*wheel)->thread_id, NULL);
+
+		close((*wheel)->timer_fd);
+		close((*wheel)->wakeup_fd);
+	}
+#else
+	(void) thread_started;
+#endif
+
+	pthread_mutex_destroy(&(*wheel)->mutex);
+	pthread_cond_destroy(&(*wheel)->callback_done_var);
+
+	free(*wheel);
+	*wheel = (cw_timer_wheel_t *) NULL;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Initialize a timer
+
+   The timer is initially not scheduled, and it is assigned to
+   libcw's default wheel.
+
+   \param timer - timer to initialize
+   \param callback - function to be called when timer's deadline is reached
+   \param callback_arg - argument passed to \p callback
+*/
+void cw_timer_init_internal(cw_timer_t * timer, cw_timer_callback_t callback, void * callback_arg)
+{
+	timer->deadline = 0;
+	timer->callback = callback;
+	timer->callback_arg = callback_arg;
+
+	timer->wheel = NULL;
+
+	timer->is_armed = false;
+	timer->slot = 0;
+	timer->prev = NULL;
+	timer->next = NULL;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Assign a timer to a timer wheel
+
+   The timer must not be scheduled when the function is called.
+
+   \param timer - timer
+   \param wheel - wheel on which the timer will be scheduled, NULL for libcw's default wheel
+*/
+void cw_timer_set_wheel_internal(cw_timer_t * timer, cw_timer_wheel_t * wheel)
+{
+	cw_assert (!cw_timer_is_armed_internal(timer), MSG_PREFIX "set wheel: timer is armed");
+
+	timer->wheel = wheel;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Get wheel on which given timer is scheduled
+
+   \param timer - timer
+
+   \return timer's wheel
+*/
+cw_timer_wheel_t * cw_timer_wheel_of_internal(const cw_timer_t * timer)
+{
+	return timer->wheel ? timer->wheel : &cw_timer_default_wheel;
+}
+
+
+
+
+/**
+   \brief Get current time of timer wheel's clock
+
+   \return current time on CLOCK_MONOTONIC [us]
+*/
+int64_t cw_timer_now_internal(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t) now.tv_sec * CW_USECS_PER_SEC + now.tv_nsec / 1000;
+}
+
+
+
+
+/**
+   \brief Check if given timer is scheduled
+
+   \param timer - timer to check
+
+   \return true if the timer is waiting for its deadline
+   \return false otherwise
+*/
+bool cw_timer_is_armed_internal(cw_timer_t * timer)
+{
+	cw_timer_wheel_t * wheel = cw_timer_wheel_of_internal(timer);
+
+	pthread_mutex_lock(&wheel->mutex);
+	bool is_armed = timer->is_armed;
+	pthread_mutex_unlock(&wheel->mutex);
+
+	return is_armed;
+}
+
+
+
+
+/**
+   \brief Schedule a timer to expire after given time
+
+   \errno ENOSYS - timer wheel is not supported on this platform
+   \errno EINVAL - \p usecs is negative
+
+   \param timer - timer to schedule
+   \param usecs - time from now, after which the timer's callback should be called [us]
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_timer_schedule_in_internal(cw_timer_t * timer, int usecs)
+{
+	if (usecs < 0) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	return cw_timer_schedule_internal(timer, cw_timer_now_internal() + usecs);
+}
+
+
+
+
+#if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H)
+
+
+
+
+/**
+   \brief Schedule a timer to expire at given deadline
+
+   If the timer is already scheduled, it is re-scheduled to the new
+   deadline. A deadline that is in the past makes the timer expire
+   as soon as possible.
+
+   The timer's callback is called from its wheel's thread, without
+   any lock held. The callback may re-schedule its own timer.
+
+   \errno ENOSYS - timer wheel is not supported on this platform
+   \errno EINVAL - the timer's wheel is being deleted
+   \errno other - errors of timerfd_create(), eventfd() or pthread_create()
+
+   \param timer - timer to schedule
+   \param deadline - absolute time on CLOCK_MONOTONIC [us], see cw_timer_now_internal()
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_timer_schedule_internal(cw_timer_t * timer, int64_t deadline)
+{
+	cw_timer_wheel_t * wheel = cw_timer_wheel_of_internal(timer);
+
+	pthread_mutex_lock(&wheel->mutex);
+
+	if (!wheel->do_run) {
+		pthread_mutex_unlock(&wheel->mutex);
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (!wheel->thread_started) {
+		/* Nobody joins thread of default wheel. */
+		if (CW_SUCCESS != cw_timer_wheel_start_internal(wheel, wheel == &cw_timer_default_wheel)) {
+			pthread_mutex_unlock(&wheel->mutex);
+			return CW_FAILURE;
+		}
+	}
+
+	if (timer->is_armed) {
+		cw_timer_wheel_unlink_internal(wheel, timer);
+	}
+	timer->deadline = deadline;
+	cw_timer_wheel_link_internal(wheel, timer);
+
+	if (wheel->armed_deadline == 0
+	    || deadline < wheel->armed_deadline) {
+
+		cw_timer_wheel_arm_internal(wheel, deadline);
+	}
+
+	pthread_mutex_unlock(&wheel->mutex);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Remove a timer from its timer wheel
+
+   When the function returns, the timer's callback is not being
+   executed and won't be executed (unless the timer is scheduled
+   again). The only exception is a call made from within the
+   callback itself: the callback is then obviously still running.
+
+   It is safe to call the function for a timer that is not scheduled.
+
+   \param timer - timer to cancel
+*/
+void cw_timer_cancel_internal(cw_timer_t * timer)
+{
+	cw_timer_wheel_t * wheel = cw_timer_wheel_of_internal(timer);
+
+	pthread_mutex_lock(&wheel->mutex);
+
+	if (timer->is_armed) {
+		cw_timer_wheel_unlink_internal(wheel, timer);
+	}
+
+	if (wheel->thread_started
+	    && !pthread_equal(pthread_self(), wheel->thread_id)) {
+
+		while (wheel->running == timer) {
+			pthread_cond_wait(&wheel->callback_done_var, &wheel->mutex);
+		}
+	}
+
+	/* The timerfd may still be armed to the deadline of this
+	   timer. This isn't a problem: the thread will wake up, find
+	   nothing to do and re-arm the timerfd. */
+
+	pthread_mutex_unlock(&wheel->mutex);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Create timerfd and eventfd, and start thread of timer wheel
+
+   Call the function with wheel's mutex locked.
+
+   \param wheel - timer wheel
+   \param detached - start the thread in detached state
+
+   \return CW_SUCCESS on success
+   \return CW_FAILURE on failure
+*/
+int cw_timer_wheel_start_internal(cw_timer_wheel_t * wheel, bool detached)
+{
+	/* Non-blocking timerfd: the timerfd may be re-armed by
+	   other thread between poll() and read() in wheel's thread,
+	   and read() must not wait for the new deadline then. */
+	wheel->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (wheel->timer_fd == -1) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "start: timerfd_create(): %d", errno);
+		return CW_FAILURE;
+	}
+
+	wheel->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wheel->wakeup_fd == -1) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "start: eventfd(): %d", errno);
+		close(wheel->timer_fd);
+		wheel->timer_fd = -1;
+		return CW_FAILURE;
+	}
+
+	wheel->current_tick = cw_timer_now_internal() / CW_TIMER_WHEEL_TICK_LEN;
+
+	pthread_attr_t thread_attr;
+	pthread_attr_init(&thread_attr);
+	pthread_attr_setdetachstate(&thread_attr, detached ? PTHREAD_CREATE_DETACHED : PTHREAD_CREATE_JOINABLE);
+	int rv = pthread_create(&wheel->thread_id, &thread_attr,
+				cw_timer_wheel_thread_internal, wheel);
+	pthread_attr_destroy(&thread_attr);
+	if (rv != 0) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "start: pthread_create(): %d", rv);
+
+		close(wheel->timer_fd);
+		close(wheel->wakeup_fd);
+		wheel->timer_fd = -1;
+		wheel->wakeup_fd = -1;
+		errno = rv;
+		return CW_FAILURE;
+	}
+
+	wheel->thread_started = true;
+
+	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_INTERNAL, CW_DEBUG_INFO,
+		      MSG_PREFIX "start: timer wheel started");
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   \brief Thread function of timer wheel
+
+   Sleep on timerfd until the earliest deadline, then call callbacks
+   of all expired timers. Return when eventfd is signalled and the
+   wheel is being deleted.
+
+   \param arg - timer wheel
+
+   \return NULL
+*/
+void * cw_timer_wheel_thread_internal(void * arg)
+{
+	cw_timer_wheel_t * wheel = (cw_timer_wheel_t *) arg;
+
+	struct pollfd fds[2] = {
+		{ .fd = wheel->timer_fd,  .events = POLLIN, .revents = 0 },
+		{ .fd = wheel->wakeup_fd, .events = POLLIN, .revents = 0 }
+	};
+
+	while (true) {
+		if (-1 == poll(fds, 2, -1)) {
+			if (errno != EINTR) {
+				cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+					      MSG_PREFIX "thread: poll(): %d", errno);
+			}
+			continue;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			uint64_t value = 0;
+			if (-1 == read(wheel->wakeup_fd, &value, sizeof (value)) && errno != EAGAIN) {
+				cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+					      MSG_PREFIX "thread: read(eventfd): %d", errno);
+			}
+		}
+
+		pthread_mutex_lock(&wheel->mutex);
+
+		if (!wheel->do_run) {
+			pthread_mutex_unlock(&wheel->mutex);
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			uint64_t expirations = 0;
+			if (read(wheel->timer_fd, &expirations, sizeof (expirations)) == (ssize_t) sizeof (expirations)) {
+				/* timerfd is armed in one-shot mode, so
+				   now it is disarmed. */
+				wheel->armed_deadline = 0;
+
+				cw_timer_wheel_expire_internal(wheel);
+				cw_timer_wheel_rearm_internal(wheel);
+			} else if (errno != EAGAIN) {
+				/* EAGAIN: the timerfd has been re-armed
+				   after poll() had returned. */
+				cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+					      MSG_PREFIX "thread: read(timerfd): %d", errno);
+			}
+		}
+
+		pthread_mutex_unlock(&wheel->mutex);
+	}
+
+	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_INTERNAL, CW_DEBUG_INFO,
+		      MSG_PREFIX "thread: timer wheel stopped");
+
+	return NULL;
+}
+
+
+
+
+/**
+   \brief Call callbacks of all expired timers
+
+   Call the function with wheel's mutex locked. The mutex is
+   released for the duration of each callback.
+
+   \param wheel - timer wheel
+*/
+void cw_timer_wheel_expire_internal(cw_timer_wheel_t * wheel)
+{
+	const int64_t now = cw_timer_now_internal();
+
+	cw_timer_t * timer = NULL;
+	while (NULL != (timer = cw_timer_wheel_pop_expired_internal(wheel, now))) {
+		wheel->running = timer;
+		pthread_mutex_unlock(&wheel->mutex);
+
+		timer->callback(timer->callback_arg);
+
+		pthread_mutex_lock(&wheel->mutex);
+		wheel->running = NULL;
+		pthread_cond_broadcast(&wheel->callback_done_var);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Take one expired timer from the wheel
+
+   Advance the wheel up to \p now, looking for a timer with deadline
+   earlier than or equal to \p now. Slots that don't contain expired
+   timers are passed. The wheel is never advanced past tick of \p
+   now, because current slot may contain timers expiring later in the
+   tick.
+
+   Call the function with wheel's mutex locked.
+
+   \param wheel - timer wheel
+   \param now - current time [us]
+
+   \return unlinked expired timer
+   \return NULL if there are no more expired timers
+*/
+cw_timer_t * cw_timer_wheel_pop_expired_internal(cw_timer_wheel_t * wheel, int64_t now)
+{
+	const int64_t now_tick = now / CW_TIMER_WHEEL_TICK_LEN;
+
+	/* Thread hasn't been woken up for more than one revolution of
+	   the wheel. Checking each slot once is enough. */
+	if (now_tick - wheel->current_tick >= CW_TIMER_WHEEL_SLOTS) {
+		wheel->current_tick = now_tick - CW_TIMER_WHEEL_SLOTS + 1;
+	}
+
+	while (true) {
+		cw_timer_t * timer = wheel->slots[wheel->current_tick % CW_TIMER_WHEEL_SLOTS];
+		for (; timer; timer = timer->next) {
+			if (timer->deadline <= now) {
+				cw_timer_wheel_unlink_internal(wheel, timer);
+				return timer;
+			}
+		}
+
+		if (wheel->current_tick >= now_tick) {
+			return NULL;
+		}
+		wheel->current_tick++;
+	}
+}
+
+
+
+
+/**
+   \brief Arm timerfd to the earliest deadline on the wheel
+
+   Look at slots ahead of current position of the wheel. Timers in
+   a slot may belong to future revolutions of the wheel, so only
+   timers with deadlines in the slot's tick are considered.
+
+   If no timer expires within one revolution, the timerfd is armed
+   to the end of the revolution, and the search is repeated then.
+
+   Call the function with wheel's mutex locked.
+
+   \param wheel - timer wheel
+*/
+void cw_timer_wheel_rearm_internal(cw_timer_wheel_t * wheel)
+{
+	if (wheel->n_armed == 0) {
+		return;
+	}
+
+	for (int64_t tick = wheel->current_tick;
+	     tick < wheel->current_tick + CW_TIMER_WHEEL_SLOTS;
+	     tick++) {
+
+		int64_t deadline = 0;
+		for (cw_timer_t * timer = wheel->slots[tick % CW_TIMER_WHEEL_SLOTS]; timer; timer = timer->next) {
+			if (timer->deadline / CW_TIMER_WHEEL_TICK_LEN <= tick
+			    && (deadline == 0 || timer->deadline < deadline)) {
+
+				deadline = timer->deadline;
+			}
+		}
+
+		if (deadline != 0) {
+			cw_timer_wheel_arm_internal(wheel, deadline);
+			return;
+		}
+	}
+
+	cw_timer_wheel_arm_internal(wheel, (wheel->current_tick + CW_TIMER_WHEEL_SLOTS) * CW_TIMER_WHEEL_TICK_LEN);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Arm timerfd to expire at given time
+
+   Call the function with wheel's mutex locked.
+
+   \param wheel - timer wheel
+   \param deadline - absolute time on CLOCK_MONOTONIC [us]
+*/
+void cw_timer_wheel_arm_internal(cw_timer_wheel_t * wheel, int64_t deadline)
+{
+	/* Zero it_value would disarm the timerfd. */
+	if (deadline <= 0) {
+		deadline = 1;
+	}
+
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = 0;
+	spec.it_interval.tv_nsec = 0;
+	spec.it_value.tv_sec = deadline / CW_USECS_PER_SEC;
+	spec.it_value.tv_nsec = (deadline % CW_USECS_PER_SEC) * 1000;
+
+	if (-1 == timerfd_settime(wheel->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL)) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "arm: timerfd_settime(): %d", errno);
+		return;
+	}
+	wheel->armed_deadline = deadline;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Put a timer in a slot of the wheel
+
+   A deadline from the past is put into current slot, otherwise the
+   timer would wait for next revolution of the wheel.
+
+   Call the function with wheel's mutex locked.
+
+   \param wheel - timer wheel
+   \param timer - timer to link
+*/
+void cw_timer_wheel_link_internal(cw_timer_wheel_t * wheel, cw_timer_t * timer)
+{
+	int64_t tick = timer->deadline / CW_TIMER_WHEEL_TICK_LEN;
+	if (tick < wheel->current_tick) {
+		tick = wheel->current_tick;
+	}
+	timer->slot = (int) (tick % CW_TIMER_WHEEL_SLOTS);
+	cw_timer_t ** slot = &wheel->slots[timer->slot];
+
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot) {
+		(*slot)->prev = timer;
+	}
+	*slot = timer;
+
+	timer->is_armed = true;
+	wheel->n_armed++;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Remove a timer from its slot of the wheel
+
+   Call the function with wheel's mutex locked.
+
+   \param wheel - timer wheel
+   \param timer - timer to unlink
+*/
+void cw_timer_wheel_unlink_internal(cw_timer_wheel_t * wheel, cw_timer_t * timer)
+{
+	if (timer->prev) {
+		timer->prev->next = timer->next;
+	} else {
+		wheel->slots[timer->slot] = timer->next;
+	}
+	if (timer->next) {
+		timer->next->prev = timer->prev;
+	}
+
+	timer->prev = NULL;
+	timer->next = NULL;
+
+	timer->is_armed = false;
+	wheel->n_armed--;
+
+	return;
+}
+
+
+
+
+#else /* #if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H) */
+
+
+
+
+int cw_timer_schedule_internal(__attribute__((unused)) cw_timer_t * timer, __attribute__((unused)) int64_t deadline)
+{
+	cw_debug_msg (&cw_debug_object, CW_DEBUG_INTERNAL, CW_DEBUG_ERROR,
+		      MSG_PREFIX "schedule: timerfd or eventfd is not supported on this platform");
+
+	errno = ENOSYS;
+	return CW_FAILURE;
+}
+
+
+
+
+void cw_timer_cancel_internal(__attribute__((unused)) cw_timer_t * timer)
+{
+	return;
+}
+
+
+
+
+#endif /* #if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENTFD_H) */
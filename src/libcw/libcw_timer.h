@@ -0,0 +1,73 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_TIMER
+#define H_LIBCW_TIMER
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+/* Number of slots in timer wheel, and length of one slot (tick) of
+   the wheel. One revolution of the wheel is 256 ms long, which
+   covers all elements of Morse code sent at 5 wpm or faster. Longer
+   deadlines are correctly handled too, they just stay in a slot for
+   more than one revolution. */
+enum { CW_TIMER_WHEEL_SLOTS = 256 };
+enum { CW_TIMER_WHEEL_TICK_LEN = 1000 }; /* [us] */
+
+
+
+
+typedef void (* cw_timer_callback_t)(void * callback_arg);
+
+
+/* Timer wheel: a thread and a set of timers scheduled on it. Each
+   library context has its own wheel. Timers that don't belong to any
+   context are scheduled on libcw's default wheel. */
+typedef struct cw_timer_wheel_struct cw_timer_wheel_t;
+
+
+/* A timer that can be registered with a timer wheel.
+
+   The timer is an intrusive list node: it is embedded in its owner
+   (key, receiver), and the timer wheel doesn't allocate any memory
+   when a timer is scheduled. */
+typedef struct cw_timer_struct {
+	int64_t deadline;                  /* Absolute time on CLOCK_MONOTONIC. [us] */
+	cw_timer_callback_t callback;      /* Called in timer wheel's thread when deadline is reached. */
+	void * callback_arg;
+
+	cw_timer_wheel_t * wheel;          /* Wheel on which the timer is scheduled, NULL for libcw's default wheel. */
+
+	bool is_armed;                     /* Is the timer on the wheel? */
+	int slot;                          /* Index of wheel's slot in which the timer is linked. */
+	struct cw_timer_struct * prev;
+	struct cw_timer_struct * next;
+} cw_timer_t;
+
+
+
+
+cw_timer_wheel_t * cw_timer_wheel_new_internal(void);
+void               cw_timer_wheel_delete_internal(cw_timer_wheel_t ** wheel);
+
+void    cw_timer_init_internal(cw_timer_t * timer, cw_timer_callback_t callback, void * callback_arg);
+void    cw_timer_set_wheel_internal(cw_timer_t * timer, cw_timer_wheel_t * wheel);
+int     cw_timer_schedule_internal(cw_timer_t * timer, int64_t deadline);
+int     cw_timer_schedule_in_internal(cw_timer_t * timer, int usecs);
+void    cw_timer_cancel_internal(cw_timer_t * timer);
+bool    cw_timer_is_armed_internal(cw_timer_t * timer);
+int64_t cw_timer_now_internal(void);
+
+
+
+
+#endif /* #ifndef H_LIBCW_TIMER */
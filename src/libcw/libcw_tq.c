@@ -80,7 +80,6 @@
 #include "libcw_tq_internal.h"
 #include "libcw_gen.h"
 #include "libcw_debug.h"
-#include "libcw_signal.h"
 #include "libcw2.h"
 
 
@@ -145,6 +144,12 @@ extern cw_debug_t cw_debug_object_dev;
 
 
 
+static void cw_tq_add_level_waiter_internal(cw_tone_queue_t * tq, cw_tq_level_waiter_t * waiter);
+static void cw_tq_wake_level_waiters_internal(cw_tone_queue_t * tq);
+
+
+
+
 /* Not used anymore. 2015.02.22. */
 #if 0
 /* Remember that tail and head are of unsigned type.  Make sure that
@@ -184,6 +189,9 @@ cw_tone_queue_t *cw_tq_new_internal(void)
 
 	pthread_cond_init(&tq->wait_var, NULL);
 	pthread_mutex_init(&tq->wait_mutex, NULL);
+	tq->tone_seq = 0;
+	tq->n_tone_waiters = 0;
+	tq->level_waiters = NULL;
 
 	pthread_cond_init(&tq->dequeue_var, NULL);
 	pthread_mutex_init(&tq->dequeue_mutex, NULL);
@@ -198,6 +206,8 @@ cw_tone_queue_t *cw_tq_new_internal(void)
 	tq->low_water_callback_arg = NULL;
 	tq->call_callback = false;
 
+	cw_event_source_init_internal(&tq->events);
+
 	tq->gen = (cw_gen_t *) NULL; /* This field will be set by generator code. */
 
 	rv = cw_tq_set_capacity_internal(tq, CW_TONE_QUEUE_CAPACITY_MAX, CW_TONE_QUEUE_HIGH_WATER_MARK_MAX);
@@ -259,6 +269,8 @@ void cw_tq_delete_internal(cw_tone_queue_t **tq)
 
 	pthread_mutex_destroy(&(*tq)->mutex);
 
+	cw_event_source_close_internal(&(*tq)->events);
+
 
 	free(*tq);
 	*tq = (cw_tone_queue_t *) NULL;
@@ -287,8 +299,10 @@ void cw_tq_make_empty_internal(cw_tone_queue_t * tq)
 	tq->len = 0;
 	tq->state = CW_TQ_IDLE;
 
-	//fprintf(stderr, MSG_PREFIX "make empty: broadcast on tq->len = 0\n");
-	pthread_cond_broadcast(&tq->wait_var);
+	/* Current tone (if any) is gone, and every level has been
+	   reached. */
+	cw_tq_notify_tone_waiters_internal(tq);
+	cw_tq_wake_level_waiters_internal(tq);
 	pthread_mutex_unlock(&tq->wait_mutex);
 
 	return;
@@ -502,6 +516,66 @@ int cw_tq_dequeue_internal(cw_tone_queue_t *tq, /* out */ cw_tone_t *tone)
 	pthread_mutex_lock(&tq->mutex);
 	pthread_mutex_lock(&tq->wait_mutex);
 
+	return cw_tq_dequeue_and_unlock_internal(tq, tone);
+}
+
+
+
+
+/**
+   \brief Dequeue a tone from tone queue without waiting for queue's locks
+
+   Non-blocking variant of cw_tq_dequeue_internal(), to be used in
+   contexts that must not be put to sleep, e.g. in audio callback
+   called by a real-time thread of audio server.
+
+   If any of queue's mutexes is held by other thread, the function
+   gives up immediately: it doesn't touch \p tone, sets errno to
+   EAGAIN and returns CW_FAILURE. Otherwise it behaves exactly like
+   cw_tq_dequeue_internal() (including calling low water callback),
+   and in case of empty queue it returns CW_FAILURE with errno left
+   unchanged.
+
+   \param tq - tone queue
+   \param tone - dequeued tone
+
+   \return CW_SUCCESS if a tone has been dequeued
+   \return CW_FAILURE if no tone has been dequeued
+*/
+int cw_tq_try_dequeue_internal(cw_tone_queue_t *tq, /* out */ cw_tone_t *tone)
+{
+	if (0 != pthread_mutex_trylock(&tq->mutex)) {
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+	if (0 != pthread_mutex_trylock(&tq->wait_mutex)) {
+		pthread_mutex_unlock(&tq->mutex);
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+
+	return cw_tq_dequeue_and_unlock_internal(tq, tone);
+}
+
+
+
+
+/**
+   \brief Dequeue a tone from tone queue with queue's mutexes already locked
+
+   Common part of cw_tq_dequeue_internal() and
+   cw_tq_try_dequeue_internal(). The function must be called with
+   both tq->mutex and tq->wait_mutex locked, and it unlocks them
+   before returning (and before calling low water callback).
+
+   \param tq - tone queue
+   \param tone - dequeued tone
+
+   \return CW_SUCCESS if a tone has been dequeued
+   \return CW_FAILURE if no tone has been dequeued
+*/
+int cw_tq_dequeue_and_unlock_internal(cw_tone_queue_t *tq, /* out */ cw_tone_t *tone)
+{
 	cw_assert (tq->state == CW_TQ_IDLE || tq->state == CW_TQ_BUSY,
 		   MSG_PREFIX "dequeue: unexpected value of tq->state = %d", tq->state);
 
@@ -565,6 +639,11 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, /* out */ cw_tone_t * tone
 {
 	CW_TONE_COPY(tone, &(tq->queue[tq->head]));
 
+	/* Previous tone (or previous period of "forever" tone) has
+	   been completed. */
+	cw_tq_notify_tone_waiters_internal(tq);
+	cw_event_source_post_internal(&tq->events, CW_EVENT_TONE);
+
 	if (tone->is_forever && tq->len == 1) {
 		/* Don't permanently remove the last tone that is
 		   "forever" tone in queue. Keep it in tq until client
@@ -587,8 +666,7 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, /* out */ cw_tone_t * tone
 	/* Dequeue. We already have the tone, now update tq's state. */
 	tq->head = cw_tq_next_index_internal(tq, tq->head);
 	tq->len--;
-	//fprintf(stderr, MSG_PREFIX "dequeue sub: broadcast on tq->len--\n");
-	pthread_cond_broadcast(&tq->wait_var);
+	cw_tq_wake_level_waiters_internal(tq);
 
 
 	if (tq->len == 0) {
@@ -613,13 +691,14 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, /* out */ cw_tone_t * tone
 
 
 	bool call_callback = false;
-	if (tq->low_water_callback) {
-		/* It may seem that the double condition in 'if ()' is
-		   redundant, but for some reason it is necessary. Be
-		   very, very careful when modifying this. */
-		if (tq_len_before > tq->low_water_mark
-		    && tq->len <= tq->low_water_mark) {
-
+	/* It may seem that the double condition in 'if ()' is
+	   redundant, but for some reason it is necessary. Be very,
+	   very careful when modifying this. */
+	if (tq_len_before > tq->low_water_mark
+	    && tq->len <= tq->low_water_mark) {
+
+		cw_event_source_post_internal(&tq->events, CW_EVENT_LOW_WATER);
+		if (tq->low_water_callback) {
 			call_callback = true;
 		}
 	}
@@ -673,7 +752,7 @@ int cw_tq_enqueue_internal(cw_tone_queue_t *tq, cw_tone_t *tone)
 		return CW_FAILURE;
 	}
 
-	if (tone->len == 0) {
+	if (tone->len == 0 && !tone->start_at) {
 		/* Drop empty tone. It won't be played anyway, and for
 		   now there are no other good reasons to enqueue
 		   it. While it may happen in higher-level code to
@@ -712,8 +791,8 @@ int cw_tq_enqueue_internal(cw_tone_queue_t *tq, cw_tone_t *tone)
 
 	tq->tail = cw_tq_next_index_internal(tq, tq->tail);
 	tq->len++;
-	// fprintf(stderr, MSG_PREFIX "enqueue: broadcast on tq->len++\n");
-	pthread_cond_broadcast(&tq->wait_var);
+	/* Nobody waits for queue to grow, so there is nobody to
+	   notify. */
 
 
 	if (tq->state == CW_TQ_IDLE) {
@@ -783,6 +862,11 @@ int cw_tq_register_low_level_callback_internal(cw_tone_queue_t * tq, cw_queue_lo
 /**
    \brief Wait for the current tone to complete
 
+   The function returns when next tone is dequeued, when generator
+   reports that last tone in queue has elapsed (see
+   cw_tq_mark_tone_elapsed_internal()), when the queue is flushed,
+   or when generator's thread exits.
+
    The routine always returns CW_SUCCESS.
 
    TODO: add unit test for this function.
@@ -794,7 +878,12 @@ int cw_tq_register_low_level_callback_internal(cw_tone_queue_t * tq, cw_queue_lo
 int cw_tq_wait_for_tone_internal(cw_tone_queue_t *tq)
 {
 	pthread_mutex_lock(&tq->wait_mutex);
-	pthread_cond_wait(&tq->wait_var, &tq->wait_mutex);
+	__atomic_add_fetch(&tq->n_tone_waiters, 1, __ATOMIC_SEQ_CST);
+	const unsigned int seq = __atomic_load_n(&tq->tone_seq, __ATOMIC_SEQ_CST);
+	while (seq == __atomic_load_n(&tq->tone_seq, __ATOMIC_SEQ_CST)) {
+		pthread_cond_wait(&tq->wait_var, &tq->wait_mutex);
+	}
+	__atomic_sub_fetch(&tq->n_tone_waiters, 1, __ATOMIC_SEQ_CST);
 	pthread_mutex_unlock(&tq->wait_mutex);
 
 
@@ -826,6 +915,11 @@ int cw_tq_wait_for_tone_internal(cw_tone_queue_t *tq)
    when this function is called, otherwise it will be waiting forever
    for a change of tone queue's level that will never happen.
 
+   The calling thread is woken up only when queue's length drops to
+   \p level, not on every dequeued tone. It returns even if new tones
+   have been enqueued between the moment the level has been reached
+   and the moment the thread has been scheduled.
+
    \reviewed on 2017-01-30
 
    \param tq - tone queue
@@ -837,8 +931,19 @@ int cw_tq_wait_for_level_internal(cw_tone_queue_t *tq, size_t level)
 {
 	/* Wait until the queue length is at or below given level. */
 	pthread_mutex_lock(&tq->wait_mutex);
-	while (tq->len > level) {
-		pthread_cond_wait(&tq->wait_var, &tq->wait_mutex);
+	if (tq->len > level) {
+		cw_tq_level_waiter_t waiter = { .level = level, .is_woken = false, .next = NULL };
+		pthread_cond_init(&waiter.var, NULL);
+		cw_tq_add_level_waiter_internal(tq, &waiter);
+
+		/* tq->len is modified only with tq->wait_mutex held,
+		   so the waiter will be removed from the list and
+		   woken up by the thread that decreases the length to
+		   our level. */
+		while (!waiter.is_woken) {
+			pthread_cond_wait(&waiter.var, &tq->wait_mutex);
+		}
+		pthread_cond_destroy(&waiter.var);
 	}
 	pthread_mutex_unlock(&tq->wait_mutex);
 
@@ -954,8 +1059,11 @@ void cw_tq_handle_backspace_internal(cw_tone_queue_t *tq)
 	}
 
 	if (is_found) {
+		pthread_mutex_lock(&tq->wait_mutex);
 		tq->len = len;
 		tq->tail = idx;
+		cw_tq_wake_level_waiters_internal(tq);
+		pthread_mutex_unlock(&tq->wait_mutex);
 	}
 
 	pthread_mutex_unlock(&tq->mutex);
@@ -965,3 +1073,141 @@ void cw_tq_handle_backspace_internal(cw_tone_queue_t *tq)
 
 
 /* *** Unit tests *** */
+
+
+
+
+
+/**
+   \brief Wake up threads waiting in cw_tq_wait_for_tone_internal()
+
+   Caller must hold tq->wait_mutex.
+
+   \param tq - tone queue
+*/
+void cw_tq_notify_tone_waiters_internal(cw_tone_queue_t * tq)
+{
+	__atomic_add_fetch(&tq->tone_seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&tq->n_tone_waiters, __ATOMIC_SEQ_CST)) {
+		/* There may be many listeners, so use broadcast(). */
+		pthread_cond_broadcast(&tq->wait_var);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Record that generator has finished playing a tone
+
+   If there are more tones in queue, threads waiting in
+   cw_tq_wait_for_tone_internal() will be woken up when next tone is
+   dequeued, so there is nothing to do here. Otherwise the waiters
+   have to be woken up with cw_tq_wake_tone_waiters_internal() if
+   this function returns true.
+
+   Function is lock-free: it doesn't touch tq->wait_mutex.
+
+   \param tq - tone queue
+
+   \return true if there are threads waiting for the event
+   \return false otherwise
+*/
+bool cw_tq_mark_tone_elapsed_internal(cw_tone_queue_t * tq)
+{
+	if (0 != __atomic_load_n(&tq->len, __ATOMIC_SEQ_CST)) {
+		return false;
+	}
+
+	__atomic_add_fetch(&tq->tone_seq, 1, __ATOMIC_SEQ_CST);
+
+	/* Pairs with increment of n_tone_waiters in
+	   cw_tq_wait_for_tone_internal(): either the waiter sees new
+	   tone_seq, or we see the waiter. */
+	return 0 != __atomic_load_n(&tq->n_tone_waiters, __ATOMIC_SEQ_CST);
+}
+
+
+
+
+/**
+   \brief Wake up threads waiting in cw_tq_wait_for_tone_internal()
+
+   If \p may_block is false, the function doesn't wait for
+   tq->wait_mutex held by other thread, and returns false instead:
+   the caller should try again later.
+
+   \param tq - tone queue
+   \param may_block - whether the function may wait for the mutex
+
+   \return true if waiters have been woken up
+   \return false if the wakeup should be retried
+*/
+bool cw_tq_wake_tone_waiters_internal(cw_tone_queue_t * tq, bool may_block)
+{
+	if (may_block) {
+		pthread_mutex_lock(&tq->wait_mutex);
+	} else if (0 != pthread_mutex_trylock(&tq->wait_mutex)) {
+		return false;
+	}
+
+	/* There may be many listeners, so use broadcast(). */
+	pthread_cond_broadcast(&tq->wait_var);
+	pthread_mutex_unlock(&tq->wait_mutex);
+
+	return true;
+}
+
+
+
+
+/**
+   \brief Insert waiter to list of level waiters
+
+   The list is kept sorted by level, highest level first, so that
+   waiters to be woken up first are at the head of the list.
+
+   Caller must hold tq->wait_mutex.
+
+   \param tq - tone queue
+   \param waiter - waiter to insert
+*/
+void cw_tq_add_level_waiter_internal(cw_tone_queue_t * tq, cw_tq_level_waiter_t * waiter)
+{
+	cw_tq_level_waiter_t ** w = &tq->level_waiters;
+	while (*w && (*w)->level >= waiter->level) {
+		w = &(*w)->next;
+	}
+	waiter->next = *w;
+	*w = waiter;
+
+	return;
+}
+
+
+
+
+/**
+   \brief Wake up level waiters whose level has been reached
+
+   Only threads waiting for a level equal to or higher than current
+   length of queue are woken up, each one with its own condition
+   variable. Other waiters keep sleeping.
+
+   Caller must hold tq->wait_mutex.
+
+   \param tq - tone queue
+*/
+void cw_tq_wake_level_waiters_internal(cw_tone_queue_t * tq)
+{
+	while (tq->level_waiters && tq->level_waiters->level >= tq->len) {
+		cw_tq_level_waiter_t * waiter = tq->level_waiters;
+		tq->level_waiters = waiter->next;
+		waiter->is_woken = true;
+		pthread_cond_signal(&waiter->var);
+	}
+
+	return;
+}
@@ -22,6 +22,11 @@
 
 
 
+#include "libcw_event.h"
+
+
+
+
 
 typedef void (* cw_queue_low_callback_t)(void*);
 
@@ -78,14 +83,32 @@ typedef struct {
 	/* Length of a tone, in microseconds. */
 	int len;
 
+	/* Difference between exact length of a tone and 'len' that
+	   has been truncated to microseconds. Generator calculates
+	   number of samples of tone from the exact length, so that
+	   truncation errors don't accumulate over many tones. [ns] */
+	int len_correction_ns;
+
 	/* Is this "forever" tone? See libcw_tq.c for more info about
 	   "forever" tones. */
 	bool is_forever;
 
+	/* Number of changes of straight key at the moment when
+	   "forever" mark of straight key has been enqueued, see
+	   cw_gen_t::sk_edges. */
+	unsigned int sk_edge;
+
 	/* Is this the first tone of a character?
 	   Used to backspace in the queue. */
 	bool is_first;
 
+	/* Absolute time on CLOCK_MONOTONIC at which next tone should
+	   start, see cw_gen_enqueue_start_time(). Non-zero only in
+	   "start time" tones. Such tones have no length of their own:
+	   generator turns them into silence lasting until the
+	   time. [us] */
+	int64_t start_at;
+
 	/* Type of slope. */
 	int slope_mode;
 
@@ -148,9 +171,12 @@ typedef struct {
 #define CW_TONE_INIT(m_tone, m_frequency, m_len, m_slope_mode) {	\
 		(m_tone)->frequency               = m_frequency;	\
 		(m_tone)->len                     = m_len;		\
+		(m_tone)->len_correction_ns       = 0;			\
 		(m_tone)->slope_mode              = m_slope_mode;	\
 		(m_tone)->is_forever              = false;		\
+		(m_tone)->sk_edge                 = 0;			\
 		(m_tone)->is_first                = false;		\
+		(m_tone)->start_at                = 0;			\
 		(m_tone)->n_samples               = 0;			\
 		(m_tone)->sample_iterator         = 0;			\
 		(m_tone)->rising_slope_n_samples  = 0;			\
@@ -164,9 +190,12 @@ typedef struct {
 #define CW_TONE_COPY(m_dest, m_source) {				\
 		(m_dest)->frequency               = (m_source)->frequency; \
 		(m_dest)->len                     = (m_source)->len;	\
+		(m_dest)->len_correction_ns       = (m_source)->len_correction_ns; \
 		(m_dest)->slope_mode              = (m_source)->slope_mode; \
 		(m_dest)->is_forever              = (m_source)->is_forever; \
+		(m_dest)->sk_edge                 = (m_source)->sk_edge; \
 		(m_dest)->is_first                = (m_source)->is_first; \
+		(m_dest)->start_at                = (m_source)->start_at; \
 		(m_dest)->n_samples               = (m_source)->n_samples; \
 		(m_dest)->sample_iterator         = (m_source)->sample_iterator;	\
 		(m_dest)->rising_slope_n_samples  = (m_source)->rising_slope_n_samples; \
@@ -179,6 +208,18 @@ typedef struct {
 
 struct cw_gen_struct;
 
+
+/* Thread waiting in cw_tq_wait_for_level_internal() for queue's
+   length to drop to given level. The waiter lives on stack of the
+   waiting thread. */
+typedef struct cw_tq_level_waiter_struct {
+	size_t level;
+	bool is_woken;        /* Set by thread that has removed the waiter from list. */
+	pthread_cond_t var;   /* Signalled only when length drops to 'level'. */
+	struct cw_tq_level_waiter_struct * next;
+} cw_tq_level_waiter_t;
+
+
 typedef struct {
 	volatile cw_tone_t queue[CW_TONE_QUEUE_CAPACITY_MAX];
 
@@ -213,12 +254,30 @@ typedef struct {
 	   code. */
 	bool         call_callback;
 
+	/* Low water mark and dequeued tones are also reported
+	   through pollable file descriptor. */
+	cw_event_source_t events;
+
 
 	/* IPC */
-	/* Used to broadcast queue events to waiting functions. */
-	pthread_cond_t wait_var;
+	/* Protects lists and counters of waiters below. */
 	pthread_mutex_t wait_mutex;
 
+	/* Used to broadcast "tone has been completed" events to
+	   threads waiting in cw_tq_wait_for_tone_internal().
+	   'tone_seq' is incremented on each event, 'n_tone_waiters'
+	   is a number of waiting threads. The variable isn't
+	   signalled when nobody waits. */
+	pthread_cond_t wait_var;
+	unsigned int tone_seq;
+	unsigned int n_tone_waiters;
+
+	/* Threads waiting in cw_tq_wait_for_level_internal(), sorted
+	   by level, highest level first. When queue's length drops,
+	   only the waiters whose level has been reached are woken
+	   up. */
+	cw_tq_level_waiter_t * level_waiters;
+
 	/* Used to communicate between enqueueing and dequeueing
 	   mechanism. */
 	pthread_cond_t dequeue_var;
@@ -241,6 +300,7 @@ size_t cw_tq_get_capacity_internal(cw_tone_queue_t *tq);
 size_t cw_tq_length_internal(cw_tone_queue_t *tq);
 int    cw_tq_enqueue_internal(cw_tone_queue_t *tq, cw_tone_t *tone);
 int    cw_tq_dequeue_internal(cw_tone_queue_t *tq, cw_tone_t *tone);
+int    cw_tq_try_dequeue_internal(cw_tone_queue_t *tq, cw_tone_t *tone);
 
 int  cw_tq_wait_for_level_internal(cw_tone_queue_t *tq, size_t level);
 int  cw_tq_register_low_level_callback_internal(cw_tone_queue_t * tq, cw_queue_low_callback_t callback_func, void * callback_arg, size_t level);
@@ -252,6 +312,10 @@ bool cw_tq_is_full_internal(const cw_tone_queue_t *tq);
 
 void cw_tq_handle_backspace_internal(cw_tone_queue_t *tq);
 
+void cw_tq_notify_tone_waiters_internal(cw_tone_queue_t * tq);
+bool cw_tq_mark_tone_elapsed_internal(cw_tone_queue_t * tq);
+bool cw_tq_wake_tone_waiters_internal(cw_tone_queue_t * tq, bool may_block);
+
 
 
 
@@ -64,8 +64,8 @@
 #include "libcw.h"
 #include "libcw_gen.h"
 #include "libcw_debug.h"
+#include "libcw_timer.h"
 #include "libcw_utils.h"
-#include "libcw_signal.h"
 #include "cw_copyright.h"
 #include "libcw2.h"
 
@@ -93,14 +93,15 @@ static const char *cw_audio_system_labels[] = {
 	"OSS",
 	"ALSA",
 	"PulseAudio",
-	"Soundcard" };
+	"Soundcard",
+	"JACK" };
 
 
 
 
 
 /* Finalization and cleanup. */
-static void cw_finalization_clock_internal(void);
+static void cw_finalization_clock_internal(void * arg);
 
 
 
@@ -203,7 +204,7 @@ void cw_license(void)
    \brief Get a readable label of given audio system
 
    The function returns one of following strings:
-   None, Null, Console, OSS, ALSA, PulseAudio, Soundcard
+   None, Null, Console, OSS, ALSA, PulseAudio, Soundcard, JACK
 
    Returned pointer is owned and managed by the library.
 
@@ -292,7 +293,7 @@ void cw_nanosleep_internal(const struct timespec *n)
 
 
 
-#if (defined(LIBCW_WITH_ALSA) || defined(LIBCW_WITH_PULSEAUDIO))
+#if (defined(LIBCW_WITH_ALSA) || defined(LIBCW_WITH_PULSEAUDIO) || defined(LIBCW_WITH_JACK))
 /**
    \brief Try to dynamically open shared library
 
@@ -301,7 +302,7 @@ void cw_nanosleep_internal(const struct timespec *n)
    returned via \p handle.
 
    Name of the library should contain ".so" suffix, e.g.: "libasound.so.2",
-   or "libpulse-simple.so".
+   or "libpulse.so".
 
    \reviewed on 2017-02-04
 
@@ -650,13 +651,20 @@ void cw_get_weighting_limits(int *min_weighting, int *max_weighting)
 
 /* We prefer to close the soundcard after a period of library inactivity,
    so that other applications can use it.  Ten seconds seems about right.
-   We do it in one-second timeouts so that any leaked pending timeouts from
-   other facilities don't cause premature finalization. */
+   The delay is measured by a timer on libcw's default timer wheel. */
 static const int CW_AUDIO_FINALIZATION_DELAY = 10000000;
 
- /* Counter counting down the number of clock calls before we finalize. */
 static volatile bool cw_is_finalization_pending = false;
-static volatile int cw_finalization_countdown = 0;
+static cw_timer_t cw_finalization_timer = {
+	.deadline = 0,
+	.callback = cw_finalization_clock_internal,
+	.callback_arg = NULL,
+	.wheel = NULL,
+	.is_armed = false,
+	.slot = 0,
+	.prev = NULL,
+	.next = NULL
+};
 
 /* Use a mutex to suppress delayed finalizations on complete resets. */
 static volatile bool cw_is_finalization_locked_out = false;
@@ -666,37 +674,23 @@ static volatile bool cw_is_finalization_locked_out = false;
 
 
 /**
-   \brief Tick a finalization clock
+   \brief Finalize the library after a period of inactivity
 
-   If finalization is pending, decrement the countdown, and if this reaches
-   zero, we've waited long enough to release sound and timeouts.
+   Callback of finalization timer, called in thread of libcw's default
+   timer wheel when the finalization delay has passed without the
+   finalization being canceled.
+
+   \param arg - unused
 */
-void cw_finalization_clock_internal(void)
+void cw_finalization_clock_internal(__attribute__((unused)) void * arg)
 {
 	if (cw_is_finalization_pending) {
-		/* Decrement the timeout countdown, and finalize if we reach zero. */
-		cw_finalization_countdown--;
-		if (cw_finalization_countdown <= 0) {
-			cw_debug_msg ((&cw_debug_object), CW_DEBUG_FINALIZATION, CW_DEBUG_INFO,
-				      MSG_PREFIX "finalization timeout, closing down");
-
-			cw_sigalrm_restore_internal();
-			// cw_gen_release_internal(&cw_generator);
+		cw_debug_msg ((&cw_debug_object), CW_DEBUG_FINALIZATION, CW_DEBUG_INFO,
+			      MSG_PREFIX "finalization timeout, closing down");
 
-			cw_is_finalization_pending = false;
-			cw_finalization_countdown = 0;
-		} else {
-			cw_debug_msg ((&cw_debug_object), CW_DEBUG_FINALIZATION, CW_DEBUG_INFO,
-				      MSG_PREFIX "finalization countdown %d", cw_finalization_countdown);
+		// cw_gen_release_internal(&cw_generator);
 
-			/* Request another timeout.  This results in a call to our
-			   cw_finalization_cancel_internal below; to ensure that it doesn't
-			   really cancel finalization, unset the pending flag, then set it
-			   back again after reqesting the timeout. */
-			cw_is_finalization_pending = false;
-			cw_timer_run_with_handler_internal(CW_USECS_PER_SEC, NULL);
-			cw_is_finalization_pending = true;
-		}
+		cw_is_finalization_pending = false;
 	}
 
 	return;
@@ -707,20 +701,17 @@ void cw_finalization_clock_internal(void)
 
 
 /**
-  Set the finalization pending flag, and request a timeout to call the
+  Set the finalization pending flag, and schedule a timer to call the
   finalization function after a delay of a few seconds.
 */
 void cw_finalization_schedule_internal(void)
 {
 	if (!cw_is_finalization_locked_out && !cw_is_finalization_pending) {
-		cw_timer_run_with_handler_internal(CW_USECS_PER_SEC,
-						   cw_finalization_clock_internal);
-
-		/* Set the flag and countdown last; calling cw_timer_run_with_handler()
-		 * above results in a call to our cw_finalization_cancel_internal(),
-		 which clears the flag and countdown if we set them early. */
 		cw_is_finalization_pending = true;
-		cw_finalization_countdown = CW_AUDIO_FINALIZATION_DELAY / CW_USECS_PER_SEC;
+		if (CW_SUCCESS != cw_timer_schedule_in_internal(&cw_finalization_timer, CW_AUDIO_FINALIZATION_DELAY)) {
+			cw_is_finalization_pending = false;
+			return;
+		}
 
 		cw_debug_msg ((&cw_debug_object), CW_DEBUG_FINALIZATION, CW_DEBUG_INFO,
 			      MSG_PREFIX "finalization scheduled");
@@ -734,16 +725,14 @@ void cw_finalization_schedule_internal(void)
 
 
 /**
-   Cancel any pending finalization on noting other library activity,
-   indicated by a call from the timeout request function telling us
-   that it is setting a timeout.
+   Cancel any pending finalization on noting other library activity.
 */
 void cw_finalization_cancel_internal(void)
 {
 	if (cw_is_finalization_pending)  {
 		/* Cancel pending finalization and return to doing nothing. */
+		cw_timer_cancel_internal(&cw_finalization_timer);
 		cw_is_finalization_pending = false;
-		cw_finalization_countdown = 0;
 
 		cw_debug_msg ((&cw_debug_object), CW_DEBUG_FINALIZATION, CW_DEBUG_INFO,
 			      MSG_PREFIX "finalization canceled");
@@ -780,7 +769,6 @@ void cw_complete_reset(void)
 	cw_reset_straight_key();
 
 	cw_generator_delete_internal();
-	cw_sigalrm_restore_internal();
 
 	/* Now we can re-enable delayed finalizations. */
 	cw_is_finalization_locked_out = false;
@@ -30,7 +30,7 @@ int cw_timestamp_validate_internal(struct timeval *out_timestamp, const volatile
 void cw_usecs_to_timespec_internal(struct timespec *t, int usecs);
 void cw_nanosleep_internal(const struct timespec *n);
 
-#if (defined(LIBCW_WITH_ALSA) || defined(LIBCW_WITH_PULSEAUDIO))
+#if (defined(LIBCW_WITH_ALSA) || defined(LIBCW_WITH_PULSEAUDIO) || defined(LIBCW_WITH_JACK))
 #include <stdbool.h>
 
 bool cw_dlopen_internal(const char *name, void **handle);
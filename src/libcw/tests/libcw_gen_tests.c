@@ -25,6 +25,8 @@
 #include <limits.h> /* UCHAR_MAX */
 #include <errno.h>
 #include <unistd.h>
+#include <inttypes.h> /* PRId64 */
+#include <time.h>
 
 
 
@@ -34,6 +36,7 @@
 #include "libcw_gen.h"
 #include "libcw_gen_tests.h"
 #include "libcw_debug.h"
+#include "libcw_timer.h"
 #include "libcw_utils.h"
 #include "libcw.h"
 #include "libcw2.h"
@@ -1221,3 +1224,490 @@ int test_cw_gen_enqueue_string(cw_test_executor_t * cte)
 
 	return 0;
 }
+
+
+
+
+/**
+   Test rendering of samples with cw_gen_fill() (pull mode of generator)
+*/
+int test_cw_gen_fill(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = cw_gen_new(cte->current_sound_system, NULL);
+	cw_sample_t samples[37]; /* Odd size, so that tones don't align with buffer boundaries. */
+	const size_t n_samples = sizeof (samples) / sizeof (samples[0]);
+
+
+	/* Test: invalid arguments. */
+	{
+		errno = 0;
+		int cwret = LIBCW_TEST_FUT(cw_gen_fill)(NULL, samples, n_samples);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "fill(NULL gen)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "fill(NULL gen) errno");
+
+		errno = 0;
+		cwret = LIBCW_TEST_FUT(cw_gen_fill)(gen, NULL, n_samples);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "fill(NULL samples)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "fill(NULL samples) errno");
+	}
+
+
+	if (cte->current_sound_system != CW_AUDIO_NULL) {
+		/* Only generators with Null audio sink can be used in pull mode. */
+		errno = 0;
+		const int cwret = LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "fill(non-Null audio system)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "fill(non-Null audio system) errno");
+
+		cw_gen_delete(&gen);
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+
+
+	/* Test: rendering of single Dot at non-default sample rate. */
+	{
+		const int sample_rate = 8000;
+		int cwret = LIBCW_TEST_FUT(cw_gen_set_sample_rate)(gen, sample_rate);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "set sample rate");
+
+		cw_gen_set_speed(gen, 12);
+		int dot_len = 0;
+		cw_gen_get_timing_parameters_internal(gen, &dot_len, NULL, NULL, NULL, NULL, NULL, NULL);
+		const int expected_n_samples = (int) ((int64_t) dot_len * sample_rate / CW_USECS_PER_SEC);
+
+		cw_gen_enqueue_character(gen, 'E');
+
+		int first_nonzero = -1;
+		int last_nonzero = -1;
+		int queue_empty_at = -1;
+		bool failure = false;
+
+		/* Render two seconds of samples, much more than needed for single 'E'. */
+		for (int i = 0; i < 2 * sample_rate; i += n_samples) {
+			cwret = cw_gen_fill(gen, samples, n_samples);
+			if (!cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 1, "fill() (i = %d)", i)) {
+				failure = true;
+				break;
+			}
+			for (size_t s = 0; s < n_samples; s++) {
+				if (samples[s] != 0) {
+					if (first_nonzero == -1) {
+						first_nonzero = i + s;
+					}
+					last_nonzero = i + s;
+				}
+			}
+			if (queue_empty_at == -1 && cw_gen_get_queue_length(gen) == 0) {
+				queue_empty_at = i;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", failure, 0, "fill()");
+
+		cte->expect_op_int(cte, -1, "!=", first_nonzero, 0, "fill(): non-silent samples present");
+		cte->expect_op_int(cte, -1, "!=", queue_empty_at, 0, "fill(): tone queue emptied");
+
+		/* Beginning and end of the Dot may have a few samples
+		   with zero value (start of slopes, zero-crossing of
+		   sine wave). */
+		const int rendered_n_samples = last_nonzero - first_nonzero + 1;
+		const int tolerance = sample_rate / cw_gen_get_frequency(gen) + 2;
+		cte->expect_between_int(cte, expected_n_samples - tolerance, rendered_n_samples, expected_n_samples, "fill(): length of Dot");
+	}
+
+
+	/* Test: pull mode can't be used when generator has been started. */
+	{
+		cw_gen_start(gen);
+		errno = 0;
+		const int cwret = LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "fill(started generator)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "fill(started generator) errno");
+		cw_gen_stop(gen);
+	}
+
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   Test offline rendering of samples with cw_gen_fill_queued()
+*/
+int test_cw_gen_fill_queued(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	if (cte->current_sound_system != CW_AUDIO_NULL) {
+		/* Only generators with Null audio sink can be used in pull mode. */
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+
+	cw_gen_t * gen = cw_gen_new(cte->current_sound_system, NULL);
+	cw_sample_t samples[37]; /* Odd size, so that tones don't align with buffer boundaries. */
+	const size_t n_samples = sizeof (samples) / sizeof (samples[0]);
+
+
+	/* Test: invalid arguments. */
+	{
+		size_t n_rendered = 1;
+		errno = 0;
+		int cwret = LIBCW_TEST_FUT(cw_gen_fill_queued)(NULL, samples, n_samples, &n_rendered);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "fill queued(NULL gen)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "fill queued(NULL gen) errno");
+		cte->expect_op_int(cte, 0, "==", n_rendered, 0, "fill queued(NULL gen) n_rendered");
+
+		errno = 0;
+		cwret = LIBCW_TEST_FUT(cw_gen_fill_queued)(gen, samples, n_samples, NULL);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "fill queued(NULL n_rendered)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "fill queued(NULL n_rendered) errno");
+	}
+
+
+	/* Test: nothing is rendered from empty tone queue. */
+	{
+		size_t n_rendered = 1;
+		const int cwret = LIBCW_TEST_FUT(cw_gen_fill_queued)(gen, samples, n_samples, &n_rendered);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "fill queued(empty queue)");
+		cte->expect_op_int(cte, 0, "==", n_rendered, 0, "fill queued(empty queue) n_rendered");
+	}
+
+
+	/* Test: characters enqueued between calls are rendered
+	   back-to-back, as many samples as there are in their
+	   tones. */
+	{
+		const int sample_rate = 8000;
+		cw_gen_set_sample_rate(gen, sample_rate);
+		cw_gen_set_speed(gen, 12);
+
+		int dot_len = 0;
+		int eom_space_len = 0;
+		int eoc_space_len = 0;
+		cw_gen_get_timing_parameters_internal(gen, &dot_len, NULL, &eom_space_len, &eoc_space_len, NULL, NULL, NULL);
+		/* 'E' is a Dot, inter-mark space and inter-character space. */
+		const int64_t character_len = dot_len + eom_space_len + eoc_space_len;
+
+		const int n_characters = 3;
+		size_t total = 0;
+		bool failure = false;
+		for (int c = 0; c < n_characters; c++) {
+			cw_gen_enqueue_character(gen, 'E');
+
+			size_t n_rendered = 0;
+			do {
+				const int cwret = LIBCW_TEST_FUT(cw_gen_fill_queued)(gen, samples, n_samples, &n_rendered);
+				if (!cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 1, "fill queued() (character %d)", c)) {
+					failure = true;
+					break;
+				}
+				total += n_rendered;
+			} while (n_rendered == n_samples);
+
+			if (failure) {
+				break;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", failure, 0, "fill queued()");
+
+		/* Fractions of samples are carried across tones, so
+		   rounding errors don't accumulate. */
+		const int expected = (int) (n_characters * character_len * sample_rate / CW_USECS_PER_SEC);
+		cte->expect_between_int(cte, expected - 1, (int) total, expected + 1, "fill queued(): number of samples of %d characters", n_characters);
+	}
+
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   Test generator with float samples and more than one channel
+*/
+int test_cw_gen_new_with_format(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	/* Test: invalid format of output. */
+	{
+		errno = 0;
+		cw_gen_t * gen = LIBCW_TEST_FUT(cw_gen_new_with_format)(cte->current_sound_system, NULL, CW_SAMPLE_FORMAT_FLOAT + 1, 1);
+		cte->expect_null_pointer(cte, gen, "new with format(invalid sample format)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "new with format(invalid sample format) errno");
+
+		errno = 0;
+		gen = LIBCW_TEST_FUT(cw_gen_new_with_format)(cte->current_sound_system, NULL, CW_SAMPLE_FORMAT_S16, CW_AUDIO_CHANNELS_MAX + 1);
+		cte->expect_null_pointer(cte, gen, "new with format(too many channels)");
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "new with format(too many channels) errno");
+	}
+
+
+	if (cte->current_sound_system != CW_AUDIO_NULL) {
+		/* Contents of samples can be checked only with cw_gen_fill(). */
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+
+
+	/* Test: stereo float output, with sound panned to each side
+	   and to center. */
+	{
+		const int n_channels = 2;
+		cw_gen_t * gen = LIBCW_TEST_FUT(cw_gen_new_with_format)(CW_AUDIO_NULL, NULL, CW_SAMPLE_FORMAT_FLOAT, n_channels);
+		if (!cte->expect_valid_pointer(cte, gen, "new with format(float, stereo)")) {
+			cte->print_test_footer(cte, __func__);
+			return -1;
+		}
+
+		cte->expect_op_int(cte, CW_FAILURE, "==", LIBCW_TEST_FUT(cw_gen_set_pan)(gen, CW_PAN_MIN - 1), 0, "set pan(below min)");
+		cte->expect_op_int(cte, CW_FAILURE, "==", LIBCW_TEST_FUT(cw_gen_set_pan)(gen, CW_PAN_MAX + 1), 0, "set pan(above max)");
+		cte->expect_op_int(cte, CW_PAN_INITIAL, "==", LIBCW_TEST_FUT(cw_gen_get_pan)(gen), 0, "get pan(initial)");
+
+		const int pans[] = { CW_PAN_MIN, CW_PAN_MAX, 0 };
+		for (size_t p = 0; p < sizeof (pans) / sizeof (pans[0]); p++) {
+			cw_gen_set_pan(gen, pans[p]);
+			cte->expect_op_int(cte, pans[p], "==", cw_gen_get_pan(gen), 0, "get pan(%d)", pans[p]);
+
+			cw_gen_enqueue_character(gen, 'T');
+
+			float frames[64 * 2];
+			double energy[2] = { 0.0, 0.0 };
+			bool in_range = true;
+			while (cw_gen_get_queue_length(gen) > 0) {
+				cw_gen_fill(gen, frames, 64);
+				for (int i = 0; i < 64; i++) {
+					for (int c = 0; c < n_channels; c++) {
+						const double sample = frames[i * n_channels + c];
+						if (sample < -1.0 || sample > 1.0) {
+							in_range = false;
+						}
+						energy[c] += sample * sample;
+					}
+				}
+			}
+			cte->expect_op_int(cte, true, "==", in_range, 0, "float samples in range (pan = %d)", pans[p]);
+
+			if (pans[p] == CW_PAN_MIN) {
+				cte->expect_op_int(cte, true, "==", energy[0] > 0.0 && energy[1] <= 0.0, 0, "only first channel is used (pan = %d)", pans[p]);
+			} else if (pans[p] == CW_PAN_MAX) {
+				cte->expect_op_int(cte, true, "==", energy[0] <= 0.0 && energy[1] > 0.0, 0, "only last channel is used (pan = %d)", pans[p]);
+			} else {
+				const double diff = energy[0] - energy[1];
+				cte->expect_op_int(cte, true, "==", energy[0] > 0.0 && diff < 0.0001 * energy[0] && diff > -0.0001 * energy[0], 0, "channels are balanced (pan = %d)", pans[p]);
+			}
+		}
+
+		cw_gen_delete(&gen);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   Test that total length of long message, rendered at different
+   sample rates, matches ideal length within one sample
+*/
+int test_cw_gen_tone_timing_accuracy(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	if (cte->current_sound_system != CW_AUDIO_NULL) {
+		/* Samples can be counted only with cw_gen_fill(). */
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+
+	const int sample_rates[] = { 8000, 11025, 16000, 22050, 44100, 48000, 88200, 96000, 176400, 192000 };
+	const int n_rates = sizeof (sample_rates) / sizeof (sample_rates[0]);
+
+	for (int r = 0; r < n_rates; r++) {
+		const int sample_rate = sample_rates[r];
+
+		cw_gen_t * gen = cw_gen_new(CW_AUDIO_NULL, NULL);
+		cw_gen_set_sample_rate(gen, sample_rate);
+		/* Speed at which lengths of tones are not a whole
+		   number of samples at any of tested rates. */
+		cw_gen_set_speed(gen, 47);
+
+		for (int i = 0; i < 5; i++) {
+			cw_gen_enqueue_string(gen, "PARIS PARIS PARIS ");
+		}
+
+		/* Ideal length of message. With default weighting and
+		   gap every enqueued tone is a whole number of half
+		   Units (inter-word space is enqueued in two halves).
+		   Tone lengths in the queue are truncated to
+		   microseconds, so only the number of half Units is
+		   taken from them, and the ideal number of samples is
+		   calculated as exact fraction:
+		   n_half_units * CW_DOT_CALIBRATION * sample_rate / (2 * speed * CW_USECS_PER_SEC). */
+		const int speed = cw_gen_get_speed(gen);
+		int64_t n_half_units = 0;
+		for (size_t i = 0; i < gen->tq->len; i++) {
+			const int len = gen->tq->queue[(gen->tq->head + i) % gen->tq->capacity].len;
+			n_half_units += ((int64_t) 2 * len * speed + CW_DOT_CALIBRATION / 2) / CW_DOT_CALIBRATION;
+		}
+		const int64_t ideal_numerator = n_half_units * CW_DOT_CALIBRATION * sample_rate;
+		const int64_t ideal_denominator = (int64_t) 2 * speed * CW_USECS_PER_SEC;
+		const double ideal_n_samples = (double) ideal_numerator / ideal_denominator;
+
+		/* Render the message one sample at a time, until
+		   generator dequeues from empty queue and starts to
+		   produce silence. */
+		cw_sample_t sample = 0;
+		int64_t rendered_n_samples = 0;
+		do {
+			cw_gen_fill(gen, &sample, 1);
+			rendered_n_samples++;
+		} while (cw_gen_get_queue_length(gen) > 0 || gen->render.dequeued_prev == CW_SUCCESS);
+		rendered_n_samples--; /* Last sample was silence after the message. */
+
+		/* |rendered - ideal| < 1, compared without rounding. */
+		const int64_t diff = rendered_n_samples * ideal_denominator - ideal_numerator;
+		cte->expect_op_int(cte, true, "==", diff > -ideal_denominator && diff < ideal_denominator, 0,
+				   "length of message at %d Hz", sample_rate);
+		cte->log_info(cte, "%"PRId64" samples rendered, %.2f samples expected\n", rendered_n_samples, ideal_n_samples);
+
+		cw_gen_delete(&gen);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   Test starting tones at scheduled time: position of first sample
+   of tone rendered by cw_gen_fill(), and start error reported by
+   generator's thread
+*/
+int test_cw_gen_start_time(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = cw_gen_new(cte->current_sound_system, NULL);
+	struct timespec start = { .tv_sec = 0, .tv_nsec = 0 };
+
+
+	/* Test: invalid arguments, and no start error before any
+	   scheduled start. */
+	{
+		errno = 0;
+		int cwret = LIBCW_TEST_FUT(cw_gen_enqueue_start_time)(gen, CLOCK_MONOTONIC, NULL);
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "enqueue start time (NULL start)");
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "enqueue start time (NULL start)");
+
+		errno = 0;
+		cwret = LIBCW_TEST_FUT(cw_gen_enqueue_start_time)(gen, CLOCK_PROCESS_CPUTIME_ID, &start);
+		cte->expect_op_int(cte, EINVAL, "==", errno, 0, "enqueue start time (invalid clock)");
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "enqueue start time (invalid clock)");
+
+		int64_t error = 0;
+		errno = 0;
+		cwret = LIBCW_TEST_FUT(cw_gen_get_start_error)(gen, &error);
+		cte->expect_op_int(cte, EAGAIN, "==", errno, 0, "get start error before scheduled start");
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "get start error before scheduled start");
+	}
+
+
+	if (cte->current_sound_system == CW_AUDIO_NULL) {
+		/* Test: position of first sample of scheduled tone,
+		   counted from beginning of call to cw_gen_fill(). */
+		const int sample_rate = 48000;
+		const int delay = 100000; /* [us] */
+		cw_gen_set_sample_rate(gen, sample_rate);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		const int64_t before = (int64_t) start.tv_sec * CW_USECS_PER_SEC + start.tv_nsec / 1000;
+		start.tv_nsec += delay * 1000;
+		if (start.tv_nsec >= CW_NSECS_PER_SEC) {
+			start.tv_sec++;
+			start.tv_nsec -= CW_NSECS_PER_SEC;
+		}
+
+		int cwret = LIBCW_TEST_FUT(cw_gen_enqueue_start_time)(gen, CLOCK_MONOTONIC, &start);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "enqueue start time (monotonic)");
+		cw_gen_enqueue_character(gen, 'T');
+
+		cw_sample_t samples[sample_rate / 2];
+		cwret = cw_gen_fill(gen, samples, sizeof (samples) / sizeof (samples[0]));
+		const int64_t after = cw_timer_now_internal();
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "fill()");
+
+		int first_nonzero = -1;
+		for (size_t s = 0; s < sizeof (samples) / sizeof (samples[0]); s++) {
+			if (samples[s] != 0) {
+				first_nonzero = s;
+				break;
+			}
+		}
+
+		/* Beginning of call to cw_gen_fill() is somewhere
+		   between 'before' and 'after'. Rising slope may
+		   start with a few samples with zero value. */
+		const int min_position = (int) ((int64_t) (delay - (after - before)) * sample_rate / CW_USECS_PER_SEC) - 1;
+		const int max_position = (int) ((int64_t) delay * sample_rate / CW_USECS_PER_SEC) + 10;
+		cte->expect_between_int(cte, min_position, first_nonzero, max_position, "position of first sample of scheduled tone");
+
+		int64_t error = 0;
+		cwret = LIBCW_TEST_FUT(cw_gen_get_start_error)(gen, &error);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "get start error (fill)");
+		/* Only rounding to whole sample. */
+		cte->expect_between_int(cte, -11, (int) error, 11, "start error (fill)");
+	}
+
+
+	/* Test: start error measured by generator's thread. Start
+	   time is given on CLOCK_REALTIME. */
+	{
+		cw_gen_delete(&gen);
+		gen = cw_gen_new(cte->current_sound_system, NULL);
+		cw_gen_start(gen);
+
+		clock_gettime(CLOCK_REALTIME, &start);
+		start.tv_sec++;
+
+		int cwret = LIBCW_TEST_FUT(cw_gen_enqueue_start_time)(gen, CLOCK_REALTIME, &start);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "enqueue start time (realtime)");
+		cw_gen_enqueue_character(gen, 'E');
+		cw_gen_wait_for_queue_level(gen, 0);
+
+		int64_t error = 0;
+		cwret = LIBCW_TEST_FUT(cw_gen_get_start_error)(gen, &error);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "get start error (generator's thread)");
+		cte->log_info(cte, "start error: %"PRId64" us\n", error);
+
+		/* Audio systems other than Null and console may have
+		   large buffers, so only lateness is limited. */
+		cte->expect_between_int(cte, -1000000, (int) error, 20000, "start error (generator's thread)");
+
+		cw_gen_stop(gen);
+	}
+
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
@@ -29,6 +29,11 @@ int test_cw_gen_enqueue_primitives(cw_test_executor_t * cte);
 int test_cw_gen_enqueue_representations(cw_test_executor_t * cte);
 int test_cw_gen_enqueue_character(cw_test_executor_t * cte);
 int test_cw_gen_enqueue_string(cw_test_executor_t * cte);
+int test_cw_gen_fill(cw_test_executor_t * cte);
+int test_cw_gen_fill_queued(cw_test_executor_t * cte);
+int test_cw_gen_new_with_format(cw_test_executor_t * cte);
+int test_cw_gen_tone_timing_accuracy(cw_test_executor_t * cte);
+int test_cw_gen_start_time(cw_test_executor_t * cte);
 
 
 
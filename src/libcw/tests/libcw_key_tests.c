@@ -20,19 +20,43 @@
 
 
 
+#define _XOPEN_SOURCE 600 /* posix_openpt() and friends */
+#define _DEFAULT_SOURCE   /* usleep() */
+
+
+#include "config.h"
+
+
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(HAVE_LINUX_INPUT_H)
+# include <linux/input.h>
+# if !defined(input_event_sec)  /* Kernel headers older than 4.16. */
+#  define input_event_sec time.tv_sec
+#  define input_event_usec time.tv_usec
+# endif
+#endif
 
 
 
 
 #include "test_framework.h"
 
+#include "libcw_input.h"
 #include "libcw_key.h"
 #include "libcw_key_tests.h"
+#include "libcw_rec.h"
 #include "libcw_debug.h"
 #include "libcw_utils.h"
 #include "libcw.h"
@@ -45,6 +69,21 @@ static int key_setup(cw_test_executor_t * cte, cw_key_t ** key, cw_gen_t ** gen)
 static void key_destroy(cw_key_t ** key, cw_gen_t ** gen);
 static int test_keyer_helper(cw_test_executor_t * cte, cw_key_t * key, int intended_dot_paddle, int intended_dash_paddle, char mark_representation, const char * marks_name, int max);
 static int test_straight_key_helper(cw_test_executor_t * cte, cw_key_t * key, int intended_key_state, const char * state_name, int max);
+static void test_keyer_without_generator_key_callback(volatile struct timeval * timestamp, int key_state, void * callback_arg);
+static void test_keyer_without_generator_gap_callback(void * callback_arg, bool is_end_of_word);
+static void test_keyer_paddle_stress_key_callback(volatile struct timeval * timestamp, int key_state, void * callback_arg);
+static void * test_keyer_paddle_stress_thread(void * arg);
+static int test_keyer_transitions_reference(int mode, int state, unsigned int inputs, bool * consume_curtis_b_latch);
+static void test_keyer_modes_key_callback(volatile struct timeval * timestamp, int key_state, void * callback_arg);
+static void test_contexts_key_callback(volatile struct timeval * timestamp, int key_state, void * callback_arg);
+static void * test_contexts_data_thread(void * arg);
+#if defined(HAVE_SYS_EVENTFD_H)
+static unsigned int test_event_fds_collect(int fd, unsigned int expected, unsigned int (* read_events)(void *), void * object);
+#endif
+#if defined(HAVE_LINUX_INPUT_H)
+static void test_input_evdev_key_callback(volatile struct timeval * timestamp, int key_state, void * callback_arg);
+static int test_input_evdev_write_internal(int fd, int code, int value, const struct timeval * timestamp);
+#endif
 
 
 
@@ -332,3 +371,1310 @@ int test_straight_key(cw_test_executor_t * cte)
 
 	return 0;
 }
+
+
+
+
+/**
+   Straight key with generator rendering samples with cw_gen_fill():
+   mark ends at the sample at which generator notices key-up, and
+   key-up followed by key-down before generator renders next sample
+   leaves no stale tones behind.
+*/
+int test_straight_key_fill(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	if (cte->current_sound_system != CW_AUDIO_NULL) {
+		/* Only generators with Null audio sink can be used in pull mode. */
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+
+	cw_sample_t samples[37]; /* Not a multiple of length of quantum of "forever" tone. */
+	const int n_samples = (int) (sizeof (samples) / sizeof (samples[0]));
+
+	/* With rectangular slopes the mark must end right at key-up,
+	   with other slopes it must end with the falling slope. */
+	const int slope_shapes[] = { CW_TONE_SLOPE_SHAPE_RECTANGULAR, CW_TONE_SLOPE_SHAPE_RAISED_COSINE };
+	const int slope_lens[] = { 0, 2000 };
+
+	for (int s = 0; s < 2; s++) {
+		cw_gen_t * gen = cw_gen_new(CW_AUDIO_NULL, NULL);
+		cw_key_t * key = cw_key_new();
+		cw_key_register_generator(key, gen);
+		cw_gen_set_tone_slope(gen, slope_shapes[s], slope_lens[s]);
+		const int sample_rate = 48000;
+		cw_gen_set_sample_rate(gen, sample_rate);
+		const int max_n_samples = (int) ((int64_t) slope_lens[s] * sample_rate / CW_USECS_PER_SEC) + 1;
+
+		/* Test: key-up ends the mark at current sample. */
+		{
+			cw_key_sk_notify_event(key, CW_KEY_STATE_CLOSED);
+			int n_nonzero = 0;
+			for (int b = 0; b < 20; b++) {
+				cw_gen_fill(gen, samples, n_samples);
+			}
+			for (int i = 0; i < n_samples; i++) {
+				n_nonzero += samples[i] != 0;
+			}
+			cte->expect_op_int(cte, 0, "<", n_nonzero, 0, "mark is generated while key is closed (slope shape %d)", slope_shapes[s]);
+
+			cw_key_sk_notify_event(key, CW_KEY_STATE_OPEN);
+			int last_nonzero = -1;
+			for (int b = 0; b < 20; b++) {
+				cw_gen_fill(gen, samples, n_samples);
+				for (int i = 0; i < n_samples; i++) {
+					if (samples[i] != 0) {
+						last_nonzero = b * n_samples + i;
+					}
+				}
+			}
+			cte->expect_op_int(cte, max_n_samples, ">", last_nonzero, 0, "silence within %d samples after key-up (slope shape %d)", max_n_samples, slope_shapes[s]);
+		}
+
+		/* Test: key-up and key-down between two calls to
+		   cw_gen_fill(). The mark is interrupted, and after
+		   final key-up nothing is generated. */
+		{
+			cw_key_sk_notify_event(key, CW_KEY_STATE_CLOSED);
+			for (int b = 0; b < 20; b++) {
+				cw_gen_fill(gen, samples, n_samples);
+			}
+			cw_key_sk_notify_event(key, CW_KEY_STATE_OPEN);
+			cw_key_sk_notify_event(key, CW_KEY_STATE_CLOSED);
+
+			int n_nonzero = 0;
+			for (int b = 0; b < 20; b++) {
+				cw_gen_fill(gen, samples, n_samples);
+			}
+			for (int i = 0; i < n_samples; i++) {
+				n_nonzero += samples[i] != 0;
+			}
+			cte->expect_op_int(cte, 0, "<", n_nonzero, 0, "mark continues after key-up and key-down (slope shape %d)", slope_shapes[s]);
+
+			cw_key_sk_notify_event(key, CW_KEY_STATE_OPEN);
+			int last_nonzero = -1;
+			for (int b = 0; b < 20; b++) {
+				cw_gen_fill(gen, samples, n_samples);
+				for (int i = 0; i < n_samples; i++) {
+					if (samples[i] != 0) {
+						last_nonzero = b * n_samples + i;
+					}
+				}
+			}
+			cte->expect_op_int(cte, max_n_samples, ">", last_nonzero, 0, "no stale tones after key-up, key-down, key-up (slope shape %d)", slope_shapes[s]);
+			cte->expect_op_int(cte, 1, ">=", (int) cw_gen_get_queue_length(gen), 0, "only \"forever\" space left in queue (slope shape %d)", slope_shapes[s]);
+		}
+
+		cw_key_delete(&key);
+		cw_gen_delete(&gen);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/* Number of keyers (and receivers) sharing libcw's timer wheel in
+   test_keyer_without_generator(). */
+#define TEST_WHEEL_KEYERS 64
+/* Number of Dots to be recorded by each keyer. */
+#define TEST_WHEEL_DOTS 10
+
+
+
+
+typedef struct {
+	struct timeval mark_begin[TEST_WHEEL_DOTS];
+	volatile int n_marks;
+	volatile int n_eoc_gaps;
+	volatile int n_eow_gaps;
+} test_wheel_keyer_t;
+
+
+
+
+static void test_keyer_without_generator_key_callback(__attribute__((unused)) volatile struct timeval * timestamp, int key_state, void * callback_arg)
+{
+	test_wheel_keyer_t * data = (test_wheel_keyer_t *) callback_arg;
+	if (key_state == CW_KEY_STATE_CLOSED && data->n_marks < TEST_WHEEL_DOTS) {
+		gettimeofday(&data->mark_begin[data->n_marks], NULL);
+		data->n_marks++;
+	}
+}
+
+
+
+
+static void test_keyer_without_generator_gap_callback(void * callback_arg, bool is_end_of_word)
+{
+	test_wheel_keyer_t * data = (test_wheel_keyer_t *) callback_arg;
+	if (is_end_of_word) {
+		data->n_eow_gaps++;
+	} else {
+		data->n_eoc_gaps++;
+	}
+}
+
+
+
+
+/**
+   Many iambic keyers without generators, timed by libcw's timer
+   wheel. Each keyer feeds its own receiver, and the receivers
+   register their end-of-character/end-of-word gaps with the same
+   timer wheel.
+*/
+int test_keyer_without_generator(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	const int speed = 60;
+	const int dot_len = CW_DOT_CALIBRATION / speed;
+
+	cw_key_t * keys[TEST_WHEEL_KEYERS] = { 0 };
+	cw_rec_t * recs[TEST_WHEEL_KEYERS] = { 0 };
+	test_wheel_keyer_t data[TEST_WHEEL_KEYERS];
+	memset(data, 0, sizeof (data));
+
+	bool setup_failure = false;
+	for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+		keys[i] = cw_key_new();
+		recs[i] = cw_rec_new();
+		if (!keys[i] || !recs[i]) {
+			setup_failure = true;
+			break;
+		}
+		if (CW_SUCCESS != LIBCW_TEST_FUT(cw_key_ik_set_speed)(keys[i], speed)
+		    || CW_SUCCESS != cw_rec_set_speed(recs[i], speed)) {
+			setup_failure = true;
+			break;
+		}
+		cw_key_register_receiver(keys[i], recs[i]);
+		cw_key_register_keying_callback(keys[i], test_keyer_without_generator_key_callback, &data[i]);
+		LIBCW_TEST_FUT(cw_rec_register_gap_callback)(recs[i], test_keyer_without_generator_gap_callback, &data[i]);
+	}
+	cte->expect_op_int(cte, false, "==", setup_failure, 0, "setting up %d keyers and receivers", TEST_WHEEL_KEYERS);
+
+
+	/* Test: all keyers send Dots at the same time. */
+	if (!setup_failure) {
+		bool paddle_failure = false;
+		for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+			if (CW_SUCCESS != LIBCW_TEST_FUT(cw_key_ik_notify_paddle_event)(keys[i], CW_KEY_STATE_CLOSED, CW_KEY_STATE_OPEN)) {
+				paddle_failure = true;
+				break;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", paddle_failure, 0, "pressing Dot paddles");
+
+		/* The last keyer to be started will be the last to
+		   finish. */
+		for (int i = 0; i < TEST_WHEEL_DOTS; i++) {
+			LIBCW_TEST_FUT(cw_key_ik_wait_for_element)(keys[TEST_WHEEL_KEYERS - 1]);
+		}
+
+		for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+			cw_key_ik_notify_paddle_event(keys[i], CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN);
+		}
+		bool wait_failure = false;
+		for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+			if (CW_SUCCESS != LIBCW_TEST_FUT(cw_key_ik_wait_for_keyer)(keys[i])) {
+				wait_failure = true;
+				break;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", wait_failure, 0, "waiting for keyers");
+
+
+		/* Distance between beginnings of consecutive Dots
+		   is Dot + inter-mark space. Keyer's deadlines are
+		   absolute, so delays of timer wheel's thread (max
+		   error) must not accumulate over many Dots (drift). */
+		int max_error = 0;
+		int max_drift = 0;
+		int min_marks = TEST_WHEEL_DOTS;
+		for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+			const int n = data[i].n_marks;
+			if (n < min_marks) {
+				min_marks = n;
+			}
+			for (int m = 1; m < n; m++) {
+				const int len = cw_timestamp_compare_internal(&data[i].mark_begin[m - 1], &data[i].mark_begin[m]);
+				const int error = abs(len - 2 * dot_len);
+				if (error > max_error) {
+					max_error = error;
+				}
+			}
+			if (n > 1) {
+				const int len = cw_timestamp_compare_internal(&data[i].mark_begin[0], &data[i].mark_begin[n - 1]);
+				const int drift = abs(len - (n - 1) * 2 * dot_len);
+				if (drift > max_drift) {
+					max_drift = drift;
+				}
+			}
+		}
+		cte->log_info(cte, "timing of Dots from %d keyers: max error = %d [us], max drift = %d [us]\n", TEST_WHEEL_KEYERS, max_error, max_drift);
+		cte->expect_op_int(cte, TEST_WHEEL_DOTS, "==", min_marks, 0, "number of Dots from each keyer");
+		/* Generous limits, to accommodate loaded test
+		   machines. */
+		cte->expect_between_int(cte, 0, max_error, dot_len / 2, "timing error of Dots");
+		cte->expect_between_int(cte, 0, max_drift, dot_len / 2, "timing drift of Dots");
+
+
+		/* Test: receivers have been notified about end of
+		   character and end of word. */
+		struct timespec t;
+		cw_usecs_to_timespec_internal(&t, 20 * dot_len);
+		cw_nanosleep_internal(&t);
+
+		int gaps_failure = 0;
+		for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+			if (data[i].n_eoc_gaps != 1 || data[i].n_eow_gaps != 1) {
+				gaps_failure++;
+			}
+		}
+		cte->expect_op_int(cte, 0, "==", gaps_failure, 0, "receivers notified about end-of-character and end-of-word gaps");
+	}
+
+	for (int i = 0; i < TEST_WHEEL_KEYERS; i++) {
+		cw_key_delete(&keys[i]);
+		cw_rec_delete(&recs[i]);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/* Number of client threads notifying keyer about paddle events in
+   test_keyer_paddle_stress(). */
+#define TEST_STRESS_THREADS 4
+/* Number of Dots to be recorded by the keyer. */
+#define TEST_STRESS_DOTS 50
+
+
+
+
+typedef struct {
+	cw_key_t * key;
+	volatile bool stop;
+	struct timeval mark_begin[TEST_STRESS_DOTS];
+	struct timeval mark_end[TEST_STRESS_DOTS];
+	volatile int n_marks;
+	volatile int n_marks_ended;
+	volatile int n_notifications[TEST_STRESS_THREADS];
+	volatile int n_notify_failures;
+} test_stress_keyer_t;
+
+
+typedef struct {
+	test_stress_keyer_t * data;
+	int index;
+} test_stress_thread_t;
+
+
+
+
+static void test_keyer_paddle_stress_key_callback(__attribute__((unused)) volatile struct timeval * timestamp, int key_state, void * callback_arg)
+{
+	test_stress_keyer_t * data = (test_stress_keyer_t *) callback_arg;
+	if (key_state == CW_KEY_STATE_CLOSED) {
+		if (data->n_marks < TEST_STRESS_DOTS) {
+			gettimeofday(&data->mark_begin[data->n_marks], NULL);
+			data->n_marks++;
+		}
+	} else {
+		if (data->n_marks_ended < data->n_marks) {
+			gettimeofday(&data->mark_end[data->n_marks_ended], NULL);
+			data->n_marks_ended++;
+		}
+	}
+}
+
+
+
+
+/* Client thread: keep the Dot paddle pressed, telling the keyer
+   about it again and again, using both variants of notification
+   function. */
+static void * test_keyer_paddle_stress_thread(void * arg)
+{
+	test_stress_thread_t * thread = (test_stress_thread_t *) arg;
+	test_stress_keyer_t * data = thread->data;
+
+	struct timespec t;
+	cw_usecs_to_timespec_internal(&t, 50 + 50 * thread->index);
+
+	int i = 0;
+	while (!data->stop) {
+		int cwret = CW_FAILURE;
+		if (i++ % 2) {
+			cwret = cw_key_ik_notify_paddle_event(data->key, CW_KEY_STATE_CLOSED, CW_KEY_STATE_OPEN);
+		} else {
+			cwret = cw_key_ik_notify_dot_paddle_event(data->key, CW_KEY_STATE_CLOSED);
+		}
+		if (CW_SUCCESS != cwret) {
+			data->n_notify_failures++;
+		}
+		data->n_notifications[thread->index]++;
+		cw_nanosleep_internal(&t);
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   Many client threads notify iambic keyer about paddle events while
+   the keyer is sending Dots. The notifications must not disturb the
+   timing of Dots.
+*/
+int test_keyer_paddle_stress(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	const int speed = 60;
+	const int dot_len = CW_DOT_CALIBRATION / speed;
+
+	test_stress_keyer_t data;
+	memset(&data, 0, sizeof (data));
+
+	data.key = cw_key_new();
+	cte->expect_op_int(cte, false, "==", NULL == data.key, 0, "creating keyer");
+	if (!data.key) {
+		cte->print_test_footer(cte, __func__);
+		return -1;
+	}
+	cw_key_ik_set_speed(data.key, speed);
+	cw_key_register_keying_callback(data.key, test_keyer_paddle_stress_key_callback, &data);
+
+
+	pthread_t thread_ids[TEST_STRESS_THREADS];
+	test_stress_thread_t threads[TEST_STRESS_THREADS];
+	int n_threads = 0;
+	for (int i = 0; i < TEST_STRESS_THREADS; i++) {
+		threads[i].data = &data;
+		threads[i].index = i;
+		if (0 != pthread_create(&thread_ids[i], NULL, test_keyer_paddle_stress_thread, &threads[i])) {
+			break;
+		}
+		n_threads++;
+	}
+	cte->expect_op_int(cte, TEST_STRESS_THREADS, "==", n_threads, 0, "starting %d client threads", TEST_STRESS_THREADS);
+
+
+	/* Wait for the Dots to be sent, with a safety margin for
+	   loaded test machines. */
+	struct timespec t;
+	cw_usecs_to_timespec_internal(&t, dot_len);
+	for (int i = 0; i < 4 * TEST_STRESS_DOTS && data.n_marks_ended < TEST_STRESS_DOTS; i++) {
+		cw_nanosleep_internal(&t);
+	}
+
+	data.stop = true;
+	for (int i = 0; i < n_threads; i++) {
+		pthread_join(thread_ids[i], NULL);
+	}
+	cw_key_ik_notify_paddle_event(data.key, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN);
+	const int cwret = LIBCW_TEST_FUT(cw_key_ik_wait_for_keyer)(data.key);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "waiting for keyer");
+
+
+	int n_notifications = 0;
+	for (int i = 0; i < n_threads; i++) {
+		n_notifications += data.n_notifications[i];
+	}
+	cte->log_info(cte, "%d notifications about paddle events from %d threads\n", n_notifications, n_threads);
+	cte->expect_op_int(cte, 0, "==", data.n_notify_failures, 0, "notifications about paddle events");
+
+
+	/* Distance between beginnings of consecutive Dots is Dot +
+	   inter-mark space. Each mark must be a Dot: a Dash would
+	   mean that the keyer has misread the paddles. */
+	const int n = data.n_marks_ended;
+	int max_error = 0;
+	long long sum_error = 0;
+	int n_intervals = 0;
+	int max_mark_error = 0;
+	for (int m = 0; m < n; m++) {
+		const int mark_len = cw_timestamp_compare_internal(&data.mark_begin[m], &data.mark_end[m]);
+		const int mark_error = abs(mark_len - dot_len);
+		if (mark_error > max_mark_error) {
+			max_mark_error = mark_error;
+		}
+
+		if (m > 0) {
+			const int len = cw_timestamp_compare_internal(&data.mark_begin[m - 1], &data.mark_begin[m]);
+			const int error = abs(len - 2 * dot_len);
+			if (error > max_error) {
+				max_error = error;
+			}
+			sum_error += error;
+			n_intervals++;
+		}
+	}
+	const int mean_error = n_intervals ? (int) (sum_error / n_intervals) : 0;
+	cte->log_info(cte, "timing of %d Dots: mean error = %d [us], max error = %d [us], max length error = %d [us]\n",
+		      n, mean_error, max_error, max_mark_error);
+
+	cte->expect_op_int(cte, TEST_STRESS_DOTS, "==", n, 0, "number of Dots");
+	/* Generous limits, to accommodate loaded test machines. */
+	cte->expect_between_int(cte, 0, max_mark_error, dot_len / 2, "length of marks");
+	cte->expect_between_int(cte, 0, max_error, dot_len / 2, "timing error of Dots");
+	cte->expect_between_int(cte, 0, mean_error, dot_len / 10, "mean timing error of Dots");
+
+	cw_key_delete(&data.key);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   Reference model of transitions of iambic keyer's state machine,
+   written independently of the tables of rules in libcw_key.c.
+*/
+static int test_keyer_transitions_reference(int mode, int state, unsigned int inputs, bool * consume_curtis_b_latch)
+{
+	*consume_curtis_b_latch = false;
+
+	switch (state) {
+	case KS_IDLE:
+		return KS_IDLE;
+	case KS_IN_DOT_A:
+		return KS_AFTER_DOT_A;
+	case KS_IN_DASH_A:
+		return KS_AFTER_DASH_A;
+	case KS_IN_DOT_B:
+		return KS_AFTER_DOT_B;
+	case KS_IN_DASH_B:
+		return KS_AFTER_DASH_B;
+	default:
+		break;
+	}
+
+	const bool after_dot = state == KS_AFTER_DOT_A || state == KS_AFTER_DOT_B;
+	const bool after_b = state == KS_AFTER_DOT_B || state == KS_AFTER_DASH_B;
+	const bool dot_paddle = inputs & CW_KEY_IK_DOT_PADDLE;
+	const bool dash_paddle = inputs & CW_KEY_IK_DASH_PADDLE;
+	const bool dot = inputs & (CW_KEY_IK_DOT_PADDLE | CW_KEY_IK_DOT_LATCH);
+	const bool dash = inputs & (CW_KEY_IK_DASH_PADDLE | CW_KEY_IK_DASH_LATCH);
+
+	switch (mode) {
+	case CW_KEY_IK_MODE_IAMBIC_A:
+	case CW_KEY_IK_MODE_IAMBIC_B:
+		if (after_b) {
+			return after_dot ? KS_IN_DASH_A : KS_IN_DOT_A;
+		}
+		if (after_dot) {
+			if (dash) {
+				*consume_curtis_b_latch = inputs & CW_KEY_IK_CURTIS_B_LATCH;
+				return *consume_curtis_b_latch ? KS_IN_DASH_B : KS_IN_DASH_A;
+			}
+			return dot ? KS_IN_DOT_A : KS_IDLE;
+		} else {
+			if (dot) {
+				*consume_curtis_b_latch = inputs & CW_KEY_IK_CURTIS_B_LATCH;
+				return *consume_curtis_b_latch ? KS_IN_DOT_B : KS_IN_DOT_A;
+			}
+			return dash ? KS_IN_DASH_A : KS_IDLE;
+		}
+
+	case CW_KEY_IK_MODE_ULTIMATIC:
+		if (dot_paddle && dash_paddle) {
+			return (inputs & CW_KEY_IK_DASH_LAST) ? KS_IN_DASH_A : KS_IN_DOT_A;
+		}
+		if (after_dot) {
+			return dash ? KS_IN_DASH_A : (dot ? KS_IN_DOT_A : KS_IDLE);
+		} else {
+			return dot ? KS_IN_DOT_A : (dash ? KS_IN_DASH_A : KS_IDLE);
+		}
+
+	case CW_KEY_IK_MODE_BUG:
+	default:
+		/* Dash of bug is manual, Dots repeat while Dot paddle
+		   is closed or latched. */
+		if (after_dot) {
+			return dot ? KS_IN_DOT_A : KS_IDLE;
+		} else {
+			return dash ? KS_IN_DASH_A : KS_IDLE;
+		}
+	}
+}
+
+
+
+
+/**
+   Compare all transitions of iambic keyer's state machine, in all
+   modes, from all states, for all combinations of paddles and
+   latches, with reference model.
+*/
+int test_keyer_transitions(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	const unsigned int n_inputs = (CW_KEY_IK_DASH_LAST << 1);
+	int n_transitions = 0;
+	int n_errors = 0;
+
+	for (int mode = 0; mode < CW_KEY_IK_MODE_N; mode++) {
+		for (int state = KS_IDLE; state <= KS_AFTER_DASH_B; state++) {
+			for (unsigned int inputs = 0; inputs < n_inputs; inputs++) {
+				bool expected_consume = false;
+				bool consume = false;
+				const int expected = test_keyer_transitions_reference(mode, state, inputs, &expected_consume);
+				const int next = LIBCW_TEST_FUT(cw_key_ik_next_state_internal)(mode, state, inputs, &consume);
+
+				if (next != expected || consume != expected_consume) {
+					cte->log_error(cte, "mode %d, state %d, inputs 0x%02x: next state %d (expected %d), consume %d (expected %d)\n",
+						       mode, state, inputs, next, expected, consume, expected_consume);
+					n_errors++;
+				}
+				n_transitions++;
+			}
+		}
+	}
+
+	cte->log_info(cte, "checked %d transitions\n", n_transitions);
+	cte->expect_op_int(cte, 0, "==", n_errors, 0, "transitions of keyer's state machine");
+
+
+	/* Test: invalid modes and memory windows are rejected. */
+	cw_key_t * key = cw_key_new();
+	cte->expect_op_int(cte, false, "==", NULL == key, 0, "creating keyer");
+	if (key) {
+		int cwret = LIBCW_TEST_FUT(cw_key_ik_set_mode)(key, CW_KEY_IK_MODE_N);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "setting invalid mode");
+		cwret = LIBCW_TEST_FUT(cw_key_ik_set_memory)(key, true, true, 101);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "setting invalid memory window");
+
+		LIBCW_TEST_FUT(cw_key_ik_enable_curtis_mode_b)(key);
+		cte->expect_op_int(cte, CW_KEY_IK_MODE_IAMBIC_B, "==", LIBCW_TEST_FUT(cw_key_ik_get_mode)(key), 0, "Curtis mode B is Iambic B mode");
+		cw_key_delete(&key);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/* Max number of marks recorded in test_keyer_modes(). */
+#define TEST_MODES_MARKS 32
+
+
+
+
+typedef struct {
+	struct timeval mark_begin[TEST_MODES_MARKS];
+	struct timeval mark_end[TEST_MODES_MARKS];
+	volatile int n_marks;
+	volatile int n_marks_ended;
+} test_modes_keyer_t;
+
+
+
+
+static void test_keyer_modes_key_callback(__attribute__((unused)) volatile struct timeval * timestamp, int key_state, void * callback_arg)
+{
+	test_modes_keyer_t * data = (test_modes_keyer_t *) callback_arg;
+	if (key_state == CW_KEY_STATE_CLOSED && data->n_marks < TEST_MODES_MARKS) {
+		gettimeofday(&data->mark_begin[data->n_marks], NULL);
+		data->n_marks++;
+	} else if (key_state == CW_KEY_STATE_OPEN && data->n_marks_ended < data->n_marks) {
+		gettimeofday(&data->mark_end[data->n_marks_ended], NULL);
+		data->n_marks_ended++;
+	}
+}
+
+
+
+
+/**
+   Get marks recorded by test_keyer_modes_key_callback() as string of
+   Dots and Dashes, start new recording
+*/
+static void test_keyer_modes_get_marks(test_modes_keyer_t * data, int dot_len, char * marks, int * max_len)
+{
+	int i = 0;
+	*max_len = 0;
+	for (; i < data->n_marks_ended; i++) {
+		const int len = cw_timestamp_compare_internal(&data->mark_begin[i], &data->mark_end[i]);
+		marks[i] = len < 2 * dot_len ? CW_DOT_REPRESENTATION : CW_DASH_REPRESENTATION;
+		if (len > *max_len) {
+			*max_len = len;
+		}
+	}
+	marks[i] = '\0';
+
+	data->n_marks = 0;
+	data->n_marks_ended = 0;
+}
+
+
+
+
+/**
+   Sequences of paddle events sent through keyer without generator
+   in different modes of the keyer.
+*/
+int test_keyer_modes(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	const int speed = 30;
+	const int dot_len = CW_DOT_CALIBRATION / speed;
+
+	test_modes_keyer_t data;
+	memset(&data, 0, sizeof (data));
+	char marks[TEST_MODES_MARKS + 1] = { 0 };
+	int max_len = 0;
+
+	cw_key_t * key = cw_key_new();
+	cte->expect_op_int(cte, false, "==", NULL == key, 0, "creating keyer");
+	if (!key) {
+		cte->print_test_footer(cte, __func__);
+		return -1;
+	}
+	cw_key_ik_set_speed(key, speed);
+	cw_key_register_keying_callback(key, test_keyer_modes_key_callback, &data);
+
+	struct timespec dot;
+	cw_usecs_to_timespec_internal(&dot, dot_len);
+
+
+	/* Test: Dash paddle tapped during Dot is remembered, unless
+	   Dash memory is disabled, or the tap is outside of memory
+	   window. */
+	struct {
+		bool dash_memory;
+		int window;
+		const char * expected;
+	} memory_cases[] = {
+		{ true,    0, ".-" },
+		{ false,   0, "."  },
+		{ true,  100, "."  }
+	};
+	for (size_t i = 0; i < sizeof (memory_cases) / sizeof (memory_cases[0]); i++) {
+		LIBCW_TEST_FUT(cw_key_ik_set_memory)(key, true, memory_cases[i].dash_memory, memory_cases[i].window);
+
+		cw_key_ik_notify_dot_paddle_event(key, CW_KEY_STATE_CLOSED);
+		cw_key_ik_notify_dash_paddle_event(key, CW_KEY_STATE_CLOSED);
+		cw_key_ik_notify_dash_paddle_event(key, CW_KEY_STATE_OPEN);
+		cw_key_ik_notify_dot_paddle_event(key, CW_KEY_STATE_OPEN);
+		cw_key_ik_wait_for_keyer(key);
+
+		test_keyer_modes_get_marks(&data, dot_len, marks, &max_len);
+		cte->expect_op_int(cte, 0, "==", strcmp(marks, memory_cases[i].expected), 0,
+				   "Dash memory %d, window %d%%: marks \"%s\" (expected \"%s\")",
+				   memory_cases[i].dash_memory, memory_cases[i].window, marks, memory_cases[i].expected);
+	}
+	cw_key_ik_set_memory(key, true, true, 0);
+
+
+	/* Test: in Ultimatic mode the paddle closed last wins, and
+	   the keyer returns to the other paddle when the last one is
+	   released. */
+	LIBCW_TEST_FUT(cw_key_ik_set_mode)(key, CW_KEY_IK_MODE_ULTIMATIC);
+	cw_key_ik_notify_dot_paddle_event(key, CW_KEY_STATE_CLOSED);
+	for (int i = 0; i < 3; i++) {
+		cw_nanosleep_internal(&dot);
+	}
+	cw_key_ik_notify_dash_paddle_event(key, CW_KEY_STATE_CLOSED);
+	for (int i = 0; i < 12; i++) {
+		cw_nanosleep_internal(&dot);
+	}
+	cw_key_ik_notify_dash_paddle_event(key, CW_KEY_STATE_OPEN);
+	for (int i = 0; i < 6; i++) {
+		cw_nanosleep_internal(&dot);
+	}
+	cw_key_ik_notify_dot_paddle_event(key, CW_KEY_STATE_OPEN);
+	cw_key_ik_wait_for_keyer(key);
+
+	test_keyer_modes_get_marks(&data, dot_len, marks, &max_len);
+	const size_t dots = strspn(marks, ".");
+	const size_t dashes = strspn(marks + dots, "-");
+	const size_t trailing_dots = strspn(marks + dots + dashes, ".");
+	const bool ultimatic_ok = dots > 0 && dashes > 0 && trailing_dots > 0 && '\0' == marks[dots + dashes + trailing_dots];
+	cte->expect_op_int(cte, true, "==", ultimatic_ok, 0, "Ultimatic: marks \"%s\"", marks);
+
+
+	/* Test: in bug mode Dash paddle keys a single mark for as
+	   long as it is closed, and Dot paddle sends Dots. */
+	LIBCW_TEST_FUT(cw_key_ik_set_mode)(key, CW_KEY_IK_MODE_BUG);
+	cw_key_ik_notify_dash_paddle_event(key, CW_KEY_STATE_CLOSED);
+	for (int i = 0; i < 5; i++) {
+		cw_nanosleep_internal(&dot);
+	}
+	cw_key_ik_notify_dash_paddle_event(key, CW_KEY_STATE_OPEN);
+	cw_nanosleep_internal(&dot);
+
+	test_keyer_modes_get_marks(&data, dot_len, marks, &max_len);
+	cte->expect_op_int(cte, 0, "==", strcmp(marks, "-"), 0, "bug: manual mark: marks \"%s\"", marks);
+	cte->expect_between_int(cte, 4 * dot_len, max_len, 7 * dot_len, "bug: length of manual mark");
+
+	cw_key_ik_notify_dot_paddle_event(key, CW_KEY_STATE_CLOSED);
+	for (int i = 0; i < 5; i++) {
+		cw_nanosleep_internal(&dot);
+	}
+	cw_key_ik_notify_dot_paddle_event(key, CW_KEY_STATE_OPEN);
+	cw_key_ik_wait_for_keyer(key);
+
+	test_keyer_modes_get_marks(&data, dot_len, marks, &max_len);
+	const bool bug_dots_ok = strlen(marks) >= 2 && strlen(marks) == strspn(marks, ".");
+	cte->expect_op_int(cte, true, "==", bug_dots_ok, 0, "bug: automatic Dots: marks \"%s\"", marks);
+
+	cw_key_delete(&key);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+static void test_contexts_key_callback(__attribute__((unused)) volatile struct timeval * timestamp, int key_state, void * callback_arg)
+{
+	if (key_state == CW_KEY_STATE_CLOSED) {
+		__atomic_add_fetch((int *) callback_arg, 1, __ATOMIC_RELAXED);
+	}
+}
+
+
+
+
+/* Counts and lengths of library's data, as seen by one thread. */
+typedef struct {
+	int character_count;
+	int maximum_representation_length;
+	int procedural_character_count;
+	int maximum_procedural_expansion_length;
+	int maximum_phonetic_length;
+} test_contexts_data_t;
+
+
+
+
+static void * test_contexts_data_thread(void * arg)
+{
+	test_contexts_data_t * data = (test_contexts_data_t *) arg;
+
+	data->character_count = cw_get_character_count();
+	data->maximum_representation_length = cw_get_maximum_representation_length();
+	data->procedural_character_count = cw_get_procedural_character_count();
+	data->maximum_procedural_expansion_length = cw_get_maximum_procedural_expansion_length();
+	data->maximum_phonetic_length = cw_get_maximum_phonetic_length();
+
+	return NULL;
+}
+
+
+
+
+/**
+   Two library contexts used side by side: each context has its
+   own generator, key and receiver, and keying one context doesn't
+   affect the other one. A third context, without generator, has
+   its keyer timed by the context's own timer wheel. Threads of the
+   contexts see the same counts and lengths of library's data.
+*/
+int test_contexts(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_context_t * contexts[2] = { NULL, NULL };
+	for (int i = 0; i < 2; i++) {
+		contexts[i] = LIBCW_TEST_FUT(cw_context_new)();
+		if (!cte->expect_valid_pointer(cte, contexts[i], "cw_context_new(): context #%d", i)) {
+			cw_context_delete(&contexts[0]);
+			return -1;
+		}
+
+		const int cwret = LIBCW_TEST_FUT(cw_context_generator_new)(contexts[i], cte->current_sound_system, NULL);
+		if (!cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "cw_context_generator_new(): context #%d", i)) {
+			cw_context_delete(&contexts[0]);
+			cw_context_delete(&contexts[1]);
+			return -1;
+		}
+		cw_gen_start(contexts[i]->gen);
+	}
+
+	/* Objects of a context are bound together, and not shared
+	   with the other context. */
+	cte->expect_op_int(cte, true, "==", contexts[0]->key->gen == contexts[0]->gen && contexts[1]->key->gen == contexts[1]->gen, 0, "key is bound to generator of its context");
+	cte->expect_op_int(cte, true, "==", contexts[0]->key->rec == contexts[0]->rec && contexts[1]->key->rec == contexts[1]->rec, 0, "key is bound to receiver of its context");
+	cte->expect_op_int(cte, true, "==", contexts[0]->gen != contexts[1]->gen && contexts[0]->rec != contexts[1]->rec, 0, "contexts don't share generator or receiver");
+
+	/* Context can't have two generators. */
+	errno = 0;
+	const int cwret = LIBCW_TEST_FUT(cw_context_generator_new)(contexts[0], cte->current_sound_system, NULL);
+	cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "cw_context_generator_new(): second generator");
+	cte->expect_op_int(cte, EEXIST, "==", errno, 0, "cw_context_generator_new(): second generator: errno");
+
+	/* Key of one context is closed, key of the other context
+	   stays open. */
+	cw_key_sk_notify_event(contexts[0]->key, CW_KEY_STATE_CLOSED);
+	cte->expect_op_int(cte, CW_KEY_STATE_CLOSED, "==", cw_key_sk_get_value(contexts[0]->key), 0, "key of context #0 is closed");
+	cte->expect_op_int(cte, CW_KEY_STATE_OPEN, "==", cw_key_sk_get_value(contexts[1]->key), 0, "key of context #1 stays open");
+	cw_key_sk_notify_event(contexts[0]->key, CW_KEY_STATE_OPEN);
+
+	/* Generator can be deleted and re-created. */
+	LIBCW_TEST_FUT(cw_context_generator_delete)(contexts[1]);
+	cte->expect_op_int(cte, true, "==", NULL == contexts[1]->gen && NULL == contexts[1]->key->gen, 0, "cw_context_generator_delete()");
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cw_context_generator_new(contexts[1], cte->current_sound_system, NULL), 0, "cw_context_generator_new(): after delete");
+
+	/* Library's data is queried from threads of both contexts at
+	   the same time; every thread must get values of the tables,
+	   and not e.g. a count incremented by two threads. */
+	{
+		test_contexts_data_t expected = { 0 };
+		char list[UCHAR_MAX + 1] = { 0 };
+		char buffer[UCHAR_MAX + 1] = { 0 };
+
+		pthread_t thread_ids[2];
+		test_contexts_data_t data[2] = { { 0 }, { 0 } };
+		for (int i = 0; i < 2; i++) {
+			pthread_create(&thread_ids[i], NULL, test_contexts_data_thread, &data[i]);
+		}
+
+		cw_list_characters(list);
+		expected.character_count = (int) strlen(list);
+		for (int i = 0; list[i]; i++) {
+			char * representation = cw_character_to_representation(list[i]);
+			const int length = representation ? (int) strlen(representation) : 0;
+			if (length > expected.maximum_representation_length) {
+				expected.maximum_representation_length = length;
+			}
+			free(representation);
+		}
+
+		cw_list_procedural_characters(list);
+		expected.procedural_character_count = (int) strlen(list);
+		for (int i = 0; list[i]; i++) {
+			int is_usually_expanded = 0;
+			if (CW_SUCCESS == cw_lookup_procedural_character(list[i], buffer, &is_usually_expanded)
+			    && (int) strlen(buffer) > expected.maximum_procedural_expansion_length) {
+				expected.maximum_procedural_expansion_length = (int) strlen(buffer);
+			}
+		}
+
+		for (char c = 'A'; c <= 'Z'; c++) {
+			if (CW_SUCCESS == cw_lookup_phonetic(c, buffer)
+			    && (int) strlen(buffer) > expected.maximum_phonetic_length) {
+				expected.maximum_phonetic_length = (int) strlen(buffer);
+			}
+		}
+
+		for (int i = 0; i < 2; i++) {
+			pthread_join(thread_ids[i], NULL);
+
+			cte->expect_op_int(cte, expected.character_count, "==", data[i].character_count, 0, "context #%d: character count", i);
+			cte->expect_op_int(cte, expected.maximum_representation_length, "==", data[i].maximum_representation_length, 0, "context #%d: maximum representation length", i);
+			cte->expect_op_int(cte, expected.procedural_character_count, "==", data[i].procedural_character_count, 0, "context #%d: procedural character count", i);
+			cte->expect_op_int(cte, expected.maximum_procedural_expansion_length, "==", data[i].maximum_procedural_expansion_length, 0, "context #%d: maximum procedural expansion length", i);
+			cte->expect_op_int(cte, expected.maximum_phonetic_length, "==", data[i].maximum_phonetic_length, 0, "context #%d: maximum phonetic length", i);
+		}
+	}
+
+	{
+		cw_context_t * context = cw_context_new();
+		if (!cte->expect_valid_pointer(cte, context, "cw_context_new(): context without generator")) {
+			cw_context_delete(&contexts[0]);
+			cw_context_delete(&contexts[1]);
+			return -1;
+		}
+
+		int n_marks = 0;
+		cw_key_register_keying_callback(context->key, test_contexts_key_callback, &n_marks);
+		cw_key_ik_set_speed(context->key, 60);
+
+		/* Five Dots at 60 wpm take 180 ms. */
+		cw_key_ik_notify_paddle_event(context->key, CW_KEY_STATE_CLOSED, CW_KEY_STATE_OPEN);
+		for (int i = 0; i < 9; i++) {
+			cw_key_ik_wait_for_element(context->key);
+		}
+		cw_key_ik_notify_paddle_event(context->key, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN);
+		cw_key_ik_wait_for_keyer(context->key);
+
+		const int n = __atomic_load_n(&n_marks, __ATOMIC_RELAXED);
+		cte->expect_op_int(cte, 5, "<=", n, 0, "keyer without generator, timed by context's wheel: %d marks", n);
+
+		/* Deleting the context stops thread of its wheel. */
+		cw_context_delete(&context);
+		cte->expect_null_pointer(cte, context, "cw_context_delete(): context without generator");
+	}
+
+	for (int i = 0; i < 2; i++) {
+		LIBCW_TEST_FUT(cw_context_delete)(&contexts[i]);
+		cte->expect_null_pointer(cte, contexts[i], "cw_context_delete(): context #%d", i);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+#if defined(HAVE_SYS_EVENTFD_H)
+
+
+
+
+/**
+   Generator and receiver report their events through pollable file
+   descriptors: dequeued tones and low water mark of generator,
+   end-of-character and end-of-word gaps of receiver, and end of work
+   of iambic keyers (with and without generator).
+*/
+int test_event_fds(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	const int speed = 60;
+
+	cw_gen_t * gen = cw_gen_new(cte->current_sound_system, NULL);
+	cw_rec_t * rec = cw_rec_new();
+	cw_key_t * gen_key = cw_key_new();
+	cw_key_t * rec_key = cw_key_new();
+	cte->assert2(cte, gen && rec && gen_key && rec_key, "failed to create generator, receiver or keys");
+
+	cw_gen_set_speed(gen, speed);
+	cw_gen_start(gen);
+	cw_rec_set_speed(rec, speed);
+	cw_key_register_generator(gen_key, gen);
+	cw_key_ik_set_speed(rec_key, speed);
+	cw_key_register_receiver(rec_key, rec);
+
+	const int gen_fd = LIBCW_TEST_FUT(cw_gen_get_event_fd)(gen);
+	const int rec_fd = LIBCW_TEST_FUT(cw_rec_get_event_fd)(rec);
+	cte->expect_op_int(cte, 0, "<=", gen_fd, 0, "file descriptor of generator's events");
+	cte->expect_op_int(cte, 0, "<=", rec_fd, 0, "file descriptor of receiver's events");
+	cte->expect_op_int(cte, gen_fd, "==", cw_gen_get_event_fd(gen), 0, "file descriptor of generator's events, second call");
+
+
+	/* Generator: tones and low water mark. Notice that callback
+	   function may be NULL. */
+	{
+		cw_gen_register_low_level_callback(gen, NULL, NULL, 2);
+		cw_gen_enqueue_string(gen, "EEEE");
+
+		const unsigned int expected = CW_EVENT_TONE | CW_EVENT_LOW_WATER;
+		const unsigned int events = test_event_fds_collect(gen_fd, expected, (unsigned int (*)(void *)) cw_gen_read_events, gen);
+		cte->expect_op_int(cte, expected, "==", events & expected, 0, "generator's events: tone, low water mark");
+
+		cw_gen_wait_for_queue_level(gen, 0);
+		cw_gen_read_events(gen);
+		cte->expect_op_int(cte, 0, "==", cw_gen_read_events(gen), 0, "generator's events after reading them");
+	}
+
+
+	/* Keyer with generator reports end of work through
+	   generator. */
+	{
+		cw_key_ik_notify_paddle_event(gen_key, CW_KEY_STATE_CLOSED, CW_KEY_STATE_OPEN);
+		cw_key_ik_notify_paddle_event(gen_key, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN);
+
+		const unsigned int events = test_event_fds_collect(gen_fd, CW_EVENT_KEYER_IDLE, (unsigned int (*)(void *)) cw_gen_read_events, gen);
+		cte->expect_op_int(cte, CW_EVENT_KEYER_IDLE, "==", events & CW_EVENT_KEYER_IDLE, 0, "generator's events: keyer idle");
+	}
+
+
+	/* Keyer without generator reports end of work through
+	   receiver, and the receiver reports end of character and end
+	   of word. */
+	{
+		cw_key_ik_notify_paddle_event(rec_key, CW_KEY_STATE_CLOSED, CW_KEY_STATE_OPEN);
+		cw_key_ik_notify_paddle_event(rec_key, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN);
+
+		const unsigned int expected = CW_EVENT_KEYER_IDLE | CW_EVENT_CHARACTER | CW_EVENT_WORD;
+		const unsigned int events = test_event_fds_collect(rec_fd, expected, (unsigned int (*)(void *)) cw_rec_read_events, rec);
+		cte->expect_op_int(cte, expected, "==", events & expected, 0, "receiver's events: keyer idle, end of character, end of word");
+
+		char c = 0;
+		cw_rec_poll_character(rec, NULL, &c, NULL, NULL);
+		cte->expect_op_int(cte, 'E', "==", c, 0, "character received after end-of-character event");
+	}
+
+	cw_key_delete(&rec_key);
+	cw_key_delete(&gen_key);
+	cw_rec_delete(&rec);
+	cw_gen_stop(gen);
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   Watch file descriptor until all \p expected events are reported
+   by \p read_events, or until a timeout.
+
+   \return all events that have been read
+*/
+static unsigned int test_event_fds_collect(int fd, unsigned int expected, unsigned int (* read_events)(void *), void * object)
+{
+	unsigned int events = 0;
+	for (int i = 0; i < 40 && (events & expected) != expected; i++) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+		if (1 == poll(&pfd, 1, 50)) {
+			events |= read_events(object);
+		}
+	}
+
+	return events;
+}
+
+
+
+
+#endif /* #if defined(HAVE_SYS_EVENTFD_H) */
+
+
+
+
+#if defined(HAVE_LINUX_INPUT_H)
+
+
+
+
+typedef struct {
+	struct timeval timestamps[4];
+	int states[4];
+	volatile int n_events;
+} test_input_key_t;
+
+
+
+
+static void test_input_evdev_key_callback(volatile struct timeval * timestamp, int key_state, void * callback_arg)
+{
+	test_input_key_t * data = (test_input_key_t *) callback_arg;
+	if (data->n_events < 4) {
+		data->timestamps[data->n_events].tv_sec = timestamp->tv_sec;
+		data->timestamps[data->n_events].tv_usec = timestamp->tv_usec;
+		data->states[data->n_events] = key_state;
+		data->n_events++;
+	}
+}
+
+
+
+
+/* Write EV_KEY event followed by SYN_REPORT, as evdev device does. */
+static int test_input_evdev_write_internal(int fd, int code, int value, const struct timeval * timestamp)
+{
+	struct input_event events[2];
+	memset(events, 0, sizeof (events));
+
+	events[0].input_event_sec = timestamp->tv_sec;
+	events[0].input_event_usec = timestamp->tv_usec;
+	events[0].type = EV_KEY;
+	events[0].code = code;
+	events[0].value = value;
+
+	events[1].input_event_sec = timestamp->tv_sec;
+	events[1].input_event_usec = timestamp->tv_usec;
+	events[1].type = EV_SYN;
+	events[1].code = SYN_REPORT;
+	events[1].value = 0;
+
+	return write(fd, events, sizeof (events)) == (ssize_t) sizeof (events) ? 0 : -1;
+}
+
+
+
+
+/**
+   Input driver reading evdev events. A FIFO is used in place of
+   evdev device, so the test doesn't need uinput or root
+   privileges.
+*/
+int test_input_evdev(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	char path[64];
+	snprintf(path, sizeof (path), "/tmp/libcw_test_input_%ld", (long) getpid());
+	unlink(path);
+	if (0 != mkfifo(path, 0600)) {
+		cte->log_error(cte, "Can't create FIFO %s, stopping the test\n", path);
+		cte->print_test_footer(cte, __func__);
+		return -1;
+	}
+	/* Open FIFO for writing without blocking on missing reader. */
+	const int fd = open(path, O_RDWR);
+	cte->expect_op_int(cte, false, "==", fd == -1, 0, "opening FIFO");
+
+
+	/* Test: straight key gets kernel timestamps of events. */
+	{
+		test_input_key_t data;
+		memset(&data, 0, sizeof (data));
+		cw_key_t * key = cw_key_new();
+		cw_key_register_keying_callback(key, test_input_evdev_key_callback, &data);
+
+		cw_input_t * input = LIBCW_TEST_FUT(cw_input_new)(CW_INPUT_EVDEV, path);
+		cte->expect_op_int(cte, false, "==", NULL == input, 0, "creating evdev input");
+
+		LIBCW_TEST_FUT(cw_input_register_key)(input, key, CW_INPUT_KEY_STRAIGHT);
+		int cwret = LIBCW_TEST_FUT(cw_input_start)(input);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "starting evdev input");
+
+		const struct timeval down = { .tv_sec = 1000, .tv_usec = 100 };
+		const struct timeval up = { .tv_sec = 1000, .tv_usec = 50000 };
+		test_input_evdev_write_internal(fd, KEY_LEFTCTRL, 1, &down);
+		test_input_evdev_write_internal(fd, KEY_LEFTCTRL, 2, &down); /* Autorepeat. */
+		test_input_evdev_write_internal(fd, KEY_A, 1, &down);        /* Unmapped key. */
+		test_input_evdev_write_internal(fd, KEY_LEFTCTRL, 0, &up);
+
+		for (int i = 0; i < 100 && data.n_events < 2; i++) {
+			usleep(1000);
+		}
+
+		cte->expect_op_int(cte, 2, "==", data.n_events, 0, "number of key events");
+		const bool timestamps_valid = data.n_events == 2
+			&& 0 == cw_timestamp_compare_internal(&down, &data.timestamps[0])
+			&& 0 == cw_timestamp_compare_internal(&up, &data.timestamps[1]);
+		const bool states_valid = data.n_events == 2
+			&& data.states[0] == CW_KEY_STATE_CLOSED
+			&& data.states[1] == CW_KEY_STATE_OPEN;
+		cte->expect_op_int(cte, true, "==", timestamps_valid, 0, "timestamps of key events");
+		cte->expect_op_int(cte, true, "==", states_valid, 0, "states of key events");
+
+		cwret = LIBCW_TEST_FUT(cw_input_stop)(input);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "stopping evdev input");
+
+		LIBCW_TEST_FUT(cw_input_delete)(&input);
+		cw_key_delete(&key);
+	}
+
+
+	/* Test: iambic keyer driven by paddles. */
+	{
+		const int speed = 60;
+		cw_key_t * key = cw_key_new();
+		cw_key_ik_set_speed(key, speed);
+
+		cw_input_t * input = cw_input_new(CW_INPUT_EVDEV, path);
+		cw_input_register_key(input, key, CW_INPUT_KEY_IAMBIC);
+		int cwret = cw_input_start(input);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "starting evdev input for iambic keyer");
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		test_input_evdev_write_internal(fd, KEY_RIGHTCTRL, 1, &now);
+
+		int dot_paddle = CW_KEY_STATE_OPEN;
+		int dash_paddle = CW_KEY_STATE_OPEN;
+		for (int i = 0; i < 100 && dash_paddle == CW_KEY_STATE_OPEN; i++) {
+			usleep(1000);
+			cw_key_ik_get_paddles(key, &dot_paddle, &dash_paddle);
+		}
+		cte->expect_op_int(cte, CW_KEY_STATE_CLOSED, "==", dash_paddle, 0, "Dash paddle pressed");
+		cte->expect_op_int(cte, CW_KEY_STATE_OPEN, "==", dot_paddle, 0, "Dot paddle released");
+		cte->expect_op_int(cte, true, "==", cw_key_ik_is_busy_internal(key), 0, "keyer busy");
+
+		gettimeofday(&now, NULL);
+		test_input_evdev_write_internal(fd, KEY_RIGHTCTRL, 0, &now);
+		for (int i = 0; i < 100 && dash_paddle == CW_KEY_STATE_CLOSED; i++) {
+			usleep(1000);
+			cw_key_ik_get_paddles(key, &dot_paddle, &dash_paddle);
+		}
+		cwret = cw_key_ik_wait_for_keyer(key);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "waiting for keyer after release of paddle");
+
+		cw_input_delete(&input);
+		cw_key_delete(&key);
+	}
+
+
+	/* Test: pseudo-terminal has no modem control lines, serial
+	   input can't use it. */
+	{
+		const int master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master != -1 && 0 == grantpt(master) && 0 == unlockpt(master)) {
+			cw_key_t * key = cw_key_new();
+			cw_input_t * input = cw_input_new(CW_INPUT_SERIAL, ptsname(master));
+			cw_input_register_key(input, key, CW_INPUT_KEY_IAMBIC);
+			const int cwret = cw_input_start(input);
+			cte->expect_op_int(cte, CW_FAILURE, "==", cwret, 0, "starting serial input on pseudo-terminal");
+			cw_input_delete(&input);
+			cw_key_delete(&key);
+		}
+		if (master != -1) {
+			close(master);
+		}
+	}
+
+	if (fd != -1) {
+		close(fd);
+	}
+
+
+	/* Test: driver stops when device goes away (e.g. USB
+	   adapter is unplugged), releases closed key, and can be
+	   started again. Closing the only writer of FIFO looks like
+	   end of evdev device to the driver. */
+	{
+		cw_key_t * key = cw_key_new();
+		cw_input_t * input = cw_input_new(CW_INPUT_EVDEV, path);
+		cw_input_register_key(input, key, CW_INPUT_KEY_STRAIGHT);
+		int cwret = cw_input_start(input);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "starting evdev input before closing device");
+
+		const int writer = open(path, O_WRONLY | O_NONBLOCK);
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		test_input_evdev_write_internal(writer, KEY_LEFTCTRL, 1, &now);
+		for (int i = 0; i < 100 && cw_key_sk_get_value(key) == CW_KEY_STATE_OPEN; i++) {
+			usleep(1000);
+		}
+		cte->expect_op_int(cte, CW_KEY_STATE_CLOSED, "==", cw_key_sk_get_value(key), 0, "key closed before closing device");
+
+		close(writer);
+		for (int i = 0; i < 100 && __atomic_load_n(&input->thread.running, __ATOMIC_ACQUIRE); i++) {
+			usleep(1000);
+		}
+		cte->expect_op_int(cte, false, "==", __atomic_load_n(&input->thread.running, __ATOMIC_ACQUIRE), 0, "driver stopped after closing device");
+		cte->expect_op_int(cte, CW_KEY_STATE_OPEN, "==", cw_key_sk_get_value(key), 0, "key released after closing device");
+
+		cwret = cw_input_start(input);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "restarting evdev input after closing device");
+
+		cw_input_delete(&input);
+		cw_key_delete(&key);
+	}
+	unlink(path);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+#endif /* #if defined(HAVE_LINUX_INPUT_H) */
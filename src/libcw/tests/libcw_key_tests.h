@@ -16,6 +16,18 @@
 
 int test_keyer(cw_test_executor_t * cte);
 int test_straight_key(cw_test_executor_t * cte);
+int test_straight_key_fill(cw_test_executor_t * cte);
+int test_keyer_without_generator(cw_test_executor_t * cte);
+int test_keyer_paddle_stress(cw_test_executor_t * cte);
+int test_keyer_transitions(cw_test_executor_t * cte);
+int test_keyer_modes(cw_test_executor_t * cte);
+int test_contexts(cw_test_executor_t * cte);
+#if defined(HAVE_SYS_EVENTFD_H)
+int test_event_fds(cw_test_executor_t * cte);
+#endif
+#if defined(HAVE_LINUX_INPUT_H)
+int test_input_evdev(cw_test_executor_t * cte);
+#endif
 
 
 
@@ -0,0 +1,331 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+
+
+
+/*
+  Benchmark of sidetone latency: time from "key down" event reported
+  by client code to a straight key or iambic keyer, to the moment
+  when first samples of the mark are passed to audio sink, and to the
+  moment when they are played (for audio sinks reporting their output
+  latency). With -u the program measures latency of "key up" events of
+  straight key instead: time to the moment when falling slope ending
+  the mark is passed to audio sink.
+
+  For each requested audio system the program presses the key many
+  times, collects samples recorded by generator's latency probe (see
+  cw_gen_set_latency_probe()), and prints percentiles of latency of
+  each stage of the path.
+*/
+
+
+
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+
+#include "libcw.h"
+#include "libcw2.h"
+#include "libcw_gen.h"
+#include "libcw_key.h"
+
+
+
+
+#define DEFAULT_SOUND_SYSTEMS "ncoapj"
+#define DEFAULT_N_SAMPLES     100
+#define MAX_N_SAMPLES         10000
+
+/* How long to wait for a sample to be complete. [ms] */
+#define SAMPLE_TIMEOUT        1000
+
+/* How long to keep straight key closed before measured "key up"
+   event. [ms] */
+#define KEY_DOWN_TIME         40
+
+
+
+
+typedef struct {
+	const char * label;
+	int from;  /* CW_LATENCY_* */
+	int to;    /* CW_LATENCY_* */
+} stage_t;
+
+
+static const stage_t stages[] = {
+	{ "key->enqueue",     CW_LATENCY_KEY_EVENT, CW_LATENCY_ENQUEUE },
+	{ "enqueue->dequeue", CW_LATENCY_ENQUEUE,   CW_LATENCY_DEQUEUE },
+	{ "dequeue->write",   CW_LATENCY_DEQUEUE,   CW_LATENCY_WRITE   },
+	{ "write->audible",   CW_LATENCY_WRITE,     CW_LATENCY_AUDIBLE },
+	{ "total",            CW_LATENCY_KEY_EVENT, CW_LATENCY_WRITE   },
+	{ "total audible",    CW_LATENCY_KEY_EVENT, CW_LATENCY_AUDIBLE },
+};
+#define N_STAGES (sizeof (stages) / sizeof (stages[0]))
+
+
+
+
+static int  audio_system_from_letter(char letter);
+static int  measure(int audio_system, bool iambic, bool key_up, int n_samples, cw_latency_sample_t * samples);
+static void print_percentiles(const char * label, const char * key_label, const cw_latency_sample_t * samples, int n_samples);
+static int  compare_int64(const void * a, const void * b);
+static void sleep_ms(int ms);
+static void usage(const char * name);
+
+
+
+
+int main(int argc, char * const argv[])
+{
+	const char * sound_systems = DEFAULT_SOUND_SYSTEMS;
+	int n_samples = DEFAULT_N_SAMPLES;
+	bool iambic = false;
+	bool key_up = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:n:kuh")) != -1) {
+		switch (opt) {
+		case 's':
+			sound_systems = optarg;
+			break;
+		case 'n':
+			n_samples = atoi(optarg);
+			if (n_samples < 1 || n_samples > MAX_N_SAMPLES) {
+				fprintf(stderr, "Number of samples must be in range 1-%d\n", MAX_N_SAMPLES);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'k':
+			iambic = true;
+			break;
+		case 'u':
+			key_up = true;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (iambic && key_up) {
+		fprintf(stderr, "\"key up\" events can be measured only for straight key\n");
+		return EXIT_FAILURE;
+	}
+
+	cw_latency_sample_t * samples = (cw_latency_sample_t *) malloc(n_samples * sizeof (cw_latency_sample_t));
+	if (!samples) {
+		fprintf(stderr, "Failed to allocate memory for samples\n");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stdout, "%-10s %-8s %-17s %8s %8s %8s %8s %8s   [us]\n",
+		"system", "key", "stage", "p50", "p90", "p99", "max", "n");
+
+	for (const char * s = sound_systems; *s; s++) {
+		const int audio_system = audio_system_from_letter(*s);
+		if (CW_AUDIO_NONE == audio_system) {
+			fprintf(stderr, "Sound system '%c' is not supported or not available\n", *s);
+			continue;
+		}
+
+		const int n = measure(audio_system, iambic, key_up, n_samples, samples);
+		if (n < 0) {
+			fprintf(stderr, "%s: sound system is not available, skipping\n", cw_get_audio_system_label(audio_system));
+			continue;
+		}
+		print_percentiles(cw_get_audio_system_label(audio_system), iambic ? "iambic" : (key_up ? "key-up" : "straight"), samples, n);
+	}
+
+	free(samples);
+
+	return EXIT_SUCCESS;
+}
+
+
+
+
+static int audio_system_from_letter(char letter)
+{
+	switch (letter) {
+	case 'n':
+		return cw_is_null_possible(NULL) ? CW_AUDIO_NULL : CW_AUDIO_NONE;
+	case 'c':
+		return cw_is_console_possible(NULL) ? CW_AUDIO_CONSOLE : CW_AUDIO_NONE;
+	case 'o':
+		return cw_is_oss_possible(NULL) ? CW_AUDIO_OSS : CW_AUDIO_NONE;
+	case 'a':
+		return cw_is_alsa_possible(NULL) ? CW_AUDIO_ALSA : CW_AUDIO_NONE;
+	case 'p':
+		return cw_is_pa_possible(NULL) ? CW_AUDIO_PA : CW_AUDIO_NONE;
+	case 'j':
+		return cw_is_jack_possible(NULL) ? CW_AUDIO_JACK : CW_AUDIO_NONE;
+	default:
+		return CW_AUDIO_NONE;
+	}
+}
+
+
+
+
+/**
+   Press key \p n_samples times, collect latency samples
+
+   \return number of collected samples
+   \return -1 if generator for \p audio_system can't be started
+*/
+static int measure(int audio_system, bool iambic, bool key_up, int n_samples, cw_latency_sample_t * samples)
+{
+	cw_gen_t * gen = cw_gen_new(audio_system, NULL);
+	if (!gen) {
+		return -1;
+	}
+	if (CW_SUCCESS != cw_gen_start(gen)) {
+		cw_gen_delete(&gen);
+		return -1;
+	}
+	cw_gen_set_speed(gen, 30);
+
+	cw_key_t * key = cw_key_new();
+	if (!key) {
+		cw_gen_delete(&gen);
+		return -1;
+	}
+	cw_key_register_generator(key, gen);
+	cw_gen_set_latency_probe_edge(gen, key_up ? CW_KEY_STATE_OPEN : CW_KEY_STATE_CLOSED);
+	cw_gen_set_latency_probe(gen, true);
+
+	int n = 0;
+	for (int i = 0; i < n_samples; i++) {
+		if (iambic) {
+			cw_key_ik_notify_paddle_event(key, CW_KEY_STATE_CLOSED, CW_KEY_STATE_OPEN);
+		} else if (key_up) {
+			cw_key_sk_notify_event(key, CW_KEY_STATE_CLOSED);
+			sleep_ms(KEY_DOWN_TIME);
+			cw_key_sk_notify_event(key, CW_KEY_STATE_OPEN);
+		} else {
+			cw_key_sk_notify_event(key, CW_KEY_STATE_CLOSED);
+		}
+
+		bool collected = false;
+		for (int ms = 0; ms < SAMPLE_TIMEOUT; ms++) {
+			if (CW_SUCCESS == cw_gen_get_latency_sample(gen, &samples[n])) {
+				collected = true;
+				break;
+			}
+			sleep_ms(1);
+		}
+
+		if (iambic) {
+			cw_key_ik_notify_paddle_event(key, CW_KEY_STATE_OPEN, CW_KEY_STATE_OPEN);
+			cw_key_ik_wait_for_keyer(key);
+		} else {
+			cw_key_sk_notify_event(key, CW_KEY_STATE_OPEN);
+		}
+
+		if (collected) {
+			n++;
+		} else {
+			fprintf(stderr, "%s: sample #%d timed out\n", cw_get_audio_system_label(audio_system), i);
+			/* Re-arm the probe. */
+			cw_gen_set_latency_probe(gen, true);
+		}
+
+		/* Let the generator go idle between measurements,
+		   with a bit of jitter so that key events don't
+		   synchronize with audio buffer period. */
+		sleep_ms(30 + rand() % 20);
+	}
+
+	cw_gen_set_latency_probe(gen, false);
+	cw_gen_stop(gen);
+	cw_key_delete(&key);
+	cw_gen_delete(&gen);
+
+	return n;
+}
+
+
+
+
+static void print_percentiles(const char * label, const char * key_label, const cw_latency_sample_t * samples, int n_samples)
+{
+	if (0 == n_samples) {
+		fprintf(stdout, "%-10s %-8s no samples\n", label, key_label);
+		return;
+	}
+
+	int64_t * values = (int64_t *) malloc(n_samples * sizeof (int64_t));
+	if (!values) {
+		return;
+	}
+
+	for (size_t s = 0; s < N_STAGES; s++) {
+		for (int i = 0; i < n_samples; i++) {
+			values[i] = samples[i].stamps[stages[s].to] - samples[i].stamps[stages[s].from];
+		}
+		qsort(values, n_samples, sizeof (int64_t), compare_int64);
+
+		fprintf(stdout, "%-10s %-8s %-17s %8lld %8lld %8lld %8lld %8d\n",
+			label, key_label, stages[s].label,
+			(long long) values[(n_samples - 1) * 50 / 100],
+			(long long) values[(n_samples - 1) * 90 / 100],
+			(long long) values[(n_samples - 1) * 99 / 100],
+			(long long) values[n_samples - 1],
+			n_samples);
+	}
+
+	free(values);
+
+	return;
+}
+
+
+
+
+static int compare_int64(const void * a, const void * b)
+{
+	const int64_t x = *(const int64_t *) a;
+	const int64_t y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+
+
+static void sleep_ms(int ms)
+{
+	struct timespec t = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+	while (nanosleep(&t, &t) == -1 && errno == EINTR) {
+		;
+	}
+
+	return;
+}
+
+
+
+
+static void usage(const char * name)
+{
+	fprintf(stdout, "Usage: %s [-s <sound systems>] [-n <count>] [-k | -u]\n", name);
+	fprintf(stdout, "    -s: sound systems to measure, any of '%s' (null, console, OSS, ALSA, PulseAudio, JACK)\n", DEFAULT_SOUND_SYSTEMS);
+	fprintf(stdout, "    -n: number of key presses per sound system (default %d)\n", DEFAULT_N_SAMPLES);
+	fprintf(stdout, "    -k: use iambic keyer (Dot paddle) instead of straight key\n");
+	fprintf(stdout, "    -u: measure \"key up\" events of straight key instead of \"key down\" events\n");
+
+	return;
+}
@@ -34,6 +34,7 @@
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 
 #include <assert.h>
 
@@ -317,6 +318,72 @@ int legacy_api_test_parameter_ranges(cw_test_executor_t * cte)
 
 
 
+/**
+   Receive a single dot, and check that end-of-character and
+   end-of-word gaps after the dot are reported through receiver's
+   event descriptor, without polling the receiver.
+*/
+int legacy_api_test_receiver_event_fd(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+	legacy_api_cw_single_test_setup();
+
+	const int fd = LIBCW_TEST_FUT(cw_get_receiver_event_fd)();
+	if (fd == -1 && errno == ENOSYS) {
+		cte->log_info(cte, "Event descriptors are not supported on this platform, skipping the test\n");
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+	cte->expect_op_int(cte, 0, "<=", fd, 0, "receiver event fd: get fd");
+
+	/* Receiver's gap isn't reset by test setup, and other tests
+	   may have left large gap that delays end-of-word. */
+	cw_set_gap(0);
+	cw_clear_receive_buffer();
+	cw_read_receiver_events();
+
+	/* A dot that has ended one dot length ago. */
+	const int dot_len = CW_DOT_CALIBRATION / cw_get_receive_speed();
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	const long long now_us = now.tv_sec * 1000000LL + now.tv_usec;
+	const struct timeval mark_start = { .tv_sec = (now_us - 2 * dot_len) / 1000000, .tv_usec = (now_us - 2 * dot_len) % 1000000 };
+	const struct timeval mark_end = { .tv_sec = (now_us - dot_len) / 1000000, .tv_usec = (now_us - dot_len) % 1000000 };
+	cw_start_receive_tone(&mark_start);
+	cw_end_receive_tone(&mark_end);
+
+	/* End-of-word gap is reported less than ten dots after the mark. */
+	const unsigned int expected = CW_EVENT_CHARACTER | CW_EVENT_WORD;
+	unsigned int events = 0;
+	for (int i = 0; i < 20 && (events & expected) != expected; i++) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+		if (poll(&pfd, 1, 100) == 1) {
+			events |= LIBCW_TEST_FUT(cw_read_receiver_events)();
+		}
+	}
+	cte->expect_op_int(cte, expected, "==", (int) (events & expected), 0, "receiver event fd: end of character, end of word");
+
+	char c = 0;
+	bool is_end_of_word = false;
+	const int cwret = cw_receive_character(NULL, &c, &is_end_of_word, NULL);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "receiver event fd: receive character");
+	cte->expect_op_int(cte, 'E', "==", c, 0, "receiver event fd: received character");
+	cte->expect_op_int(cte, true, "==", is_end_of_word, 0, "receiver event fd: end of word");
+	cw_clear_receive_buffer();
+
+	/* Nothing happens in idle receiver, so nothing can be read. */
+	struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+	const int n = poll(&pfd, 1, 100);
+	cte->expect_op_int(cte, 0, "==", n, 0, "receiver event fd: idle receiver");
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
 /**
    Fill a queue and then wait for each tone separately - repeat until
    all tones are dequeued.
@@ -791,6 +858,69 @@ int legacy_api_test_tone_queue_callback(cw_test_executor_t * cte)
 
 
 
+/**
+   Test that descriptor of tone queue's events reports dequeued tones
+   and low water mark, and that it isn't readable after events have
+   been read and the queue is idle.
+*/
+int legacy_api_test_tone_queue_event_fd(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+	legacy_api_cw_single_test_setup();
+
+	const int fd = LIBCW_TEST_FUT(cw_get_tone_queue_event_fd)();
+	if (fd == -1 && errno == ENOSYS) {
+		cte->log_info(cte, "Event descriptors are not supported on this platform, skipping the test\n");
+		cte->print_test_footer(cte, __func__);
+		return 0;
+	}
+	cte->expect_op_int(cte, 0, "<=", fd, 0, "tone queue event fd: get fd");
+
+	/* Low water callback function may be NULL, the event is
+	   reported anyway. */
+	const int level = 2;
+	int cwret = cw_register_tone_queue_low_callback(NULL, NULL, level);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, 0, "tone queue event fd: register low water mark");
+	cw_read_tone_queue_events();
+
+	for (int i = 0; i < 3 * level; i++) {
+		cw_queue_tone(20000, 440);
+	}
+
+	/* Collect events until the queue is drained. */
+	unsigned int events = 0;
+	int n_wakeups = 0;
+	while (cw_get_tone_queue_length() > 0 || cw_is_tone_busy()) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+		if (poll(&pfd, 1, 1000) == 1) {
+			events |= LIBCW_TEST_FUT(cw_read_tone_queue_events)();
+			n_wakeups++;
+		}
+	}
+	cw_wait_for_tone_queue();
+	usleep(50000); /* Let dequeueing of last tone complete. */
+	events |= cw_read_tone_queue_events();
+
+	cte->expect_op_int(cte, CW_EVENT_TONE, "==", (int) (events & CW_EVENT_TONE), 0, "tone queue event fd: tone events");
+	cte->expect_op_int(cte, CW_EVENT_LOW_WATER, "==", (int) (events & CW_EVENT_LOW_WATER), 0, "tone queue event fd: low water event");
+	cte->expect_op_int(cte, 0, "<", n_wakeups, 0, "tone queue event fd: wakeups");
+
+	/* Nothing happens in idle queue, so nothing can be read. */
+	struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+	const int n = poll(&pfd, 1, 100);
+	cte->expect_op_int(cte, 0, "==", n, 0, "tone queue event fd: idle queue");
+
+	cw_register_tone_queue_low_callback(NULL, NULL, 0);
+	cw_reset_tone_queue();
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
 /**
    @reviewed on 2019-10-13
 */
@@ -28,6 +28,7 @@ int legacy_api_test_empty_tone_queue(cw_test_executor_t * cte);
 int legacy_api_test_full_tone_queue(cw_test_executor_t * cte);
 
 int legacy_api_test_tone_queue_callback(cw_test_executor_t * cte);
+int legacy_api_test_tone_queue_event_fd(cw_test_executor_t * cte);
 
 /* "Generator" topic. */
 int legacy_api_test_volume_functions(cw_test_executor_t * cte);
@@ -47,6 +48,7 @@ int legacy_api_test_straight_key(cw_test_executor_t * cte);
 /* Other functions. */
 int legacy_api_test_low_level_gen_parameters(cw_test_executor_t * cte);
 int legacy_api_test_parameter_ranges(cw_test_executor_t * cte);
+int legacy_api_test_receiver_event_fd(cw_test_executor_t * cte);
 
 // int legacy_api_cw_test_delayed_release(cw_test_executor_t * cte);
 
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
 
 
 
@@ -58,6 +59,7 @@ static void gen_destroy(cw_gen_t ** gen);
 static void enqueue_tone_low_level(cw_test_executor_t * cte, cw_tone_queue_t * tq, const cw_tone_t * tone);
 static cw_tone_queue_t * test_cw_tq_capacity_test_init(cw_test_executor_t * cte, size_t capacity, size_t high_water_mark, int head_shift);
 static void test_helper_tq_callback(void * data);
+static void * test_helper_tq_level_waiter(void * arg);
 
 
 
@@ -1108,6 +1110,101 @@ int test_cw_tq_wait_for_level_internal(cw_test_executor_t * cte)
 
 
 
+typedef struct {
+	cw_tone_queue_t * tq;
+	size_t level;
+	int is_done;         /* Accessed with atomic operations. */
+} test_tq_level_waiter_t;
+
+
+
+
+/**
+   Many threads wait for different levels of the same queue. Each of
+   them should return only after the queue's length has dropped to
+   its level, and the queue should forget all of them once they
+   return.
+*/
+int test_cw_tq_wait_for_level_targeted_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_tone_queue_t * tq = cw_tq_new_internal();
+	cte->assert2(cte, tq, "failed to create new tone queue");
+
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 20, 10000, CW_SLOPE_MODE_NO_SLOPES);
+
+	const size_t n_tones = 12;
+	for (size_t i = 0; i < n_tones; i++) {
+		cw_tq_enqueue_internal(tq, &tone);
+	}
+
+	test_tq_level_waiter_t waiters[] = {
+		{ tq, 8, 0 },
+		{ tq, 2, 0 },
+		{ tq, 5, 0 },
+		{ tq, 5, 0 },
+		{ tq, 0, 0 }
+	};
+	const size_t n_waiters = sizeof (waiters) / sizeof (waiters[0]);
+	pthread_t threads[sizeof (waiters) / sizeof (waiters[0])];
+
+	for (size_t i = 0; i < n_waiters; i++) {
+		pthread_create(&threads[i], NULL, test_helper_tq_level_waiter, &waiters[i]);
+	}
+	/* Let the threads go to sleep. */
+	usleep(50000);
+
+	bool early_failure = false;
+	bool late_failure = false;
+	while (cw_tq_length_internal(tq) > 0) {
+		cw_tone_t dequeued;
+		cw_tq_dequeue_internal(tq, &dequeued);
+		usleep(20000);
+
+		const size_t len = cw_tq_length_internal(tq);
+		for (size_t i = 0; i < n_waiters; i++) {
+			const bool is_done = __atomic_load_n(&waiters[i].is_done, __ATOMIC_ACQUIRE);
+			if (waiters[i].level < len && is_done) {
+				early_failure = true;
+			}
+			if (waiters[i].level >= len && !is_done) {
+				late_failure = true;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n_waiters; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	cte->expect_op_int(cte, false, "==", early_failure, 0, "targeted wait for level: waiter woken up before reaching its level");
+	cte->expect_op_int(cte, false, "==", late_failure, 0, "targeted wait for level: waiter not woken up after reaching its level");
+	cte->expect_null_pointer(cte, tq->level_waiters, "targeted wait for level: list of waiters after end of waiting");
+
+	cw_tq_delete_internal(&tq);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+static void * test_helper_tq_level_waiter(void * arg)
+{
+	test_tq_level_waiter_t * waiter = (test_tq_level_waiter_t *) arg;
+	cw_tq_wait_for_level_internal(waiter->tq, waiter->level);
+	__atomic_store_n(&waiter->is_done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+
+
+
 /**
    \brief Simple tests of queueing and dequeueing of tones
 
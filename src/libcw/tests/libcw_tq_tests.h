@@ -21,6 +21,7 @@ int test_cw_tq_enqueue_internal_B(cw_test_executor_t * cte);
 int test_cw_tq_test_capacity_A(cw_test_executor_t * cte);
 int test_cw_tq_test_capacity_B(cw_test_executor_t * cte);
 int test_cw_tq_wait_for_level_internal(cw_test_executor_t * cte);
+int test_cw_tq_wait_for_level_targeted_internal(cw_test_executor_t * cte);
 int test_cw_tq_is_full_internal(cw_test_executor_t * cte);
 int test_cw_tq_enqueue_dequeue_internal(cw_test_executor_t * cte);
 int test_cw_tq_enqueue_args_internal(cw_test_executor_t * cte);
@@ -0,0 +1,304 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+
+
+
+/*
+  Benchmark of wakeups of threads observing generator's tone queue.
+
+  A number of observer threads wait, each for a different level of
+  the queue, with cw_gen_wait_for_queue_level(), while main thread
+  keeps refilling the queue. Optionally other observer threads wait
+  for each tone with cw_gen_wait_for_tone().
+
+  Each return from a wait function is a useful wakeup. The program
+  counts voluntary context switches of the whole process (every
+  sleep of a thread in a wait function ends with one) and prints
+  them per second and per useful wakeup. A thread waiting for a
+  level should be woken up once per refill, not once per tone, so
+  the lower the number of context switches per wakeup, the better.
+
+  Voluntary context switches include also sleeps of generator's
+  thread and of threads synchronizing refills, so run the program
+  with "-n 0" to get a baseline.
+*/
+
+
+
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+
+
+
+#include "libcw.h"
+#include "libcw2.h"
+
+
+
+
+#define DEFAULT_N_LEVEL_OBSERVERS  16
+#define DEFAULT_N_TONE_OBSERVERS   0
+#define DEFAULT_DURATION           10    /* [s] */
+#define MAX_N_OBSERVERS            1000
+
+/* Each refill enqueues this string. Every character is a Dot and
+   two spaces, so there are many tones to be dequeued between levels
+   of observers. */
+#define REFILL_STRING              "EEEEEEEEEEEEEEEEEEEEEEEEE"
+
+
+
+
+typedef struct {
+	cw_gen_t * gen;
+
+	/* Synchronization of observers of levels with main thread:
+	   observers start waiting after queue has been refilled, and
+	   main thread refills the queue after all observers have
+	   returned. */
+	pthread_barrier_t refilled;
+	pthread_barrier_t drained;
+	size_t fill;            /* Length of queue after refill. */
+	int n_level_observers;
+
+	int stop;               /* Accessed with atomic operations. */
+	int n_tone_running;     /* Accessed with atomic operations. */
+
+	unsigned long level_returns; /* Accessed with atomic operations. */
+	unsigned long tone_returns;  /* Accessed with atomic operations. */
+} bench_t;
+
+
+typedef struct {
+	bench_t * bench;
+	int index;
+} observer_t;
+
+
+
+
+static void * level_observer(void * arg);
+static void * tone_observer(void * arg);
+static long   voluntary_context_switches(void);
+static double now_seconds(void);
+static void   usage(const char * name);
+
+
+
+
+int main(int argc, char * const argv[])
+{
+	int n_level_observers = DEFAULT_N_LEVEL_OBSERVERS;
+	int n_tone_observers = DEFAULT_N_TONE_OBSERVERS;
+	int duration = DEFAULT_DURATION;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:t:d:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			n_level_observers = atoi(optarg);
+			break;
+		case 't':
+			n_tone_observers = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (n_level_observers < 0 || n_tone_observers < 0
+	    || n_level_observers + n_tone_observers > MAX_N_OBSERVERS) {
+		fprintf(stderr, "Number of observers must be in range 0-%d\n", MAX_N_OBSERVERS);
+		return EXIT_FAILURE;
+	}
+	if (duration < 1) {
+		fprintf(stderr, "Duration must be at least 1 second\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_t bench;
+	memset(&bench, 0, sizeof (bench));
+	bench.n_level_observers = n_level_observers;
+
+	bench.gen = cw_gen_new(CW_AUDIO_NULL, NULL);
+	if (!bench.gen) {
+		fprintf(stderr, "Failed to create generator\n");
+		return EXIT_FAILURE;
+	}
+	cw_gen_set_speed(bench.gen, CW_SPEED_MAX);
+	if (CW_SUCCESS != cw_gen_start(bench.gen)) {
+		fprintf(stderr, "Failed to start generator\n");
+		cw_gen_delete(&bench.gen);
+		return EXIT_FAILURE;
+	}
+
+	pthread_barrier_init(&bench.refilled, NULL, n_level_observers + 1);
+	pthread_barrier_init(&bench.drained, NULL, n_level_observers + 1);
+
+	const int n_observers = n_level_observers + n_tone_observers;
+	pthread_t * threads = (pthread_t *) calloc(n_observers + 1, sizeof (pthread_t));
+	observer_t * observers = (observer_t *) calloc(n_observers + 1, sizeof (observer_t));
+	if (!threads || !observers) {
+		fprintf(stderr, "Failed to allocate memory for observers\n");
+		return EXIT_FAILURE;
+	}
+
+	__atomic_store_n(&bench.n_tone_running, n_tone_observers, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < n_observers; i++) {
+		observers[i].bench = &bench;
+		observers[i].index = i;
+		pthread_create(&threads[i], NULL, i < n_level_observers ? level_observer : tone_observer, &observers[i]);
+	}
+
+	const long csw_start = voluntary_context_switches();
+	const double start = now_seconds();
+	unsigned long rounds = 0;
+
+	while (now_seconds() - start < duration) {
+		cw_gen_enqueue_string(bench.gen, REFILL_STRING);
+		bench.fill = cw_gen_get_queue_length(bench.gen);
+
+		pthread_barrier_wait(&bench.refilled);
+		cw_gen_wait_for_queue_level(bench.gen, 0);
+		pthread_barrier_wait(&bench.drained);
+		rounds++;
+	}
+
+	const double elapsed = now_seconds() - start;
+	const long csw = voluntary_context_switches() - csw_start;
+
+	/* Let observers notice end of benchmark. Observers of
+	   tones need tones to be woken up. */
+	__atomic_store_n(&bench.stop, 1, __ATOMIC_SEQ_CST);
+	pthread_barrier_wait(&bench.refilled);
+	while (__atomic_load_n(&bench.n_tone_running, __ATOMIC_SEQ_CST)) {
+		cw_gen_enqueue_string(bench.gen, "E");
+		cw_gen_wait_for_queue_level(bench.gen, 0);
+	}
+	for (int i = 0; i < n_observers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	const unsigned long level_returns = __atomic_load_n(&bench.level_returns, __ATOMIC_SEQ_CST);
+	const unsigned long tone_returns = __atomic_load_n(&bench.tone_returns, __ATOMIC_SEQ_CST);
+	const unsigned long returns = level_returns + tone_returns;
+
+	fprintf(stdout, "observers:                    %d of levels, %d of tones\n", n_level_observers, n_tone_observers);
+	fprintf(stdout, "duration:                     %.1f s, %lu refills\n", elapsed, rounds);
+	fprintf(stdout, "useful wakeups:               %lu (%.1f/s), %lu of levels, %lu of tones\n",
+		returns, returns / elapsed, level_returns, tone_returns);
+	fprintf(stdout, "voluntary context switches:   %ld (%.1f/s)\n", csw, csw / elapsed);
+	if (returns) {
+		fprintf(stdout, "context switches per wakeup:  %.2f\n", (double) csw / returns);
+	}
+
+	cw_gen_stop(bench.gen);
+	cw_gen_delete(&bench.gen);
+
+	pthread_barrier_destroy(&bench.refilled);
+	pthread_barrier_destroy(&bench.drained);
+	free(observers);
+	free(threads);
+
+	return EXIT_SUCCESS;
+}
+
+
+
+
+/**
+   Wait for a level of queue specific for given observer, once per
+   refill of the queue. Levels of observers are spread evenly between
+   empty and full queue.
+*/
+static void * level_observer(void * arg)
+{
+	observer_t * observer = (observer_t *) arg;
+	bench_t * bench = observer->bench;
+
+	while (true) {
+		pthread_barrier_wait(&bench->refilled);
+		if (__atomic_load_n(&bench->stop, __ATOMIC_SEQ_CST)) {
+			break;
+		}
+
+		const size_t level = bench->fill * observer->index / (bench->n_level_observers + 1);
+		cw_gen_wait_for_queue_level(bench->gen, level);
+		__atomic_add_fetch(&bench->level_returns, 1, __ATOMIC_SEQ_CST);
+
+		pthread_barrier_wait(&bench->drained);
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   Wait for each tone until end of benchmark.
+*/
+static void * tone_observer(void * arg)
+{
+	observer_t * observer = (observer_t *) arg;
+	bench_t * bench = observer->bench;
+
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_SEQ_CST)) {
+		cw_gen_wait_for_tone(bench->gen);
+		__atomic_add_fetch(&bench->tone_returns, 1, __ATOMIC_SEQ_CST);
+	}
+	__atomic_sub_fetch(&bench->n_tone_running, 1, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+
+
+
+static long voluntary_context_switches(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_nvcsw;
+}
+
+
+
+
+static double now_seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+
+
+static void usage(const char * name)
+{
+	fprintf(stdout, "Usage: %s [-n <count>] [-t <count>] [-d <seconds>]\n", name);
+	fprintf(stdout, "    -n: number of threads waiting for levels of queue (default %d)\n", DEFAULT_N_LEVEL_OBSERVERS);
+	fprintf(stdout, "    -t: number of threads waiting for each tone (default %d)\n", DEFAULT_N_TONE_OBSERVERS);
+	fprintf(stdout, "    -d: duration of benchmark (default %d s)\n", DEFAULT_DURATION);
+
+	return;
+}
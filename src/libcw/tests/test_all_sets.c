@@ -21,6 +21,8 @@
 
 
 
+#include "config.h"
+
 #include "libcw_utils_tests.h"
 #include "libcw_data_tests.h"
 #include "libcw_debug_tests.h"
@@ -87,12 +89,13 @@ cw_test_set_t cw_test_sets[] = {
 		LIBCW_TEST_API_MODERN,
 
 		{ LIBCW_TEST_TOPIC_TQ, LIBCW_TEST_TOPIC_MAX }, /* Topics. */
-		{ CW_AUDIO_NULL, CW_AUDIO_CONSOLE, CW_AUDIO_OSS, CW_AUDIO_ALSA, CW_AUDIO_PA, LIBCW_TEST_SOUND_SYSTEM_MAX }, /* Sound systems. All sound systems are included in tests of tq, because sometimes a running gen is necessary. */
+		{ CW_AUDIO_NULL, CW_AUDIO_CONSOLE, CW_AUDIO_OSS, CW_AUDIO_ALSA, CW_AUDIO_PA, CW_AUDIO_JACK, LIBCW_TEST_SOUND_SYSTEM_MAX }, /* Sound systems. All sound systems are included in tests of tq, because sometimes a running gen is necessary. */
 
 		{
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_test_capacity_A),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_test_capacity_B),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_wait_for_level_internal),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_wait_for_level_targeted_internal),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_is_full_internal),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_enqueue_dequeue_internal),
 #if 0
@@ -118,7 +121,7 @@ cw_test_set_t cw_test_sets[] = {
 		LIBCW_TEST_API_MODERN,
 
 		{ LIBCW_TEST_TOPIC_GEN, LIBCW_TEST_TOPIC_MAX }, /* Topics. */
-		{ CW_AUDIO_NULL, CW_AUDIO_CONSOLE, CW_AUDIO_OSS, CW_AUDIO_ALSA, CW_AUDIO_PA, LIBCW_TEST_SOUND_SYSTEM_MAX }, /* Sound systems. */
+		{ CW_AUDIO_NULL, CW_AUDIO_CONSOLE, CW_AUDIO_OSS, CW_AUDIO_ALSA, CW_AUDIO_PA, CW_AUDIO_JACK, LIBCW_TEST_SOUND_SYSTEM_MAX }, /* Sound systems. */
 
 		{
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_new_delete),
@@ -136,6 +139,11 @@ cw_test_set_t cw_test_sets[] = {
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_enqueue_character),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_enqueue_string),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_forever_internal),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_fill),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_fill_queued),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_new_with_format),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_tone_timing_accuracy),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_start_time),
 
 			LIBCW_TEST_FUNCTION_INSERT(NULL),
 		}
@@ -145,11 +153,23 @@ cw_test_set_t cw_test_sets[] = {
 		LIBCW_TEST_API_MODERN,
 
 		{ LIBCW_TEST_TOPIC_KEY, LIBCW_TEST_TOPIC_MAX }, /* Topics. */
-		{ CW_AUDIO_NULL, CW_AUDIO_CONSOLE, CW_AUDIO_OSS, CW_AUDIO_ALSA, CW_AUDIO_PA, LIBCW_TEST_SOUND_SYSTEM_MAX }, /* Sound systems. */
+		{ CW_AUDIO_NULL, CW_AUDIO_CONSOLE, CW_AUDIO_OSS, CW_AUDIO_ALSA, CW_AUDIO_PA, CW_AUDIO_JACK, LIBCW_TEST_SOUND_SYSTEM_MAX }, /* Sound systems. */
 
 		{
 			LIBCW_TEST_FUNCTION_INSERT(test_keyer),
 			LIBCW_TEST_FUNCTION_INSERT(test_straight_key),
+			LIBCW_TEST_FUNCTION_INSERT(test_straight_key_fill),
+			LIBCW_TEST_FUNCTION_INSERT(test_keyer_without_generator),
+			LIBCW_TEST_FUNCTION_INSERT(test_keyer_paddle_stress),
+			LIBCW_TEST_FUNCTION_INSERT(test_keyer_transitions),
+			LIBCW_TEST_FUNCTION_INSERT(test_keyer_modes),
+			LIBCW_TEST_FUNCTION_INSERT(test_contexts),
+#if defined(HAVE_SYS_EVENTFD_H)
+			LIBCW_TEST_FUNCTION_INSERT(test_event_fds),
+#endif
+#if defined(HAVE_LINUX_INPUT_H)
+			LIBCW_TEST_FUNCTION_INSERT(test_input_evdev),
+#endif
 
 			LIBCW_TEST_FUNCTION_INSERT(NULL),
 		}
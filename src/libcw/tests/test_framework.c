@@ -173,6 +173,13 @@ int cw_test_fill_default_sound_systems_and_topics(cw_test_executor_t * self)
 	} else {
 		self->log_info(self, "PulseAudio sound system is not available on this machine - will skip it\n");
 	}
+
+	if (cw_is_jack_possible(default_device)) {
+		self->tested_sound_systems[dest_idx] = CW_AUDIO_JACK;
+		dest_idx++;
+	} else {
+		self->log_info(self, "JACK sound system is not available on this machine - will skip it\n");
+	}
 	self->tested_sound_systems[dest_idx] = LIBCW_TEST_SOUND_SYSTEM_MAX; /* Guard element. */
 
 
@@ -272,6 +279,16 @@ int cw_test_process_args(cw_test_executor_t * self, int argc, char * const argv[
 						fprintf(stderr, "Requested PulseAudio sound system is not available on this machine\n");
 						goto help_and_error;
 
+					}
+					break;
+				case 'j':
+					if (cw_is_jack_possible(NULL)) {
+						self->tested_sound_systems[dest_idx] = CW_AUDIO_JACK;
+						dest_idx++;
+					} else {
+						fprintf(stderr, "Requested JACK sound system is not available on this machine\n");
+						goto help_and_error;
+
 					}
 					break;
 				default:
@@ -363,6 +380,7 @@ void cw_test_print_help(__attribute__((unused)) cw_test_executor_t * self, const
 	fprintf(stderr, "    o - OSS\n");
 	fprintf(stderr, "    a - ALSA\n");
 	fprintf(stderr, "    p - PulseAudio\n");
+	fprintf(stderr, "    j - JACK (or PipeWire through its JACK interface)\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "    <topics> is one or more of those:\n"); /* TODO: add missing test topics. */
 	fprintf(stderr, "    g - generator\n");
@@ -804,6 +822,7 @@ bool cw_test_sound_system_was_requested(cw_test_executor_t * self, int sound_sys
 	case CW_AUDIO_OSS:
 	case CW_AUDIO_ALSA:
 	case CW_AUDIO_PA:
+	case CW_AUDIO_JACK:
 		for (int i = 0; i < n; i++) {
 			if (LIBCW_TEST_SOUND_SYSTEM_MAX == self->tested_sound_systems[i]) {
 				/* Found guard element. */
@@ -815,8 +834,11 @@ bool cw_test_sound_system_was_requested(cw_test_executor_t * self, int sound_sys
 		}
 		return false;
 
-	case CW_AUDIO_NONE:
 	case CW_AUDIO_SOUNDCARD:
+		/* Not tested separately. */
+		return false;
+
+	case CW_AUDIO_NONE:
 	default:
 		fprintf(stderr, "Unexpected sound system %d\n", sound_system);
 		exit(EXIT_FAILURE);
@@ -924,7 +946,7 @@ void cw_test_set_current_topic_and_sound_system(cw_test_executor_t * self, int t
 
 void cw_test_print_test_stats(cw_test_executor_t * self)
 {
-	const char sound_systems[] = " NCOAP";
+	const char sound_systems[] = " NCOAPSJ";
 
 	fprintf(self->stderr, "\n\nlibcw tests: Statistics of tests (failures/total)\n\n");
 
@@ -938,7 +960,11 @@ void cw_test_print_test_stats(cw_test_executor_t * self)
 	fprintf(self->stderr,       "     | tone queue | generator  |    key     |  receiver  |    data    |    other   |\n");
 	fprintf(self->stderr,       "%s", SEPARATOR_LINE);
 
-	for (int sound = CW_AUDIO_NULL; sound <= CW_AUDIO_PA; sound++) {
+	for (int sound = CW_AUDIO_NULL; sound < LIBCW_TEST_SOUND_SYSTEM_MAX; sound++) {
+		if (sound == CW_AUDIO_SOUNDCARD) {
+			/* Not tested separately. */
+			continue;
+		}
 
 		/* If a row with error counter has non-zero values,
 		   use arrows at the beginning and end of the row to
@@ -1182,6 +1208,9 @@ void cw_test_print_sound_systems(cw_test_executor_t * self, int * sound_systems,
 		case CW_AUDIO_PA:
 			self->log_info_cont(self, "PulseAudio ");
 			break;
+		case CW_AUDIO_JACK:
+			self->log_info_cont(self, "JACK ");
+			break;
 		default:
 			self->log_info_cont(self, "unknown! ");
 			break;
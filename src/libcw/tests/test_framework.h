@@ -31,7 +31,7 @@
 #define default_cw_test_print_n_chars 75
 
 #define LIBCW_TEST_ALL_TOPICS           "tgkrdo"   /* generator, tone queue, key, receiver, data, other. */
-#define LIBCW_TEST_ALL_SOUND_SYSTEMS    "ncoap"   /* Null, console, OSS, ALSA, PulseAudio. */
+#define LIBCW_TEST_ALL_SOUND_SYSTEMS    "ncoapj"   /* Null, console, OSS, ALSA, PulseAudio, JACK. */
 
 
 
@@ -54,10 +54,11 @@ enum {
 
 
 /*
-  NONE = 0, NULL = 1, CONSOLE = 2, OSS = 3, ALSA = 4, PA = 5;
-  everything else after PA we right now don't test, so MAX = 6.
+  NONE = 0, NULL = 1, CONSOLE = 2, OSS = 3, ALSA = 4, PA = 5,
+  SOUNDCARD = 6, JACK = 7; SOUNDCARD is not tested (it's just an alias
+  for one of OSS/ALSA/PA), so it's skipped in tests. MAX = 8.
 */
-#define LIBCW_TEST_SOUND_SYSTEM_MAX 6
+#define LIBCW_TEST_SOUND_SYSTEM_MAX 8
 
 
 
@@ -319,10 +319,23 @@ void Application::start()
 
 	clear_status();
 
-	/* At 60WPM, a dot is 20ms, so polling for the maximum speed
-	   library needs a 10ms timeout. */
-	poll_timer->setSingleShot(false);
-	poll_timer->start(10);
+	if (tone_queue_notifier) {
+		/* Discard events that have occurred while this
+		   instance wasn't using libcw. */
+		cw_read_tone_queue_events();
+		cw_read_receiver_events();
+		tone_queue_notifier->setEnabled(true);
+		receiver_notifier->setEnabled(true);
+
+		/* Empty tone queue won't report any event, so start
+		   sending in dictionary mode here. */
+		sender->poll(modeset.get_current());
+	} else {
+		/* At 60WPM, a dot is 20ms, so polling for the
+		   maximum speed library needs a 10ms timeout. */
+		poll_timer->setSingleShot(false);
+		poll_timer->start(10);
+	}
 
 	return;
 }
@@ -345,6 +358,10 @@ void Application::stop()
 
 	is_using_libcw = false;
 
+	if (tone_queue_notifier) {
+		tone_queue_notifier->setEnabled(false);
+		receiver_notifier->setEnabled(false);
+	}
 	poll_timer->stop();
 	sender->clear();
 	receiver->clear();
@@ -560,6 +577,12 @@ void Application::change_mode()
 	/* Keep the ModeSet synchronized to mode_combo changes. */
 	modeset.set_current(mode_combo->currentIndex());
 
+	if (is_using_libcw) {
+		/* Start sending if the new mode is a dictionary
+		   mode. */
+		sender->poll(modeset.get_current());
+	}
+
 	return;
 }
 
@@ -669,7 +692,8 @@ void Application::colors()
 /**
    Handle a timer event from the QTimer we set up on initialization.
    This timer is used for regular polling for sender tone queue low
-   and completed receive characters.
+   and completed receive characters on platforms where libcw can't
+   report its events through file descriptors.
 */
 void Application::poll_timer_event()
 {
@@ -685,6 +709,61 @@ void Application::poll_timer_event()
 
 
 
+/**
+   \brief Handle events of libcw's tone queue
+
+   Called by tone queue notifier when a tone has been dequeued or the
+   queue has dropped to low water mark. The sender gets more
+   characters to send if the queue is getting low.
+
+   Low water mark event alone isn't enough: it is reported only when
+   the queue drops from above the mark, so a character made of a
+   single tone (e.g. a space) wouldn't be followed by the event.
+
+   End of work of iambic keyer is a good moment to report receive
+   errors registered during keying.
+*/
+void Application::tone_queue_event()
+{
+	const unsigned int events = cw_read_tone_queue_events();
+	if (!is_using_libcw) {
+		return;
+	}
+
+	if (events & (CW_EVENT_LOW_WATER | CW_EVENT_TONE)) {
+		sender->poll(modeset.get_current());
+	}
+	if (events & CW_EVENT_KEYER_IDLE) {
+		receiver->poll(modeset.get_current());
+	}
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Handle events of libcw's receiver
+
+   Called by receiver notifier at end-of-character and end-of-word
+   gaps, when the receiver has a character or a space to display.
+*/
+void Application::receiver_event()
+{
+	cw_read_receiver_events();
+	if (is_using_libcw) {
+		receiver->poll(modeset.get_current());
+	}
+
+	return;
+}
+
+
+
+
+
 /**
    \brief Handle key event from a keyboard
 
@@ -716,9 +795,17 @@ void Application::key_event(QKeyEvent *event)
 		if (modeset.get_current()->is_keyboard()) {
 			//fprintf(stderr, "---------- key event: keyboard mode\n");
 			sender->handle_key_event(event);
+
+			/* Start sending if tone queue is empty, and
+			   won't report any event. */
+			sender->poll(modeset.get_current());
 		} else if (modeset.get_current()->is_receive()) {
 			//fprintf(stderr, "---------- key event: receiver mode mode\n");
 			receiver->handle_key_event(event, reverse_paddles_action->isChecked());
+
+			/* Report receive errors registered during
+			   keying with straight key. */
+			receiver->poll(modeset.get_current());
 		} else {
 			;
 		}
@@ -751,6 +838,7 @@ void Application::mouse_event(QMouseEvent *event)
 		if (modeset.get_current()->is_receive()) {
 			//fprintf(stderr, "---------- mouse event: receiver mode\n");
 			receiver->handle_mouse_event(event, reverse_paddles_action->isChecked());
+			receiver->poll(modeset.get_current());
 		}
 	}
 
@@ -1067,8 +1155,29 @@ void Application::make_auxiliaries_begin(void)
 	is_using_libcw = false;
 	saved_receive_speed = cw_get_receive_speed();
 	play = false;
+	render_time_label = NULL;
+
+	/* Sender and receiver are driven by events of libcw's tone
+	   queue and receiver. The sender gets more characters when
+	   the queue drops to one tone (or below). */
+	tone_queue_notifier = NULL;
+	receiver_notifier = NULL;
+	const int tone_queue_fd = cw_get_tone_queue_event_fd();
+	const int receiver_fd = cw_get_receiver_event_fd();
+	if (tone_queue_fd != -1 && receiver_fd != -1) {
+		cw_register_tone_queue_low_callback(NULL, NULL, 1);
+
+		tone_queue_notifier = new QSocketNotifier(tone_queue_fd, QSocketNotifier::Read, this);
+		tone_queue_notifier->setEnabled(false);
+		connect(tone_queue_notifier, SIGNAL (activated(int)), SLOT (tone_queue_event()));
+
+		receiver_notifier = new QSocketNotifier(receiver_fd, QSocketNotifier::Read, this);
+		receiver_notifier->setEnabled(false);
+		connect(receiver_notifier, SIGNAL (activated(int)), SLOT (receiver_event()));
+	}
 
-	/* Create a timer for polling send and receive. */
+	/* Create a timer for polling send and receive, used when
+	   libcw can't report its events. */
 	poll_timer = new QTimer(this);
 	connect(poll_timer, SIGNAL (timeout()), SLOT (poll_timer_event()));
 
@@ -1119,6 +1228,9 @@ void Application::make_auxiliaries_end(void)
 	QLabel *sound_system = new QLabel(label);
 	statusBar()->addPermanentWidget(sound_system);
 
+	render_time_label = new QLabel();
+	statusBar()->addPermanentWidget(render_time_label);
+
 	return;
 }
 
@@ -1175,4 +1287,22 @@ void Application::clear_status()
 
 
 
+/**
+   \brief Show time of last update of text area in status bar
+
+   \param usecs - time of inserting new text and painting it [us]
+*/
+void Application::show_render_time(qint64 usecs)
+{
+	if (render_time_label) {
+		render_time_label->setText(QString(_("Render: %1 ms")).arg(usecs / 1000.0, 0, 'f', 1));
+	}
+
+	return;
+}
+
+
+
+
+
 }  /* namespace cw */
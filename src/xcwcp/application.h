@@ -27,6 +27,8 @@
 #include <QToolButton>
 #include <QComboBox>
 #include <QSpinBox>
+#include <QSocketNotifier>
+#include <QLabel>
 
 #include <string>
 #include <deque>
@@ -70,6 +72,7 @@ namespace cw {
 
 		void show_status(const QString &status);
 		void clear_status();
+		void show_render_time(qint64 usecs);
 
 	protected:
 		void closeEvent(QCloseEvent *event);
@@ -87,6 +90,8 @@ namespace cw {
 		void colors();
 		void toggle_toolbar();
 		void poll_timer_event();
+		void tone_queue_event();
+		void receiver_event();
 
 		/* These Qt widget callback functions interact with
 		   libcw. */
@@ -156,10 +161,23 @@ namespace cw {
 
 		TextArea *textarea;
 
-		/* Poll timer, used to ensure that all of the
-		   application processing can be handled in the
-		   foreground, rather than in the signal handling
-		   context of a libcw tone queue low callback. */
+		/* Status bar label with time of last update of text
+		   area. */
+		QLabel *render_time_label;
+
+		/* Notifiers of events of libcw's tone queue and
+		   receiver. libcw reports the events through file
+		   descriptors, so that all of the application
+		   processing can be handled in the foreground, rather
+		   than in the context of libcw's threads. The
+		   notifiers are enabled only while this instance is
+		   using libcw. NULL if the descriptors aren't
+		   supported on this platform. */
+		QSocketNotifier *tone_queue_notifier;
+		QSocketNotifier *receiver_notifier;
+
+		/* Poll timer, used instead of the notifiers on
+		   platforms without libcw's event descriptors. */
 		QTimer *poll_timer;
 
 		/* Flag indicating if this instance is currently using
@@ -58,6 +58,7 @@ std::string all_options = "s:|sound,d:|device,"
 	"g:|gap,k:|weighting,"
 	// "i:|infile,F:|outfile,"
 	// "T:|time,"
+	"W:|weights,"
 	"h|help,V|version";
 
 
@@ -115,6 +116,7 @@ int main(int argc, char **argv)
 		}
 		config->has_practice_time = 0;
 		config->has_infile = false;
+		config->has_character_weights = true;
 
 		if (!cw_process_argv(argc, argv, all_options.c_str(), config)) {
 			fprintf(stderr, _("%s: failed to parse command line args\n"), config->program_name);
@@ -148,6 +150,13 @@ int main(int argc, char **argv)
 			}
 		}
 
+		if (config->character_weights) {
+			if (!cw_dictionaries_set_character_weights(config->character_weights)) {
+				fprintf(stderr, _("%s: invalid weights value: '%s'\n"), config->program_name, config->character_weights);
+				return EXIT_FAILURE;
+			}
+		}
+
 		generator = cw_generator_new_from_config(config);
 		if (!generator) {
 			fprintf(stderr, "%s: failed to create generator\n", config->program_name);
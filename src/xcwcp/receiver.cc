@@ -48,6 +48,9 @@ namespace cw {
    \brief Poll the CW library receive buffer and handle anything found
    in the buffer
 
+   Called on receiver's end-of-character and end-of-word events, and
+   after keying events, to report receive errors.
+
    \param current_mode
 */
 void Receiver::poll(const Mode *current_mode)
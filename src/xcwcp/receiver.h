@@ -56,7 +56,7 @@ namespace cw {
 		is_left_down (false),
 		is_right_down (false) { }
 
-		/* Poll timeout handler. */
+		/* Receiver event (or poll timeout) handler. */
 		void poll(const Mode *current_mode);
 
 		/* Keyboard key event handler. */
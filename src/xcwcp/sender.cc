@@ -49,6 +49,9 @@ namespace cw {
 
    Check the CW library tone queue, and if it is getting low, arrange
    for more data to be passed in to the sender.
+
+   Called on events of the tone queue, and after changes of sender's
+   state that may require sending to be started in empty tone queue.
 */
 void Sender::poll(const Mode *current_mode)
 {
@@ -61,8 +61,8 @@ namespace cw {
 			textarea (t),
 			is_queue_idle (true) { }
 
-		/* Poll timeout handler, and keypress event
-		   handler. */
+		/* Tone queue event (or poll timeout) handler, and
+		   keypress event handler. */
 		void poll(const Mode *current_mode);
 		void handle_key_event(QKeyEvent *event);
 
@@ -26,6 +26,11 @@
 #include <QKeyEvent>
 #include <QMenu>
 #include <QPoint>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTimerEvent>
+#include <QPaintEvent>
+#include <QElapsedTimer>
 
 #include <string>
 
@@ -52,12 +57,26 @@ const QString DISPLAY_WHATSTHIS =
 	  "received, and other general error and Xcwcp status information.");
 
 
+/* Characters are added to the display at most once per frame (at 60
+   frames per second), however fast they are received. */
+const int FLUSH_INTERVAL = 16; /* [ms] */
+
+/* The display keeps at most this many characters. Layout of a
+   paragraph gets slower as the paragraph grows, and received text is
+   usually a single paragraph. The oldest characters are removed in
+   batches of SCROLLBACK_TRIM, so that removal is rare. */
+const int SCROLLBACK_MAX = 100000;
+const int SCROLLBACK_TRIM = 10000;
+
+
 
 
 
 TextArea::TextArea(Application *a, QWidget *parent) :
 	QTextEdit (parent),
-	app (a)
+	app (a),
+	render_nsecs (0),
+	is_render_time_pending (false)
 {
 	/* Block context menu in text area, this is to make right mouse
 	   button work as correct sending key (paddle).
@@ -72,6 +91,10 @@ TextArea::TextArea(Application *a, QWidget *parent) :
 	/* Clear widget. */
 	setPlainText("");
 
+	/* Text is appended by the program, not edited by user, and
+	   history of the appends would grow without bound. */
+	setUndoRedoEnabled(false);
+
 #if 0
 	/* These two lines just repeat the default settings.
 	   TODO: maybe just remove them? */
@@ -204,10 +227,116 @@ QMenu *TextArea::createPopupMenu()
 
 /**
    \brief Append a character at the current notional cursor position.
+
+   The character is displayed on next update of the display, at most
+   FLUSH_INTERVAL later.
 */
 void TextArea::append(char c)
 {
-	this->insertPlainText(QString(QChar(c)));
+	pending.append(QChar(c));
+	if (!flush_timer.isActive()) {
+		flush_timer.start(FLUSH_INTERVAL, this);
+	}
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Add pending characters to the display
+
+   All characters appended since last update are inserted at once, so
+   the text is laid out and repainted once. Oldest characters are
+   removed if the display has grown over SCROLLBACK_MAX.
+*/
+void TextArea::flush()
+{
+	flush_timer.stop();
+	if (pending.isEmpty()) {
+		return;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	this->insertPlainText(pending);
+	pending.clear();
+
+	QTextDocument *doc = document();
+	const int excess = doc->characterCount() - SCROLLBACK_MAX;
+	if (excess > 0) {
+		QTextCursor cursor(doc);
+		cursor.setPosition(excess + SCROLLBACK_TRIM, QTextCursor::KeepAnchor);
+		cursor.removeSelectedText();
+	}
+
+	render_nsecs = timer.nsecsElapsed();
+	is_render_time_pending = true;
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Update the display when flush timer expires
+*/
+void TextArea::timerEvent(QTimerEvent *event)
+{
+	if (event->timerId() == flush_timer.timerId()) {
+		flush();
+	} else {
+		QTextEdit::timerEvent(event);
+	}
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Paint the display, and report time of its last update
+
+   Time of the update includes inserting the characters and painting
+   them, and is shown in status bar.
+*/
+void TextArea::paintEvent(QPaintEvent *event)
+{
+	if (!is_render_time_pending) {
+		QTextEdit::paintEvent(event);
+		return;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	QTextEdit::paintEvent(event);
+	render_nsecs += timer.nsecsElapsed();
+
+	is_render_time_pending = false;
+	app->show_render_time(render_nsecs / 1000);
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Remove all characters from the display, including pending ones
+*/
+void TextArea::clear()
+{
+	flush_timer.stop();
+	pending.clear();
+	QTextEdit::clear();
 
 	return;
 }
@@ -224,6 +353,12 @@ void TextArea::append(char c)
 */
 void TextArea::backspace()
 {
+	if (!pending.isEmpty()) {
+		/* The character hasn't been displayed yet. */
+		pending.chop(1);
+		return;
+	}
+
 	QKeyEvent *keyEvent = new QKeyEvent(QEvent::KeyPress, Qt::Key_Backspace, Qt::NoModifier);
 	QTextEdit::keyPressEvent(keyEvent);
 
@@ -20,6 +20,8 @@
 #include <QTextEdit>
 #include <QEvent>
 #include <QMenu>
+#include <QBasicTimer>
+#include <QString>
 
 
 
@@ -37,6 +39,8 @@ namespace cw {
 
 		void append(char c);
 		void backspace();
+		void clear();
+		void flush();
 
 	protected:
 		// Functions overridden to catch events from the parent class.
@@ -48,11 +52,26 @@ namespace cw {
 		// Are these necessary after adding fontPointSize() in constructor?
 		virtual QMenu *createPopupMenu(const QPoint &);
 		virtual QMenu *createPopupMenu();
+		// Updates of display with pending characters.
+		void timerEvent(QTimerEvent *event);
+		void paintEvent(QPaintEvent *event);
 
 	private:
 		// Application to forward key and mouse events to.
 		Application *app;
 
+		// Characters appended since last update of the display.
+		QString pending;
+
+		// Timer of next update of the display, running while
+		// there are pending characters.
+		QBasicTimer flush_timer;
+
+		// Time spent on last update of the display, reported
+		// to Application when the update has been painted.
+		qint64 render_nsecs;
+		bool is_render_time_pending;
+
 		// Prevent unwanted operations.
 		TextArea(const TextArea &);
 		TextArea &operator=(const TextArea &);